@@ -0,0 +1,44 @@
+#include "alloc_stats.hpp"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+    // constant-initialised, so allocations made before the registration below are counted too
+    std::atomic<uint64_t> g_allocations{0};
+
+    void* counted_alloc(std::size_t size) {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+        return std::malloc(size ? size : 1);
+    }
+
+    struct Registration {
+        Registration() { noterm::detail::allocation_counter = &g_allocations; }
+    } g_registration;
+}// namespace
+
+// the aligned overloads are left to the runtime; nothing on the I/O path over-aligns heap objects
+void* operator new(std::size_t size) {
+    if (void* p = counted_alloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    if (void* p = counted_alloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_alloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_alloc(size);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
@@ -0,0 +1,20 @@
+#ifndef NOTERM_ALLOC_STATS_HPP
+#define NOTERM_ALLOC_STATS_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace noterm {
+    namespace detail {
+        // set before main by alloc_stats.cpp, when the executable links it
+        inline std::atomic<uint64_t>* allocation_counter = nullptr;
+    }// namespace detail
+
+    // number of global operator new calls so far, counted by the replacement in alloc_stats.cpp
+    inline uint64_t allocation_count() {
+        return detail::allocation_counter ? detail::allocation_counter->load(std::memory_order_relaxed) : 0;
+    }
+    inline bool allocation_stats_enabled() { return detail::allocation_counter != nullptr; }
+}// namespace noterm
+
+#endif
@@ -0,0 +1,438 @@
+// End-to-end benchmark of the PTY -> reactor -> ring -> scheduler -> transport pipeline.
+//
+//   pty_pipeline [--mb=N] [--sessions=N] [--keystrokes=N] [--read-min=KiB] [--read-max=KiB]
+//                [--read-batch=us] [--json=PATH|-]
+//
+// Drives PTYManager with synthetic children through a stub transport that acknowledges every
+// frame as soon as it arrives, so it runs headless. Scenarios:
+//
+//   flood       one session writing N MB of plain lines
+//   colored     one session writing N MB of SGR-coloured lines
+//   concurrent  --sessions sessions writing N MB between them at once
+//   echo        single keystrokes into a tty running cat, timed until their echo is handed to the
+//               transport; one in flight at a time
+//   busy-echo   the echo scenario while --sessions other sessions flood output without end
+//
+// For each scenario: MB/s, allocations per MB, process CPU time as a share of
+// wall time, the thread count and the number of reactor wakeups that read output. The --read-*
+// options set the ReadPolicy; --read-min=4 --read-max=4 --read-batch=0 reads a fixed 4 KiB. With
+// --json the results are also written as one JSON object, for tracking across commits. POSIX only: the children are shell pipelines.
+//
+// --check-allocations=on: after a warm-up, typing into a session whose lines scroll into the history
+// and streaming output past a full scrollback must not allocate at all; the count of each is printed
+// and any allocation fails the run.
+
+#include "alloc_stats.hpp"
+#include "frame.hpp"
+#include "pty_manager.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/resource.h>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // printed by every output child when it is done; never part of the payload
+    constexpr std::string_view DONE_MARKER = "__noterm_bench_done__";
+
+    const char* find_option(int argc, char** argv, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+        }
+        return nullptr;
+    }
+
+    double cpu_seconds() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        auto seconds = [](const timeval& tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+        return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+    }
+
+    int thread_count() {
+#ifdef __linux__
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.rfind("Threads:", 0) == 0) return std::atoi(line.c_str() + 8);
+        }
+#endif
+        return 0;
+    }
+
+    struct Result {
+        std::string name;
+        int sessions = 1;
+        double seconds = 0;
+        uint64_t bytes = 0;
+        double cpu_percent = 0;
+        double allocations_per_mb = 0;
+        int threads = 0;
+        // reactor wakeups that read output, over every session
+        uint64_t reads = 0;
+        // echo latency percentiles in microseconds, echo scenario only
+        std::vector<std::pair<std::string, double>> latency;
+
+        double mb_per_s() const { return seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0; }
+    };
+
+    uint64_t count_reads(const std::vector<int>& ids) {
+        uint64_t reads = 0;
+        for (auto& st: noterm::PTYManager::instance().stats()) {
+            if (std::find(ids.begin(), ids.end(), st.id) != ids.end()) reads += st.read_sizes.count;
+        }
+        return reads;
+    }
+
+    // The stub transport: counts bytes per session, acknowledges at once and watches for the end
+    // marker, which may straddle two records.
+    class StubTransport {
+    public:
+        explicit StubTransport(noterm::PTYManager& manager) : m_manager(manager) {
+            manager.set_output_sink([this](const char* frame, size_t size) { receive(frame, size); });
+        }
+
+        void watch(int id) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sessions[id] = Session{};
+        }
+
+        // blocks until every watched session printed the marker, or the timeout
+        bool wait_done(std::chrono::seconds timeout) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            return m_cv.wait_for(lock, timeout, [this] {
+                return std::all_of(m_sessions.begin(), m_sessions.end(), [](const auto& kv) { return kv.second.done; });
+            });
+        }
+
+        // blocks until the session received more than `seen` bytes; returns the new count
+        uint64_t wait_bytes(int id, uint64_t seen, std::chrono::seconds timeout) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait_for(lock, timeout, [&] { return m_sessions[id].bytes > seen; });
+            return m_sessions[id].bytes;
+        }
+
+        uint64_t total_bytes() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            uint64_t total = 0;
+            for (auto& kv: m_sessions) total += kv.second.bytes;
+            return total;
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sessions.clear();
+        }
+
+    private:
+        struct Session {
+            uint64_t bytes = 0;
+            bool done = false;
+            std::string tail;
+        };
+
+        void receive(const char* frame, size_t size) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (size_t off = 0; off + noterm::FRAME_HEADER_SIZE <= size;) {
+                    int id = static_cast<int>(noterm::read_u32_le(frame + off));
+                    size_t length = noterm::read_u32_le(frame + off + 4);
+                    std::string_view payload(frame + off + noterm::FRAME_HEADER_SIZE, length);
+                    off += noterm::FRAME_HEADER_SIZE + length;
+
+                    auto it = m_sessions.find(id);
+                    if (it == m_sessions.end()) continue;
+                    Session& s = it->second;
+                    s.bytes += length;
+                    if (s.done) continue;
+                    // a marker split across records shows up in the previous tail plus this head
+                    s.tail.append(payload.data(), std::min(length, DONE_MARKER.size()));
+                    s.done = s.tail.find(DONE_MARKER) != std::string::npos || payload.find(DONE_MARKER) != std::string_view::npos;
+                    size_t keep = std::min(length, DONE_MARKER.size() - 1);
+                    s.tail.assign(payload.data() + length - keep, keep);
+                }
+            }
+            m_cv.notify_all();
+            for (size_t off = 0; off + noterm::FRAME_HEADER_SIZE <= size;) {
+                size_t length = noterm::read_u32_le(frame + off + 4);
+                m_manager.acknowledge(static_cast<int>(noterm::read_u32_le(frame + off)), length);
+                off += noterm::FRAME_HEADER_SIZE + length;
+            }
+        }
+
+        noterm::PTYManager& m_manager;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::unordered_map<int, Session> m_sessions;
+    };
+
+    // an awk program printing `lines` lines of `format` with `args` (awk expressions of the line
+    // number i), then the marker
+    std::string output_command(long long lines, const char* format, const char* args) {
+        char program[256];
+        std::snprintf(program, sizeof(program), "BEGIN { for (i = 0; i < %lld; i++) printf \"%s\", %s }", lines, format, args);
+        // the shell stays alive so the session is not torn down before the marker was read
+        return std::string("/bin/sh -c 'awk '\\''") + program + "'\\''; echo " + std::string(DONE_MARKER) + "; sleep 60'";
+    }
+
+    Result finish(Result result, Clock::time_point begin, double cpu, uint64_t allocations) {
+        result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        result.threads = thread_count();
+        result.cpu_percent = 100.0 * (cpu_seconds() - cpu) / result.seconds;
+        double mb = result.bytes / (1024.0 * 1024.0);
+        result.allocations_per_mb = mb > 0 ? (noterm::allocation_count() - allocations) / mb : 0;
+        return result;
+    }
+
+    Result run_output(StubTransport& transport, const char* name, const std::string& command, int sessions) {
+        auto& manager = noterm::PTYManager::instance();
+        transport.clear();
+
+        Result result;
+        result.name = name;
+        result.sessions = sessions;
+        uint64_t allocations = noterm::allocation_count();
+        double cpu = cpu_seconds();
+        auto begin = Clock::now();
+
+        std::vector<int> ids;
+        for (int i = 0; i < sessions; ++i) {
+            int id = manager.create(command, 120, 40);
+            transport.watch(id);
+            ids.push_back(id);
+        }
+        if (!transport.wait_done(std::chrono::seconds(300))) std::fprintf(stderr, "%s: timed out\n", name);
+        result.bytes = transport.total_bytes();
+        result = finish(std::move(result), begin, cpu, allocations);
+        result.reads = count_reads(ids);
+
+        for (int id: ids) manager.close(id);
+        return result;
+    }
+
+    // with flooders > 0, that many other sessions write output until the keystrokes are done
+    Result run_echo(StubTransport& transport, int keystrokes, int flooders) {
+        auto& manager = noterm::PTYManager::instance();
+        transport.clear();
+
+        Result result;
+        result.name = flooders > 0 ? "busy-echo" : "echo";
+        result.sessions = flooders + 1;
+        // not watched: their output is acknowledged and otherwise dropped
+        std::vector<int> flooding;
+        for (int i = 0; i < flooders; ++i) {
+            flooding.push_back(manager.create(output_command(1LL << 40, "line %09d of a background flood, plain text, padding.\\n", "i"), 120, 40));
+        }
+        // the line discipline echoes; cat only swallows the lines
+        int id = manager.create("/bin/sh -c 'exec cat > /dev/null'", 120, 40);
+        transport.watch(id);
+        // let the child settle before timing anything
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        uint64_t allocations = noterm::allocation_count();
+        double cpu = cpu_seconds();
+        auto begin = Clock::now();
+
+        uint64_t reads = count_reads({id});
+        std::vector<double> latencies;
+        latencies.reserve(keystrokes);
+        uint64_t seen = transport.total_bytes();
+        char frame[noterm::FRAME_HEADER_SIZE + 1];
+        for (int i = 0; i < keystrokes; ++i) {
+            // a newline now and then keeps the line short
+            char key = i % 64 == 63 ? '\r' : static_cast<char>('a' + i % 26);
+            noterm::write_frame_header(frame, id, 1);
+            frame[noterm::FRAME_HEADER_SIZE] = key;
+
+            auto sent = Clock::now();
+            manager.write_input_frame(frame, sizeof(frame));
+            uint64_t now_seen = transport.wait_bytes(id, seen, std::chrono::seconds(5));
+            if (now_seen == seen) {
+                std::fprintf(stderr, "echo: keystroke %d was not echoed\n", i);
+                break;
+            }
+            seen = now_seen;
+            if (key != '\r') latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+        }
+        result.bytes = seen;
+        result = finish(std::move(result), begin, cpu, allocations);
+        result.reads = count_reads({id}) - reads;
+
+        std::sort(latencies.begin(), latencies.end());
+        auto pct = [&](double p) { return latencies.empty() ? 0.0 : latencies[static_cast<size_t>(p * (latencies.size() - 1))]; };
+        result.latency = {{"p50_us", pct(0.5)}, {"p99_us", pct(0.99)}, {"p999_us", pct(0.999)}, {"max_us", pct(1.0)}};
+
+        manager.close(id);
+        for (int flooder: flooding) manager.close(flooder);
+        return result;
+    }
+
+    // Allocations over `count` keystrokes into a cat session, in lines of 64, after as many to warm
+    // up, and at least enough that the lines already scroll off the screen into the history.
+    uint64_t steady_echo_allocations(StubTransport& transport, int count) {
+        constexpr int ROWS = 40;
+        auto& manager = noterm::PTYManager::instance();
+        transport.clear();
+        int id = manager.create("/bin/sh -c 'exec cat > /dev/null'", 120, ROWS);
+        transport.watch(id);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        int warmup = std::max(count, (ROWS + 8) * 64);
+        uint64_t seen = transport.total_bytes();
+        uint64_t allocations = 0;
+        char frame[noterm::FRAME_HEADER_SIZE + 1];
+        for (int i = 0; i < warmup + count; ++i) {
+            if (i == warmup) allocations = noterm::allocation_count();
+            noterm::write_frame_header(frame, id, 1);
+            frame[noterm::FRAME_HEADER_SIZE] = i % 64 == 63 ? '\r' : static_cast<char>('a' + i % 26);
+            manager.write_input_frame(frame, sizeof(frame));
+            seen = transport.wait_bytes(id, seen, std::chrono::seconds(5));
+        }
+        allocations = noterm::allocation_count() - allocations;
+        manager.close(id);
+        return allocations;
+    }
+
+    // allocations over `mb` MB of output, after as many to warm up, with history over its budget
+    // so every sealed scrollback block drops an old one
+    uint64_t steady_flood_allocations(StubTransport& transport, int mb) {
+        auto& manager = noterm::PTYManager::instance();
+        transport.clear();
+        noterm::ScrollbackStore::set_limits(64 * 1024, 0);
+        int id = manager.create(output_command(1LL << 40, "line %09d of the steady benchmark, plain text only, padding.\\n", "i"), 120, 40);
+        transport.watch(id);
+
+        uint64_t target = static_cast<uint64_t>(mb) * 1024 * 1024;
+        uint64_t seen = 0;
+        while (seen < target) seen = transport.wait_bytes(id, seen, std::chrono::seconds(5));
+        uint64_t allocations = noterm::allocation_count();
+        while (seen < 2 * target) seen = transport.wait_bytes(id, seen, std::chrono::seconds(5));
+        allocations = noterm::allocation_count() - allocations;
+        manager.close(id);
+        return allocations;
+    }
+
+    void print_result(const Result& r) {
+        std::printf("%-10s %3d session(s) %9.1f MB/s %8.2f MB %7.1f%% cpu %3d threads %8llu reads", r.name.c_str(), r.sessions,
+                    r.mb_per_s(), r.bytes / (1024.0 * 1024.0), r.cpu_percent, r.threads, static_cast<unsigned long long>(r.reads));
+        if (noterm::allocation_stats_enabled()) std::printf(" %9.1f allocs/MB", r.allocations_per_mb);
+        for (auto& [key, value]: r.latency) std::printf(" %s=%.1f", key.c_str(), value);
+        std::printf("\n");
+    }
+
+    std::string to_json(const std::vector<Result>& results, const std::string& config) {
+        std::string json = "{\"benchmark\":\"pty_pipeline\",\"config\":{" + config + "},\"results\":[";
+        char number[64];
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            if (i) json += ",";
+            json += "{\"name\":\"" + r.name + "\",\"sessions\":" + std::to_string(r.sessions);
+            std::snprintf(number, sizeof(number), ",\"seconds\":%.4f", r.seconds);
+            json += number;
+            json += ",\"bytes\":" + std::to_string(r.bytes);
+            std::snprintf(number, sizeof(number), ",\"mb_per_s\":%.2f,\"cpu_percent\":%.1f", r.mb_per_s(), r.cpu_percent);
+            json += number;
+            if (noterm::allocation_stats_enabled()) {
+                std::snprintf(number, sizeof(number), ",\"allocations_per_mb\":%.1f", r.allocations_per_mb);
+                json += number;
+            }
+            json += ",\"threads\":" + std::to_string(r.threads);
+            json += ",\"reads\":" + std::to_string(r.reads);
+            for (auto& [key, value]: r.latency) {
+                std::snprintf(number, sizeof(number), ",\"%s\":%.1f", key.c_str(), value);
+                json += number;
+            }
+            json += "}";
+        }
+        json += "]}\n";
+        return json;
+    }
+}// namespace
+
+int main(int argc, char** argv) {
+    if (!noterm::init_context()) {
+        std::fprintf(stderr, "failed to initialise the pty backend\n");
+        return 1;
+    }
+
+    int mb = 64;
+    int sessions = 16;
+    int keystrokes = 2000;
+    if (const char* v = find_option(argc, argv, "--mb")) mb = std::max(1, std::atoi(v));
+    if (const char* v = find_option(argc, argv, "--sessions")) sessions = std::max(1, std::atoi(v));
+    if (const char* v = find_option(argc, argv, "--keystrokes")) keystrokes = std::max(1, std::atoi(v));
+    const char* json_path = find_option(argc, argv, "--json");
+
+    noterm::ReadPolicy policy;
+    if (const char* v = find_option(argc, argv, "--read-min")) policy.min_read = static_cast<size_t>(std::max(1, std::atoi(v))) * 1024;
+    if (const char* v = find_option(argc, argv, "--read-max")) policy.max_read = static_cast<size_t>(std::max(1, std::atoi(v))) * 1024;
+    if (policy.max_read < policy.min_read) policy.max_read = policy.min_read;
+    if (const char* v = find_option(argc, argv, "--read-batch")) policy.batch_delay = std::chrono::microseconds(std::max(0, std::atoi(v)));
+
+    // every format below prints about 64 bytes per line
+    long long lines = static_cast<long long>(mb) * 16384;
+
+    auto& manager = noterm::PTYManager::instance();
+    manager.set_read_policy(policy);
+    StubTransport transport(manager);
+    std::vector<Result> results;
+
+    results.push_back(run_output(transport, "flood", output_command(lines, "line %09d of the flood benchmark, plain text only, padding.\\n", "i"), 1));
+    print_result(results.back());
+
+    results.push_back(run_output(transport, "colored", output_command(lines, "\\033[1;3%dm%09d\\033[0m \\033[4mcoloured\\033[0m output line of the benchmark\\n", "i % 8, i"), 1));
+    print_result(results.back());
+
+    results.push_back(run_output(transport, "concurrent",
+                                 output_command(std::max(1LL, lines / sessions), "line %09d of the concurrent benchmark, plain text, padding.\\n", "i"), sessions));
+    print_result(results.back());
+
+    results.push_back(run_echo(transport, keystrokes, 0));
+    print_result(results.back());
+
+    results.push_back(run_echo(transport, keystrokes, sessions));
+    print_result(results.back());
+
+    const char* check = find_option(argc, argv, "--check-allocations");
+    bool allocated = false;
+    if (check && std::strcmp(check, "on") == 0 && noterm::allocation_stats_enabled()) {
+        uint64_t echo = steady_echo_allocations(transport, keystrokes);
+        uint64_t flood = steady_flood_allocations(transport, mb);
+        std::printf("steady state: %llu allocations over %d keystrokes, %llu over %d MB of output\n",
+                    static_cast<unsigned long long>(echo), keystrokes, static_cast<unsigned long long>(flood), mb);
+        allocated = echo > 0 || flood > 0;
+    }
+
+    if (json_path) {
+        std::string config = "\"mb\":" + std::to_string(mb) + ",\"sessions\":" + std::to_string(sessions) +
+                             ",\"keystrokes\":" + std::to_string(keystrokes) + ",\"read_min\":" + std::to_string(policy.min_read) +
+                             ",\"read_max\":" + std::to_string(policy.max_read) +
+                             ",\"read_batch_us\":" + std::to_string(policy.batch_delay.count());
+        std::string json = to_json(results, config);
+        if (std::strcmp(json_path, "-") == 0) {
+            std::fputs(json.c_str(), stdout);
+        } else if (FILE* f = std::fopen(json_path, "w")) {
+            std::fputs(json.c_str(), f);
+            std::fclose(f);
+        } else {
+            std::fprintf(stderr, "cannot write %s\n", json_path);
+            return 1;
+        }
+    }
+    manager.close_all();
+    return allocated ? 1 : 0;
+}
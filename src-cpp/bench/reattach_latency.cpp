@@ -0,0 +1,134 @@
+// Reattach latency after a frontend disconnect.
+//
+//   reattach_latency [--sessions=N] [--seconds=S] [--command=CMD]
+//
+// Starts N sessions producing output continuously, with a frontend that acknowledges everything.
+// The frontend then disconnects for S seconds while the shells keep writing. Finally every session
+// is reattached at once. For each one the bench reports the time until its snapshot (recent
+// history plus a screen repaint) was handed to the transport, and the snapshot's size.
+
+#include "frame.hpp"
+#include "pty_manager.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const char* find_option(int argc, char** argv, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+        }
+        return nullptr;
+    }
+
+    struct Snapshot {
+        double ms = -1;
+        size_t bytes = 0;
+    };
+}// namespace
+
+int main(int argc, char** argv) {
+    if (!noterm::init_context()) {
+        std::fprintf(stderr, "failed to initialise the pty backend\n");
+        return 1;
+    }
+
+    int sessions = 20;
+    double seconds = 2.0;
+#ifdef _WIN32
+    std::string command = "cmd.exe /q /c \"for /l %i in (0,0,1) do @dir /s C:\\Windows\\System32\"";
+#else
+    std::string command = "/bin/sh -c 'while :; do ls -la /usr/bin /usr/lib; done'";
+#endif
+    if (const char* v = find_option(argc, argv, "--sessions")) sessions = std::max(1, std::atoi(v));
+    if (const char* v = find_option(argc, argv, "--seconds")) seconds = std::max(0.1, std::atof(v));
+    if (const char* v = find_option(argc, argv, "--command")) command = v;
+
+    auto& manager = noterm::PTYManager::instance();
+    std::atomic<uint64_t> streamed{0};
+    std::atomic_bool connected{true};
+
+    std::mutex snapshot_mutex;
+    std::vector<Snapshot> snapshots;
+    std::vector<int> ids;
+    Clock::time_point reattached_at;
+    std::atomic_bool reattaching{false};
+
+    manager.set_output_sink([&](const char* frame, size_t size) {
+        // a disconnected frontend acknowledges nothing
+        if (!connected.load()) return;
+        for (size_t off = 0; off + noterm::FRAME_HEADER_SIZE <= size;) {
+            int id = static_cast<int>(noterm::read_u32_le(frame + off));
+            size_t length = noterm::read_u32_le(frame + off + 4);
+            if (reattaching.load()) {
+                std::lock_guard<std::mutex> lock(snapshot_mutex);
+                size_t index = std::find(ids.begin(), ids.end(), id) - ids.begin();
+                if (index < snapshots.size() && snapshots[index].ms < 0) {
+                    snapshots[index].ms = std::chrono::duration<double, std::milli>(Clock::now() - reattached_at).count();
+                    snapshots[index].bytes = length;
+                }
+            }
+            manager.acknowledge(id, length);
+            streamed += length;
+            off += noterm::FRAME_HEADER_SIZE + length;
+        }
+    });
+
+    for (int i = 0; i < sessions; ++i) ids.push_back(manager.create(command, 120, 40));
+    snapshots.resize(ids.size());
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    std::printf("%d sessions streamed %.1f MB while connected\n", sessions, streamed.load() / (1024.0 * 1024.0));
+
+    connected = false;
+    manager.detach();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+
+    uint64_t history_lines = 0;
+    for (auto& st: manager.stats()) history_lines += st.scrollback.lines;
+
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        reattached_at = Clock::now();
+        reattaching = true;
+        connected = true;
+    }
+    for (int id: ids) manager.reattach(id, true);
+
+    auto deadline = Clock::now() + std::chrono::seconds(10);
+    while (Clock::now() < deadline) {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        if (std::all_of(snapshots.begin(), snapshots.end(), [](const Snapshot& s) { return s.ms >= 0; })) break;
+    }
+
+    std::vector<double> ms;
+    size_t total_bytes = 0, max_bytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        for (auto& s: snapshots) {
+            if (s.ms < 0) continue;
+            ms.push_back(s.ms);
+            total_bytes += s.bytes;
+            max_bytes = std::max(max_bytes, s.bytes);
+        }
+    }
+    std::sort(ms.begin(), ms.end());
+    auto pct = [&](double p) { return ms.empty() ? 0.0 : ms[static_cast<size_t>(p * (ms.size() - 1))]; };
+
+    std::printf("reattach of %d sessions (%llu history lines kept):\n", sessions, static_cast<unsigned long long>(history_lines));
+    std::printf("  %zu snapshots, latency p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", ms.size(), pct(0.5), pct(0.99), pct(1.0));
+    std::printf("  snapshot size avg %.1f KB, max %.1f KB\n", ms.empty() ? 0.0 : total_bytes / 1024.0 / ms.size(), max_bytes / 1024.0);
+
+    manager.close_all();
+    return ms.size() == ids.size() ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+// Contention benchmark for the session registry.
+//
+//   registry_contention [--sessions=N] [--seconds=S] [--command=CMD]
+//
+// Part 1 drives N threads, one per session, through lookup + per-session update on the sharded
+// registry and on a single mutex-guarded std::map (the previous PTYManager layout).
+// Part 2 drives N real PTY sessions concurrently through PTYManager: every thread sends small input
+// frames and resizes its own session, and the per-operation latency is reported.
+
+#include "frame.hpp"
+#include "pty_manager.hpp"
+#include "session_registry.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Counter {
+        std::atomic<uint64_t> value{0};
+    };
+
+    const char* find_option(int argc, char** argv, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+        }
+        return nullptr;
+    }
+
+    // runs body(thread index) on n threads for the given time, returns total iterations
+    template<typename Body>
+    uint64_t run_threads(int n, double seconds, Body body) {
+        std::atomic_bool start{false}, stop{false};
+        std::atomic<uint64_t> total{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < n; ++t) {
+            threads.emplace_back([&, t]() {
+                while (!start.load()) std::this_thread::yield();
+                uint64_t ops = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    body(t);
+                    ++ops;
+                }
+                total += ops;
+            });
+        }
+        start = true;
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        stop = true;
+        for (auto& thread: threads) thread.join();
+        return total.load();
+    }
+
+    void bench_registry(int sessions, double seconds) {
+        noterm::ShardedRegistry<Counter> sharded;
+        std::mutex map_mutex;
+        std::map<int, std::shared_ptr<Counter>> map;
+        for (int id = 1; id <= sessions; ++id) {
+            auto counter = std::make_shared<Counter>();
+            sharded.insert(id, counter);
+            map[id] = counter;
+        }
+
+        uint64_t sharded_ops = run_threads(sessions, seconds, [&](int t) {
+            if (auto c = sharded.find(t + 1)) c->value.fetch_add(1, std::memory_order_relaxed);
+        });
+        uint64_t locked_ops = run_threads(sessions, seconds, [&](int t) {
+            std::lock_guard<std::mutex> lock(map_mutex);
+            auto it = map.find(t + 1);
+            if (it != map.end()) it->second->value.fetch_add(1, std::memory_order_relaxed);
+        });
+
+        std::printf("registry lookups, %d threads:\n", sessions);
+        std::printf("  sharded registry : %12.0f ops/s\n", sharded_ops / seconds);
+        std::printf("  global mutex map : %12.0f ops/s\n", locked_ops / seconds);
+    }
+
+    void bench_manager(int sessions, double seconds, const std::string& command) {
+        auto& manager = noterm::PTYManager::instance();
+        std::atomic<uint64_t> output{0};
+        manager.set_output_sink([&](const char* frame, size_t size) {
+            // acknowledge immediately so flow control never holds a session back
+            for (size_t off = 0; off + noterm::FRAME_HEADER_SIZE <= size;) {
+                int id = static_cast<int>(noterm::read_u32_le(frame + off));
+                size_t length = noterm::read_u32_le(frame + off + 4);
+                manager.acknowledge(id, length);
+                output += length;
+                off += noterm::FRAME_HEADER_SIZE + length;
+            }
+        });
+
+        std::vector<int> ids;
+        for (int i = 0; i < sessions; ++i) ids.push_back(manager.create(command, 80, 24));
+
+        std::vector<std::vector<double>> latencies(sessions);
+        uint64_t ops = run_threads(sessions, seconds, [&](int t) {
+            int id = ids[t];
+            char frame[noterm::FRAME_HEADER_SIZE + 1];
+            noterm::write_frame_header(frame, id, 1);
+            frame[noterm::FRAME_HEADER_SIZE] = 'x';
+
+            auto begin = Clock::now();
+            manager.write_input_frame(frame, sizeof(frame));
+            manager.set_size(id, 80 + (t & 1), 24);
+            auto end = Clock::now();
+            if (latencies[t].size() < 1000000) latencies[t].push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+        });
+
+        std::vector<double> all;
+        for (auto& l: latencies) all.insert(all.end(), l.begin(), l.end());
+        std::sort(all.begin(), all.end());
+        auto pct = [&](double p) { return all.empty() ? 0.0 : all[static_cast<size_t>(p * (all.size() - 1))]; };
+
+        std::printf("PTYManager input + resize, %d sessions:\n", sessions);
+        std::printf("  %12.0f ops/s, latency p50 %.2f us, p99 %.2f us, p99.9 %.2f us\n",
+                    ops / seconds, pct(0.5), pct(0.99), pct(0.999));
+        std::printf("  %llu output bytes echoed\n", static_cast<unsigned long long>(output.load()));
+
+        manager.close_all();
+    }
+}// namespace
+
+int main(int argc, char** argv) {
+    if (!noterm::init_context()) {
+        std::fprintf(stderr, "failed to initialise the pty backend\n");
+        return 1;
+    }
+
+    int sessions = 8;
+    double seconds = 2.0;
+#ifdef _WIN32
+    std::string command = "cmd.exe /q /k";
+#else
+    std::string command = "cat > /dev/null";
+#endif
+    if (const char* v = find_option(argc, argv, "--sessions")) sessions = std::max(1, std::atoi(v));
+    if (const char* v = find_option(argc, argv, "--seconds")) seconds = std::max(0.1, std::atof(v));
+    if (const char* v = find_option(argc, argv, "--command")) command = v;
+
+    bench_registry(sessions, seconds);
+    bench_manager(sessions, seconds, command);
+    return 0;
+}
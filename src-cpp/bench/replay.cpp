@@ -0,0 +1,144 @@
+// Replay throughput of asciicast recordings.
+//
+//   replay [--file=PATH] [--sessions=N] [--speed=X] [--render-mode=stream|screen]
+//          [--command=CMD] [--capture=S] [--record-compress=on]
+//
+// Plays the recording in N sessions at once through the whole output pipeline (staging, flow
+// control, stream or screen encoding) into a frontend that acknowledges everything at once, and
+// reports how long it took. Speed 0, the default, replays as fast as the pipeline goes. Without
+// --file, CMD is first recorded for S seconds and that recording is replayed, so a run is
+// repeatable from one captured workload to the next.
+
+#include "frame.hpp"
+#include "pty_manager.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const char* find_option(int argc, char** argv, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+        }
+        return nullptr;
+    }
+
+    // output bytes the recording replays
+    uint64_t output_bytes(const std::string& path) {
+        noterm::CastReader reader;
+        if (!reader.open(path)) return 0;
+        uint64_t bytes = 0;
+        noterm::CastEvent event;
+        while (reader.next(event)) {
+            if (event.type == 'o') bytes += event.data.size();
+        }
+        return bytes;
+    }
+}// namespace
+
+int main(int argc, char** argv) {
+    if (!noterm::init_context()) {
+        std::fprintf(stderr, "failed to initialise the pty backend\n");
+        return 1;
+    }
+
+    int sessions = 4;
+    double speed = 0;
+    double capture = 2.0;
+#ifdef _WIN32
+    std::string command = "cmd.exe /q /c \"for /l %i in (0,0,1) do @dir /s C:\\Windows\\System32\"";
+#else
+    std::string command = "/bin/sh -c 'while :; do ls -la --color=always /usr/bin /usr/lib; done'";
+#endif
+    std::string path;
+    if (const char* v = find_option(argc, argv, "--sessions")) sessions = std::max(1, std::atoi(v));
+    if (const char* v = find_option(argc, argv, "--speed")) speed = std::max(0.0, std::atof(v));
+    if (const char* v = find_option(argc, argv, "--capture")) capture = std::max(0.1, std::atof(v));
+    if (const char* v = find_option(argc, argv, "--command")) command = v;
+    if (const char* v = find_option(argc, argv, "--file")) path = v;
+    const char* compress = find_option(argc, argv, "--record-compress");
+
+    auto& manager = noterm::PTYManager::instance();
+    const char* mode = find_option(argc, argv, "--render-mode");
+    if (mode && std::strcmp(mode, "screen") == 0) manager.set_default_render_mode(noterm::RenderMode::Screen);
+
+    manager.set_output_sink([&](const char* frame, size_t size) {
+        for (size_t off = 0; off + noterm::FRAME_HEADER_SIZE <= size;) {
+            int id = static_cast<int>(noterm::read_u32_le(frame + off));
+            size_t length = noterm::read_u32_le(frame + off + 4);
+            manager.acknowledge(id, length);
+            off += noterm::FRAME_HEADER_SIZE + length;
+        }
+    });
+
+    if (path.empty()) {
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "noterm-replay-bench";
+        std::filesystem::remove_all(directory);
+        std::filesystem::create_directories(directory);
+        manager.set_recording(directory.string(), compress && std::strcmp(compress, "on") == 0);
+        int id = manager.create(command, 120, 40);
+        std::this_thread::sleep_for(std::chrono::duration<double>(capture));
+        manager.close(id);
+        manager.set_recording("", false);
+        // the recorder closes its file once the session is gone
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        noterm::Recorder::flush_all();
+        for (auto& entry: std::filesystem::directory_iterator(directory)) path = entry.path().string();
+        if (path.empty()) {
+            std::fprintf(stderr, "nothing was recorded\n");
+            return 1;
+        }
+        std::printf("recorded %.1f s of \"%s\" to %s (%.1f KiB)\n", capture, command.c_str(), path.c_str(),
+                    static_cast<double>(std::filesystem::file_size(path)) / 1024.0);
+    }
+
+    uint64_t expected = output_bytes(path);
+    if (expected == 0) {
+        std::fprintf(stderr, "%s has no output to replay\n", path.c_str());
+        return 1;
+    }
+
+    auto start = Clock::now();
+    std::vector<int> ids;
+    for (int i = 0; i < sessions; ++i) {
+        int id = manager.replay(path, 120, 40, speed, std::chrono::milliseconds(0));
+        if (id == 0) return 1;
+        ids.push_back(id);
+    }
+
+    // done once every session took in the whole recording and staged nothing more
+    uint64_t sent = 0;
+    uint64_t records = 0;
+    while (true) {
+        bool done = true;
+        sent = 0;
+        records = 0;
+        for (auto& st: manager.stats()) {
+            if (st.bytes_out < expected || st.buffered > 0) done = false;
+            sent += st.bytes_sent;
+            records += st.records_sent;
+        }
+        if (done) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    double mb = static_cast<double>(expected) * sessions / (1024.0 * 1024.0);
+    std::printf("%d sessions x %.1f MiB in %.3f s: %.1f MiB/s replayed, %.1f MiB sent in %llu records (%s mode)\n", sessions,
+                static_cast<double>(expected) / (1024.0 * 1024.0), seconds, mb / seconds, static_cast<double>(sent) / (1024.0 * 1024.0),
+                static_cast<unsigned long long>(records), mode ? mode : "stream");
+
+    manager.close_all();
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Ingest and search speed of the native scrollback store.
+//
+//   scrollback_search [--mb=N]
+//
+// Appends N MB of synthetic log lines to a ScrollbackStore the way the screen does, one row at a
+// time, then times a rare literal (a handful of blocks pass the trigram filter), a common one, a
+// case-folded one and a regex (no filtering, every block is decompressed).
+//
+// First checks the regex prefilter: for a set of patterns with escapes, repeats and groups, the
+// Searcher must find what std::regex alone finds, and the line must pass its trigram filter.
+
+#include "scrollback_store.hpp"
+#include "search.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <regex>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const char* find_option(int argc, char** argv, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+        }
+        return nullptr;
+    }
+
+    double ms_since(Clock::time_point begin) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    }
+
+    // returns the number of patterns the prefilter gets wrong
+    int check_prefilter() {
+        struct Case {
+            const char* pattern;
+            const char* line;
+            bool ignore_case;
+        };
+        const Case cases[] = {
+                {"foo\\x20bar", "xx foo bar xx", false},
+                {"ab\\u0041cd", "abAcd", false},
+                {"id\\x3d\\d+ ok", "id=42 ok", false},
+                {"(ab)cd\\1ef", "abcdabef", false},
+                {"(a)(b)(c)(d)(e)(f)(g)(h)(i)(j)xyz\\10klm", "abcdefghijxyzjklm", false},
+                {"(?:x)<name>\\d+", "x<name>42", false},
+                {"status=5\\d{2} took", "status=503 took", false},
+                {"ab{2}cd", "abbcd", false},
+                {"colou?r scheme", "color scheme", false},
+                {"err(or)? in \\w+\\.cpp", "error in main.cpp", false},
+                {"\\[warn\\] disk", "[warn] disk", false},
+                {"PANIC\\s+shard", "panic   shard", true},
+        };
+        int failures = 0;
+        std::vector<noterm::LineMatch> found;
+        for (const Case& c: cases) {
+            auto flags = std::regex::ECMAScript;
+            if (c.ignore_case) flags |= std::regex::icase;
+            std::regex re(c.pattern, flags);
+            size_t expected = 0;
+            for (std::cregex_iterator it(c.line, c.line + std::strlen(c.line), re), end; it != end; ++it) ++expected;
+
+            noterm::Searcher searcher(c.pattern, true, c.ignore_case);
+            found.clear();
+            searcher.find(c.line, found);
+            noterm::TrigramFilter block;
+            block.add(c.line);
+            bool filtered = expected > 0 && searcher.filter() && !block.covers(*searcher.filter());
+            if (!searcher.valid() || filtered || found.size() != expected) {
+                std::printf("  MISMATCH: /%s/ on \"%s\": std::regex finds %zu, the searcher %zu%s\n", c.pattern, c.line,
+                            expected, found.size(), filtered ? " (block filtered out)" : "");
+                ++failures;
+            }
+        }
+        return failures;
+    }
+
+    void run_query(const noterm::ScrollbackStore& store, const char* name, const std::string& pattern, bool regex, bool ignore_case) {
+        noterm::Searcher searcher(pattern, regex, ignore_case);
+        std::vector<noterm::ScrollbackHit> hits;
+        auto begin = Clock::now();
+        store.search(searcher, 1000, hits);
+        std::printf("  %-10s %-28s %8.2f ms  %zu hits\n", name, pattern.c_str(), ms_since(begin), hits.size());
+    }
+}// namespace
+
+int main(int argc, char** argv) {
+    size_t mb = 256;
+    if (const char* v = find_option(argc, argv, "--mb")) mb = static_cast<size_t>(std::max(1, std::atoi(v)));
+    size_t target = mb * 1024 * 1024;
+
+    int failures = check_prefilter();
+    std::printf("prefilter: %d mismatches\n", failures);
+
+    // everything in memory: this measures the index and the codec, not the budget
+    noterm::ScrollbackStore::set_limits(SIZE_MAX, 0);
+    noterm::ScrollbackStore store;
+
+    const char* levels[] = {"INFO", "DEBUG", "WARN", "INFO", "INFO", "DEBUG"};
+    const char* paths[] = {"/api/v1/users", "/api/v1/orders", "/healthz", "/static/app.js", "/api/v1/search"};
+    std::vector<noterm::Cell> row(160);
+    size_t bytes = 0;
+    unsigned seed = 1;
+    auto begin = Clock::now();
+    for (uint64_t i = 0; bytes < target; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        char line[160];
+        int n = std::snprintf(line, sizeof(line), "2024-05-%02u 12:%02u:%02u.%03u %-5s [worker-%u] GET %s status=%u req=%08x took=%ums",
+                              1 + seed % 28, (seed >> 3) % 60, (seed >> 9) % 60, (seed >> 5) % 1000, levels[seed % 6], (seed >> 7) % 16,
+                              paths[(seed >> 11) % 5], (seed >> 13) % 50 == 0 ? 500u : 200u, seed, (seed >> 17) % 900);
+        // one needle every ~million lines
+        if (i % 1000003 == 999) n = std::snprintf(line, sizeof(line), "PANIC unrecoverable state in shard %u", seed % 64);
+        for (int x = 0; x < 160; ++x) {
+            row[x] = noterm::Cell{};
+            if (x < n) row[x].ch = static_cast<unsigned char>(line[x]);
+        }
+        // the level is coloured, as most loggers do on a tty
+        for (int x = 24; x < 29 && x < n; ++x) row[x].fg = noterm::COLOR_INDEXED | 3;
+        store.append(row.data(), 160);
+        bytes += static_cast<size_t>(n) + 1;
+    }
+    double ingest_ms = ms_since(begin);
+
+    noterm::ScrollbackStats stats = store.stats();
+    std::printf("ingest: %zu MB of text, %llu lines in %.0f ms (%.1f MB/s)\n", bytes >> 20,
+                static_cast<unsigned long long>(stats.lines), ingest_ms, (bytes / (1024.0 * 1024.0)) / (ingest_ms / 1000.0));
+    std::printf("stored: %.1f MB (%.2fx of %.1f MB styled)\n", stats.stored_bytes / (1024.0 * 1024.0),
+                static_cast<double>(stats.raw_bytes) / stats.stored_bytes, stats.raw_bytes / (1024.0 * 1024.0));
+
+    run_query(store, "rare", "PANIC unrecoverable", false, false);
+    run_query(store, "icase", "panic UNRECOVERABLE", false, true);
+    run_query(store, "common", "status=500", false, false);
+    run_query(store, "regex", "shard (1|2)[0-9]$", true, false);
+    return failures ? 1 : 0;
+}
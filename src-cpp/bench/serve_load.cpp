@@ -0,0 +1,340 @@
+// Load test of the --serve daemon: many sessions driven by several clients over its socket.
+//
+//   serve_load [--sessions=N] [--clients=N] [--seconds=N] [--keystrokes=N] [--socket=PATH]
+//
+// Without --socket a SessionServer is started in this process on a temporary path; with it, a
+// running `noterm --serve=PATH` is loaded instead. The sessions are spread over the clients, each
+// a connection of its own that acknowledges output as soon as it is read. Phases:
+//
+//   create   every client creates its share of sessions running cat, all at once; time from
+//            Create to Created
+//   echo     single keystrokes into the idle sessions in turn, timed until their echo arrives
+//   flood    the sessions are replaced by ones running yes for --seconds; aggregate MiB/s, and
+//            keystroke echo latency into one more cat session meanwhile
+//
+// POSIX only, like the server.
+
+#include "frame.hpp"
+#include "pty_manager.hpp"
+#include "session_server.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+    using noterm::ServeMessage;
+
+    const char* find_option(int argc, char** argv, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+        }
+        return nullptr;
+    }
+
+    void append_u32(std::string& out, uint32_t value) {
+        char bytes[4];
+        noterm::write_u32_le(bytes, value);
+        out.append(bytes, 4);
+    }
+
+    double percentile(std::vector<double> samples, double q) {
+        if (samples.empty()) return 0;
+        std::sort(samples.begin(), samples.end());
+        return samples[std::min(samples.size() - 1, static_cast<size_t>(q * samples.size()))];
+    }
+
+    // One connection to the server. A reader thread acknowledges every output record at once and
+    // wakes whoever waits for a reply or an echo.
+    class Client {
+    public:
+        ~Client() {
+            if (m_socket >= 0) ::shutdown(m_socket, SHUT_RDWR);
+            if (m_reader.joinable()) m_reader.join();
+            if (m_socket >= 0) ::close(m_socket);
+        }
+
+        bool connect(const std::string& path) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            std::snprintf(address.sun_path, sizeof(address.sun_path), "%s", path.c_str());
+            m_socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (m_socket < 0 || ::connect(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) return false;
+            m_reader = std::thread([this] { read_loop(); });
+            return true;
+        }
+
+        void send(ServeMessage kind, const std::string& payload) {
+            std::string message(noterm::FRAME_HEADER_SIZE, '\0');
+            noterm::write_frame_header(message.data(), static_cast<int>(kind), payload.size());
+            message += payload;
+            std::lock_guard<std::mutex> lock(m_write_mutex);
+            for (size_t off = 0; off < message.size();) {
+                long n = static_cast<long>(::send(m_socket, message.data() + off, message.size() - off, MSG_NOSIGNAL));
+                if (n <= 0) return;
+                off += static_cast<size_t>(n);
+            }
+        }
+
+        // returns the token the reply carries
+        uint32_t create(const std::string& command, int cols, int rows) {
+            uint32_t token = ++m_next_token;
+            std::string payload;
+            append_u32(payload, token);
+            append_u32(payload, static_cast<uint32_t>(cols));
+            append_u32(payload, static_cast<uint32_t>(rows));
+            payload += command;
+            send(ServeMessage::Create, payload);
+            return token;
+        }
+
+        // blocks until the Created replies of tokens arrived; 0 ids for the ones that did not
+        std::vector<int> wait_created(const std::vector<uint32_t>& tokens, std::chrono::seconds timeout) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait_for(lock, timeout, [&] {
+                return std::all_of(tokens.begin(), tokens.end(), [&](uint32_t token) { return m_created.count(token) > 0; });
+            });
+            std::vector<int> ids;
+            for (uint32_t token: tokens) ids.push_back(m_created.count(token) ? m_created[token] : 0);
+            return ids;
+        }
+
+        void input(int id, const std::string& bytes) {
+            std::string payload(noterm::FRAME_HEADER_SIZE, '\0');
+            noterm::write_frame_header(payload.data(), id, bytes.size());
+            payload += bytes;
+            send(ServeMessage::Input, payload);
+        }
+
+        void close(int id) {
+            std::string payload;
+            append_u32(payload, static_cast<uint32_t>(id));
+            send(ServeMessage::Close, payload);
+        }
+
+        // types c into the session and returns microseconds until it came back, or -1
+        double echo(int id, char c) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_echo_id = id;
+                m_echo_char = c;
+                m_echo_seen = false;
+            }
+            auto begin = Clock::now();
+            input(id, std::string(1, c));
+            std::unique_lock<std::mutex> lock(m_mutex);
+            bool seen = m_cv.wait_for(lock, std::chrono::seconds(5), [&] { return m_echo_seen; });
+            m_echo_id = 0;
+            if (!seen) return -1;
+            return std::chrono::duration<double, std::micro>(m_echo_at - begin).count();
+        }
+
+        Clock::time_point created_at(uint32_t token) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_created_at[token];
+        }
+
+        uint64_t bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+
+    private:
+        bool read_exact(char* data, size_t size) {
+            for (size_t off = 0; off < size;) {
+                long n = static_cast<long>(::recv(m_socket, data + off, size - off, 0));
+                if (n <= 0) return false;
+                off += static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        void read_loop() {
+            char header[noterm::FRAME_HEADER_SIZE];
+            std::string payload;
+            std::string ack;
+            while (read_exact(header, sizeof(header))) {
+                auto kind = static_cast<ServeMessage>(noterm::read_u32_le(header));
+                payload.resize(noterm::read_u32_le(header + 4));
+                if (!read_exact(payload.data(), payload.size())) break;
+
+                if (kind == ServeMessage::Created && payload.size() >= 8) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    uint32_t token = noterm::read_u32_le(payload.data());
+                    m_created[token] = static_cast<int>(noterm::read_u32_le(payload.data() + 4));
+                    m_created_at[token] = Clock::now();
+                    m_cv.notify_all();
+                } else if (kind == ServeMessage::Output) {
+                    ack.clear();
+                    for (size_t off = 0; off + noterm::FRAME_HEADER_SIZE <= payload.size();) {
+                        uint32_t id = noterm::read_u32_le(payload.data() + off);
+                        uint32_t length = noterm::read_u32_le(payload.data() + off + 4);
+                        const char* record = payload.data() + off + noterm::FRAME_HEADER_SIZE;
+                        off += noterm::FRAME_HEADER_SIZE + length;
+                        m_bytes.fetch_add(length, std::memory_order_relaxed);
+                        append_u32(ack, id);
+                        append_u32(ack, length);
+
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        if (static_cast<int>(id) == m_echo_id && !m_echo_seen && std::memchr(record, m_echo_char, length)) {
+                            m_echo_seen = true;
+                            m_echo_at = Clock::now();
+                            m_cv.notify_all();
+                        }
+                    }
+                    send(ServeMessage::Ack, ack);
+                }
+            }
+        }
+
+        int m_socket = -1;
+        std::mutex m_write_mutex;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        uint32_t m_next_token = 0;
+        std::unordered_map<uint32_t, int> m_created;
+        std::unordered_map<uint32_t, Clock::time_point> m_created_at;
+        int m_echo_id = 0;
+        char m_echo_char = 0;
+        bool m_echo_seen = false;
+        Clock::time_point m_echo_at;
+        std::atomic<uint64_t> m_bytes{0};
+        std::thread m_reader;
+    };
+
+    // every client creates its share of count sessions at once; returns their ids per client and
+    // appends the create latencies in milliseconds
+    std::vector<std::vector<int>> create_all(std::vector<std::unique_ptr<Client>>& clients, int count, const std::string& command,
+                                             std::vector<double>& latencies) {
+        std::vector<std::vector<int>> ids(clients.size());
+        std::vector<std::vector<uint32_t>> tokens(clients.size());
+        std::vector<std::vector<Clock::time_point>> sent(clients.size());
+        for (int i = 0; i < count; ++i) {
+            size_t c = static_cast<size_t>(i) % clients.size();
+            sent[c].push_back(Clock::now());
+            tokens[c].push_back(clients[c]->create(command, 80, 24));
+        }
+        for (size_t c = 0; c < clients.size(); ++c) {
+            ids[c] = clients[c]->wait_created(tokens[c], std::chrono::seconds(60));
+            for (size_t t = 0; t < ids[c].size(); ++t) {
+                if (!ids[c][t]) continue;
+                latencies.push_back(std::chrono::duration<double, std::milli>(clients[c]->created_at(tokens[c][t]) - sent[c][t]).count());
+            }
+        }
+        return ids;
+    }
+}// namespace
+
+int main(int argc, char** argv) {
+    int sessions = 200;
+    int client_count = 4;
+    int seconds = 5;
+    int keystrokes = 200;
+    if (const char* v = find_option(argc, argv, "--sessions")) sessions = std::max(1, std::atoi(v));
+    if (const char* v = find_option(argc, argv, "--clients")) client_count = std::max(1, std::atoi(v));
+    if (const char* v = find_option(argc, argv, "--seconds")) seconds = std::max(1, std::atoi(v));
+    if (const char* v = find_option(argc, argv, "--keystrokes")) keystrokes = std::max(1, std::atoi(v));
+
+    std::string path;
+    std::unique_ptr<noterm::SessionServer> server;
+    if (const char* socket = find_option(argc, argv, "--socket")) {
+        path = socket;
+    } else {
+        path = "/tmp/noterm-serve-load-" + std::to_string(getpid()) + ".sock";
+        if (!noterm::init_context()) return 1;
+        server = std::make_unique<noterm::SessionServer>();
+        if (!server->start(path)) return 1;
+    }
+
+    // one client more for the echo probe during the flood
+    std::vector<std::unique_ptr<Client>> clients;
+    for (int i = 0; i < client_count + 1; ++i) {
+        clients.push_back(std::make_unique<Client>());
+        if (!clients.back()->connect(path)) {
+            std::fprintf(stderr, "cannot connect to %s\n", path.c_str());
+            return 1;
+        }
+    }
+    std::unique_ptr<Client> probe = std::move(clients.back());
+    clients.pop_back();
+
+    std::printf("%d sessions over %d clients\n", sessions, client_count);
+
+    std::vector<double> create_ms;
+    auto ids = create_all(clients, sessions, "cat", create_ms);
+    size_t created = create_ms.size();
+    std::printf("create   %zu/%d sessions, p50 %.1f ms, p99 %.1f ms, max %.1f ms\n", created, sessions, percentile(create_ms, 0.5),
+                percentile(create_ms, 0.99), percentile(create_ms, 1.0));
+    // the shells' startup output settles
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    std::vector<double> echo_us;
+    for (int k = 0; k < keystrokes; ++k) {
+        size_t c = static_cast<size_t>(k) % clients.size();
+        if (ids[c].empty()) continue;
+        int id = ids[c][(static_cast<size_t>(k) / clients.size()) % ids[c].size()];
+        double us = id ? clients[c]->echo(id, static_cast<char>('a' + k % 26)) : -1;
+        if (us >= 0) echo_us.push_back(us);
+    }
+    std::printf("echo     idle: p50 %.0f us, p99 %.0f us over %zu keystrokes\n", percentile(echo_us, 0.5), percentile(echo_us, 0.99),
+                echo_us.size());
+
+    for (size_t c = 0; c < clients.size(); ++c) {
+        for (int id: ids[c]) {
+            if (id) clients[c]->close(id);
+        }
+    }
+
+    std::vector<double> flood_create_ms;
+    ids = create_all(clients, sessions, "yes 'noterm serve load 0123456789 abcdefghijklmnopqrstuvwxyz'", flood_create_ms);
+    int probe_id = probe->wait_created({probe->create("cat", 80, 24)}, std::chrono::seconds(10))[0];
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    auto total_bytes = [&] {
+        uint64_t total = 0;
+        for (auto& client: clients) total += client->bytes();
+        return total;
+    };
+    uint64_t before = total_bytes();
+    auto begin = Clock::now();
+    auto end = begin + std::chrono::seconds(seconds);
+    echo_us.clear();
+    for (int k = 0; Clock::now() < end; ++k) {
+        double us = probe_id ? probe->echo(probe_id, static_cast<char>('a' + k % 26)) : -1;
+        if (us >= 0) echo_us.push_back(us);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+    double mib = (total_bytes() - before) / (1024.0 * 1024.0);
+    std::printf("flood    %zu sessions: %.1f MiB/s (%.2f MiB/s per session)\n", flood_create_ms.size(), mib / elapsed,
+                flood_create_ms.empty() ? 0.0 : mib / elapsed / flood_create_ms.size());
+    std::printf("echo     under flood: p50 %.0f us, p99 %.0f us over %zu keystrokes\n", percentile(echo_us, 0.5),
+                percentile(echo_us, 0.99), echo_us.size());
+
+    for (size_t c = 0; c < clients.size(); ++c) {
+        for (int id: ids[c]) {
+            if (id) clients[c]->close(id);
+        }
+    }
+    if (probe_id) probe->close(probe_id);
+    clients.clear();
+    probe.reset();
+    if (server) {
+        noterm::PTYManager::instance().close_all();
+        server->stop();
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+// Time to first prompt for new tabs, cold and from the prewarm pool.
+//
+//   tab_open [--tabs=N] [--prewarm=N] [--command=CMD]
+//
+// Opens N tabs one after another, first with process startup on the creating thread, then with
+// N idle sessions of the same command prewarmed. For each round the bench reports how long create()
+// blocked its caller and how long the first output (the prompt) took to reach the transport,
+// measured from the create request.
+
+#include "frame.hpp"
+#include "pty_manager.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const char* find_option(int argc, char** argv, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+        }
+        return nullptr;
+    }
+
+    double percentile(std::vector<double> values, double q) {
+        if (values.empty()) return 0;
+        std::sort(values.begin(), values.end());
+        return values[static_cast<size_t>(q * static_cast<double>(values.size() - 1))];
+    }
+
+    // first output of the session in ms, or -1 if none arrived within the timeout
+    double wait_first_output(int id) {
+        auto deadline = Clock::now() + std::chrono::seconds(5);
+        while (Clock::now() < deadline) {
+            for (auto& st: noterm::PTYManager::instance().stats()) {
+                if (st.id == id && st.first_output_us > 0) return static_cast<double>(st.first_output_us) / 1000.0;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        return -1;
+    }
+
+    void run(const char* label, const std::string& command, int tabs) {
+        auto& manager = noterm::PTYManager::instance();
+        std::vector<double> blocked;
+        std::vector<double> first_output;
+        for (int i = 0; i < tabs; ++i) {
+            // let the pool refill, and give the cold round the same pause
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            auto start = Clock::now();
+            int id = manager.create(command, 120, 30);
+            blocked.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+            double ms = wait_first_output(id);
+            if (ms >= 0) first_output.push_back(ms);
+            manager.close(id);
+        }
+        std::printf("%-10s %3d tab(s)  create p50 %7.2f ms  max %7.2f ms   first output p50 %7.2f ms  max %7.2f ms  (%zu/%d)\n",
+                    label, tabs, percentile(blocked, 0.5), percentile(blocked, 1.0), percentile(first_output, 0.5),
+                    percentile(first_output, 1.0), first_output.size(), tabs);
+    }
+}// namespace
+
+int main(int argc, char** argv) {
+    if (!noterm::init_context()) {
+        std::fprintf(stderr, "failed to initialise the pty backend\n");
+        return 1;
+    }
+
+    int tabs = 10;
+    size_t prewarm = 1;
+#ifdef _WIN32
+    std::string command = "cmd.exe";
+#else
+    std::string command = "/bin/sh -i";
+#endif
+    if (const char* v = find_option(argc, argv, "--tabs")) tabs = std::max(1, std::atoi(v));
+    if (const char* v = find_option(argc, argv, "--prewarm")) prewarm = static_cast<size_t>(std::max(1, std::atoi(v)));
+    if (const char* v = find_option(argc, argv, "--command")) command = v;
+
+    auto& manager = noterm::PTYManager::instance();
+    // the frontend acknowledges everything at once
+    manager.set_output_sink([&manager](const char* frame, size_t size) {
+        for (size_t off = 0; off + noterm::FRAME_HEADER_SIZE <= size;) {
+            int id = static_cast<int>(noterm::read_u32_le(frame + off));
+            size_t length = noterm::read_u32_le(frame + off + 4);
+            manager.acknowledge(id, length);
+            off += noterm::FRAME_HEADER_SIZE + length;
+        }
+    });
+
+    run("cold", command, tabs);
+    manager.set_prewarm(command, prewarm);
+    run("prewarmed", command, tabs);
+
+    manager.close_all();
+    return 0;
+}
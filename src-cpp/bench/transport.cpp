@@ -0,0 +1,374 @@
+// Output transports over loopback, headless.
+//
+//   transport [--frame=BYTES] [--frames=N] [--window=KiB] [--rate=HZ] [--seconds=S]
+//
+// Compares two ways of getting output frames from the scheduler thread to the frontend's main
+// thread:
+//
+//   websocket  a stand-in for WebUI's path: every frame is copied behind a protocol header into a
+//              new buffer and written as a WebSocket message under a send lock; the receiving side
+//              parses the message framing, copies the message out and posts it to the main thread,
+//              which copies the payload once more before parsing records, as the bridge script does
+//   stream     OutputStreamServer: frames are written straight to the socket of one long HTTP
+//              response; received chunks are posted to the main thread, which parses records
+//              across chunk boundaries
+//
+// Throughput sends N frames as fast as an unacknowledged window allows; latency sends a small
+// frame RATE times a second for S seconds and measures the time from send to parse.
+
+#include "frame.hpp"
+#include "output_stream.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const char* find_option(int argc, char** argv, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+        }
+        return nullptr;
+    }
+
+    uint64_t now_ns() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+    }
+
+    bool read_exact(int fd, char* data, size_t size) {
+        while (size > 0) {
+            ssize_t n = ::read(fd, data, size);
+            if (n <= 0) return false;
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // a connected pair of loopback TCP sockets, as between WebUI and the webview
+    void tcp_pair(int& server, int& client) {
+        int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        ::listen(listener, 1);
+        ::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+        client = ::socket(AF_INET, SOCK_STREAM, 0);
+        ::connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        server = ::accept(listener, nullptr, nullptr);
+        ::close(listener);
+        int on = 1;
+        ::setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    // the frontend's main thread: takes posted buffers one at a time, like an event loop
+    class MainThread {
+    public:
+        using Handler = std::function<void(std::unique_ptr<char[]>, size_t)>;
+
+        explicit MainThread(Handler handler) : m_handler(std::move(handler)), m_thread([this]() { run(); }) {}
+
+        ~MainThread() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_running = false;
+            }
+            m_cv.notify_all();
+            m_thread.join();
+        }
+
+        void post(std::unique_ptr<char[]> data, size_t size) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_queue.emplace_back(std::move(data), size);
+            }
+            m_cv.notify_all();
+        }
+
+    private:
+        void run() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true) {
+                m_cv.wait(lock, [this]() { return !m_running || !m_queue.empty(); });
+                if (m_queue.empty()) break;
+                auto item = std::move(m_queue.front());
+                m_queue.pop_front();
+                lock.unlock();
+                m_handler(std::move(item.first), item.second);
+                lock.lock();
+            }
+        }
+
+        Handler m_handler;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<std::pair<std::unique_ptr<char[]>, size_t>> m_queue;
+        bool m_running = true;
+        std::thread m_thread;
+    };
+
+    // what the frontend did with the records: bytes parsed (the acknowledgements) and send-to-parse latencies
+    struct Receiver {
+        std::atomic<uint64_t> parsed{0};
+        std::mutex latency_mutex;
+        std::vector<double> latencies_us;
+        std::string carry;
+
+        void parse(const char* data, size_t size) {
+            if (!carry.empty()) {
+                carry.append(data, size);
+                data = carry.data();
+                size = carry.size();
+            }
+            size_t off = 0;
+            uint64_t now = 0;
+            while (off + noterm::FRAME_HEADER_SIZE <= size) {
+                size_t length = noterm::read_u32_le(data + off + 4);
+                if (off + noterm::FRAME_HEADER_SIZE + length > size) break;
+                if (length >= 8) {
+                    uint64_t sent;
+                    std::memcpy(&sent, data + off + noterm::FRAME_HEADER_SIZE, sizeof(sent));
+                    if (sent != 0) {
+                        if (now == 0) now = now_ns();
+                        std::lock_guard<std::mutex> lock(latency_mutex);
+                        latencies_us.push_back(static_cast<double>(now - sent) / 1000.0);
+                    }
+                }
+                parsed += length;
+                off += noterm::FRAME_HEADER_SIZE + length;
+            }
+            std::string rest(data + off, size - off);
+            carry.swap(rest);
+        }
+    };
+
+    class Transport {
+    public:
+        virtual ~Transport() = default;
+        virtual void send(const char* frame, size_t size) = 0;
+    };
+
+    class WebSocketStandIn : public Transport {
+    public:
+        explicit WebSocketStandIn(Receiver& receiver)
+            : m_main([&receiver](std::unique_ptr<char[]> message, size_t size) {
+                  // the bridge strips its header and hands the callback a copy of the payload
+                  std::unique_ptr<char[]> payload(new char[size - HEADER]);
+                  std::memcpy(payload.get(), message.get() + HEADER, size - HEADER);
+                  receiver.parse(payload.get(), size - HEADER);
+              }) {
+            tcp_pair(m_write, m_read);
+            m_reader = std::thread([this]() { read_messages(); });
+        }
+
+        ~WebSocketStandIn() override {
+            ::shutdown(m_write, SHUT_RDWR);
+            m_reader.join();
+            ::close(m_write);
+            ::close(m_read);
+        }
+
+        void send(const char* frame, size_t size) override {
+            // the protocol header and a private copy of the payload
+            size_t message = HEADER + size;
+            std::unique_ptr<char[]> packet(new char[message]);
+            std::memset(packet.get(), 0, HEADER);
+            std::memcpy(packet.get() + HEADER, frame, size);
+
+            // a binary WebSocket frame, unmasked from the server side
+            unsigned char head[10];
+            size_t head_size;
+            head[0] = 0x82;
+            if (message < 126) {
+                head[1] = static_cast<unsigned char>(message);
+                head_size = 2;
+            } else if (message < 65536) {
+                head[1] = 126;
+                head[2] = static_cast<unsigned char>(message >> 8);
+                head[3] = static_cast<unsigned char>(message);
+                head_size = 4;
+            } else {
+                head[1] = 127;
+                for (int i = 0; i < 8; ++i) head[2 + i] = static_cast<unsigned char>(static_cast<uint64_t>(message) >> (56 - 8 * i));
+                head_size = 10;
+            }
+            std::lock_guard<std::mutex> lock(m_send_mutex);
+            ::send(m_write, head, head_size, MSG_NOSIGNAL);
+            ::send(m_write, packet.get(), message, MSG_NOSIGNAL);
+        }
+
+    private:
+        static constexpr size_t HEADER = 8;
+
+        void read_messages() {
+            unsigned char head[10];
+            while (read_exact(m_read, reinterpret_cast<char*>(head), 2)) {
+                uint64_t size = head[1] & 0x7f;
+                if (size == 126) {
+                    if (!read_exact(m_read, reinterpret_cast<char*>(head + 2), 2)) break;
+                    size = static_cast<uint64_t>(head[2]) << 8 | head[3];
+                } else if (size == 127) {
+                    if (!read_exact(m_read, reinterpret_cast<char*>(head + 2), 8)) break;
+                    size = 0;
+                    for (int i = 0; i < 8; ++i) size = size << 8 | head[2 + i];
+                }
+                // the browser copies every message into its own ArrayBuffer
+                std::unique_ptr<char[]> message(new char[size]);
+                if (!read_exact(m_read, message.get(), size)) break;
+                m_main.post(std::move(message), size);
+            }
+        }
+
+        MainThread m_main;
+        std::mutex m_send_mutex;
+        int m_write = -1;
+        int m_read = -1;
+        std::thread m_reader;
+    };
+
+    class StreamTransport : public Transport {
+    public:
+        explicit StreamTransport(Receiver& receiver)
+            : m_main([&receiver](std::unique_ptr<char[]> chunk, size_t size) { receiver.parse(chunk.get(), size); }) {
+            m_server.start();
+            std::string url = m_server.open(1);
+            // http://127.0.0.1:<port>/output/<token>
+            size_t colon = url.rfind(':');
+            int port = std::atoi(url.c_str() + colon + 1);
+            std::string path = url.substr(url.find('/', colon));
+
+            m_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = htons(static_cast<uint16_t>(port));
+            ::connect(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+            std::string request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+            ::send(m_socket, request.data(), request.size(), MSG_NOSIGNAL);
+            m_reader = std::thread([this]() { read_chunks(); });
+        }
+
+        ~StreamTransport() override {
+            ::shutdown(m_socket, SHUT_RDWR);
+            m_reader.join();
+            ::close(m_socket);
+            m_server.stop();
+        }
+
+        void send(const char* frame, size_t size) override {
+            m_server.send(1, frame, size);
+        }
+
+    private:
+        void read_chunks() {
+            // skip the response header
+            std::string header;
+            char c;
+            while (header.size() < 4 || header.compare(header.size() - 4, 4, "\r\n\r\n") != 0) {
+                if (::read(m_socket, &c, 1) != 1) return;
+                header.push_back(c);
+            }
+            constexpr size_t CHUNK = 64 * 1024;
+            while (true) {
+                std::unique_ptr<char[]> chunk(new char[CHUNK]);
+                ssize_t n = ::read(m_socket, chunk.get(), CHUNK);
+                if (n <= 0) break;
+                m_main.post(std::move(chunk), static_cast<size_t>(n));
+            }
+        }
+
+        noterm::OutputStreamServer m_server;
+        MainThread m_main;
+        int m_socket = -1;
+        std::thread m_reader;
+    };
+
+    // a frame of one record whose payload starts with the send time, 0 for unmeasured
+    void build_frame(std::string& frame, size_t payload, uint64_t sent) {
+        frame.assign(noterm::FRAME_HEADER_SIZE + payload, 'x');
+        noterm::write_frame_header(frame.data(), 1, payload);
+        if (payload >= 8) std::memcpy(frame.data() + noterm::FRAME_HEADER_SIZE, &sent, sizeof(sent));
+    }
+
+    double percentile(std::vector<double>& values, double q) {
+        if (values.empty()) return 0;
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1, static_cast<size_t>(q * static_cast<double>(values.size())))];
+    }
+
+    template<typename T>
+    void run(const char* name, size_t frame_size, size_t frames, size_t window, double rate, double seconds) {
+        Receiver receiver;
+        T transport(receiver);
+        std::string frame;
+
+        build_frame(frame, frame_size, 0);
+        auto start = Clock::now();
+        uint64_t sent = 0;
+        for (size_t i = 0; i < frames; ++i) {
+            while (sent - receiver.parsed.load() > window) std::this_thread::yield();
+            transport.send(frame.data(), frame.size());
+            sent += frame_size;
+        }
+        while (receiver.parsed.load() < sent) std::this_thread::yield();
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+        auto next = Clock::now();
+        auto end = next + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+        while (next < end) {
+            std::this_thread::sleep_until(next);
+            build_frame(frame, 64, now_ns());
+            transport.send(frame.data(), frame.size());
+            sent += 64;
+            next += period;
+        }
+        while (receiver.parsed.load() < sent) std::this_thread::yield();
+
+        std::lock_guard<std::mutex> lock(receiver.latency_mutex);
+        double p50 = percentile(receiver.latencies_us, 0.5);
+        double p99 = percentile(receiver.latencies_us, 0.99);
+        std::printf("%-10s %9.1f MiB/s %10.1f us p50 %8.1f us p99\n", name,
+                    static_cast<double>(frame_size * frames) / (1024.0 * 1024.0) / elapsed, p50, p99);
+    }
+}// namespace
+
+int main(int argc, char** argv) {
+    size_t frame_size = 16 * 1024;
+    size_t frames = 20000;
+    size_t window = 1024 * 1024;
+    double rate = 1000;
+    double seconds = 2;
+    if (const char* v = find_option(argc, argv, "--frame")) frame_size = std::max<size_t>(8, std::strtoul(v, nullptr, 10));
+    if (const char* v = find_option(argc, argv, "--frames")) frames = std::strtoul(v, nullptr, 10);
+    if (const char* v = find_option(argc, argv, "--window")) window = std::strtoul(v, nullptr, 10) * 1024;
+    if (const char* v = find_option(argc, argv, "--rate")) rate = std::max(1.0, std::atof(v));
+    if (const char* v = find_option(argc, argv, "--seconds")) seconds = std::max(0.1, std::atof(v));
+
+    std::printf("%zu frames of %zu bytes, %zu KiB window; latency of 64-byte frames at %.0f Hz\n", frames, frame_size,
+                window / 1024, rate);
+    run<WebSocketStandIn>("websocket", frame_size, frames, window, rate, seconds);
+    run<StreamTransport>("stream", frame_size, frames, window, rate, seconds);
+    return 0;
+}
@@ -0,0 +1,133 @@
+// Throughput of the trigger matcher over coloured output, by pattern count.
+//
+//   trigger_scan [--mb=N] [--patterns=N]
+//
+// Builds PatternSets of 1, 100 and N random lowercase literals (plus a few real-world ones such
+// as "password:"), then scans N MB of SGR-coloured log lines in 64KB chunks, the size of one pty
+// read, with some patterns planted in the lines and some split by an escape sequence. Reports
+// the build time, MB/s and matches. Over the first MB the matches are checked against a naive
+// search of the text with its escape sequences stripped.
+
+#include "search.hpp"
+#include "trigger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const char* find_option(int argc, char** argv, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+        }
+        return nullptr;
+    }
+
+    uint32_t next_random(uint32_t& seed) {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    }
+
+    std::vector<std::string> make_patterns(size_t count) {
+        std::vector<std::string> patterns = {"password:", "Traceback (most recent call last)", "error:", "FAILED"};
+        uint32_t seed = 42;
+        while (patterns.size() < count) {
+            std::string word(6 + next_random(seed) % 11, ' ');
+            for (char& c: word) c = static_cast<char>('a' + next_random(seed) % 26);
+            patterns.push_back(std::move(word));
+        }
+        patterns.resize(count);
+        return patterns;
+    }
+
+    // log lines in rotating colours; every 50th carries a pattern, every other one of those
+    // with an SGR sequence in the middle of it
+    std::string make_output(size_t size, const std::vector<std::string>& patterns) {
+        std::string out;
+        out.reserve(size + 256);
+        uint32_t seed = 7;
+        char line[160];
+        for (size_t i = 0; out.size() < size; ++i) {
+            std::snprintf(line, sizeof(line), "\033[3%dm%09zu\033[0m build step %zu of the benchmark, compiling unit_%zu.cpp ",
+                          static_cast<int>(i % 8), i, i % 977, i % 31);
+            out += line;
+            if (i % 50 == 0) {
+                const std::string& pattern = patterns[next_random(seed) % patterns.size()];
+                if (i % 100 == 0 && pattern.size() > 1) {
+                    out.append(pattern, 0, pattern.size() / 2);
+                    out += "\033[1m";
+                    out.append(pattern, pattern.size() / 2, std::string::npos);
+                    out += "\033[0m";
+                } else {
+                    out += pattern;
+                }
+            }
+            out += "\r\n";
+        }
+        return out;
+    }
+
+    size_t scan(const noterm::PatternSet& set, const std::string& data, size_t limit) {
+        constexpr size_t CHUNK = 64 * 1024;
+        noterm::TriggerScanner scanner;
+        std::vector<noterm::TriggerMatch> matches;
+        matches.reserve(1024);
+        size_t found = 0;
+        for (size_t off = 0; off < limit; off += CHUNK) {
+            scanner.scan(set, 1, data.data() + off, std::min(CHUNK, limit - off), matches, SIZE_MAX);
+            found += matches.size();
+            matches.clear();
+        }
+        return found;
+    }
+
+    // overlapping occurrences of every pattern in the text without its escape sequences
+    size_t naive(const std::vector<std::string>& patterns, const std::string& data, size_t limit) {
+        std::string plain;
+        noterm::strip_escapes(std::string_view(data.data(), limit), plain);
+        size_t found = 0;
+        for (const std::string& pattern: patterns) {
+            for (size_t at = plain.find(pattern); at != std::string::npos; at = plain.find(pattern, at + 1)) ++found;
+        }
+        return found;
+    }
+
+    void bench(const std::vector<std::string>& all, size_t count, const std::string& data) {
+        std::vector<std::string> patterns(all.begin(), all.begin() + static_cast<std::ptrdiff_t>(std::min(count, all.size())));
+        auto begin = Clock::now();
+        noterm::PatternSet set(patterns, false);
+        double build_ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+
+        begin = Clock::now();
+        size_t matches = scan(set, data, data.size());
+        double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        std::printf("  %6zu patterns  build %8.2f ms  %8.1f MB/s  %9zu matches\n", patterns.size(), build_ms,
+                    data.size() / (1024.0 * 1024.0) / seconds, matches);
+
+        size_t checked = std::min<size_t>(data.size(), 1024 * 1024);
+        size_t expected = naive(patterns, data, checked);
+        size_t got = scan(set, data, checked);
+        if (got != expected) std::printf("  %6zu patterns  MISMATCH: %zu matches in the first MB, naive search finds %zu\n", patterns.size(), got, expected);
+    }
+}// namespace
+
+int main(int argc, char** argv) {
+    size_t mb = 64;
+    size_t count = 5000;
+    if (const char* v = find_option(argc, argv, "--mb")) mb = static_cast<size_t>(std::max(1, std::atoi(v)));
+    if (const char* v = find_option(argc, argv, "--patterns")) count = static_cast<size_t>(std::max(1, std::atoi(v)));
+
+    std::vector<std::string> patterns = make_patterns(std::max<size_t>(count, 100));
+    std::string data = make_output(mb * 1024 * 1024, patterns);
+    std::printf("scanning %zu MB of coloured output:\n", mb);
+    for (size_t n: {static_cast<size_t>(1), static_cast<size_t>(100), count}) bench(patterns, n, data);
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Throughput of the UTF-8 validator on the output path, against its scalar baseline.
+//
+//   utf8_throughput [--mb=N]
+//
+// Validates N MB of each workload in 64KB chunks, the size of one pty read, with valid_prefix()
+// and valid_prefix_scalar(), and reports MB/s for both. "sanitize" replaces the invalid bytes of
+// a workload with one stray byte per line.
+
+#include "utf8.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const char* find_option(int argc, char** argv, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+        }
+        return nullptr;
+    }
+
+    std::string repeat_to(const std::string& unit, size_t size) {
+        std::string out;
+        out.reserve(size + unit.size());
+        while (out.size() < size) out += unit;
+        return out;
+    }
+
+    double mb_per_s(size_t bytes, Clock::duration elapsed) {
+        return bytes / (1024.0 * 1024.0) / std::chrono::duration<double>(elapsed).count();
+    }
+
+    template<typename Validate>
+    double run(const std::string& data, Validate validate, size_t& checked) {
+        constexpr size_t CHUNK = 64 * 1024;
+        auto begin = Clock::now();
+        for (size_t off = 0; off < data.size();) {
+            size_t n = std::min(CHUNK, data.size() - off);
+            // a chunk boundary may split a code point, as a pty read does
+            size_t valid = validate(data.data() + off, n);
+            checked += valid;
+            off += valid > 0 ? valid : n;
+        }
+        return mb_per_s(data.size(), Clock::now() - begin);
+    }
+
+    void bench(const char* name, const std::string& data) {
+        size_t checked = 0;
+        double fast = run(data, noterm::utf8::valid_prefix, checked);
+        double scalar = run(data, noterm::utf8::valid_prefix_scalar, checked);
+        std::printf("  %-12s %10.1f MB/s   scalar %8.1f MB/s   %5.1fx\n", name, fast, scalar, fast / scalar);
+        if (checked != 2 * data.size()) std::printf("  %-12s validators disagree\n", name);
+    }
+}// namespace
+
+int main(int argc, char** argv) {
+    size_t mb = 64;
+    if (const char* v = find_option(argc, argv, "--mb")) mb = static_cast<size_t>(std::max(1, std::atoi(v)));
+    size_t size = mb * 1024 * 1024;
+
+    std::string ascii = repeat_to("drwxr-xr-x  2 user user  4096 Jan  1 00:00 some-directory-name\r\n", size);
+    std::string cjk = repeat_to("\xe4\xb8\xad\xe6\x96\x87\xe6\xb5\x8b\xe8\xaf\x95\xe3\x81\xae\xe3\x83\x86\xe3\x82\xb9\xe3\x83\x88 "
+                                "\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4 \xe2\x94\x82 log \xe2\x94\x80\xe2\x94\x80\r\n",
+                                size);
+    std::string emoji = repeat_to("\xf0\x9f\x9a\x80 deploy \xf0\x9f\x9f\xa2 ok \xf0\x9f\x98\x80\xf0\x9f\x91\x8d\xf0\x9f\x8f\xbd "
+                                  "\xe2\x9c\x85 \xf0\x9f\x94\xa5\xf0\x9f\x94\xa5\r\n",
+                                  size);
+
+    std::printf("utf-8 validation, %zu MB per workload:\n", mb);
+    bench("ascii", ascii);
+    bench("utf8-cjk", cjk);
+    bench("utf8-emoji", emoji);
+
+    std::string broken = repeat_to("\xe4\xb8\xad\xe6\x96\x87 text \xff\r\n", size);
+    std::string out;
+    out.reserve(broken.size() * 2);
+    auto begin = Clock::now();
+    noterm::utf8::sanitize(broken.data(), broken.size(), out);
+    std::printf("  %-12s %10.1f MB/s\n", "sanitize", mb_per_s(broken.size(), Clock::now() - begin));
+    return out.empty();
+}
@@ -0,0 +1,77 @@
+// Throughput of the native VT parser and screen model.
+//
+//   vt_throughput [--mb=N]
+//
+// Feeds N MB of each synthetic workload through Screen in 64KB chunks, the size of one pty read,
+// and reports MB/s. "scan" measures the vectorised printable-run scan on its own.
+
+#include "screen.hpp"
+#include "vt.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const char* find_option(int argc, char** argv, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < argc; ++i) {
+            if (std::strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+        }
+        return nullptr;
+    }
+
+    std::string repeat_to(const std::string& unit, size_t size) {
+        std::string out;
+        out.reserve(size + unit.size());
+        while (out.size() < size) out += unit;
+        return out;
+    }
+
+    void report(const char* name, size_t bytes, Clock::duration elapsed) {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        std::printf("  %-12s %10.1f MB/s\n", name, bytes / (1024.0 * 1024.0) / seconds);
+    }
+
+    void bench_screen(const char* name, const std::string& data) {
+        constexpr size_t CHUNK = 64 * 1024;
+        noterm::Screen screen(120, 40);
+        auto begin = Clock::now();
+        for (size_t off = 0; off < data.size(); off += CHUNK) {
+            size_t n = data.size() - off < CHUNK ? data.size() - off : CHUNK;
+            screen.feed(data.data() + off, n);
+        }
+        report(name, data.size(), Clock::now() - begin);
+    }
+}// namespace
+
+int main(int argc, char** argv) {
+    size_t mb = 64;
+    if (const char* v = find_option(argc, argv, "--mb")) mb = static_cast<size_t>(std::max(1, std::atoi(v)));
+    size_t size = mb * 1024 * 1024;
+
+    std::string ascii = repeat_to("drwxr-xr-x  2 user user  4096 Jan  1 00:00 some-directory-name\r\n", size);
+    std::string colored = repeat_to("\x1b[01;34mdirectory\x1b[0m  \x1b[01;32mexecutable.sh\x1b[0m  plain-file.txt\r\n", size);
+    std::string cjk = repeat_to("\xe4\xb8\xad\xe6\x96\x87\xe6\xb5\x8b\xe8\xaf\x95 mixed text \xe2\x94\x80\xe2\x94\x80\r\n", size);
+    std::string tui = repeat_to("\x1b[H\x1b[2K\x1b[7m status \x1b[0m\x1b[5;10H\x1b[38;2;200;100;50mcell\x1b[K\x1b[?25l\x1b[?25h", size);
+
+    std::printf("screen model, %zu MB per workload:\n", mb);
+    bench_screen("ascii", ascii);
+    bench_screen("sgr-colored", colored);
+    bench_screen("utf8-cjk", cjk);
+    bench_screen("tui-csi", tui);
+
+    auto begin = Clock::now();
+    size_t total = 0;
+    for (size_t off = 0; off < ascii.size();) {
+        size_t run = noterm::vt::scan_printable(ascii.data() + off, ascii.size() - off);
+        total += run;
+        off += run + 1;
+    }
+    report("scan", ascii.size(), Clock::now() - begin);
+    return total == 0;
+}
@@ -0,0 +1,31 @@
+#ifndef NOTERM_FRAME_HPP
+#define NOTERM_FRAME_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace noterm {
+    // Input and output frames are a sequence of records, one per session:
+    //   [id: u32 little-endian][length: u32 little-endian][length bytes]
+    constexpr size_t FRAME_HEADER_SIZE = 8;
+
+    inline void write_u32_le(char* p, uint32_t v) {
+        p[0] = static_cast<char>(v & 0xFF);
+        p[1] = static_cast<char>((v >> 8) & 0xFF);
+        p[2] = static_cast<char>((v >> 16) & 0xFF);
+        p[3] = static_cast<char>((v >> 24) & 0xFF);
+    }
+
+    inline uint32_t read_u32_le(const char* p) {
+        const auto* u = reinterpret_cast<const unsigned char*>(p);
+        return static_cast<uint32_t>(u[0]) | (static_cast<uint32_t>(u[1]) << 8) |
+               (static_cast<uint32_t>(u[2]) << 16) | (static_cast<uint32_t>(u[3]) << 24);
+    }
+
+    inline void write_frame_header(char* p, int id, size_t length) {
+        write_u32_le(p, static_cast<uint32_t>(id));
+        write_u32_le(p + 4, static_cast<uint32_t>(length));
+    }
+}// namespace noterm
+
+#endif
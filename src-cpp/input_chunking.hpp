@@ -0,0 +1,41 @@
+#ifndef NOTERM_INPUT_CHUNKING_HPP
+#define NOTERM_INPUT_CHUNKING_HPP
+
+#include <cstddef>
+
+namespace noterm::detail {
+    // Largest prefix of data, at most limit bytes, that can be written on its own without splitting a
+    // UTF-8 sequence or an escape sequence such as the bracketed-paste markers ESC[200~ / ESC[201~.
+    // Pastes are written in chunks that fit the kernel/pipe buffer, so the child reads whole
+    // sequences instead of re-assembling them across reads.
+    inline size_t input_chunk_boundary(const char* data, size_t size, size_t limit) {
+        if (size <= limit) return size;
+
+        size_t cut = limit;
+        // data[cut] starts the next chunk; it must not be a UTF-8 continuation byte
+        while (cut > 0 && (static_cast<unsigned char>(data[cut]) & 0xC0) == 0x80) --cut;
+
+        // an escape sequence starting shortly before the cut must be complete before it
+        constexpr size_t MAX_SEQUENCE = 16;
+        for (size_t i = cut; i > 0 && cut - i < MAX_SEQUENCE; --i) {
+            if (data[i - 1] != '\x1b') continue;
+            size_t j = i;
+            bool complete;
+            if (j < cut && data[j] == '[') {
+                // CSI: parameters and intermediates until a final byte in 0x40..0x7E
+                ++j;
+                while (j < cut && !(data[j] >= 0x40 && data[j] <= 0x7E)) ++j;
+                complete = j < cut;
+            } else {
+                complete = j < cut;
+            }
+            if (!complete) cut = i - 1;
+            break;
+        }
+
+        // pathological input (one giant sequence): fall back to the plain limit
+        return cut > 0 ? cut : limit;
+    }
+}// namespace noterm::detail
+
+#endif
@@ -1,232 +1,309 @@
-#ifdef _WIN32
-#include "win32.hpp"
-#else
-#error "Unsupported platform"
-#endif
+// first: the platform header has to set up the Windows version macros before windows.h is seen
+#include "pty_manager.hpp"
 
+#include "frame.hpp"
 #include "lib.hpp"
+#include "log.hpp"
+#include "output_fanout.hpp"
+#include "output_stream.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
-#include <functional>
-#include <iostream>
-#include <map>
 #include <memory>
-#include <optional>
+#include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
+#ifndef _WIN32
+#include "session_server.hpp"
+#include <pthread.h>
+#endif
+
+#ifdef _WIN32
+#define DEFAULT_COMMAND "powershell.exe"
+#else
+// empty command: the pty backend starts the user's login shell
+#define DEFAULT_COMMAND ""
+#endif
 
 #define INIT_CB_NAME "webui_init_terminal"
 #define RESIZE_CB_NAME "webui_resize_terminal"
+#define RESIZE_ALL_CB_NAME "webui_resize_terminals"
 #define SEND_INPUT_CB_NAME "webui_send_input"
 #define PULL_OUTPUT_CB_NAME "webui_pull_output"
 #define CREATED_CB_NAME "webui_created_pty"
-#define NOTIFY_OUTPUT_CB_NAME "webui_output_available"
 #define WEB_RECEIVE_OUTPUT_CB_NAME "webui_receive_output"
 #define READY_CB_NAME "webui_ready"
 #define CLOSE_PTY_CB_NAME "webui_close_pty"
+#define ACK_OUTPUT_CB_NAME "webui_ack_output"
+#define SESSION_STATS_CB_NAME "webui_session_stats"
+#define SCREEN_TEXT_CB_NAME "webui_screen_text"
+#define RENDER_MODE_CB_NAME "webui_set_render_mode"
+#define SCROLLBACK_CB_NAME "webui_scrollback"
+#define SEARCH_CB_NAME "webui_search"
+#define ATTACH_CB_NAME "webui_attach_ptys"
+#define REATTACH_CB_NAME "webui_reattach_pty"
+#define TRACE_CB_NAME "webui_trace"
+#define PREWARM_CB_NAME "webui_prewarm_pty"
 #define MINIMIZE_CB_NAME "webui_minimize"
 #define CLOSE_CB_NAME "webui_close"
+#define OUTPUT_STREAM_CB_NAME "webui_output_stream"
+#define OUTPUT_FALLBACK_CB_NAME "webui_output_fallback"
+#define SET_TRIGGERS_CB_NAME "webui_set_triggers"
+#define TRIGGER_MATCHED_CB_NAME "webui_trigger_matched"
 
 namespace {
-    class PTYManager {
-    public:
-        static PTYManager& instance() {
-            static PTYManager mgr;
-            return mgr;
+    using noterm::PTYManager;
+
+    // value of a "--name=value" command line option, or nullptr
+    const char* find_option(const webui_context& ctx, const char* name) {
+        size_t len = std::strlen(name);
+        for (int i = 1; i < ctx.argc; ++i) {
+            if (std::strncmp(ctx.argv[i], name, len) == 0 && ctx.argv[i][len] == '=') {
+                return ctx.argv[i] + len + 1;
+            }
         }
+        return nullptr;
+    }
 
-        int create(const std::string& command, int cols, int rows) {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            int id = ++m_last_id;
-            auto p = std::make_unique<noterm::detail::PseudoConsole>();
-            p->init(command.c_str(), cols, rows);
-            m_consoles[id] = std::move(p);
-
-            m_running.store(true);
-
-            // start a dedicated thread to block on this PTY's output
-            m_threads[id] = std::thread([this, id]() {
-                while (m_running.load()) {
-                    noterm::detail::PseudoConsole* pc = nullptr;
-                    {
-                        std::lock_guard<std::mutex> lock(m_mutex);
-                        auto it = m_consoles.find(id);
-                        if (it == m_consoles.end()) {
-                            break;// console removed
-                        }
-                        pc = it->second.get();
-                    }
-
-                    // blocking read; will be unblocked when console is closed (sentinel)
-                    auto out = pc->read_output();
-
-
-                    if (out.has_value() && !out->empty()) {
-                        // append to staged buffer
-                        std::function<void(int)> cb;
-                        {
-                            std::lock_guard<std::mutex> lock(m_mutex);
-                            m_staged_outputs[id].append(*out);
-                            cb = m_notify_cb;
-                        }
-                        // notify outside lock
-                        if (cb) cb(id);
-                    }
-                }
-            });
-
-            return id;
+    void append_json_string(std::string& out, const std::string& s) {
+        out.push_back('"');
+        for (unsigned char c: s) {
+            if (c == '"' || c == '\\') {
+                out.push_back('\\');
+                out.push_back(static_cast<char>(c));
+            } else if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out.push_back(static_cast<char>(c));
+            }
         }
+        out.push_back('"');
+    }
 
-        void set_size(int id, int cols, int rows) {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            auto it = m_consoles.find(id);
-            if (it != m_consoles.end()) it->second->set_size(cols, rows);
+    // one pattern per line, a trailing \r dropped; empty lines stay as patterns that never match
+    std::vector<std::string> split_lines(const std::string& text) {
+        std::vector<std::string> lines;
+        size_t start = 0;
+        while (start < text.size()) {
+            size_t end = text.find('\n', start);
+            if (end == std::string::npos) end = text.size();
+            size_t length = end - start;
+            if (length > 0 && text[end - 1] == '\r') --length;
+            lines.emplace_back(text, start, length);
+            start = end + 1;
         }
+        return lines;
+    }
 
-        void write_input(int id, const std::string& s) {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            auto it = m_consoles.find(id);
-            if (it != m_consoles.end()) it->second->write_input(s);
-        }
+    void append_histogram(std::string& out, const char* name, const noterm::HistogramSnapshot& h) {
+        char entry[192];
+        snprintf(entry, sizeof(entry), ",\"%s\":{\"count\":%llu,\"mean\":%llu,\"p50\":%llu,\"p99\":%llu,\"max\":%llu}", name,
+                 static_cast<unsigned long long>(h.count), static_cast<unsigned long long>(h.mean()),
+                 static_cast<unsigned long long>(h.quantile(0.5)), static_cast<unsigned long long>(h.quantile(0.99)),
+                 static_cast<unsigned long long>(h.max));
+        out += entry;
+    }
+}// namespace
 
-        // non-blocking read: returns optional vector if data available
-        std::optional<std::string> read_output_nonblocking(int id) {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            auto it = m_consoles.find(id);
-            if (it == m_consoles.end()) return std::nullopt;
-            return it->second->read_output();
-        }
+static std::atomic_bool running = false;
+// --render-mode=stream disables screen mode, =screen forces it; by default the frontend chooses per tab
+static std::string render_mode_option = "auto";
+// --grace-period=<s>|forever: how long PTYs outlive a disconnected frontend, 0 closes them at once
+static long long grace_seconds = 30;
+// bumped on every connect and disconnect; a grace timer only fires if nothing happened since
+static std::atomic<uint64_t> connection_epoch{0};
+// --trace=<path>: record a trace from startup, written as Chrome trace JSON on cleanup
+static std::string trace_path;
+// --prewarm=<n>: idle sessions kept ready per command the frontend asks to prewarm, 0 disables the pool
+static size_t prewarm_count = 1;
+static std::mutex webui_send_mutex;
+// --replay=<path>: tabs play this asciicast recording instead of starting a shell
+static std::string replay_path;
+// --replay-speed=<x>: 1 plays at the recorded pace, 0 as fast as the frontend takes it
+static double replay_speed = 1.0;
+// --replay-idle=<ms>: longest pause between two replayed events, 0 keeps the recorded ones
+static long long replay_idle_ms = 0;
+// --multi-client=on: further windows or browsers opening the app's URL mirror the open sessions;
+// =readonly mirrors them too, but only a session's owner types into it and the others just watch
+static bool mirror_clients = false;
+static bool readonly_mirrors = false;
+// --transport=stream: output reaches each client over one streamed HTTP response instead of a
+// WebSocket message per frame; control traffic stays on the WebSocket
+static bool stream_transport = false;
+static noterm::OutputStreamServer output_streams;
+// every connected client subscribes to the output of the sessions it shows, keyed by its webui client id
+static noterm::OutputFanout fanout([](int id, size_t bytes) { PTYManager::instance().acknowledge(id, bytes); },
+                                   [](int id) { PTYManager::instance().repaint(id); });
 
-        // stage output for later pull
-        bool stage_output_if_available(int id) {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            auto it = m_consoles.find(id);
-            if (it == m_consoles.end()) return false;
-            auto out = it->second->read_output_nonblocking();
-            if (out.has_value() && !out->empty()) {
-                // append to any previously staged data so we don't overwrite
-                auto& dest = m_staged_outputs[id];
-                dest.append(*out);
-            }
-            return m_staged_outputs.find(id) != m_staged_outputs.end() && !m_staged_outputs[id].empty();
-        }
+void cleanup() {
+    NOTERM_LOG_INFO("Cleaning up PTYs...");
 
-        // Pull staged output if present; otherwise read directly from PTY (fallback)
-        std::optional<std::string> pull_output(int id) {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            auto sit = m_staged_outputs.find(id);
-            if (sit != m_staged_outputs.end()) {
-                std::string s = std::move(sit->second);
-                m_staged_outputs.erase(sit);
-                return s;
-            }
-            auto it = m_consoles.find(id);
-            if (it == m_consoles.end()) return std::nullopt;
-            return it->second->read_output_nonblocking();
+    if (!running.load()) {
+        NOTERM_LOG_INFO("PTYs already cleaned up.");
+        return;
+    }
+
+    running.store(false);
+    PTYManager::instance().close_all();
+    output_streams.stop();
+    // recordings of the sessions just closed
+    noterm::Recorder::flush_all();
+
+    if (!trace_path.empty()) {
+        noterm::trace::stop();
+        std::string json = noterm::trace::export_json();
+        if (FILE* f = std::fopen(trace_path.c_str(), "wb")) {
+            std::fwrite(json.data(), 1, json.size(), f);
+            std::fclose(f);
+            NOTERM_LOG_INFO("Trace written to %s", trace_path.c_str());
+        } else {
+            NOTERM_LOG_ERROR("Failed to write trace to %s: %s", trace_path.c_str(), std::strerror(errno));
         }
+    }
 
-        void close_all() {
-            // close consoles first to wake threads
-            {
-                std::lock_guard<std::mutex> lock(m_mutex);
-                for (auto& kv: m_consoles) {
-                    kv.second->close();
-                }
-            }
+    NOTERM_LOG_INFO("PTYs cleaned up.");
+    noterm::log::flush();
+}
 
-            m_running.store(false);
+// options of the pty core, shared by the window and --serve; false if the pty backend cannot start
+static bool configure_core(const webui_context& ctx) {
+    if (!noterm::init_context()) return false;
 
-            // join threads
-            for (auto& kv: m_threads) {
-                if (kv.second.joinable()) kv.second.join();
-            }
+    // --output-buffer=<KiB>: per-session output ring capacity
+    if (const char* kib = find_option(ctx, "--output-buffer")) {
+        PTYManager::instance().set_output_capacity(static_cast<size_t>(std::strtoul(kib, nullptr, 10)) * 1024);
+    }
 
-            std::lock_guard<std::mutex> lock(m_mutex);
-            m_consoles.clear();
-            m_staged_outputs.clear();
-            m_threads.clear();
+    // --flow-high=<KiB> / --flow-low=<KiB>: unacknowledged output watermarks per session
+    {
+        const char* high = find_option(ctx, "--flow-high");
+        const char* low = find_option(ctx, "--flow-low");
+        if (high || low) {
+            size_t high_bytes = high ? static_cast<size_t>(std::strtoul(high, nullptr, 10)) * 1024 : 512 * 1024;
+            size_t low_bytes = low ? static_cast<size_t>(std::strtoul(low, nullptr, 10)) * 1024 : high_bytes / 4;
+            PTYManager::instance().set_flow_control(high_bytes, low_bytes);
         }
+    }
 
-        // Close and remove a single PTY by id
-        void close(int id) {
-            // first, close the console to wake blocking reads
-            {
-                std::lock_guard<std::mutex> lock(m_mutex);
-                auto it = m_consoles.find(id);
-                if (it != m_consoles.end()) {
-                    it->second->close();
-                }
-            }
-
-            // join and remove thread
-            auto tit = m_threads.find(id);
-            if (tit != m_threads.end()) {
-                if (tit->second.joinable()) tit->second.join();
-                m_threads.erase(tit);
-            }
-
-            // now remove console and staged outputs
-            std::lock_guard<std::mutex> lock(m_mutex);
-            auto it = m_consoles.find(id);
-            if (it != m_consoles.end()) {
-                m_consoles.erase(it);
-            }
-            m_staged_outputs.erase(id);
-        }
+    // --frame-interval=<ms>: minimum time between two rounds of background output; a session being
+    // typed into is flushed as its output arrives
+    if (const char* ms = find_option(ctx, "--frame-interval")) {
+        PTYManager::instance().set_frame_interval(std::chrono::microseconds(static_cast<long long>(std::strtod(ms, nullptr) * 1000.0)));
+    }
 
-        void set_notify_callback(std::function<void(int)> cb) {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            m_notify_cb = std::move(cb);
+    // --read-min=<KiB> / --read-max=<KiB>: range of the adaptive per-wakeup pty read size
+    // --read-batch=<us>: how long a busy pty waits before it is read again, 0 reads it right away
+    {
+        const char* min = find_option(ctx, "--read-min");
+        const char* max = find_option(ctx, "--read-max");
+        const char* batch = find_option(ctx, "--read-batch");
+        if (min || max || batch) {
+            noterm::ReadPolicy policy;
+            if (min) policy.min_read = std::max<size_t>(1, std::strtoul(min, nullptr, 10)) * 1024;
+            if (max) policy.max_read = std::max<size_t>(1, std::strtoul(max, nullptr, 10)) * 1024;
+            if (policy.max_read < policy.min_read) policy.max_read = policy.min_read;
+            if (batch) policy.batch_delay = std::chrono::microseconds(std::strtoll(batch, nullptr, 10));
+            PTYManager::instance().set_read_policy(policy);
         }
+    }
 
-        // iterate IDs
-        std::vector<int> ids() {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            std::vector<int> out;
-            out.reserve(m_consoles.size());
-            for (auto& kv: m_consoles) out.push_back(kv.first);
-            return out;
+    // --scrollback-memory=<MiB>: compressed history kept in memory across all sessions
+    // --scrollback-spill=<MiB>: per-session spill file for history over that budget, 0 drops it instead
+    {
+        const char* memory = find_option(ctx, "--scrollback-memory");
+        const char* spill = find_option(ctx, "--scrollback-spill");
+        if (memory || spill) {
+            size_t memory_bytes = (memory ? static_cast<size_t>(std::strtoul(memory, nullptr, 10)) : 64) * 1024 * 1024;
+            size_t spill_bytes = (spill ? static_cast<size_t>(std::strtoul(spill, nullptr, 10)) : 0) * 1024 * 1024;
+            noterm::ScrollbackStore::set_limits(memory_bytes, spill_bytes);
         }
+    }
 
-    private:
-        PTYManager() = default;
-        ~PTYManager() = default;
-        std::mutex m_mutex;
-        std::map<int, std::unique_ptr<noterm::detail::PseudoConsole>> m_consoles;
-        std::map<int, std::string> m_staged_outputs;
-        std::map<int, std::thread> m_threads;
-        std::function<void(int)> m_notify_cb;
-        std::atomic_bool m_running{false};
-        int m_last_id = 0;
-    };
-}// namespace
-
-static std::atomic_bool running = false;
-static std::mutex webui_send_mutex;
+    // --log-level=debug|info|warn|error: debug messages only exist in DEBUG builds
+    if (const char* level = find_option(ctx, "--log-level")) {
+        using noterm::log::Level;
+        if (std::strcmp(level, "debug") == 0) noterm::log::set_level(Level::Debug);
+        else if (std::strcmp(level, "info") == 0) noterm::log::set_level(Level::Info);
+        else if (std::strcmp(level, "warn") == 0) noterm::log::set_level(Level::Warn);
+        else if (std::strcmp(level, "error") == 0) noterm::log::set_level(Level::Error);
+    }
 
-void cleanup() {
-    std::cout << "Cleaning up PTYs..." << std::endl;
+    // --record=<dir>: every session's output is recorded to an asciicast file in dir
+    // --record-compress=on: LZ4-compressed .castz files instead, replayed by noterm only
+    if (const char* directory = find_option(ctx, "--record")) {
+        const char* compress = find_option(ctx, "--record-compress");
+        PTYManager::instance().set_recording(directory, compress && std::strcmp(compress, "on") == 0);
+    }
 
-    if (!running.load()) {
-        std::cout << "PTYs already cleaned up." << std::endl;
-        return;
+    if (const char* path = find_option(ctx, "--trace")) {
+        trace_path = path;
+        noterm::trace::start();
     }
 
-    running.store(false);
-    PTYManager::instance().close_all();
+    // --triggers=<path>: patterns to watch every session's output for, one literal per line;
+    // matches reach the frontend (or --serve clients) as events
+    // --triggers-ignore-case=on: ASCII case is ignored in them
+    if (const char* path = find_option(ctx, "--triggers")) {
+        std::string text;
+        if (FILE* f = std::fopen(path, "rb")) {
+            char buffer[4096];
+            size_t n;
+            while ((n = std::fread(buffer, 1, sizeof(buffer), f)) > 0) text.append(buffer, n);
+            std::fclose(f);
+            const char* ignore_case = find_option(ctx, "--triggers-ignore-case");
+            auto triggers = std::make_shared<noterm::PatternSet>(split_lines(text), ignore_case && std::strcmp(ignore_case, "on") == 0);
+            NOTERM_LOG_INFO("Watching output for %zu trigger patterns from %s", triggers->size(), path);
+            PTYManager::instance().set_triggers(std::move(triggers));
+        } else {
+            NOTERM_LOG_ERROR("Failed to read triggers from %s: %s", path, std::strerror(errno));
+        }
+    }
 
-    std::cout << "PTYs cleaned up." << std::endl;
+    if (const char* mode = find_option(ctx, "--render-mode")) {
+        render_mode_option = mode;
+        if (render_mode_option == "screen") PTYManager::instance().set_default_render_mode(noterm::RenderMode::Screen);
+    }
+    return true;
 }
 
 void webui_main(webui::window& window, webui_context ctx, int* err) {
-    bool success = noterm::init_context();
-    if (!success) {
+    if (!configure_core(ctx)) {
         if (err) *err = 1;
         return;
     }
 
+    if (const char* grace = find_option(ctx, "--grace-period")) {
+        grace_seconds = std::strcmp(grace, "forever") == 0 ? -1 : std::strtoll(grace, nullptr, 10);
+    }
+
+    if (const char* count = find_option(ctx, "--prewarm")) {
+        prewarm_count = static_cast<size_t>(std::strtoul(count, nullptr, 10));
+    }
+
+    if (const char* clients = find_option(ctx, "--multi-client")) {
+        readonly_mirrors = std::strcmp(clients, "readonly") == 0;
+        mirror_clients = readonly_mirrors || std::strcmp(clients, "on") == 0;
+    }
+    // one client per window unless sessions are mirrored; output is addressed per client either way
+    webui::set_config(multi_client, mirror_clients);
+
+    if (const char* path = find_option(ctx, "--replay")) replay_path = path;
+    if (const char* speed = find_option(ctx, "--replay-speed")) replay_speed = std::max(0.0, std::strtod(speed, nullptr));
+    if (const char* idle = find_option(ctx, "--replay-idle")) replay_idle_ms = std::max(0LL, std::strtoll(idle, nullptr, 10));
+
+    if (const char* transport = find_option(ctx, "--transport")) {
+        // falls back to the WebSocket if no port can be had
+        stream_transport = std::strcmp(transport, "stream") == 0 && output_streams.start();
+    }
+
     window.set_size(1280, 720);
     window.set_frameless(true);
     window.set_transparent(true);
@@ -234,60 +311,260 @@ void webui_main(webui::window& window, webui_context ctx, int* err) {
     window.set_center();
 
     // init: create a new PTY and notify frontend with its id and request token
-    // webui_init_terminal(cols, rows, token)
+    // webui_init_terminal(cols, rows, token); the process starts on the spawner thread, which calls back
     window.bind(INIT_CB_NAME, [](webui::window::event* ev) {
         int cols = ev->get_int(0);
         int rows = ev->get_int(1);
         int token = ev->get_int(2);
         // optional 4th argument: command to run (e.g., "powershell.exe" or "bash")
-        std::string command = "powershell.exe";
+        std::string command = DEFAULT_COMMAND;
         if (ev->get_count() > 3) {
             std::string c = ev->get_string(3);
             if (!c.empty()) command = c;
         }
-        int id = PTYManager::instance().create(command, cols, rows);
-        // Call back into JS with both id and token: webui_created_pty(id, token)
-        ev->get_window().run_fmt(CREATED_CB_NAME "(%d, %d);", id, token);
+        // the event itself only lives for this call
+        webui_event_t client = *ev;
+        auto created = [client, token](int id) mutable {
+            // claimed first: the prompt may already be waiting for its viewer
+            fanout.claim(client.client_id, id);
+            // Call back into JS with both id and token: webui_created_pty(id, token)
+            char script[64];
+            std::snprintf(script, sizeof(script), CREATED_CB_NAME "(%d, %d);", id, token);
+            std::lock_guard<std::mutex> lk(webui_send_mutex);
+            webui_run_client(&client, script);
+        };
+        // opening a recording is quick, unlike starting a process
+        int replayed = replay_path.empty() ? 0 : PTYManager::instance().replay(replay_path, cols, rows, replay_speed,
+                                                                               std::chrono::milliseconds(replay_idle_ms));
+        if (replayed) created(replayed);
+        else PTYManager::instance().create_async(command, cols, rows, std::move(created));
     });
 
-    // resize: expects (id, cols, rows)
+    // keep idle sessions of a command ready so its next tab opens at once: expects (command), an
+    // empty command prewarms the default shell
+    window.bind(PREWARM_CB_NAME, [](webui::window::event* ev) {
+        std::string command = ev->get_string(0);
+        if (command.empty()) command = DEFAULT_COMMAND;
+        PTYManager::instance().set_prewarm(command, prewarm_count);
+    });
+
+    // resize: expects (id, cols, rows); only the client owning the PTY sizes it, mirrors follow
     window.bind(RESIZE_CB_NAME, [](webui::window::event* ev) {
         int id = ev->get_int(0);
         int cols = ev->get_int(1);
         int rows = ev->get_int(2);
-        PTYManager::instance().set_size(id, cols, rows);
+        if (fanout.owns(ev->client_id, id)) PTYManager::instance().set_size(id, cols, rows);
+    });
+
+    // resize several PTYs at once: expects one binary frame of [id u32 LE][8 u32 LE][cols u32 LE][rows u32 LE] records
+    window.bind(RESIZE_ALL_CB_NAME, [](webui::window::event* ev) {
+        size_t size = ev->get_size(0);
+        if (size == 0) return;
+        const char* frame = ev->get_string_view(0).data();
+        std::string owned;
+        for (size_t off = 0; off + noterm::FRAME_HEADER_SIZE <= size;) {
+            size_t record = noterm::FRAME_HEADER_SIZE + noterm::read_u32_le(frame + off + 4);
+            if (record > size - off) break;
+            if (fanout.owns(ev->client_id, static_cast<int>(noterm::read_u32_le(frame + off)))) owned.append(frame + off, record);
+            off += record;
+        }
+        if (!owned.empty()) PTYManager::instance().set_sizes_frame(owned.data(), owned.size());
     });
 
-    // send input: expects (id, inputString)
+    // send input: expects one binary frame of [id u32 LE][len u32 LE][bytes] records, batched by the frontend;
+    // records for sessions the client does not show, or only watches, are dropped
     window.bind(SEND_INPUT_CB_NAME, [](webui::window::event* ev) {
-        int id = ev->get_int(0);
-        std::string s = ev->get_string(1);
-        std::cout << "Sending input to PTY " << id << ", size: " << s.size() << std::endl;
-        PTYManager::instance().write_input(id, s);
+        size_t size = ev->get_size(0);
+        if (size == 0) return;
+        const char* frame = ev->get_string_view(0).data();
+        auto allowed = [ev](int id) { return readonly_mirrors ? fanout.owns(ev->client_id, id) : fanout.shows(ev->client_id, id); };
+        // the frame goes through as it is unless something has to be cut out of it
+        size_t off = 0;
+        while (off + noterm::FRAME_HEADER_SIZE <= size) {
+            size_t record = noterm::FRAME_HEADER_SIZE + noterm::read_u32_le(frame + off + 4);
+            if (record > size - off || !allowed(static_cast<int>(noterm::read_u32_le(frame + off)))) break;
+            off += record;
+        }
+        if (off == size) {
+            PTYManager::instance().write_input_frame(frame, size);
+            return;
+        }
+        std::string kept(frame, off);
+        while (off + noterm::FRAME_HEADER_SIZE <= size) {
+            size_t record = noterm::FRAME_HEADER_SIZE + noterm::read_u32_le(frame + off + 4);
+            if (record > size - off) break;
+            if (allowed(static_cast<int>(noterm::read_u32_le(frame + off)))) kept.append(frame + off, record);
+            off += record;
+        }
+        if (!kept.empty()) PTYManager::instance().write_input_frame(kept.data(), kept.size());
     });
 
-    // pull output: frontend calls this to request the buffered output for a PTY id
+    // pull output: output is pushed by the scheduler; this only forces a flush for a PTY id
     window.bind(PULL_OUTPUT_CB_NAME, [](webui::window::event* ev) {
         int id = ev->get_int(0);
-        auto out = PTYManager::instance().pull_output(id);
-        if (out.has_value() && !out->empty()) {
-            // prepend 4-byte little-endian id header so frontend can route bytes to correct PTY
-            int data_len = static_cast<int>(out->size());
-            std::vector<char> buf(4 + data_len);
-            // write id as little-endian 32-bit
-            buf[0] = static_cast<char>(id & 0xFF);
-            buf[1] = static_cast<char>((id >> 8) & 0xFF);
-            buf[2] = static_cast<char>((id >> 16) & 0xFF);
-            buf[3] = static_cast<char>((id >> 24) & 0xFF);
-            memcpy(buf.data() + 4, out->data(), data_len);
-            ev->get_window().send_raw(WEB_RECEIVE_OUTPUT_CB_NAME, buf.data(), static_cast<int>(buf.size()));
+        PTYManager::instance().request_output(id);
+    });
+
+    // search every PTY's history and screen: expects (pattern, flags, limit), flags bit 0 regex, bit 1
+    // ignore case; returns [{"id","line","column","length","text"}], lines numbered as in webui_scrollback
+    window.bind(SEARCH_CB_NAME, [](webui::window::event* ev) {
+        std::string pattern = ev->get_string(0);
+        long long flags = ev->get_int(1);
+        long long limit = ev->get_int(2);
+        auto results = PTYManager::instance().search(pattern, flags & 1, flags & 2, limit > 0 ? static_cast<size_t>(limit) : 1000);
+        std::string json = "[";
+        for (auto& r: results) {
+            if (json.size() > 1) json.push_back(',');
+            json += "{\"id\":" + std::to_string(r.id) + ",\"line\":" + std::to_string(r.line) + ",\"column\":" +
+                    std::to_string(r.column) + ",\"length\":" + std::to_string(r.length) + ",\"text\":";
+            append_json_string(json, r.text);
+            json.push_back('}');
         }
+        json += "]";
+        ev->return_string(json);
     });
 
-    // close a specific PTY: expects (id)
+    // acknowledge written output: expects (id, bytes), sent after xterm.js finished writing them
+    window.bind(ACK_OUTPUT_CB_NAME, [](webui::window::event* ev) {
+        int id = ev->get_int(0);
+        long long bytes = ev->get_int(1);
+        if (bytes > 0) fanout.acknowledge(ev->client_id, id, static_cast<size_t>(bytes));
+    });
+
+    // per-session gauges and counters as a JSON array; readSizes in bytes, screenLockWait in ns and
+    // ackLatency in us are {"count","mean","p50","p99","max"} with quantiles rounded up to a power of 4
+    window.bind(SESSION_STATS_CB_NAME, [](webui::window::event* ev) {
+        std::string json = "[";
+        for (auto& st: PTYManager::instance().stats()) {
+            char entry[576];
+            snprintf(entry, sizeof(entry),
+                     "%s{\"id\":%d,\"buffered\":%zu,\"unacked\":%zu,\"readingPaused\":%s,\"bytesOut\":%llu,"
+                     "\"bytesIn\":%llu,\"bytesSent\":%llu,\"recordsSent\":%llu,\"bufferedPeak\":%llu,\"unackedPeak\":%llu,"
+                     "\"firstOutputUs\":%llu,\"prewarmed\":%s,"
+                     "\"scrollbackLines\":%llu,\"scrollbackRaw\":%zu,\"scrollbackStored\":%zu,\"scrollbackSpilled\":%zu",
+                     json.size() > 1 ? "," : "", st.id, st.buffered, st.unacked, st.reading_paused ? "true" : "false",
+                     static_cast<unsigned long long>(st.bytes_out), static_cast<unsigned long long>(st.bytes_in),
+                     static_cast<unsigned long long>(st.bytes_sent), static_cast<unsigned long long>(st.records_sent),
+                     static_cast<unsigned long long>(st.buffered_peak), static_cast<unsigned long long>(st.unacked_peak),
+                     static_cast<unsigned long long>(st.first_output_us), st.prewarmed ? "true" : "false",
+                     static_cast<unsigned long long>(st.scrollback.lines), st.scrollback.raw_bytes,
+                     st.scrollback.stored_bytes, st.scrollback.spilled_bytes);
+            json += entry;
+            append_histogram(json, "readSizes", st.read_sizes);
+            append_histogram(json, "screenLockWait", st.screen_lock_wait);
+            append_histogram(json, "ackLatency", st.ack_latency);
+            json.push_back('}');
+        }
+        json += "]";
+        ev->return_string(json);
+    });
+
+    // text currently on a PTY's screen, from the native screen model: expects (id)
+    window.bind(SCREEN_TEXT_CB_NAME, [](webui::window::event* ev) {
+        int id = ev->get_int(0);
+        ev->return_string(PTYManager::instance().screen_text(id));
+    });
+
+    // native history of a PTY: expects (id, first, count), returns {"first","end","lines":[...]} with
+    // SGR-styled lines; first is clamped to the oldest line still kept
+    window.bind(SCROLLBACK_CB_NAME, [](webui::window::event* ev) {
+        int id = ev->get_int(0);
+        long long first = ev->get_int(1);
+        long long count = ev->get_int(2);
+        noterm::ScrollbackPage page = PTYManager::instance().scrollback(
+                id, static_cast<uint64_t>(first > 0 ? first : 0), static_cast<size_t>(count > 0 ? count : 0));
+        std::string json = "{\"first\":" + std::to_string(page.first) + ",\"end\":" + std::to_string(page.end) + ",\"lines\":[";
+        for (size_t i = 0; i < page.lines.size(); ++i) {
+            if (i) json.push_back(',');
+            append_json_string(json, page.lines[i]);
+        }
+        json += "]}";
+        ev->return_string(json);
+    });
+
+    // render mode of a PTY: expects (id, mode), 0 streams raw output, 1 sends screen diffs (hidden
+    // tabs); a PTY shown in any client keeps streaming
+    window.bind(RENDER_MODE_CB_NAME, [](webui::window::event* ev) {
+        if (render_mode_option != "auto") return;
+        int id = ev->get_int(0);
+        int mode = ev->get_int(1);
+        bool shown = fanout.set_visible(ev->client_id, id, mode == 0);
+        PTYManager::instance().set_render_mode(id, shown ? noterm::RenderMode::Stream : noterm::RenderMode::Screen);
+    });
+
+    // PTYs that survived a frontend disconnect: returns [{"id","command","title","cols","rows"}]
+    window.bind(ATTACH_CB_NAME, [](webui::window::event* ev) {
+        std::string json = "[";
+        for (auto& info: PTYManager::instance().describe()) {
+            if (json.size() > 1) json.push_back(',');
+            json += "{\"id\":" + std::to_string(info.id) + ",\"command\":";
+            append_json_string(json, info.command);
+            json += ",\"title\":";
+            append_json_string(json, info.title);
+            json += ",\"cols\":" + std::to_string(info.cols) + ",\"rows\":" + std::to_string(info.rows) + "}";
+        }
+        json += "]";
+        ev->return_string(json);
+    });
+
+    // take over a surviving PTY: expects (id, cols, rows, history); its snapshot arrives as regular
+    // output. cols/rows of 0 keep the size; history 0 skips the scrollback for a terminal that kept its own.
+    // A PTY another client shows is mirrored instead: this client gets a repaint, at the owner's size.
+    window.bind(REATTACH_CB_NAME, [](webui::window::event* ev) {
+        int id = ev->get_int(0);
+        int cols = ev->get_int(1);
+        int rows = ev->get_int(2);
+        bool history = ev->get_int(3) != 0;
+        if (!fanout.claim(ev->client_id, id)) {
+            PTYManager::instance().repaint(id);
+            return;
+        }
+        // resized first, so the snapshot is encoded at the new terminal's size
+        if (cols > 0 && rows > 0) PTYManager::instance().set_size(id, cols, rows);
+        PTYManager::instance().reattach(id, history);
+    });
+
+    // span tracing of the output path: expects (enable); 1 starts a fresh recording, 0 stops it and
+    // returns it as Chrome trace JSON
+    window.bind(TRACE_CB_NAME, [](webui::window::event* ev) {
+        if (ev->get_int(0) != 0) {
+            noterm::trace::start();
+            return;
+        }
+        noterm::trace::stop();
+        ev->return_string(noterm::trace::export_json());
+    });
+
+    // close a specific PTY: expects (id); a mirror only stops showing it
     window.bind(CLOSE_PTY_CB_NAME, [](webui::window::event* ev) {
         int id = ev->get_int(0);
+        if (!fanout.owns(ev->client_id, id) && !fanout.release(ev->client_id, id)) return;
         PTYManager::instance().close(id);
+        fanout.forget(id);
+    });
+
+    // the frontend's output stream failed or ended: output goes over the WebSocket from now on
+    window.bind(OUTPUT_FALLBACK_CB_NAME, [](webui::window::event* ev) {
+        webui_event_t client = *ev;
+        bool lost = output_streams.close(ev->client_id, [&client](const char* data, size_t size) {
+            std::lock_guard<std::mutex> lk(webui_send_mutex);
+            webui_send_raw_client(&client, WEB_RECEIVE_OUTPUT_CB_NAME, data, size);
+        });
+        if (lost) {
+            NOTERM_LOG_WARN("Client %zu lost its output stream, repainting its sessions.", ev->client_id);
+            fanout.reset(ev->client_id);
+        }
+    });
+
+    // patterns to watch every PTY's output for: expects (patterns, flags), one literal per line,
+    // flags bit 0 ignores ASCII case; an empty string stops watching. Matches are reported by
+    // calling webui_trigger_matched([{"id","pattern","end"}]), pattern being the line index and
+    // end the PTY's output byte count up to the end of the match.
+    window.bind(SET_TRIGGERS_CB_NAME, [](webui::window::event* ev) {
+        std::string patterns = ev->get_string(0);
+        bool ignore_case = (ev->get_int(1) & 1) != 0;
+        PTYManager::instance().set_triggers(patterns.empty() ? nullptr
+                                                             : std::make_shared<noterm::PatternSet>(split_lines(patterns), ignore_case));
     });
 
     window.bind(MINIMIZE_CB_NAME, [](webui::window::event* e) { webui_minimize(e->window); });
@@ -296,20 +573,94 @@ void webui_main(webui::window& window, webui_context ctx, int* err) {
     // connection events
     window.bind("", [](webui::window::event* e) {
         if (e->event_type == WEBUI_EVENT_CONNECTED) {
-            std::cout << "Client connected." << std::endl;
-            e->get_window().run(READY_CB_NAME "();");
+            NOTERM_LOG_INFO("Client %zu connected.", e->client_id);
+            ++connection_epoch;
+            webui_event_t client = *e;
+            if (stream_transport) {
+                // frames are queued until the frontend fetches the stream
+                std::string script = OUTPUT_STREAM_CB_NAME "(\"" + output_streams.open(e->client_id) + "\");";
+                webui_run_client(e, script.c_str());
+            }
+            fanout.subscribe(e->client_id, [client](const char* frame, size_t size) mutable {
+                if (stream_transport && output_streams.send(client.client_id, frame, size)) return;
+                std::lock_guard<std::mutex> lk(webui_send_mutex);
+                webui_send_raw_client(&client, WEB_RECEIVE_OUTPUT_CB_NAME, frame, size);
+            });
+            webui_run_client(e, READY_CB_NAME "();");
         } else if (e->event_type == WEBUI_EVENT_DISCONNECTED) {
-            std::cout << "Client disconnected." << std::endl;
-            cleanup();
+            NOTERM_LOG_INFO("Client %zu disconnected.", e->client_id);
+            std::vector<int> orphaned = fanout.unsubscribe(e->client_id);
+            output_streams.close(e->client_id, nullptr);
+            if (fanout.subscriber_count() > 0) {
+                // other clients stay; what only this one showed waits in screen mode
+                for (int id: orphaned) PTYManager::instance().set_render_mode(id, noterm::RenderMode::Screen);
+                return;
+            }
+            if (grace_seconds == 0) {
+                cleanup();
+                return;
+            }
+            // a reload or a crashed webview: keep the shells running for the next frontend
+            PTYManager::instance().detach();
+            uint64_t epoch = ++connection_epoch;
+            if (grace_seconds > 0) {
+                std::thread([epoch] {
+                    std::this_thread::sleep_for(std::chrono::seconds(grace_seconds));
+                    if (connection_epoch.load() == epoch) cleanup();
+                }).detach();
+            }
         }
     });
 
-    // register notify callback so per-PTY threads can alert the frontend
-    PTYManager::instance()
-            .set_notify_callback(
-                    [&window](int id) {
-                        std::lock_guard<std::mutex> lk(webui_send_mutex);
-                        window.run_fmt(NOTIFY_OUTPUT_CB_NAME "(%d);", id);
-                    });
+    // multiplexed output frames are pushed to every client showing their sessions
+    PTYManager::instance().set_output_sink([](const char* frame, size_t size) { fanout.publish(frame, size); });
+    // every client hears of every match, as every client may show the PTY
+    PTYManager::instance().set_trigger_callback([&window](const std::vector<noterm::TriggerMatch>& matches) {
+        std::string script = TRIGGER_MATCHED_CB_NAME "([";
+        for (size_t i = 0; i < matches.size(); ++i) {
+            char entry[96];
+            std::snprintf(entry, sizeof(entry), "%s{\"id\":%d,\"pattern\":%u,\"end\":%llu}", i ? "," : "", matches[i].id,
+                          matches[i].pattern, static_cast<unsigned long long>(matches[i].end));
+            script += entry;
+        }
+        script += "]);";
+        std::lock_guard<std::mutex> lk(webui_send_mutex);
+        window.run(script);
+    });
+    running.store(true);
+}
+
+int serve_main(webui_context ctx) {
+#ifdef _WIN32
+    (void) ctx;
+    NOTERM_LOG_ERROR("--serve needs Unix domain sockets and is not supported on Windows.");
+    return 1;
+#else
+    const char* path = find_option(ctx, "--serve");
+    if (!path || !*path) {
+        NOTERM_LOG_ERROR("--serve needs a socket path.");
+        return 1;
+    }
+
+    // blocked before any thread starts, so every thread inherits the mask and only sigwait sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    if (!configure_core(ctx)) return 1;
+    noterm::SessionServer server;
+    if (render_mode_option != "auto") server.fix_render_modes();
+    if (!server.start(path)) return 1;
     running.store(true);
-}
\ No newline at end of file
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+    NOTERM_LOG_INFO("Received signal %d, shutting down.", signal);
+    // sessions first: no create can call back into the server once it is gone
+    cleanup();
+    server.stop();
+    return 0;
+#endif
+}
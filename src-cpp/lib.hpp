@@ -12,5 +12,7 @@ struct webui_context {
 };
 
 void webui_main(webui::window& window, webui_context ctx, int* err);
+// --serve=<path>: no window; the sessions are served on a Unix domain socket until SIGINT or SIGTERM
+int serve_main(webui_context ctx);
 
 #endif
\ No newline at end of file
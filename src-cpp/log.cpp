@@ -0,0 +1,139 @@
+#include "log.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace noterm::log {
+    namespace {
+        struct Entry {
+            Level level;
+            std::string text;
+        };
+
+        const char* prefix(Level level) {
+            switch (level) {
+                case Level::Debug: return "[debug] ";
+                case Level::Warn: return "[warn] ";
+                case Level::Error: return "[error] ";
+                default: return "";
+            }
+        }
+
+        void print(const Entry& entry) {
+            FILE* stream = entry.level >= Level::Warn ? stderr : stdout;
+            std::fputs(prefix(entry.level), stream);
+            std::fputs(entry.text.c_str(), stream);
+            std::fputc('\n', stream);
+        }
+
+        std::atomic<int> g_level{static_cast<int>(Level::Debug)};
+        // set once the writer is gone; late messages from other static destructors are printed directly
+        std::atomic_bool g_closed{false};
+
+        class Writer {
+        public:
+            Writer() : m_thread([this]() { run(); }) {}
+
+            ~Writer() {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_running = false;
+                }
+                m_cv.notify_all();
+                m_thread.join();
+                g_closed = true;
+            }
+
+            void push(Level level, std::string text) {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_queue.push_back({level, std::move(text)});
+                    ++m_queued;
+                }
+                m_cv.notify_all();
+            }
+
+            void flush() {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                uint64_t target = m_queued;
+                m_cv.wait(lock, [&]() { return m_written >= target || !m_running; });
+            }
+
+        private:
+            void run() {
+                std::vector<Entry> batch;
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while (true) {
+                    m_cv.wait(lock, [this]() { return !m_running || !m_queue.empty(); });
+                    if (m_queue.empty() && !m_running) break;
+
+                    batch.swap(m_queue);
+                    lock.unlock();
+                    for (const Entry& entry: batch) print(entry);
+                    std::fflush(stdout);
+                    std::fflush(stderr);
+                    lock.lock();
+                    m_written += batch.size();
+                    batch.clear();
+                    m_cv.notify_all();
+                }
+            }
+
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::vector<Entry> m_queue;
+            uint64_t m_queued = 0;
+            uint64_t m_written = 0;
+            bool m_running = true;
+            // last: started once the queue above exists
+            std::thread m_thread;
+        };
+
+        Writer& writer() {
+            static Writer w;
+            return w;
+        }
+    }// namespace
+
+    void write(Level level, const char* format, ...) {
+        if (static_cast<int>(level) < g_level.load(std::memory_order_relaxed)) return;
+
+        char buffer[512];
+        va_list args;
+        va_start(args, format);
+        int n = std::vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if (n < 0) return;
+
+        std::string text;
+        if (static_cast<size_t>(n) < sizeof(buffer)) {
+            text.assign(buffer, static_cast<size_t>(n));
+        } else {
+            text.resize(static_cast<size_t>(n));
+            va_start(args, format);
+            std::vsnprintf(text.data(), text.size() + 1, format, args);
+            va_end(args);
+        }
+
+        if (g_closed.load()) {
+            print({level, std::move(text)});
+            return;
+        }
+        writer().push(level, std::move(text));
+    }
+
+    void set_level(Level level) {
+        g_level.store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    void flush() {
+        if (!g_closed.load()) writer().flush();
+    }
+}// namespace noterm::log
@@ -0,0 +1,54 @@
+#ifndef NOTERM_LOG_HPP
+#define NOTERM_LOG_HPP
+
+// Levels below NOTERM_LOG_MIN_LEVEL compile to nothing: 0 debug, 1 info, 2 warn, 3 error. Release
+// builds drop debug messages; the DEBUG CMake switch keeps them.
+#ifndef NOTERM_LOG_MIN_LEVEL
+#define NOTERM_LOG_MIN_LEVEL 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NOTERM_PRINTF_FORMAT(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define NOTERM_PRINTF_FORMAT(fmt, args)
+#endif
+
+namespace noterm::log {
+    enum class Level { Debug = 0, Info = 1, Warn = 2, Error = 3 };
+
+    // Formats on the calling thread and queues the line; a background thread writes it, debug and
+    // info to stdout, warnings and errors to stderr. Never blocks on the console, so it is safe on
+    // the reactor and scheduler threads.
+    void write(Level level, const char* format, ...) NOTERM_PRINTF_FORMAT(2, 3);
+
+    // messages below this level are discarded at runtime as well
+    void set_level(Level level);
+
+    // blocks until everything queued before the call has been written
+    void flush();
+}// namespace noterm::log
+
+// compiled-out messages still type-check their arguments, but never evaluate them
+#define NOTERM_LOG_DISCARD(level, ...) ((void) sizeof((::noterm::log::write(level, __VA_ARGS__), 0)))
+
+#if NOTERM_LOG_MIN_LEVEL <= 0
+#define NOTERM_LOG_DEBUG(...) ::noterm::log::write(::noterm::log::Level::Debug, __VA_ARGS__)
+#else
+#define NOTERM_LOG_DEBUG(...) NOTERM_LOG_DISCARD(::noterm::log::Level::Debug, __VA_ARGS__)
+#endif
+
+#if NOTERM_LOG_MIN_LEVEL <= 1
+#define NOTERM_LOG_INFO(...) ::noterm::log::write(::noterm::log::Level::Info, __VA_ARGS__)
+#else
+#define NOTERM_LOG_INFO(...) NOTERM_LOG_DISCARD(::noterm::log::Level::Info, __VA_ARGS__)
+#endif
+
+#if NOTERM_LOG_MIN_LEVEL <= 2
+#define NOTERM_LOG_WARN(...) ::noterm::log::write(::noterm::log::Level::Warn, __VA_ARGS__)
+#else
+#define NOTERM_LOG_WARN(...) NOTERM_LOG_DISCARD(::noterm::log::Level::Warn, __VA_ARGS__)
+#endif
+
+#define NOTERM_LOG_ERROR(...) ::noterm::log::write(::noterm::log::Level::Error, __VA_ARGS__)
+
+#endif
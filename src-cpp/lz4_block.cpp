@@ -0,0 +1,111 @@
+#include "lz4_block.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+namespace noterm::lz4 {
+    namespace {
+        constexpr size_t MIN_MATCH = 4;
+        // the format requires the last 5 bytes to be literals and the last match to start 12 bytes
+        // before the end
+        constexpr size_t LAST_LITERALS = 5;
+        constexpr size_t MATCH_LIMIT = 12;
+        constexpr size_t MAX_OFFSET = 65535;
+        constexpr int HASH_BITS = 12;
+
+        inline uint32_t load_u32(const char* p) {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        inline uint32_t hash(uint32_t v) { return (v * 2654435761u) >> (32 - HASH_BITS); }
+
+        void append_length(std::string& out, size_t length) {
+            for (; length >= 255; length -= 255) out.push_back(static_cast<char>(255));
+            out.push_back(static_cast<char>(length));
+        }
+
+        void append_sequence(std::string& out, const char* literals, size_t literal_count, size_t offset, size_t match_length) {
+            size_t match_code = match_length ? match_length - MIN_MATCH : 0;
+            uint8_t token = static_cast<uint8_t>((literal_count < 15 ? literal_count : 15) << 4);
+            if (match_length) token |= static_cast<uint8_t>(match_code < 15 ? match_code : 15);
+            out.push_back(static_cast<char>(token));
+            if (literal_count >= 15) append_length(out, literal_count - 15);
+            out.append(literals, literal_count);
+            if (!match_length) return;
+            out.push_back(static_cast<char>(offset & 0xFF));
+            out.push_back(static_cast<char>(offset >> 8));
+            if (match_code >= 15) append_length(out, match_code - 15);
+        }
+    }// namespace
+
+    size_t compress(const char* src, size_t size, std::string& out) {
+        size_t start = out.size();
+        size_t anchor = 0;
+        if (size > MATCH_LIMIT) {
+            // positions + 1, so 0 means empty; the table is small enough to live on the stack
+            uint32_t table[1 << HASH_BITS] = {};
+            size_t match_end = size - LAST_LITERALS;
+            size_t i = 0;
+            while (i + MATCH_LIMIT <= size) {
+                uint32_t v = load_u32(src + i);
+                uint32_t& slot = table[hash(v)];
+                size_t candidate = slot;
+                slot = static_cast<uint32_t>(i + 1);
+                if (candidate == 0 || i - (candidate - 1) > MAX_OFFSET || load_u32(src + candidate - 1) != v) {
+                    ++i;
+                    continue;
+                }
+                size_t ref = candidate - 1;
+                size_t length = MIN_MATCH;
+                while (i + length < match_end && src[ref + length] == src[i + length]) ++length;
+                append_sequence(out, src + anchor, i - anchor, i - ref, length);
+                i += length;
+                anchor = i;
+            }
+        }
+        append_sequence(out, src + anchor, size - anchor, 0, 0);
+        return out.size() - start;
+    }
+
+    bool decompress(const char* src, size_t size, char* dst, size_t raw_size) {
+        const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+        const uint8_t* in_end = in + size;
+        size_t written = 0;
+
+        auto read_length = [&](size_t length) -> size_t {
+            if (length != 15) return length;
+            while (in < in_end) {
+                uint8_t b = *in++;
+                length += b;
+                if (b != 255) return length;
+            }
+            return SIZE_MAX;
+        };
+
+        while (in < in_end) {
+            uint8_t token = *in++;
+            size_t literals = read_length(token >> 4);
+            if (literals == SIZE_MAX || literals > static_cast<size_t>(in_end - in) || literals > raw_size - written) return false;
+            std::memcpy(dst + written, in, literals);
+            in += literals;
+            written += literals;
+            // the last sequence has no match
+            if (in == in_end) break;
+
+            if (in_end - in < 2) return false;
+            size_t offset = in[0] | (in[1] << 8);
+            in += 2;
+            size_t length = read_length(token & 0x0F);
+            if (length == SIZE_MAX) return false;
+            length += MIN_MATCH;
+            if (offset == 0 || offset > written || length > raw_size - written) return false;
+            // overlapping copies repeat the pattern, so byte by byte
+            const char* ref = dst + written - offset;
+            for (size_t k = 0; k < length; ++k) dst[written + k] = ref[k];
+            written += length;
+        }
+        return written == raw_size;
+    }
+}// namespace noterm::lz4
@@ -0,0 +1,18 @@
+#ifndef NOTERM_LZ4_BLOCK_HPP
+#define NOTERM_LZ4_BLOCK_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace noterm::lz4 {
+    // Greedy single-pass compressor producing the LZ4 block format (no frame header, no checksum),
+    // so blocks stay readable by the reference decoder. Tuned for terminal text: long repeated
+    // prompts, SGR runs and indentation compress 3-6x; the speed matters more than the last percent.
+    // Appends to out and returns the compressed size.
+    size_t compress(const char* src, size_t size, std::string& out);
+
+    // Decodes exactly raw_size bytes into dst. False on malformed input; dst is then unspecified.
+    bool decompress(const char* src, size_t size, char* dst, size_t raw_size);
+}// namespace noterm::lz4
+
+#endif
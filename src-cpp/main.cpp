@@ -1,19 +1,23 @@
 #include <webui.hpp>
 
 #include <cstring>
-#include <iostream>
 #include <string>
 
 #include "lib.hpp"
+#include "log.hpp"
 
 int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--serve=", 8) == 0) return serve_main(webui_context(false, argc, argv));
+    }
+
     webui::window window;
 
     bool is_dev = false;
     int err = 0;
     webui_main(window, webui_context(is_dev, argc, argv), &err);
     if (err != 0) {
-        std::cout << "Failed to initialize WebUI context." << std::endl;
+        NOTERM_LOG_ERROR("Failed to initialize WebUI context.");
         return err;
     }
 
@@ -22,15 +26,15 @@ int main(int argc, char** argv) {
             int node_port = std::stoi(argv[2]);
             int webui_port = std::stoi(argv[3]);
 
-            std::cout << "Running in development mode" << std::endl;
-            std::cout << "Node.js port: " << node_port << std::endl;
-            std::cout << "WebUI port: " << webui_port << std::endl;
+            NOTERM_LOG_INFO("Running in development mode");
+            NOTERM_LOG_INFO("Node.js port: %d", node_port);
+            NOTERM_LOG_INFO("WebUI port: %d", webui_port);
 
             if (!window.set_port(webui_port)) {
-                std::cout << "Failed to set WebUI port" << std::endl;
+                NOTERM_LOG_ERROR("Failed to set WebUI port");
             }
             if (!window.show_wv("http://localhost:" + std::to_string(node_port) + "/")) {
-                std::cout << "Failed to start WebUI server" << std::endl;
+                NOTERM_LOG_ERROR("Failed to start WebUI server");
             }
             is_dev = true;
         } else {
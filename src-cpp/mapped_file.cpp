@@ -0,0 +1,92 @@
+#include "mapped_file.hpp"
+
+#include "log.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace noterm {
+#ifdef _WIN32
+    bool MappedFile::open(size_t size) {
+        close();
+        char dir[MAX_PATH];
+        char path[MAX_PATH];
+        if (!GetTempPathA(MAX_PATH, dir) || !GetTempFileNameA(dir, "ntm", 0, path)) return false;
+
+        m_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                             FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) {
+            m_file = nullptr;
+            NOTERM_LOG_ERROR("Failed to create spill file.");
+            return false;
+        }
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(size) >> 32),
+                                       static_cast<DWORD>(size), nullptr);
+        if (m_mapping) m_data = static_cast<char*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+        if (!m_data) {
+            NOTERM_LOG_ERROR("Failed to map spill file.");
+            close();
+            return false;
+        }
+        m_size = size;
+        return true;
+    }
+
+    void MappedFile::close() {
+        if (m_data) UnmapViewOfFile(m_data);
+        if (m_mapping) CloseHandle(m_mapping);
+        if (m_file) CloseHandle(m_file);
+        m_data = nullptr;
+        m_mapping = nullptr;
+        m_file = nullptr;
+        m_size = 0;
+    }
+#else
+    bool MappedFile::open(size_t size) {
+        close();
+        const char* dir = std::getenv("TMPDIR");
+        std::string path = dir && *dir ? dir : "/tmp";
+        path += "/noterm-spill-XXXXXX";
+
+        m_fd = mkstemp(path.data());
+        if (m_fd < 0) {
+            NOTERM_LOG_ERROR("Failed to create spill file: %s", std::strerror(errno));
+            return false;
+        }
+        unlink(path.c_str());
+        // sparse: blocks only take disk space once written
+        if (ftruncate(m_fd, static_cast<off_t>(size)) != 0) {
+            NOTERM_LOG_ERROR("Failed to size spill file: %s", std::strerror(errno));
+            close();
+            return false;
+        }
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (data == MAP_FAILED) {
+            NOTERM_LOG_ERROR("Failed to map spill file: %s", std::strerror(errno));
+            close();
+            return false;
+        }
+        m_data = static_cast<char*>(data);
+        m_size = size;
+        return true;
+    }
+
+    void MappedFile::close() {
+        if (m_data) munmap(m_data, m_size);
+        if (m_fd >= 0) ::close(m_fd);
+        m_data = nullptr;
+        m_fd = -1;
+        m_size = 0;
+    }
+#endif
+}// namespace noterm
@@ -0,0 +1,36 @@
+#ifndef NOTERM_MAPPED_FILE_HPP
+#define NOTERM_MAPPED_FILE_HPP
+
+#include <cstddef>
+
+namespace noterm {
+    // A temporary file mapped read-write into memory. It never has a visible name for long: it is
+    // unlinked right after creation (deleted on close on Windows), so nothing is left behind.
+    // Pages are written back by the OS under memory pressure, which is the point of spilling.
+    class MappedFile {
+    public:
+        MappedFile() = default;
+        ~MappedFile() { close(); }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool open(size_t size);
+        void close();
+
+        bool is_open() const { return m_data != nullptr; }
+        char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        char* m_data = nullptr;
+        size_t m_size = 0;
+#ifdef _WIN32
+        void* m_file = nullptr;
+        void* m_mapping = nullptr;
+#else
+        int m_fd = -1;
+#endif
+    };
+}// namespace noterm
+
+#endif
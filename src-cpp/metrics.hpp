@@ -0,0 +1,74 @@
+#ifndef NOTERM_METRICS_HPP
+#define NOTERM_METRICS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace noterm {
+    // point-in-time copy of a Histogram
+    struct HistogramSnapshot {
+        static constexpr int BUCKETS = 16;
+
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        // bucket 0 counts values below 4, bucket i > 0 values in [4^i, 4^(i+1)), the last one everything above
+        uint64_t buckets[BUCKETS] = {};
+
+        uint64_t mean() const { return count ? sum / count : 0; }
+
+        // upper bound of the bucket holding the q-th quantile, capped at the largest value seen
+        uint64_t quantile(double q) const {
+            if (count == 0) return 0;
+            uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count - 1));
+            uint64_t seen = 0;
+            for (int i = 0; i < BUCKETS; ++i) {
+                seen += buckets[i];
+                if (seen > rank) {
+                    uint64_t bound = i + 1 < BUCKETS ? (uint64_t{4} << (2 * i)) - 1 : max;
+                    return bound < max ? bound : max;
+                }
+            }
+            return max;
+        }
+    };
+
+    // Unit-agnostic log4-bucketed distribution. Recording is a handful of relaxed atomic adds, cheap
+    // enough to stay on in the hot path; any thread may record while another one takes a snapshot.
+    class Histogram {
+    public:
+        void record(uint64_t value) {
+            int bucket = 0;
+            for (uint64_t v = value >> 2; v != 0 && bucket + 1 < HistogramSnapshot::BUCKETS; v >>= 2) ++bucket;
+            m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            m_count.fetch_add(1, std::memory_order_relaxed);
+            m_sum.fetch_add(value, std::memory_order_relaxed);
+            uint64_t max = m_max.load(std::memory_order_relaxed);
+            while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+        }
+
+        HistogramSnapshot snapshot() const {
+            HistogramSnapshot out;
+            out.count = m_count.load(std::memory_order_relaxed);
+            out.sum = m_sum.load(std::memory_order_relaxed);
+            out.max = m_max.load(std::memory_order_relaxed);
+            for (int i = 0; i < HistogramSnapshot::BUCKETS; ++i) out.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+            return out;
+        }
+
+    private:
+        std::atomic<uint64_t> m_count{0};
+        std::atomic<uint64_t> m_sum{0};
+        std::atomic<uint64_t> m_max{0};
+        std::atomic<uint64_t> m_buckets[HistogramSnapshot::BUCKETS] = {};
+    };
+
+    // running maximum of a gauge such as a queue depth
+    inline void update_peak(std::atomic<uint64_t>& peak, uint64_t value) {
+        uint64_t current = peak.load(std::memory_order_relaxed);
+        while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+}// namespace noterm
+
+#endif
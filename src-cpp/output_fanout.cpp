@@ -0,0 +1,309 @@
+#include "output_fanout.hpp"
+
+#include "frame.hpp"
+#include <algorithm>
+
+namespace noterm {
+    namespace {
+        // calls f(id, offset, length) for every complete record of frame
+        template<typename F>
+        void for_each_record(const char* frame, size_t size, F&& f) {
+            for (size_t off = 0; off + FRAME_HEADER_SIZE <= size;) {
+                int id = static_cast<int>(read_u32_le(frame + off));
+                size_t length = read_u32_le(frame + off + 4);
+                if (length > size - off - FRAME_HEADER_SIZE) break;
+                f(id, off, length);
+                off += FRAME_HEADER_SIZE + length;
+            }
+        }
+    }// namespace
+
+    void OutputFanout::publish(const char* frame, size_t size) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for_each_record(frame, size, [&](int id, size_t off, size_t length) {
+            SessionState& state = m_sessions[id];
+            state.sent += length;
+            if (state.viewers == 0) keep_unclaimed(id, state, frame + off, FRAME_HEADER_SIZE + length);
+        });
+
+        uint64_t seq = m_next_seq++;
+        bool behind = false;
+        for (auto& [key, subscriber]: m_subscribers) {
+            // one with a backlog gets this frame after it, from the backlog
+            if (subscriber.cursor == seq && deliver(subscriber, seq, frame, size)) ++subscriber.cursor;
+            else behind = true;
+        }
+        if (behind) {
+            if (m_backlog.empty()) m_backlog_seq = seq;
+            m_backlog.push_back().assign(frame, size);
+            m_backlog_bytes += size;
+        }
+        trim();
+    }
+
+    void OutputFanout::subscribe(uint64_t subscriber, Deliver deliver) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Subscriber& s = m_subscribers[subscriber];
+        s.deliver = std::move(deliver);
+        s.cursor = m_next_seq;
+    }
+
+    std::vector<int> OutputFanout::unsubscribe(uint64_t subscriber) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<int> orphaned;
+        auto it = m_subscribers.find(subscriber);
+        if (it == m_subscribers.end()) return orphaned;
+        for (auto& [session, view]: it->second.views) {
+            if (drop_view(it->second, session, view)) orphaned.push_back(session);
+        }
+        m_subscribers.erase(it);
+        trim();
+        return orphaned;
+    }
+
+    bool OutputFanout::claim(uint64_t subscriber, int session) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_subscribers.find(subscriber);
+        if (it == m_subscribers.end()) return false;
+        Subscriber& s = it->second;
+        if (s.views.count(session)) return false;
+
+        SessionState& state = m_sessions[session];
+        View& view = s.views[session];
+        view.since = m_next_seq;
+        view.order = m_next_order++;
+        if (++state.viewers > 1) {
+            // nothing published so far is meant for it
+            view.base = state.sent;
+            return false;
+        }
+
+        // everything up to the kept records has been acknowledged already
+        view.base = state.acked;
+        if (!state.unclaimed.empty()) {
+            view.in_flight += state.unclaimed_bytes;
+            s.in_flight += state.unclaimed_bytes;
+            s.deliver(state.unclaimed.data(), state.unclaimed.size());
+            state.unclaimed = std::string();
+            state.unclaimed_bytes = 0;
+        }
+        if (state.repaint_on_claim) {
+            state.repaint_on_claim = false;
+            m_repaint(session);
+        }
+        return true;
+    }
+
+    bool OutputFanout::release(uint64_t subscriber, int session) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_subscribers.find(subscriber);
+        if (it == m_subscribers.end()) return false;
+        auto view = it->second.views.find(session);
+        if (view == it->second.views.end()) return false;
+        bool orphaned = drop_view(it->second, session, view->second);
+        it->second.views.erase(view);
+        trim();
+        return orphaned;
+    }
+
+    void OutputFanout::forget(int session) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& [key, subscriber]: m_subscribers) {
+            auto view = subscriber.views.find(session);
+            if (view == subscriber.views.end()) continue;
+            subscriber.in_flight -= std::min(subscriber.in_flight, view->second.in_flight);
+            subscriber.views.erase(view);
+            pump(subscriber);
+        }
+        m_sessions.erase(session);
+        trim();
+    }
+
+    void OutputFanout::acknowledge(uint64_t subscriber, int session, size_t bytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_subscribers.find(subscriber);
+        if (it == m_subscribers.end()) return;
+        Subscriber& s = it->second;
+        auto view = s.views.find(session);
+        if (view == s.views.end()) return;
+
+        size_t done = std::min(bytes, view->second.in_flight);
+        view->second.in_flight -= done;
+        s.in_flight -= std::min(s.in_flight, done);
+        view->second.acked += done;
+        sync_acknowledged(session, m_sessions[session]);
+
+        pump(s);
+        trim();
+    }
+
+    void OutputFanout::reset(uint64_t subscriber) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_subscribers.find(subscriber);
+        if (it == m_subscribers.end()) return;
+        Subscriber& s = it->second;
+        for (auto& [session, view]: s.views) {
+            view.acked += view.in_flight;
+            view.in_flight = 0;
+            sync_acknowledged(session, m_sessions[session]);
+            m_repaint(session);
+        }
+        s.in_flight = 0;
+        pump(s);
+        trim();
+    }
+
+    bool OutputFanout::shows(uint64_t subscriber, int session) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_subscribers.find(subscriber);
+        return it != m_subscribers.end() && it->second.views.count(session) > 0;
+    }
+
+    bool OutputFanout::owns(uint64_t subscriber, int session) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t first = UINT64_MAX;
+        uint64_t owner = 0;
+        for (auto& [key, s]: m_subscribers) {
+            auto view = s.views.find(session);
+            if (view != s.views.end() && view->second.order < first) {
+                first = view->second.order;
+                owner = key;
+            }
+        }
+        return first != UINT64_MAX && owner == subscriber;
+    }
+
+    bool OutputFanout::set_visible(uint64_t subscriber, int session, bool visible) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_subscribers.find(subscriber);
+        if (it != m_subscribers.end()) {
+            auto view = it->second.views.find(session);
+            if (view != it->second.views.end()) view->second.visible = visible;
+        }
+        for (auto& [key, s]: m_subscribers) {
+            auto view = s.views.find(session);
+            if (view != s.views.end() && view->second.visible) return true;
+        }
+        return false;
+    }
+
+    size_t OutputFanout::subscriber_count() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_subscribers.size();
+    }
+
+    size_t OutputFanout::backlog_bytes() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_backlog_bytes;
+    }
+
+    bool OutputFanout::deliver(Subscriber& subscriber, uint64_t seq, const char* frame, size_t size) {
+        if (subscriber.in_flight >= m_window) return false;
+
+        size_t records = 0;
+        size_t matched = 0;
+        for_each_record(frame, size, [&](int id, size_t, size_t) {
+            ++records;
+            auto view = subscriber.views.find(id);
+            if (view != subscriber.views.end() && view->second.since <= seq) ++matched;
+        });
+        if (matched == 0) return true;
+
+        if (matched < records) m_scratch.clear();
+        for_each_record(frame, size, [&](int id, size_t off, size_t length) {
+            auto view = subscriber.views.find(id);
+            if (view == subscriber.views.end() || view->second.since > seq) return;
+            view->second.in_flight += length;
+            subscriber.in_flight += length;
+            if (matched < records) m_scratch.append(frame + off, FRAME_HEADER_SIZE + length);
+        });
+        if (matched == records) subscriber.deliver(frame, size);
+        else subscriber.deliver(m_scratch.data(), m_scratch.size());
+        return true;
+    }
+
+    void OutputFanout::pump(Subscriber& subscriber) {
+        while (subscriber.cursor < m_next_seq) {
+            const std::string& frame = m_backlog[subscriber.cursor - m_backlog_seq];
+            if (!deliver(subscriber, subscriber.cursor, frame.data(), frame.size())) return;
+            ++subscriber.cursor;
+        }
+        // caught up: what it skipped is brought back with a repaint, which every viewer gets
+        for (int session: subscriber.stale) {
+            if (subscriber.views.count(session)) m_repaint(session);
+        }
+        subscriber.stale.clear();
+    }
+
+    void OutputFanout::trim() {
+        uint64_t oldest = m_next_seq;
+        for (auto& [key, subscriber]: m_subscribers) oldest = std::min(oldest, subscriber.cursor);
+        while (!m_backlog.empty() && m_backlog_seq < oldest) {
+            m_backlog_bytes -= m_backlog.front().size();
+            m_backlog.pop_front();
+            ++m_backlog_seq;
+        }
+
+        while (m_backlog_bytes > m_backlog_limit && !m_backlog.empty()) {
+            // whoever still waits for the oldest frame skips it
+            const std::string& frame = m_backlog.front();
+            for (auto& [key, subscriber]: m_subscribers) {
+                if (subscriber.cursor != m_backlog_seq) continue;
+                for_each_record(frame.data(), frame.size(), [&](int id, size_t, size_t length) {
+                    auto view = subscriber.views.find(id);
+                    if (view == subscriber.views.end() || view->second.since > m_backlog_seq) return;
+                    view->second.skipped += length;
+                    if (std::find(subscriber.stale.begin(), subscriber.stale.end(), id) == subscriber.stale.end()) {
+                        subscriber.stale.push_back(id);
+                    }
+                    sync_acknowledged(id, m_sessions[id]);
+                });
+                ++subscriber.cursor;
+            }
+            m_backlog_bytes -= frame.size();
+            m_backlog.pop_front();
+            ++m_backlog_seq;
+        }
+        if (m_backlog.empty()) m_backlog_seq = m_next_seq;
+    }
+
+    void OutputFanout::keep_unclaimed(int session, SessionState& state, const char* record, size_t length) {
+        size_t payload = length - FRAME_HEADER_SIZE;
+        if (state.unclaimed.size() + length <= UNCLAIMED_LIMIT) {
+            state.unclaimed.append(record, length);
+            state.unclaimed_bytes += payload;
+            return;
+        }
+        // too much for a tab that never showed up: let the PTY go on, its first viewer is repainted
+        state.unclaimed = std::string();
+        state.unclaimed_bytes = 0;
+        state.repaint_on_claim = true;
+        if (state.sent > state.acked) m_acknowledge(session, static_cast<size_t>(state.sent - state.acked));
+        state.acked = state.sent;
+    }
+
+    void OutputFanout::sync_acknowledged(int session, SessionState& state) {
+        uint64_t fastest = state.acked;
+        for (auto& [key, subscriber]: m_subscribers) {
+            auto view = subscriber.views.find(session);
+            if (view != subscriber.views.end()) fastest = std::max(fastest, view->second.position());
+        }
+        fastest = std::min(fastest, state.sent);
+        if (fastest > state.acked) {
+            m_acknowledge(session, static_cast<size_t>(fastest - state.acked));
+            state.acked = fastest;
+        }
+    }
+
+    bool OutputFanout::drop_view(Subscriber& subscriber, int session, View& view) {
+        subscriber.in_flight -= std::min(subscriber.in_flight, view.in_flight);
+        auto it = m_sessions.find(session);
+        if (it == m_sessions.end()) return false;
+        SessionState& state = it->second;
+        if (--state.viewers > 0) return false;
+        // nobody will acknowledge what is still in flight; the PTY must not stall on it
+        if (state.sent > state.acked) m_acknowledge(session, static_cast<size_t>(state.sent - state.acked));
+        state.acked = state.sent;
+        return true;
+    }
+}// namespace noterm
@@ -0,0 +1,158 @@
+#ifndef NOTERM_OUTPUT_FANOUT_HPP
+#define NOTERM_OUTPUT_FANOUT_HPP
+
+#include "slot_queue.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace noterm {
+    // Hands the multiplexed output frames of PTYManager to several subscribers, e.g. frontend
+    // windows mirroring the same sessions. Each subscriber claims the sessions it shows and gets
+    // their records in order.
+    //
+    // Frames are encoded once. A subscriber that keeps up is handed the frame as published, or
+    // only its records gathered into a scratch buffer. A frame some subscriber cannot take yet
+    // is copied once into a shared backlog that every lagging subscriber reads from at its own
+    // cursor. A subscriber only gets records while fewer than `window` of its bytes are
+    // unacknowledged, so a slow one only delays itself. If the backlog grows past its limit, the
+    // subscribers holding it skip ahead and their sessions are repainted.
+    //
+    // A session's flow control follows its fastest viewer: the sink acknowledges bytes to the
+    // PTY once the first subscriber has acknowledged them. Records of a session nobody claimed
+    // yet, e.g. the prompt of a tab whose id is still on its way to the frontend, are kept for
+    // its first viewer.
+    class OutputFanout {
+    public:
+        // hands a frame of [id][len][payload] records to one subscriber; called with the fanout locked, must not block
+        using Deliver = std::function<void(const char* frame, size_t size)>;
+        // bytes of a session that reached a frontend; PTYManager::acknowledge
+        using Acknowledge = std::function<void(int session, size_t bytes)>;
+        // a session needs a full repaint; PTYManager::repaint
+        using Repaint = std::function<void(int session)>;
+
+        OutputFanout(Acknowledge acknowledge, Repaint repaint)
+            : m_acknowledge(std::move(acknowledge)), m_repaint(std::move(repaint)) {}
+        OutputFanout(const OutputFanout&) = delete;
+        OutputFanout& operator=(const OutputFanout&) = delete;
+
+        // unacknowledged bytes per subscriber, and the shared backlog limit
+        void set_limits(size_t window, size_t backlog) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_window = window;
+            m_backlog_limit = backlog;
+        }
+
+        // the output sink
+        void publish(const char* frame, size_t size);
+
+        void subscribe(uint64_t subscriber, Deliver deliver);
+        // returns the sessions nobody shows any more
+        std::vector<int> unsubscribe(uint64_t subscriber);
+
+        // The subscriber shows the session from now on and is handed the records kept for it.
+        // Returns true for its first viewer; anyone else joins mid-stream and needs a repaint.
+        bool claim(uint64_t subscriber, int session);
+        // the subscriber no longer shows the session; true if nobody does
+        bool release(uint64_t subscriber, int session);
+        // drops what is kept about a closed session
+        void forget(int session);
+
+        // bytes of the session's records the subscriber has written
+        void acknowledge(uint64_t subscriber, int session, size_t bytes);
+        // What was handed to the subscriber and not acknowledged is lost, e.g. with its transport.
+        // It counts as acknowledged, and every session it shows is repainted.
+        void reset(uint64_t subscriber);
+
+        // the subscriber has claimed the session and not released it
+        bool shows(uint64_t subscriber, int session);
+        // the first viewer still showing a session owns it, and decides e.g. its size
+        bool owns(uint64_t subscriber, int session);
+        // Returns true if any of the session's viewers shows it on screen, as opposed to in a
+        // hidden tab.
+        bool set_visible(uint64_t subscriber, int session, bool visible);
+
+        size_t subscriber_count();
+        size_t backlog_bytes();
+
+    private:
+        // one subscriber's view of a session: its position in the session's byte stream is
+        // base + acked + skipped, the largest over all views is acknowledged to the sink
+        struct View {
+            uint64_t base = 0;
+            uint64_t acked = 0;
+            uint64_t skipped = 0;
+            // delivered and not yet acknowledged
+            size_t in_flight = 0;
+            // only frames from this sequence number on carry records for it
+            uint64_t since = 0;
+            // claim order; the earliest view of a session is its owner
+            uint64_t order = 0;
+            bool visible = true;
+            uint64_t position() const { return base + acked + skipped; }
+        };
+
+        struct Subscriber {
+            Deliver deliver;
+            std::unordered_map<int, View> views;
+            // sequence number of the next frame to hand over
+            uint64_t cursor = 0;
+            // over all views
+            size_t in_flight = 0;
+            // sessions whose records were skipped, repainted once the subscriber has caught up
+            std::vector<int> stale;
+        };
+
+        struct SessionState {
+            // record bytes published so far, and the part of it acknowledged to the sink
+            uint64_t sent = 0;
+            uint64_t acked = 0;
+            int viewers = 0;
+            // records published while nobody showed the session, as one ready frame, and their payload bytes
+            std::string unclaimed;
+            size_t unclaimed_bytes = 0;
+            // unclaimed records were dropped; the first viewer gets a repaint instead
+            bool repaint_on_claim = false;
+        };
+
+        // hands the subscriber the records of frame `seq` it shows; false if its window is full
+        bool deliver(Subscriber& subscriber, uint64_t seq, const char* frame, size_t size);
+        // hands the subscriber what the backlog holds for it, as far as its window allows
+        void pump(Subscriber& subscriber);
+        // drops the frames every subscriber is past, then skips laggards until it fits the limit
+        void trim();
+        void keep_unclaimed(int session, SessionState& state, const char* record, size_t length);
+        // acknowledges to the sink what the session's fastest view has reached
+        void sync_acknowledged(int session, SessionState& state);
+        // caller erases the view; true if the session has no viewers left
+        bool drop_view(Subscriber& subscriber, int session, View& view);
+
+        Acknowledge m_acknowledge;
+        Repaint m_repaint;
+
+        std::mutex m_mutex;
+        std::unordered_map<uint64_t, Subscriber> m_subscribers;
+        std::unordered_map<int, SessionState> m_sessions;
+        uint64_t m_next_order = 0;
+
+        // frames some subscriber has not been handed yet; front() has sequence number m_backlog_seq.
+        // Popped frames keep their buffers for the next lag, up to the backlog's high-water mark.
+        SlotQueue<std::string> m_backlog;
+        uint64_t m_backlog_seq = 0;
+        size_t m_backlog_bytes = 0;
+        uint64_t m_next_seq = 0;
+        std::string m_scratch;
+
+        size_t m_window = 1024 * 1024;
+        size_t m_backlog_limit = 8 * 1024 * 1024;
+        // kept per unclaimed session; whatever is over is acknowledged right away and repainted
+        static constexpr size_t UNCLAIMED_LIMIT = 256 * 1024;
+    };
+}// namespace noterm
+
+#endif
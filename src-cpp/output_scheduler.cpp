@@ -0,0 +1,89 @@
+#include "output_scheduler.hpp"
+
+#include "trace.hpp"
+#include <algorithm>
+
+namespace noterm {
+    void OutputScheduler::start(Flush flush) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_running) return;
+        m_flush = std::move(flush);
+        m_running = true;
+        m_dirty.reserve(64);
+        m_foreground.reserve(16);
+        m_round.reserve(64);
+        m_thread = std::thread([this]() { run(); });
+    }
+
+    void OutputScheduler::stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_running) return;
+            m_running = false;
+        }
+        m_cv.notify_all();
+        if (m_thread.joinable()) m_thread.join();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_dirty.clear();
+        m_foreground.clear();
+        m_round.clear();
+    }
+
+    void OutputScheduler::mark_dirty(int id, bool foreground) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::vector<int>& ids = foreground ? m_foreground : m_dirty;
+            if (std::find(ids.begin(), ids.end(), id) != ids.end()) return;
+            ids.push_back(id);
+            // a background id joining others only has to wait for the round they wait for
+            if (!foreground && ids.size() > 1) return;
+        }
+        m_cv.notify_one();
+    }
+
+    void OutputScheduler::run() {
+        trace::set_thread_name("scheduler");
+        // swapped with m_foreground on every foreground flush, as m_round is with m_dirty, so
+        // none of the vectors reallocates in steady state
+        std::vector<int> batch;
+        batch.reserve(16);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_running) {
+            auto now = std::chrono::steady_clock::now();
+            auto foreground_due = m_last_foreground + FOREGROUND_GAP;
+            if (!m_foreground.empty() && now >= foreground_due) {
+                batch.swap(m_foreground);
+                m_last_foreground = now;
+                lock.unlock();
+                m_flush(batch, true);
+                batch.clear();
+                lock.lock();
+                continue;
+            }
+
+            // rate limit: a new round starts a frame after the last one, collecting dirty ids meanwhile
+            auto round_due = m_last_flush + m_interval;
+            if (m_round.empty() && !m_dirty.empty() && now >= round_due) {
+                m_round.swap(m_dirty);
+                m_last_flush = now;
+            }
+            if (!m_round.empty()) {
+                lock.unlock();
+                size_t served = std::min(m_flush(m_round, false), m_round.size());
+                m_round.erase(m_round.begin(), m_round.begin() + static_cast<std::ptrdiff_t>(served));
+                lock.lock();
+                continue;
+            }
+
+            if (m_foreground.empty() && m_dirty.empty()) {
+                m_cv.wait(lock);
+            } else if (m_foreground.empty()) {
+                m_cv.wait_until(lock, round_due);
+            } else {
+                m_cv.wait_until(lock, m_dirty.empty() ? foreground_due : std::min(foreground_due, round_due));
+            }
+        }
+    }
+}// namespace noterm
@@ -0,0 +1,63 @@
+#ifndef NOTERM_OUTPUT_SCHEDULER_HPP
+#define NOTERM_OUTPUT_SCHEDULER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace noterm {
+    // Coalesces "output available" signals and flushes dirty sessions in two classes. Foreground
+    // sessions, the ones being typed into, are flushed as soon as their output arrives, at most
+    // once per FOREGROUND_GAP and ahead of everything else. Background sessions are flushed in
+    // rounds, at most one per frame interval: the first signal after an idle interval starts one
+    // at once, bursts are batched on the trailing edge. A round is handed to the flush in slices,
+    // each served as far as the flush's budget goes, with foreground work run in between, so
+    // output flooding other sessions holds an echo up by one slice at most.
+    class OutputScheduler {
+    public:
+        // Runs on the scheduler thread with the ids to flush and returns how many of them, from
+        // the front, it is done with. A background round goes on with the rest in another call.
+        using Flush = std::function<size_t(const std::vector<int>& ids, bool foreground)>;
+
+        static constexpr std::chrono::microseconds FOREGROUND_GAP{1000};
+
+        OutputScheduler() = default;
+        ~OutputScheduler() { stop(); }
+        OutputScheduler(const OutputScheduler&) = delete;
+        OutputScheduler& operator=(const OutputScheduler&) = delete;
+
+        void start(Flush flush);
+        void stop();
+
+        void set_frame_interval(std::chrono::microseconds interval) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_interval = interval;
+        }
+
+        // safe from any thread; duplicate ids are merged until the next flush of their class
+        void mark_dirty(int id, bool foreground = false);
+
+    private:
+        void run();
+
+        Flush m_flush;
+        std::chrono::microseconds m_interval{8000};
+        std::chrono::steady_clock::time_point m_last_flush{};
+        std::chrono::steady_clock::time_point m_last_foreground{};
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::vector<int> m_dirty;
+        std::vector<int> m_foreground;
+        // what is left of the current background round; scheduler thread only
+        std::vector<int> m_round;
+        bool m_running = false;
+        std::thread m_thread;
+    };
+}// namespace noterm
+
+#endif
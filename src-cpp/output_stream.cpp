@@ -0,0 +1,323 @@
+#include "output_stream.hpp"
+
+#include "log.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace noterm {
+    namespace {
+#ifdef _WIN32
+        using native_socket = SOCKET;
+        using pollfd_t = WSAPOLLFD;
+        int poll_sockets(pollfd_t* fds, size_t count, int timeout) { return WSAPoll(fds, static_cast<ULONG>(count), timeout); }
+        bool would_block() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+        const char* socket_error() {
+            static thread_local char text[32];
+            std::snprintf(text, sizeof(text), "error %d", WSAGetLastError());
+            return text;
+        }
+        void set_nonblocking(native_socket s) {
+            u_long on = 1;
+            ioctlsocket(s, FIONBIO, &on);
+        }
+        constexpr int SEND_FLAGS = 0;
+#else
+        using native_socket = int;
+        using pollfd_t = pollfd;
+        int poll_sockets(pollfd_t* fds, size_t count, int timeout) { return ::poll(fds, static_cast<nfds_t>(count), timeout); }
+        bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+        const char* socket_error() { return std::strerror(errno); }
+        void set_nonblocking(native_socket s) { fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK); }
+#ifdef MSG_NOSIGNAL
+        constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+        constexpr int SEND_FLAGS = 0;
+#endif
+#endif
+
+        native_socket native(intptr_t s) { return static_cast<native_socket>(s); }
+
+        // bytes written, 0 if the socket is full, -1 if the connection failed
+        long send_some(intptr_t s, const char* data, size_t size) {
+            long n = static_cast<long>(::send(native(s), data, static_cast<int>(size), SEND_FLAGS));
+            if (n >= 0) return n;
+            return would_block() ? 0 : -1;
+        }
+
+        // a request line longer than this is not one of ours
+        constexpr size_t MAX_REQUEST = 4096;
+
+        const char RESPONSE_HEADER[] = "HTTP/1.1 200 OK\r\n"
+                                       "Content-Type: application/octet-stream\r\n"
+                                       "Cache-Control: no-store\r\n"
+                                       // the page is served by WebUI from another port
+                                       "Access-Control-Allow-Origin: *\r\n"
+                                       "Connection: close\r\n\r\n";
+        const char NOT_FOUND[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nAccess-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n";
+    }// namespace
+
+    bool OutputStreamServer::start() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_running) return true;
+#ifdef _WIN32
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        socklen_t length = sizeof(address);
+
+        native_socket listener = ::socket(AF_INET, SOCK_STREAM, 0);
+        native_socket waker = ::socket(AF_INET, SOCK_DGRAM, 0);
+        m_listener = static_cast<Socket>(listener);
+        m_waker = static_cast<Socket>(waker);
+        sockaddr_in waker_address = address;
+        bool ok = m_listener != NO_SOCKET && m_waker != NO_SOCKET &&
+                  ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 && ::listen(listener, 8) == 0 &&
+                  ::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) == 0 &&
+                  ::bind(waker, reinterpret_cast<sockaddr*>(&waker_address), sizeof(waker_address)) == 0 &&
+                  ::getsockname(waker, reinterpret_cast<sockaddr*>(&waker_address), &length) == 0 &&
+                  ::connect(waker, reinterpret_cast<sockaddr*>(&waker_address), sizeof(waker_address)) == 0;
+        if (!ok) {
+            NOTERM_LOG_ERROR("Failed to start the output stream server: %s", socket_error());
+            close_socket(m_listener);
+            close_socket(m_waker);
+            m_listener = NO_SOCKET;
+            m_waker = NO_SOCKET;
+            return false;
+        }
+        set_nonblocking(listener);
+        set_nonblocking(waker);
+        m_port = ntohs(address.sin_port);
+        m_running = true;
+        m_thread = std::thread([this]() { run(); });
+        NOTERM_LOG_INFO("Output streams served on 127.0.0.1:%u", static_cast<unsigned>(m_port));
+        return true;
+    }
+
+    void OutputStreamServer::stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_running) return;
+            m_running = false;
+        }
+        wake();
+        m_thread.join();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& [key, stream]: m_streams) close_socket(stream.socket);
+        for (Connection& connection: m_connections) close_socket(connection.socket);
+        m_streams.clear();
+        m_connections.clear();
+        close_socket(m_listener);
+        close_socket(m_waker);
+        m_listener = NO_SOCKET;
+        m_waker = NO_SOCKET;
+    }
+
+    std::string OutputStreamServer::open(uint64_t subscriber) {
+        std::random_device random;
+        char token[33];
+        std::snprintf(token, sizeof(token), "%08x%08x%08x%08x", random(), random(), random(), random());
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Stream& stream = m_streams[subscriber];
+        close_socket(stream.socket);
+        stream = Stream();
+        stream.token = token;
+        return "http://127.0.0.1:" + std::to_string(m_port) + "/output/" + token;
+    }
+
+    bool OutputStreamServer::send(uint64_t subscriber, const char* frame, size_t size) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_streams.find(subscriber);
+        if (it == m_streams.end()) return false;
+        Stream& stream = it->second;
+        if (stream.socket == NO_SOCKET || stream.broken || !stream.queued.empty()) {
+            stream.queued.append(frame, size);
+            return true;
+        }
+        long n = send_some(stream.socket, frame, size);
+        if (n < 0) {
+            stream.broken = true;
+            n = 0;
+        }
+        if (static_cast<size_t>(n) < size) {
+            stream.queued.append(frame + n, size - static_cast<size_t>(n));
+            // the server thread waits for the socket to drain
+            wake();
+        }
+        return true;
+    }
+
+    bool OutputStreamServer::close(uint64_t subscriber, const Deliver& rest) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_streams.find(subscriber);
+        if (it == m_streams.end()) return false;
+        Stream& stream = it->second;
+        // only whole frames are queued until the response starts
+        bool under_way = stream.socket != NO_SOCKET;
+        if (!under_way && !stream.queued.empty() && rest) rest(stream.queued.data(), stream.queued.size());
+        close_socket(stream.socket);
+        m_streams.erase(it);
+        return under_way;
+    }
+
+    size_t OutputStreamServer::queued_bytes(uint64_t subscriber) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_streams.find(subscriber);
+        return it == m_streams.end() ? 0 : it->second.queued.size();
+    }
+
+    bool OutputStreamServer::connected(uint64_t subscriber) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_streams.find(subscriber);
+        return it != m_streams.end() && it->second.socket != NO_SOCKET && !it->second.broken;
+    }
+
+    void OutputStreamServer::run() {
+        std::vector<pollfd_t> fds;
+        // what each entry of fds after the first two belongs to: a connection index, or a stream key
+        std::vector<std::pair<bool, uint64_t>> owners;
+        char buffer[4096];
+        while (true) {
+            fds.clear();
+            owners.clear();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_running) break;
+                fds.push_back({native(m_listener), POLLIN, 0});
+                fds.push_back({native(m_waker), POLLIN, 0});
+                for (size_t i = 0; i < m_connections.size(); ++i) {
+                    fds.push_back({native(m_connections[i].socket), POLLIN, 0});
+                    owners.emplace_back(true, i);
+                }
+                for (auto& [key, stream]: m_streams) {
+                    if (stream.socket == NO_SOCKET || stream.broken) continue;
+                    // readable only when the frontend hung up
+                    short events = POLLIN;
+                    if (!stream.queued.empty()) events |= POLLOUT;
+                    fds.push_back({native(stream.socket), events, 0});
+                    owners.emplace_back(false, key);
+                }
+            }
+
+            if (poll_sockets(fds.data(), fds.size(), -1) < 0) continue;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (fds[1].revents & POLLIN) {
+                while (::recv(native(m_waker), buffer, sizeof(buffer), 0) > 0) {}
+            }
+
+            std::vector<size_t> finished;
+            for (size_t i = 2; i < fds.size(); ++i) {
+                short revents = fds[i].revents;
+                if (!revents) continue;
+                auto [is_connection, key] = owners[i - 2];
+                if (is_connection) {
+                    Connection& connection = m_connections[key];
+                    long n = static_cast<long>(::recv(native(connection.socket), buffer, sizeof(buffer), 0));
+                    if (n > 0) connection.request.append(buffer, static_cast<size_t>(n));
+                    bool complete = connection.request.find("\r\n\r\n") != std::string::npos;
+                    if (n == 0 || (n < 0 && !would_block()) || complete || connection.request.size() > MAX_REQUEST) {
+                        if (complete) accept_request(connection);
+                        else close_socket(connection.socket);
+                        finished.push_back(key);
+                    }
+                    continue;
+                }
+
+                auto it = m_streams.find(key);
+                // closed or reopened meanwhile
+                if (it == m_streams.end() || native(it->second.socket) != fds[i].fd) continue;
+                Stream& stream = it->second;
+                bool failed = (revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+                if (revents & POLLIN) failed = failed || ::recv(native(stream.socket), buffer, sizeof(buffer), 0) <= 0;
+                if (!failed && (revents & POLLOUT)) failed = !flush(stream);
+                if (failed) {
+                    NOTERM_LOG_WARN("Output stream of client %llu closed by the frontend", static_cast<unsigned long long>(key));
+                    stream.broken = true;
+                }
+            }
+            for (auto it = finished.rbegin(); it != finished.rend(); ++it) m_connections.erase(m_connections.begin() + static_cast<long>(*it));
+
+            if (fds[0].revents & POLLIN) {
+                while (true) {
+                    native_socket accepted = ::accept(native(m_listener), nullptr, nullptr);
+                    if (static_cast<Socket>(accepted) == NO_SOCKET) break;
+                    set_nonblocking(accepted);
+                    // frames are written whole; small ones should not wait for the next
+                    int on = 1;
+                    ::setsockopt(accepted, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+                    m_connections.push_back({static_cast<Socket>(accepted), {}});
+                }
+            }
+        }
+    }
+
+    void OutputStreamServer::wake() {
+        char byte = 0;
+        ::send(native(m_waker), &byte, 1, 0);
+    }
+
+    bool OutputStreamServer::flush(Stream& stream) {
+        size_t written = 0;
+        while (written < stream.queued.size()) {
+            long n = send_some(stream.socket, stream.queued.data() + written, stream.queued.size() - written);
+            if (n < 0) return false;
+            if (n == 0) break;
+            written += static_cast<size_t>(n);
+        }
+        stream.queued.erase(0, written);
+        return true;
+    }
+
+    void OutputStreamServer::accept_request(Connection& connection) {
+        // GET /output/<token> HTTP/1.1
+        const std::string& request = connection.request;
+        size_t path = request.find(' ');
+        size_t end = path == std::string::npos ? path : request.find(' ', path + 1);
+        std::string target = end == std::string::npos ? std::string() : request.substr(path + 1, end - path - 1);
+        const std::string prefix = "/output/";
+
+        if (request.compare(0, 4, "GET ") == 0 && target.compare(0, prefix.size(), prefix) == 0) {
+            std::string token = target.substr(prefix.size());
+            for (auto& [key, stream]: m_streams) {
+                if (stream.token != token || stream.socket != NO_SOCKET) continue;
+                stream.socket = connection.socket;
+                stream.queued.insert(0, RESPONSE_HEADER, sizeof(RESPONSE_HEADER) - 1);
+                if (!flush(stream)) stream.broken = true;
+                return;
+            }
+        }
+        send_some(connection.socket, NOT_FOUND, sizeof(NOT_FOUND) - 1);
+        close_socket(connection.socket);
+    }
+
+    void OutputStreamServer::close_socket(Socket socket) {
+        if (socket == NO_SOCKET) return;
+#ifdef _WIN32
+        closesocket(native(socket));
+#else
+        ::close(native(socket));
+#endif
+    }
+}// namespace noterm
@@ -0,0 +1,90 @@
+#ifndef NOTERM_OUTPUT_STREAM_HPP
+#define NOTERM_OUTPUT_STREAM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace noterm {
+    // Output frames over one long-lived HTTP response per client, instead of a WebUI WebSocket
+    // message per frame. The frontend fetches the URL open() returns and reads the response body
+    // as a byte stream of [id][len][payload] records. There is no per-message framing, masking
+    // or event loop hop on either side: send() writes the frame straight to a non-blocking
+    // loopback socket on the caller's thread.
+    //
+    // Whatever the socket does not take at once, or arrives before the frontend connected, is
+    // queued and written by the server thread. The queue is not bounded here; output flow control
+    // keeps it within the unacknowledged window.
+    class OutputStreamServer {
+    public:
+        using Deliver = std::function<void(const char* data, size_t size)>;
+
+        OutputStreamServer() = default;
+        OutputStreamServer(const OutputStreamServer&) = delete;
+        OutputStreamServer& operator=(const OutputStreamServer&) = delete;
+        ~OutputStreamServer() { stop(); }
+
+        // listens on a free port of 127.0.0.1; false, logged, if it cannot
+        bool start();
+        void stop();
+
+        // A stream for the subscriber, and the URL its frontend fetches to receive it. The URL
+        // carries a random token; nothing else is served.
+        std::string open(uint64_t subscriber);
+        // false if the subscriber has no stream; never blocks
+        bool send(uint64_t subscriber, const char* frame, size_t size);
+        // Ends the subscriber's stream. If the frontend never connected, the frames queued for it
+        // are handed to rest, before any other send() for it returns. Returns true if the stream
+        // was under way instead: whatever was still on its way is lost.
+        bool close(uint64_t subscriber, const Deliver& rest);
+
+        // queued for the subscriber and not written to its socket yet
+        size_t queued_bytes(uint64_t subscriber);
+        // the frontend's request arrived and the response is under way
+        bool connected(uint64_t subscriber);
+
+    private:
+        // a socket handle on either platform, -1 for none
+        using Socket = intptr_t;
+        static constexpr Socket NO_SOCKET = -1;
+
+        struct Stream {
+            std::string token;
+            Socket socket = NO_SOCKET;
+            std::string queued;
+            // the frontend went away; sends are queued until close()
+            bool broken = false;
+        };
+
+        // accepted, waiting for the request to be complete
+        struct Connection {
+            Socket socket;
+            std::string request;
+        };
+
+        void run();
+        void wake();
+        // writes the queue as far as the socket takes it; false if the connection failed
+        static bool flush(Stream& stream);
+        // the request of a connection is complete: it turns into a stream, or is turned away
+        void accept_request(Connection& connection);
+        static void close_socket(Socket socket);
+
+        std::mutex m_mutex;
+        std::unordered_map<uint64_t, Stream> m_streams;
+        std::vector<Connection> m_connections;
+        Socket m_listener = NO_SOCKET;
+        // a datagram to itself wakes the server thread from poll
+        Socket m_waker = NO_SOCKET;
+        uint16_t m_port = 0;
+        bool m_running = false;
+        std::thread m_thread;
+    };
+}// namespace noterm
+
+#endif
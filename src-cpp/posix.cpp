@@ -0,0 +1,471 @@
+#include "posix.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "input_chunking.hpp"
+#include "log.hpp"
+#include "trace.hpp"
+
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+// not declared by every libc's unistd.h
+extern char** environ;
+
+namespace noterm::detail {
+    namespace {
+        constexpr uint64_t WAKE_TOKEN = 0;
+        constexpr uint64_t TIMER_TOKEN = 1;
+        // the N_TTY input buffer size; larger writes would only be accepted partially
+        constexpr size_t WRITE_CHUNK = 4096;
+        constexpr int MAX_IOVECS = 16;
+
+        void reap_child(pid_t pid) {
+            if (pid <= 0) return;
+            // the shell normally exits on SIGHUP; give it a moment before forcing it
+            kill(pid, SIGHUP);
+            for (int i = 0; i < 20; ++i) {
+                if (waitpid(pid, nullptr, WNOHANG) != 0) return;
+                usleep(5000);
+            }
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+    }// namespace
+
+    void PseudoConsole::init(std::string_view proc_name, int cols, int rows) {
+        if (m_master_fd >= 0) {
+            // close existing pseudo console
+            close();
+        }
+
+        struct winsize ws = {};
+        ws.ws_col = static_cast<unsigned short>(cols);
+        ws.ws_row = static_cast<unsigned short>(rows);
+
+        // build the command and environment before forking; only async-signal-safe calls are allowed
+        // in the child, setenv() may allocate or wait for a lock another thread held at the fork
+        std::string command(proc_name);
+        const char* shell = std::getenv("SHELL");
+        if (!shell || !*shell) shell = "/bin/sh";
+        std::vector<char*> env;
+        for (char** var = environ; *var; ++var) {
+            if (std::strncmp(*var, "TERM=", 5) != 0) env.push_back(*var);
+        }
+        char term[] = "TERM=xterm-256color";
+        env.push_back(term);
+        env.push_back(nullptr);
+
+        pid_t pid = forkpty(&m_master_fd, nullptr, nullptr, &ws);
+        if (pid < 0) {
+            NOTERM_LOG_ERROR("forkpty failed: %s", std::strerror(errno));
+            m_master_fd = -1;
+            return;
+        }
+
+        if (pid == 0) {
+            // --serve blocks SIGINT and SIGTERM for its sigwait; the mask and dispositions survive
+            // exec, and a shell that cannot be interrupted or killed is no use
+            sigset_t none;
+            sigemptyset(&none);
+            sigprocmask(SIG_SETMASK, &none, nullptr);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            if (command.empty()) {
+                execle(shell, shell, "-l", static_cast<char*>(nullptr), env.data());
+            } else {
+                execle("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr), env.data());
+            }
+            _exit(127);
+        }
+
+        m_child = pid;
+
+        int flags = fcntl(m_master_fd, F_GETFL);
+        fcntl(m_master_fd, F_SETFL, flags | O_NONBLOCK);
+        fcntl(m_master_fd, F_SETFD, FD_CLOEXEC);
+
+        NOTERM_LOG_INFO("PseudoConsole initialized with process: %s", command.empty() ? shell : command.c_str());
+    }
+
+    void PseudoConsole::close() {
+        Reactor* reactor = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_io_mutex);
+            reactor = m_reactor;
+        }
+        if (reactor) {
+            reactor->detach(this);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_io_mutex);
+            if (m_master_fd >= 0) {
+                ::close(m_master_fd);
+                m_master_fd = -1;
+            }
+            m_pending_input.clear();
+            m_write_armed = false;
+            m_output_paused = false;
+        }
+        reap_child(m_child);
+        m_child = -1;
+    }
+
+    void PseudoConsole::write_input(const std::string_view* parts, size_t count) {
+        std::lock_guard<std::mutex> lock(m_io_mutex);
+        if (m_master_fd < 0) return;
+
+        size_t part = 0;
+        size_t offset = 0;
+        if (m_pending_input.empty()) {
+            // nothing queued ahead of us: gather the parts straight from the caller's buffers
+            while (part < count) {
+                struct iovec iov[MAX_IOVECS];
+                int n = 0;
+                size_t chunk = 0;
+                for (size_t p = part, off = offset; p < count && n < MAX_IOVECS && chunk < WRITE_CHUNK; ++p, off = 0) {
+                    const char* data = parts[p].data() + off;
+                    size_t len = input_chunk_boundary(data, parts[p].size() - off, WRITE_CHUNK - chunk);
+                    if (len == 0) break;
+                    iov[n++] = {const_cast<char*>(data), len};
+                    chunk += len;
+                    if (off + len < parts[p].size()) break;
+                }
+                if (n == 0) break;
+
+                ssize_t written = ::writev(m_master_fd, iov, n);
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN) break;
+                    return;
+                }
+                // advance (part, offset) past what the kernel accepted
+                size_t left = static_cast<size_t>(written);
+                while (part < count && left >= parts[part].size() - offset) {
+                    left -= parts[part].size() - offset;
+                    ++part;
+                    offset = 0;
+                }
+                offset += left;
+                if (static_cast<size_t>(written) < chunk) break;
+            }
+        }
+
+        if (part < count) {
+            // queued behind earlier input, or the child is not draining its input fast enough: keep
+            // the rest and let the reactor finish what this attempt cannot write
+            for (; part < count; ++part, offset = 0) {
+                m_pending_input.append(parts[part].data() + offset, parts[part].size() - offset);
+            }
+            if (!flush_pending_input()) {
+                m_pending_input.clear();
+                return;
+            }
+        }
+
+        bool want_write = !m_pending_input.empty();
+        if (want_write != m_write_armed) {
+            m_write_armed = want_write;
+            update_events();
+        }
+    }
+
+    void PseudoConsole::resume_output() {
+        std::lock_guard<std::mutex> lock(m_io_mutex);
+        if (!m_output_paused) return;
+        m_output_paused = false;
+        update_events();
+    }
+
+    bool PseudoConsole::flush_pending_input() {
+        size_t offset = 0;
+        while (offset < m_pending_input.size()) {
+            size_t len = input_chunk_boundary(m_pending_input.data() + offset, m_pending_input.size() - offset, WRITE_CHUNK);
+            ssize_t n = ::write(m_master_fd, m_pending_input.data() + offset, len);
+            if (n > 0) {
+                offset += static_cast<size_t>(n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EAGAIN) break;
+            return false;
+        }
+        m_pending_input.erase(0, offset);
+        return true;
+    }
+
+    bool PseudoConsole::pause_output() {
+        std::lock_guard<std::mutex> lock(m_io_mutex);
+        // re-check under the lock: resume_output() runs after the consumer released space
+        if (m_output_ring->write_span().second > 0) return false;
+        m_output_paused = true;
+        update_events();
+        return true;
+    }
+
+    void PseudoConsole::update_events() {
+        if (m_reactor) m_reactor->update_events(this);
+    }
+
+    bool PseudoConsole::on_readable(const ReadPolicy& policy, bool& busy) {
+        trace::Span traced("pty.read");
+        // bounded so a flooding child cannot starve the others
+        size_t asked = m_read_size.next(policy);
+        size_t budget = asked;
+        size_t total = 0;
+        bool alive = true;
+        while (budget > 0) {
+            auto span = m_output_ring->write_span();
+            if (span.second == 0) {
+                if (pause_output()) break;
+                continue;
+            }
+
+            ssize_t bytes_read = ::read(m_master_fd, span.first, std::min(span.second, budget));
+            if (bytes_read < 0) {
+                if (errno == EINTR) continue;
+                // EIO: every slave fd is closed, i.e. the child has exited
+                if (errno != EAGAIN) alive = false;
+                break;
+            }
+            if (bytes_read == 0) {
+                alive = false;
+                break;
+            }
+
+            m_output_ring->commit(static_cast<size_t>(bytes_read));
+            total += static_cast<size_t>(bytes_read);
+            budget -= static_cast<size_t>(bytes_read);
+        }
+
+        traced.bytes = total;
+        busy = m_read_size.update(policy, asked, total) && alive;
+        // one notification per wakeup rather than per read
+        if (total > 0 && m_output_handler) m_output_handler(total);
+        // level-triggered: anything left over is reported again on the next epoll_wait
+        return alive;
+    }
+
+    void PseudoConsole::on_writable() {
+        std::lock_guard<std::mutex> lock(m_io_mutex);
+        if (!flush_pending_input()) {
+            m_pending_input.clear();
+        }
+        if (m_pending_input.empty() && m_write_armed) {
+            m_write_armed = false;
+            update_events();
+        }
+    }
+
+    bool Reactor::start() {
+        if (m_running) return true;
+
+        m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (m_epoll_fd < 0 || m_wake_fd < 0 || m_timer_fd < 0) {
+            NOTERM_LOG_ERROR("Failed to create epoll reactor: %s", std::strerror(errno));
+            stop();
+            return false;
+        }
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = WAKE_TOKEN;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &ev);
+        ev.data.u64 = TIMER_TOKEN;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_timer_fd, &ev);
+
+        m_running = true;
+        m_thread = std::thread([this]() { run(); });
+        return true;
+    }
+
+    void Reactor::stop() {
+        if (m_running.exchange(false)) {
+            uint64_t one = 1;
+            ssize_t ignored = ::write(m_wake_fd, &one, sizeof(one));
+            (void) ignored;
+        }
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& kv: m_consoles) {
+                std::lock_guard<std::mutex> io_lock(kv.second->m_io_mutex);
+                kv.second->m_reactor = nullptr;
+                kv.second->m_registered = false;
+                kv.second->m_read_deferred = false;
+            }
+            m_consoles.clear();
+            m_deferred.clear();
+        }
+
+        if (m_wake_fd >= 0) {
+            ::close(m_wake_fd);
+            m_wake_fd = -1;
+        }
+        if (m_timer_fd >= 0) {
+            ::close(m_timer_fd);
+            m_timer_fd = -1;
+        }
+        if (m_epoll_fd >= 0) {
+            ::close(m_epoll_fd);
+            m_epoll_fd = -1;
+        }
+    }
+
+    void Reactor::attach(PseudoConsole* pc) {
+        if (pc->m_master_fd < 0 || !pc->m_output_ring) return;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::lock_guard<std::mutex> io_lock(pc->m_io_mutex);
+        pc->m_reactor = this;
+        pc->m_token = m_next_token++;
+        m_consoles[pc->m_token] = pc;
+        update_events(pc);
+    }
+
+    void Reactor::detach(PseudoConsole* pc) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::lock_guard<std::mutex> io_lock(pc->m_io_mutex);
+        m_consoles.erase(pc->m_token);
+        if (pc->m_registered) {
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, pc->m_master_fd, nullptr);
+            pc->m_registered = false;
+        }
+        pc->m_reactor = nullptr;
+        pc->m_token = 0;
+        // a pending batch timer entry no longer finds the token
+        pc->m_read_deferred = false;
+    }
+
+    void Reactor::update_events(PseudoConsole* pc) {
+        struct epoll_event ev = {};
+        if (!pc->m_output_paused && !pc->m_read_deferred) ev.events |= EPOLLIN;
+        if (pc->m_write_armed) ev.events |= EPOLLOUT;
+        ev.data.u64 = pc->m_token;
+
+        // a paused or deferred console is removed entirely: epoll reports EPOLLHUP regardless of the interest set
+        if (ev.events == 0) {
+            if (pc->m_registered) epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, pc->m_master_fd, nullptr);
+            pc->m_registered = false;
+        } else {
+            epoll_ctl(m_epoll_fd, pc->m_registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, pc->m_master_fd, &ev);
+            pc->m_registered = true;
+        }
+    }
+
+    void Reactor::defer_read(PseudoConsole* pc) {
+        {
+            std::lock_guard<std::mutex> io_lock(pc->m_io_mutex);
+            pc->m_read_deferred = true;
+            update_events(pc);
+        }
+        bool arm = m_deferred.empty();
+        m_deferred.push_back() = {std::chrono::steady_clock::now() + m_policy.batch_delay, pc->m_token};
+        if (arm) {
+            struct itimerspec spec = {};
+            auto delay = std::chrono::duration_cast<std::chrono::nanoseconds>(m_policy.batch_delay).count();
+            spec.it_value.tv_sec = static_cast<time_t>(delay / 1000000000);
+            spec.it_value.tv_nsec = static_cast<long>(delay % 1000000000);
+            timerfd_settime(m_timer_fd, 0, &spec, nullptr);
+        }
+    }
+
+    void Reactor::resume_deferred() {
+        auto now = std::chrono::steady_clock::now();
+        while (!m_deferred.empty() && m_deferred.front().first <= now) {
+            auto it = m_consoles.find(m_deferred.front().second);
+            m_deferred.pop_front();
+            if (it == m_consoles.end()) continue;
+            PseudoConsole* pc = it->second;
+            std::lock_guard<std::mutex> io_lock(pc->m_io_mutex);
+            pc->m_read_deferred = false;
+            update_events(pc);
+        }
+        if (m_deferred.empty()) return;
+        // level-triggered: a console with data waiting is reported by the next epoll_wait
+        struct itimerspec spec = {};
+        auto delay = std::chrono::duration_cast<std::chrono::nanoseconds>(m_deferred.front().first - now).count();
+        spec.it_value.tv_sec = static_cast<time_t>(delay / 1000000000);
+        spec.it_value.tv_nsec = static_cast<long>(delay % 1000000000);
+        timerfd_settime(m_timer_fd, 0, &spec, nullptr);
+    }
+
+    void Reactor::run() {
+        trace::set_thread_name("reactor");
+        constexpr int MAX_EVENTS = 64;
+        struct epoll_event events[MAX_EVENTS];
+
+        while (m_running) {
+            int n = epoll_wait(m_epoll_fd, events, MAX_EVENTS, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                NOTERM_LOG_ERROR("epoll_wait failed: %s", std::strerror(errno));
+                break;
+            }
+
+            for (int i = 0; i < n; ++i) {
+                uint64_t token = events[i].data.u64;
+                if (token == WAKE_TOKEN) {
+                    uint64_t value;
+                    ssize_t ignored = ::read(m_wake_fd, &value, sizeof(value));
+                    (void) ignored;
+                    continue;
+                }
+                if (token == TIMER_TOKEN) {
+                    uint64_t expirations;
+                    ssize_t ignored = ::read(m_timer_fd, &expirations, sizeof(expirations));
+                    (void) ignored;
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    resume_deferred();
+                    continue;
+                }
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_consoles.find(token);
+                if (it == m_consoles.end()) {
+                    continue;// detached while this batch was pending
+                }
+                PseudoConsole* pc = it->second;
+
+                if (events[i].events & EPOLLOUT) {
+                    pc->on_writable();
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    bool busy = false;
+                    if (!pc->on_readable(m_policy, busy)) {
+                        // child exited: stop polling the fd, the owner still closes the console
+                        m_consoles.erase(it);
+                        std::lock_guard<std::mutex> io_lock(pc->m_io_mutex);
+                        if (pc->m_registered) epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, pc->m_master_fd, nullptr);
+                        pc->m_registered = false;
+                        pc->m_reactor = nullptr;
+                    } else if (busy && m_policy.batch_delay.count() > 0) {
+                        defer_read(pc);
+                    }
+                }
+            }
+        }
+    }
+}// namespace noterm::detail
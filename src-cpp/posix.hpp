@@ -0,0 +1,163 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "read_policy.hpp"
+#include "ring_buffer.hpp"
+#include "slot_queue.hpp"
+
+namespace noterm {
+    namespace detail {
+        class Reactor;
+
+        struct PseudoConsole {
+        public:
+            // invoked on the reactor thread after new bytes were committed to the output ring
+            using OutputHandler = std::function<void(size_t bytes)>;
+
+            PseudoConsole() = default;
+            PseudoConsole(const PseudoConsole&) = delete;
+            PseudoConsole& operator=(const PseudoConsole&) = delete;
+
+            void init(std::string_view proc_name, int cols, int rows);
+
+            void close();
+
+            void set_size(int cols, int rows) {
+                if (m_master_fd < 0) return;
+                struct winsize ws = {};
+                ws.ws_col = static_cast<unsigned short>(cols);
+                ws.ws_row = static_cast<unsigned short>(rows);
+                ioctl(m_master_fd, TIOCSWINSZ, &ws);
+            }
+
+            // Writes the parts in order with as few syscalls as possible (writev, chunked so no
+            // escape or UTF-8 sequence is split). Whatever the pty does not accept right away is
+            // queued and flushed by the reactor.
+            void write_input(const std::string_view* parts, size_t count);
+
+            void write_input(std::string_view input) {
+                write_input(&input, 1);
+            }
+
+            // the reactor reads straight into this ring; must be set before attaching
+            void set_output_ring(ByteRing* ring) {
+                m_output_ring = ring;
+            }
+
+            void set_output_handler(OutputHandler handler) {
+                m_output_handler = std::move(handler);
+            }
+
+            // consumer side: the ring has room again, resume reading if it was full
+            void resume_output();
+
+            // true while reading is suspended because the ring is full
+            bool output_paused() {
+                std::lock_guard<std::mutex> lock(m_io_mutex);
+                return m_output_paused;
+            }
+
+        private:
+            friend class Reactor;
+
+            // Reactor thread: drain readable data into the ring, returns false once the child side hung
+            // up. busy is set when the pty should be polled again only after the policy's batch delay.
+            bool on_readable(const ReadPolicy& policy, bool& busy);
+            // reactor thread: retry pending input after EPOLLOUT
+            void on_writable();
+            // caller holds m_io_mutex; returns false on a hard write error
+            bool flush_pending_input();
+            // reactor thread: stop polling for input while the ring is full; false if it drained meanwhile
+            bool pause_output();
+            // caller holds m_io_mutex
+            void update_events();
+
+            // master side of the pty, opened non-blocking; the child owns the slave side
+            int m_master_fd = -1;
+            pid_t m_child = -1;
+
+            Reactor* m_reactor = nullptr;
+            uint64_t m_token = 0;
+
+            ByteRing* m_output_ring = nullptr;
+            OutputHandler m_output_handler;
+            // reactor thread only
+            AdaptiveReadSize m_read_size;
+
+            // guards the fd, pending input and the epoll interest set
+            std::mutex m_io_mutex;
+            std::string m_pending_input;
+            bool m_write_armed = false;
+            bool m_output_paused = false;
+            // not polled for input until the reactor's batch timer fires
+            bool m_read_deferred = false;
+            bool m_registered = false;
+        };
+
+        // single epoll loop multiplexing the master fds of every attached PseudoConsole
+        class Reactor {
+        public:
+            Reactor() = default;
+            ~Reactor() { stop(); }
+            Reactor(const Reactor&) = delete;
+            Reactor& operator=(const Reactor&) = delete;
+
+            bool start();
+            void stop();
+
+            void attach(PseudoConsole* pc);
+            // once detach returns the reactor thread no longer touches pc
+            void detach(PseudoConsole* pc);
+
+            void set_read_policy(const ReadPolicy& policy) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_policy = policy;
+            }
+
+        private:
+            friend struct PseudoConsole;
+
+            // registers, updates or removes pc's fd according to its paused/deferred/armed state
+            void update_events(PseudoConsole* pc);
+            // caller holds m_mutex: stop polling pc for input until the batch delay has passed
+            void defer_read(PseudoConsole* pc);
+            // caller holds m_mutex: poll the consoles whose batch delay is over again
+            void resume_deferred();
+            void run();
+
+            int m_epoll_fd = -1;
+            // eventfd used to interrupt epoll_wait on stop
+            int m_wake_fd = -1;
+            // timerfd firing when the first deferred console is due
+            int m_timer_fd = -1;
+            std::atomic_bool m_running{false};
+            std::thread m_thread;
+
+            // held while dispatching so detach can synchronise with the loop
+            std::mutex m_mutex;
+            std::unordered_map<uint64_t, PseudoConsole*> m_consoles;
+            // tokens 0 and 1 are the wake fd and the timer
+            uint64_t m_next_token = 2;
+            ReadPolicy m_policy;
+            // consoles waiting out the batch delay, by token, in deadline order
+            SlotQueue<std::pair<std::chrono::steady_clock::time_point, uint64_t>> m_deferred;
+        };
+    }// namespace detail
+
+    inline bool init_context() {
+        // writes to a pty whose child has exited must fail with EPIPE/EIO instead of killing us
+        signal(SIGPIPE, SIG_IGN);
+        return true;
+    }
+}// namespace noterm
@@ -0,0 +1,872 @@
+#include "pty_manager.hpp"
+
+#include "alloc_stats.hpp"
+#include "frame.hpp"
+#include "log.hpp"
+#include "trace.hpp"
+#include "utf8.hpp"
+#include "vt.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+
+namespace noterm {
+    namespace {
+        // takes the lock, recording how long the caller waited for it if another thread held it
+        std::unique_lock<std::mutex> lock_timed(std::mutex& mutex, Histogram& waits) {
+            std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+            if (!lock.owns_lock()) {
+                auto start = std::chrono::steady_clock::now();
+                lock.lock();
+                waits.record(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+            }
+            return lock;
+        }
+    }// namespace
+
+    void PTYManager::start() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_running) return;
+        m_running = true;
+        m_reactor.start();
+        m_scheduler.start([this](const std::vector<int>& ids, bool foreground) { return flush(ids, foreground); });
+        {
+            std::lock_guard<std::mutex> spawn_lock(m_spawn_mutex);
+            m_spawner_running = true;
+        }
+        m_spawner = std::thread([this]() { run_spawner(); });
+    }
+
+    std::shared_ptr<PTYManager::Session> PTYManager::make_session(const std::string& command, int cols, int rows) {
+        auto session = std::make_shared<Session>();
+        session->ring = std::make_unique<ByteRing>(m_output_capacity.load(std::memory_order_relaxed), FRAME_HEADER_SIZE);
+        session->screen = std::make_unique<Screen>(cols, rows);
+        session->render_mode = m_default_render_mode.load(std::memory_order_relaxed);
+        session->command = command;
+        // runs inside update_screen() on the scheduler thread; in stream mode the frontend gets the raw
+        // bytes and builds its own recent history
+        session->screen->set_scroll_callback([raw = session.get()](const Cell* row, int cols) {
+            raw->history.append(row, cols);
+            if (raw->active_render_mode == RenderMode::Screen) raw->scrollback.push(row, cols);
+        });
+        return session;
+    }
+
+    std::shared_ptr<PTYManager::Session> PTYManager::spawn(const std::string& command, int cols, int rows) {
+        start();
+
+        std::shared_ptr<Session> session = make_session(command, cols, rows);
+        session->console = std::make_unique<detail::PseudoConsole>();
+        session->console->init(command.c_str(), cols, rows);
+        session->allocations_at_open = allocation_count();
+
+        // the shared reactor thread reads straight into the session's ring; a pooled session's
+        // output (its prompt) waits there until the session is handed over
+        session->console->set_output_ring(session->ring.get());
+        session->console->set_output_handler([this, raw = session.get()](size_t bytes) { on_output(*raw, bytes); });
+        m_reactor.attach(session->console.get());
+        return session;
+    }
+
+    void PTYManager::on_output(Session& session, size_t bytes) {
+        session.bytes_out.fetch_add(bytes, std::memory_order_relaxed);
+        session.read_sizes.record(bytes);
+        update_peak(session.buffered_peak, session.ring->size());
+        if (int id = session.id.load()) m_scheduler.mark_dirty(id, is_foreground(session));
+    }
+
+    bool PTYManager::is_foreground(const Session& session) {
+        auto since = std::chrono::steady_clock::now().time_since_epoch().count() - session.last_input.load(std::memory_order_relaxed);
+        return since < std::chrono::duration_cast<std::chrono::steady_clock::duration>(FOREGROUND_HOLD).count();
+    }
+
+    std::shared_ptr<PTYManager::Session> PTYManager::take_prewarmed(const std::string& command) {
+        std::lock_guard<std::mutex> lock(m_spawn_mutex);
+        for (PrewarmPool& pool: m_pools) {
+            if (pool.command != command || pool.idle.empty()) continue;
+            std::shared_ptr<Session> session = std::move(pool.idle.back());
+            pool.idle.pop_back();
+            return session;
+        }
+        return nullptr;
+    }
+
+    int PTYManager::adopt(const std::shared_ptr<Session>& session, int cols, int rows, std::chrono::steady_clock::time_point requested_at) {
+        {
+            std::lock_guard<std::mutex> lock(session->screen_mutex);
+            if (session->screen->cols() != cols || session->screen->rows() != rows) {
+                session->screen->resize(cols, rows);
+                if (session->console) session->console->set_size(cols, rows);
+            }
+        }
+        session->requested_at = requested_at;
+
+        int id = m_last_id.fetch_add(1) + 1;
+        std::string directory;
+        bool compress;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            directory = m_record_directory;
+            compress = m_record_compress;
+        }
+        if (!directory.empty()) {
+            // published to the scheduler thread along with the session itself
+            char name[64];
+            std::snprintf(name, sizeof(name), "/noterm-%lld-%d.cast%s", static_cast<long long>(std::time(nullptr)), id, compress ? "z" : "");
+            auto recorder = std::make_unique<Recorder>();
+            if (recorder->open(directory + name, cols, rows, session->command, compress)) session->recorder = std::move(recorder);
+        }
+        m_sessions.insert(id, session);
+        // from here on reads mark the session dirty; whatever was staged before is flushed now
+        session->id.store(id);
+        if (session->ring->size() > 0) m_scheduler.mark_dirty(id);
+        return id;
+    }
+
+    int PTYManager::create(const std::string& command, int cols, int rows, std::chrono::steady_clock::time_point requested_at) {
+        m_last_cols = cols;
+        m_last_rows = rows;
+        std::shared_ptr<Session> session = take_prewarmed(command);
+        if (session) session->prewarmed = true;
+        else session = spawn(command, cols, rows);
+        int id = adopt(session, cols, rows, requested_at);
+        // refill only now: forking the replacement stalls page faults in every other thread
+        if (session->prewarmed) m_spawn_cv.notify_one();
+        NOTERM_LOG_DEBUG("PTY %d created%s", id, session->prewarmed ? " from the prewarm pool" : "");
+        return id;
+    }
+
+    int PTYManager::create(const std::string& command, int cols, int rows) {
+        return create(command, cols, rows, std::chrono::steady_clock::now());
+    }
+
+    int PTYManager::replay(const std::string& path, int cols, int rows, double speed, std::chrono::milliseconds idle_limit) {
+        auto player = std::make_unique<CastPlayer>();
+        if (!player->open(path)) return 0;
+        start();
+
+        std::shared_ptr<Session> session = make_session(path, cols, rows);
+        session->player = std::move(player);
+        session->allocations_at_open = allocation_count();
+        int id = adopt(session, cols, rows, std::chrono::steady_clock::now());
+        session->player->start(session->ring.get(), speed, idle_limit, [this, raw = session.get()](size_t bytes) { on_output(*raw, bytes); });
+        NOTERM_LOG_INFO("PTY %d replays %s (recorded at %dx%d)", id, path.c_str(), session->player->cols(), session->player->rows());
+        return id;
+    }
+
+    void PTYManager::create_async(const std::string& command, int cols, int rows, CreateCallback done) {
+        start();
+        {
+            std::lock_guard<std::mutex> lock(m_spawn_mutex);
+            m_spawn_jobs.push_back({command, cols, rows, std::move(done), std::chrono::steady_clock::now()});
+        }
+        m_spawn_cv.notify_one();
+    }
+
+    void PTYManager::set_prewarm(const std::string& command, size_t count) {
+        std::vector<std::shared_ptr<Session>> surplus;
+        {
+            std::lock_guard<std::mutex> lock(m_spawn_mutex);
+            auto it = std::find_if(m_pools.begin(), m_pools.end(), [&](const PrewarmPool& pool) { return pool.command == command; });
+            if (it == m_pools.end()) {
+                if (count == 0) return;
+                it = m_pools.insert(m_pools.end(), {command, count, {}});
+            }
+            it->count = count;
+            while (it->idle.size() > count) {
+                surplus.push_back(std::move(it->idle.back()));
+                it->idle.pop_back();
+            }
+            if (count == 0) m_pools.erase(it);
+            // closed by the spawner like any other session
+            for (auto& session: surplus) m_retired.push_back(std::move(session));
+        }
+        if (count > 0) start();
+        m_spawn_cv.notify_one();
+    }
+
+    void PTYManager::run_spawner() {
+        std::unique_lock<std::mutex> lock(m_spawn_mutex);
+        while (true) {
+            PrewarmPool* refill = nullptr;
+            m_spawn_cv.wait(lock, [&]() {
+                if (!m_spawner_running || !m_spawn_jobs.empty() || !m_retired.empty()) return true;
+                for (PrewarmPool& pool: m_pools) {
+                    if (pool.idle.size() < pool.count) {
+                        refill = &pool;
+                        return true;
+                    }
+                }
+                return false;
+            });
+            if (!m_spawner_running) break;
+
+            if (!m_spawn_jobs.empty()) {
+                SpawnJob job = std::move(m_spawn_jobs.front());
+                m_spawn_jobs.pop_front();
+                lock.unlock();
+                int id = create(job.command, job.cols, job.rows, job.requested_at);
+                if (job.done) job.done(id);
+                lock.lock();
+            } else if (!m_retired.empty()) {
+                std::shared_ptr<Session> session = std::move(m_retired.back());
+                m_retired.pop_back();
+                lock.unlock();
+                close_session(session->id.load(), *session);
+                session.reset();
+                lock.lock();
+            } else if (refill) {
+                std::string command = refill->command;
+                int cols = m_last_cols.load();
+                int rows = m_last_rows.load();
+                lock.unlock();
+                std::shared_ptr<Session> session = spawn(command, cols, rows);
+                lock.lock();
+                // the pool may have shrunk or gone while the process started
+                auto it = std::find_if(m_pools.begin(), m_pools.end(), [&](const PrewarmPool& pool) { return pool.command == command; });
+                if (it != m_pools.end() && it->idle.size() < it->count) it->idle.push_back(std::move(session));
+                else m_retired.push_back(std::move(session));
+            }
+        }
+    }
+
+    void PTYManager::set_size(int id, int cols, int rows) {
+        if (cols <= 0 || rows <= 0) return;
+        std::shared_ptr<Session> session = m_sessions.find(id);
+        if (!session) return;
+        m_last_cols = cols;
+        m_last_rows = rows;
+        session->pending_size.store(static_cast<uint64_t>(cols) << 32 | static_cast<uint32_t>(rows));
+        m_scheduler.mark_dirty(id);
+    }
+
+    void PTYManager::set_sizes_frame(const char* frame, size_t size) {
+        size_t offset = 0;
+        while (size - offset >= FRAME_HEADER_SIZE) {
+            int id = static_cast<int>(read_u32_le(frame + offset));
+            size_t length = read_u32_le(frame + offset + 4);
+            offset += FRAME_HEADER_SIZE;
+            if (length > size - offset) break;// truncated record
+            if (length >= 8) set_size(id, static_cast<int>(read_u32_le(frame + offset)), static_cast<int>(read_u32_le(frame + offset + 4)));
+            offset += length;
+        }
+    }
+
+    void PTYManager::write_input_frame(const char* frame, size_t size) {
+        constexpr size_t MAX_PARTS = 16;
+        std::string_view parts[MAX_PARTS];
+        size_t count = 0;
+        int current = -1;
+
+        auto submit = [&]() {
+            if (count == 0) return;
+            std::shared_ptr<Session> session = m_sessions.find(current);
+            if (session && session->console) {
+                size_t bytes = 0;
+                for (size_t i = 0; i < count; ++i) bytes += parts[i].size();
+                trace::Span traced("input", current);
+                traced.bytes = bytes;
+                session->console->write_input(parts, count);
+                session->bytes_in.fetch_add(bytes, std::memory_order_relaxed);
+                // its echo, and whatever the input starts, is flushed ahead of other sessions' output
+                session->last_input.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+            }
+            count = 0;
+        };
+
+        size_t offset = 0;
+        while (size - offset >= FRAME_HEADER_SIZE) {
+            int id = static_cast<int>(read_u32_le(frame + offset));
+            size_t length = read_u32_le(frame + offset + 4);
+            offset += FRAME_HEADER_SIZE;
+            if (length > size - offset) break;// truncated record
+
+            if (id != current || count == MAX_PARTS) {
+                submit();
+                current = id;
+            }
+            if (length > 0) parts[count++] = std::string_view(frame + offset, length);
+            offset += length;
+        }
+        submit();
+    }
+
+    void PTYManager::acknowledge(int id, size_t bytes) {
+        std::shared_ptr<Session> session = m_sessions.find(id);
+        if (!session) return;
+
+        uint64_t prev = session->unacked.load();
+        uint64_t next;
+        do {
+            next = prev > bytes ? prev - bytes : 0;
+        } while (!session->unacked.compare_exchange_weak(prev, next));
+
+        size_t low = m_low_watermark.load(std::memory_order_relaxed);
+        if (next <= low && session->throttled.exchange(false)) m_scheduler.mark_dirty(id, is_foreground(*session));
+
+        // the records this acknowledgement completes
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(session->ack_mutex);
+        session->acked_total = std::min(session->acked_total + bytes, session->sent_total);
+        while (session->sent_count > 0) {
+            SentRecord& record = session->sent[session->sent_first];
+            if (record.end > session->acked_total) break;
+            session->ack_latency.record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(now - record.time).count()));
+            trace::async_end("frame", record.trace_id, id, 0);
+            session->sent_first = (session->sent_first + 1) % SENT_RECORD_SLOTS;
+            --session->sent_count;
+        }
+    }
+
+    std::vector<SessionStats> PTYManager::stats() {
+        std::vector<std::pair<int, std::shared_ptr<Session>>> sessions;
+        m_sessions.collect(sessions);
+
+        std::vector<SessionStats> out;
+        out.reserve(sessions.size());
+        for (auto& [id, session]: sessions) {
+            out.push_back({id,
+                           session->ring->size(),
+                           static_cast<size_t>(session->unacked.load()),
+                           session->console ? session->console->output_paused() : session->player->output_paused(),
+                           session->bytes_out.load(),
+                           session->bytes_in.load(),
+                           session->bytes_sent.load(),
+                           session->records_sent.load(),
+                           session->buffered_peak.load(),
+                           session->unacked_peak.load(),
+                           session->read_sizes.snapshot(),
+                           session->screen_lock_wait.snapshot(),
+                           session->ack_latency.snapshot(),
+                           session->first_output_us.load(),
+                           session->prewarmed,
+                           session->history.stats()});
+        }
+        return out;
+    }
+
+    void PTYManager::set_render_mode(int id, RenderMode mode) {
+        std::shared_ptr<Session> session = m_sessions.find(id);
+        if (!session) return;
+        if (session->render_mode.exchange(mode) != mode) m_scheduler.mark_dirty(id);
+    }
+
+    std::string PTYManager::screen_text(int id) {
+        std::shared_ptr<Session> session = m_sessions.find(id);
+        if (!session) return {};
+        std::lock_guard<std::mutex> lock(session->screen_mutex);
+        return session->screen->text();
+    }
+
+    ScrollbackPage PTYManager::scrollback(int id, uint64_t first, size_t count) {
+        std::shared_ptr<Session> session = m_sessions.find(id);
+        if (!session) return {};
+        return session->history.read(first, count);
+    }
+
+    std::vector<SearchResult> PTYManager::search(const std::string& pattern, bool regex, bool ignore_case, size_t limit) {
+        std::vector<SearchResult> results;
+        Searcher searcher(pattern, regex, ignore_case);
+        if (!searcher.valid()) return results;
+
+        std::vector<std::pair<int, std::shared_ptr<Session>>> sessions;
+        m_sessions.collect(sessions);
+
+        std::vector<ScrollbackHit> hits;
+        std::vector<LineMatch> matches;
+        for (auto& [id, session]: sessions) {
+            if (results.size() >= limit) break;
+            hits.clear();
+            {
+                // history and screen only change together under this lock, so the numbering lines up
+                std::lock_guard<std::mutex> lock(session->screen_mutex);
+                uint64_t screen_first = session->history.end();
+                const Screen& screen = *session->screen;
+                for (int y = screen.rows() - 1; y >= 0 && results.size() + hits.size() < limit; --y) {
+                    std::string text = screen.row_text(y);
+                    matches.clear();
+                    searcher.find(text, matches);
+                    for (const LineMatch& match: matches) {
+                        hits.push_back({screen_first + static_cast<uint64_t>(y), cell_columns(text, 0, match.offset),
+                                        cell_columns(text, match.offset, match.offset + match.length), text});
+                    }
+                }
+            }
+            if (results.size() + hits.size() < limit) session->history.search(searcher, limit - results.size() - hits.size(), hits);
+            for (auto& hit: hits) results.push_back({id, hit.line, hit.column, hit.length, std::move(hit.text)});
+        }
+
+        if (results.size() > limit) results.resize(limit);
+        std::sort(results.begin(), results.end(), [](const SearchResult& a, const SearchResult& b) {
+            if (a.id != b.id) return a.id < b.id;
+            if (a.line != b.line) return a.line < b.line;
+            return a.column < b.column;
+        });
+        return results;
+    }
+
+    void PTYManager::close_all() {
+        // stop the spawner first, so no session is created, pooled or retired behind our back
+        std::thread spawner;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            {
+                std::lock_guard<std::mutex> spawn_lock(m_spawn_mutex);
+                m_spawner_running = false;
+            }
+            spawner = std::move(m_spawner);
+        }
+        m_spawn_cv.notify_all();
+        if (spawner.joinable()) spawner.join();
+
+        std::vector<std::pair<int, std::shared_ptr<Session>>> sessions;
+        m_sessions.take_all(sessions);
+        {
+            std::lock_guard<std::mutex> lock(m_spawn_mutex);
+            // creates still queued are dropped, their callers are shutting down as well
+            m_spawn_jobs.clear();
+            for (auto& session: m_retired) sessions.emplace_back(session->id.load(), std::move(session));
+            m_retired.clear();
+            for (PrewarmPool& pool: m_pools) {
+                for (auto& session: pool.idle) sessions.emplace_back(0, std::move(session));
+                pool.idle.clear();
+            }
+        }
+
+        // close outside any lock: the reactor may still be notifying while a console shuts down
+        for (auto& [id, session]: sessions) {
+            close_session(id, *session);
+        }
+        sessions.clear();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_running) {
+            m_running = false;
+            m_reactor.stop();
+            m_scheduler.stop();
+        }
+    }
+
+    void PTYManager::close(int id) {
+        std::shared_ptr<Session> session = m_sessions.erase(id);
+        if (!session) return;
+        {
+            std::lock_guard<std::mutex> lock(m_spawn_mutex);
+            if (m_spawner_running) {
+                m_retired.push_back(std::move(session));
+                m_spawn_cv.notify_one();
+                return;
+            }
+        }
+        close_session(id, *session);
+    }
+
+    std::vector<int> PTYManager::ids() {
+        std::vector<std::pair<int, std::shared_ptr<Session>>> sessions;
+        m_sessions.collect(sessions);
+        std::vector<int> out;
+        out.reserve(sessions.size());
+        for (auto& kv: sessions) out.push_back(kv.first);
+        return out;
+    }
+
+    void PTYManager::detach() {
+        std::vector<std::pair<int, std::shared_ptr<Session>>> sessions;
+        m_sessions.collect(sessions);
+        for (auto& [id, session]: sessions) {
+            session->render_mode = RenderMode::Screen;
+            m_scheduler.mark_dirty(id);
+        }
+    }
+
+    std::vector<SessionInfo> PTYManager::describe() {
+        std::vector<std::pair<int, std::shared_ptr<Session>>> sessions;
+        m_sessions.collect(sessions);
+        std::sort(sessions.begin(), sessions.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        std::vector<SessionInfo> out;
+        out.reserve(sessions.size());
+        for (auto& [id, session]: sessions) {
+            std::lock_guard<std::mutex> lock(session->screen_mutex);
+            const Screen& screen = *session->screen;
+            out.push_back({id, session->command, screen.title(), screen.cols(), screen.rows()});
+        }
+        return out;
+    }
+
+    void PTYManager::reattach(int id, bool with_history) {
+        std::shared_ptr<Session> session = m_sessions.find(id);
+        if (!session) return;
+        session->render_mode = RenderMode::Screen;
+        session->reattach_history = with_history;
+        session->reattach_pending = true;
+        m_scheduler.mark_dirty(id);
+        NOTERM_LOG_DEBUG("PTY %d reattached%s", id, with_history ? " with history" : "");
+    }
+
+    void PTYManager::repaint(int id) {
+        std::shared_ptr<Session> session = m_sessions.find(id);
+        if (!session) return;
+        session->repaint_pending = true;
+        m_scheduler.mark_dirty(id);
+    }
+
+    // Scheduler thread: send the sessions' staged bytes as one multiplexed frame. A frame with a
+    // single record is sent straight out of the ring; several records are gathered into a reused
+    // buffer so the transport still sees one message.
+    //
+    // Foreground sessions are flushed whole. Background ones share the scheduler by deficit round
+    // robin: every round adds the session's quantum to its allowance, which caps what is parsed,
+    // and so what can be sent; the rest waits for the next round. A slice parses BACKGROUND_SLICE
+    // bytes at most, the session it ran out in is picked up again by the next one, after any
+    // foreground work.
+    size_t PTYManager::flush(const std::vector<int>& ids, bool foreground) {
+        trace::Span traced("flush");
+        OutputSink sink;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            sink = m_sink;
+            m_flush_triggers = m_triggers;
+        }
+        size_t high = m_high_watermark.load(std::memory_order_relaxed);
+        size_t low = m_low_watermark.load(std::memory_order_relaxed);
+        auto now = std::chrono::steady_clock::now();
+
+        m_flush_sessions.clear();
+        m_records.clear();
+        size_t frame_size = 0;
+        size_t parsed = 0;
+        size_t served = 0;
+        int resume_id = foreground ? 0 : std::exchange(m_resume_id, 0);
+        size_t resume_at = SIZE_MAX;
+        for (; served < ids.size() && (foreground || parsed < BACKGROUND_SLICE); ++served) {
+            int id = ids[served];
+            std::shared_ptr<Session> session = m_sessions.find(id);
+            if (!session) continue;
+            // held until the frame is sent, its records point into the session
+            m_flush_sessions.emplace_back(id, std::move(session));
+            Session& s = *m_flush_sessions.back().second;
+            if (uint64_t size = s.pending_size.exchange(0)) {
+                // everything staged so far was written for the old geometry
+                update_screen(s, s.ring->read_spans(), SIZE_MAX);
+                int cols = static_cast<int>(size >> 32);
+                int rows = static_cast<int>(size & 0xffffffffu);
+                {
+                    auto lock = lock_timed(s.screen_mutex, s.screen_lock_wait);
+                    s.screen->resize(cols, rows);
+                }
+                if (s.console) s.console->set_size(cols, rows);
+                if (s.recorder) s.recorder->resize(cols, rows);
+                s.resize_settle_until = now + RESIZE_SETTLE;
+            }
+            bool settling = now < s.resize_settle_until;
+            bool repaint = s.repaint_pending.exchange(false);
+            // polled until the settle time is over, or the repaint is out, and the session can stream again
+            if (settling || repaint) m_scheduler.mark_dirty(id);
+
+            bool reattached = s.reattach_pending.exchange(false);
+            if (reattached) {
+                // the new frontend has seen nothing, and nothing sent to the old one will be acknowledged
+                s.encoder.invalidate();
+                s.scrollback.clear();
+                s.restore_history = s.reattach_history.load();
+                s.unacked = 0;
+                s.throttled = false;
+                std::lock_guard<std::mutex> lock(s.ack_mutex);
+                s.sent_count = 0;
+                s.acked_total = s.sent_total;
+            }
+            RenderMode requested = settling || repaint ? RenderMode::Screen : s.render_mode.load();
+            if (requested != s.active_render_mode) {
+                // entering screen mode: what the frontend shows is unknown, repaint it all; leaving
+                // it: one last diff brings the frontend up to date before raw output resumes
+                if (requested == RenderMode::Screen) s.encoder.invalidate();
+                else s.resync_pending = true;
+                s.active_render_mode = requested;
+                NOTERM_LOG_DEBUG("PTY %d render mode: %s", id, requested == RenderMode::Screen ? "screen" : "stream");
+            } else if (repaint) {
+                s.encoder.invalidate();
+            }
+
+            // drained up to the current head; bytes arriving meanwhile mark the session dirty again
+            auto spans = s.ring->read_spans();
+            // The screen sees every byte as soon as it is staged, even while flow control holds it back.
+            // Nothing streams in screen mode, so the parse work per flush is capped there: a backlog in
+            // one session must not hold up the frame every other session is waiting for. A reattach
+            // snapshot shows the screen as it stands; the backlog follows as an ordinary update.
+            bool screen_mode = s.active_render_mode == RenderMode::Screen || s.resync_pending;
+            size_t staged = spans.first.second + spans.second.second;
+            if (!reattached) {
+                size_t limit = screen_mode ? SCREEN_PARSE_BUDGET : SIZE_MAX;
+                if (!foreground) {
+                    if (served > 0 || id != resume_id) {
+                        s.deficit += BACKGROUND_QUANTUM * (s.render_mode.load() == RenderMode::Stream ? BACKGROUND_SHOWN_WEIGHT : 1);
+                    }
+                    limit = std::min(limit, s.deficit);
+                    if (limit > BACKGROUND_SLICE - parsed && staged - s.parsed_ahead > BACKGROUND_SLICE - parsed) {
+                        // the slice ends within this session's share
+                        limit = BACKGROUND_SLICE - parsed;
+                        m_resume_id = id;
+                        resume_at = served;
+                    }
+                }
+                trace::Span parse_traced("screen.parse", id);
+                size_t before = s.parsed_ahead;
+                update_screen(s, spans, limit);
+                parse_traced.bytes = s.parsed_ahead - before;
+                parsed += s.parsed_ahead - before;
+                if (!foreground) {
+                    // an allowance is only kept while there is a backlog to spend it on
+                    s.deficit = s.parsed_ahead == staged ? 0 : s.deficit - (s.parsed_ahead - before);
+                }
+            }
+
+            if (screen_mode) {
+                // the screen already holds the effect of the parsed bytes; they are never replayed
+                s.ring->consume(s.parsed_ahead);
+                s.parsed_ahead = 0;
+                resume_output(s);
+                if (s.ring->size() > 0) m_scheduler.mark_dirty(id);
+
+                // one diff in flight at a time: changes pile up in the row generations until it is acknowledged
+                if (!s.resync_pending && s.unacked.load() > 0) {
+                    s.throttled = true;
+                    if (s.unacked.load() == 0 && s.throttled.exchange(false)) m_scheduler.mark_dirty(id);
+                    continue;
+                }
+                s.resync_pending = false;
+
+                auto lock = lock_timed(s.screen_mutex, s.screen_lock_wait);
+                if (!s.encoder.pending(*s.screen, s.scrollback)) continue;
+                trace::Span encode_traced("screen.encode", id);
+                // the record header goes in front of the encoded update, as it does for ring spans
+                s.diff_frame.assign(FRAME_HEADER_SIZE, '\0');
+                if (s.restore_history) {
+                    append_history(s, s.diff_frame);
+                    // lines that scrolled off since are part of that history already
+                    s.scrollback.clear();
+                    s.restore_history = false;
+                }
+                s.encoder.encode(*s.screen, s.scrollback, s.diff_frame);
+                size_t length = s.diff_frame.size() - FRAME_HEADER_SIZE;
+                write_frame_header(s.diff_frame.data(), id, length);
+                encode_traced.bytes = length;
+                m_records.push_back({&s, s.diff_frame.data(), length, 0});
+                frame_size += length + FRAME_HEADER_SIZE;
+                s.unacked.fetch_add(length);
+                continue;
+            }
+
+            // only parsed bytes stream, the screen must have seen them; a backlog left unparsed
+            // waits for the session's next round
+            if (s.parsed_ahead < staged) m_scheduler.mark_dirty(id);
+            uint64_t unacked = s.unacked.load();
+            size_t budget = unacked < high ? static_cast<size_t>(high - unacked) : 0;
+            size_t available = s.parsed_ahead;
+            size_t take = available < budget ? available : budget;
+            size_t cut = take ? stream_cut(s, spans, take, take == staged) : 0;
+            if (cut > 0) {
+                // Each record must decode on its own in the frontend. The ring bytes go out as they
+                // are when they are valid UTF-8 and no code point straddles the wrap; otherwise they
+                // are copied with the invalid bytes replaced.
+                size_t first = cut < spans.first.second ? cut : spans.first.second;
+                size_t second = cut - first;
+                bool clean = utf8::valid_prefix(spans.first.first, first) == first &&
+                             utf8::valid_prefix(spans.second.first, second) == second;
+                if (clean) {
+                    for (auto part: {std::make_pair(spans.first.first, first), std::make_pair(spans.second.first, second)}) {
+                        if (part.second == 0) continue;
+                        char* frame = part.first - FRAME_HEADER_SIZE;
+                        write_frame_header(frame, id, part.second);
+                        m_records.push_back({&s, frame, part.second, part.second});
+                        frame_size += part.second + FRAME_HEADER_SIZE;
+                        s.unacked.fetch_add(part.second);
+                    }
+                } else {
+                    m_stream_raw.assign(spans.first.first, first);
+                    m_stream_raw.append(spans.second.first, second);
+                    s.stream_copy.assign(FRAME_HEADER_SIZE, '\0');
+                    utf8::sanitize(m_stream_raw.data(), m_stream_raw.size(), s.stream_copy);
+                    size_t length = s.stream_copy.size() - FRAME_HEADER_SIZE;
+                    write_frame_header(s.stream_copy.data(), id, length);
+                    m_records.push_back({&s, s.stream_copy.data(), length, cut});
+                    frame_size += length + FRAME_HEADER_SIZE;
+                    // acknowledgements count what the frontend received
+                    s.unacked.fetch_add(length);
+                }
+                s.parsed_ahead -= cut;
+            }
+
+            if (take < available) {
+                s.throttled = true;
+                // an acknowledgement may have landed before the flag was set
+                if (s.unacked.load() <= low && s.throttled.exchange(false)) m_scheduler.mark_dirty(id);
+            }
+        }
+
+        // bookkeeping before sending, so an early acknowledgement finds its records
+        auto sent_at = std::chrono::steady_clock::now();
+        for (auto& record: m_records) {
+            if (!sink) break;
+            Session& s = *record.session;
+            if (s.first_output_us.load(std::memory_order_relaxed) == 0) {
+                auto waited = std::chrono::duration_cast<std::chrono::microseconds>(sent_at - s.requested_at).count();
+                s.first_output_us.store(waited > 0 ? static_cast<uint64_t>(waited) : 1, std::memory_order_relaxed);
+                NOTERM_LOG_DEBUG("PTY %d first output %.1f ms after the request%s", s.id.load(), static_cast<double>(waited) / 1000.0,
+                                 s.prewarmed ? " (prewarmed)" : "");
+            }
+            s.bytes_sent.fetch_add(record.length, std::memory_order_relaxed);
+            s.records_sent.fetch_add(1, std::memory_order_relaxed);
+            update_peak(s.unacked_peak, s.unacked.load());
+
+            uint64_t trace_id = ++m_trace_id;
+            std::lock_guard<std::mutex> lock(s.ack_mutex);
+            s.sent_total += record.length;
+            if (s.sent_count < SENT_RECORD_SLOTS) {
+                s.sent[(s.sent_first + s.sent_count) % SENT_RECORD_SLOTS] = {s.sent_total, sent_at, trace_id};
+                ++s.sent_count;
+                trace::async_begin("frame", trace_id, static_cast<int>(read_u32_le(record.frame)), record.length);
+            }
+        }
+
+        if (sink && !m_records.empty()) {
+            trace::Span send_traced("send");
+            send_traced.bytes = frame_size;
+            if (m_records.size() == 1) {
+                sink(m_records[0].frame, m_records[0].length + FRAME_HEADER_SIZE);
+            } else {
+                m_frame.resize(frame_size);
+                size_t pos = 0;
+                for (auto& record: m_records) {
+                    std::memcpy(m_frame.data() + pos, record.frame, record.length + FRAME_HEADER_SIZE);
+                    pos += record.length + FRAME_HEADER_SIZE;
+                }
+                sink(m_frame.data(), frame_size);
+            }
+        }
+        traced.bytes = frame_size;
+
+        for (auto& record: m_records) {
+            if (record.consumed == 0) continue;
+            record.session->ring->consume(record.consumed);
+            resume_output(*record.session);
+        }
+        m_flush_sessions.clear();
+
+        // after the frame, so whatever reacts to a match finds its output already there
+        if (!m_matches.empty()) {
+            TriggerCallback callback;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                callback = m_trigger_callback;
+            }
+            if (callback) callback(m_matches);
+            m_matches.clear();
+        }
+        m_flush_triggers.reset();
+        return resume_at < served ? resume_at : served;
+    }
+
+    void PTYManager::append_history(Session& session, std::string& out) {
+        uint64_t end = session.history.end();
+        uint64_t first = end > SCROLLBACK_APPEND_LIMIT ? end - SCROLLBACK_APPEND_LIMIT : 0;
+        ScrollbackPage page = session.history.read(first, SCROLLBACK_APPEND_LIMIT);
+        if (page.lines.empty()) return;
+        for (const std::string& line: page.lines) {
+            out += line;
+            out += "\r\n";
+        }
+        // scroll the last of them off a fresh terminal; the repaint that follows fills the screen
+        out.append(static_cast<size_t>(session.screen->rows() > 1 ? session.screen->rows() - 1 : 0), '\n');
+    }
+
+    // Back off from `take` over a code point, and preferably an escape sequence, that the staged
+    // bytes end in the middle of: xterm.js would otherwise render half of it, or a replacement
+    // character where the record is sanitized. An escape sequence is held back once, when the
+    // bytes taken are all there are (whole); if no more arrive by the next flush, the program
+    // stopped there and gets what it wrote. A split code point waits for its remaining bytes.
+    size_t PTYManager::stream_cut(Session& session, const std::pair<ByteRing::Span, ByteRing::Span>& spans, size_t take, bool whole) {
+        char tail[STREAM_TAIL_SCAN];
+        size_t n = take < STREAM_TAIL_SCAN ? take : STREAM_TAIL_SCAN;
+        size_t from = take - n;
+        size_t pos = 0;
+        for (auto span: {spans.first, spans.second}) {
+            if (from < span.second) {
+                size_t length = std::min(span.second - from, n - pos);
+                std::memcpy(tail + pos, span.first + from, length);
+                pos += length;
+                from = 0;
+            } else {
+                from -= span.second;
+            }
+            if (pos == n) break;
+        }
+
+        size_t partial = utf8::incomplete_tail(tail, n);
+        size_t escape = vt::unterminated_escape(tail, n);
+        size_t held = session.stream_held;
+        session.stream_held = 0;
+        if (escape <= partial) return take - partial;
+        if (!whole) {
+            // cut at the watermark, the rest follows once acknowledgements make room
+            return escape < take ? take - escape : take - partial;
+        }
+        if (held == take) return take - partial;
+        session.stream_held = escape;
+        m_scheduler.mark_dirty(session.id.load());
+        return take - escape;
+    }
+
+    void PTYManager::update_screen(Session& session, const std::pair<ByteRing::Span, ByteRing::Span>& spans, size_t limit) {
+        size_t skip = session.parsed_ahead;
+        ByteRing::Span fed[2];
+        size_t count = 0;
+        std::unique_lock<std::mutex> lock(session.screen_mutex);
+        for (auto span: {spans.first, spans.second}) {
+            if (skip >= span.second) {
+                skip -= span.second;
+                continue;
+            }
+            size_t length = span.second - skip < limit ? span.second - skip : limit;
+            if (length == 0) break;
+            session.screen->feed(span.first + skip, length);
+            fed[count++] = {span.first + skip, length};
+            session.parsed_ahead += length;
+            limit -= length;
+            skip = 0;
+        }
+        lock.unlock();
+        // every byte passes here exactly once, whatever the render mode
+        if (session.recorder) {
+            for (size_t i = 0; i < count; ++i) session.recorder->output(fed[i].first, fed[i].second);
+        }
+        if (m_flush_triggers) {
+            size_t max = m_matches.size() + TRIGGER_MATCHES_PER_FLUSH;
+            for (size_t i = 0; i < count; ++i) {
+                session.triggers.scan(*m_flush_triggers, session.id.load(), fed[i].first, fed[i].second, m_matches, max);
+            }
+        }
+    }
+
+    void PTYManager::resume_output(Session& session) {
+        if (session.console) session.console->resume_output();
+        else session.player->resume_output();
+    }
+
+    void PTYManager::close_session(int id, Session& session) {
+        // detaches from the reactor, or stops the player, so nothing is written to the ring afterwards
+        if (session.console) session.console->close();
+        else session.player->stop();
+
+        if (allocation_stats_enabled()) {
+            double mb = static_cast<double>(session.bytes_out.load()) / (1024.0 * 1024.0);
+            uint64_t allocations = allocation_count() - session.allocations_at_open;
+            NOTERM_LOG_INFO("PTY %d closed: %g MB output, %g allocations/MB (process-wide)", id, mb,
+                            mb > 0 ? static_cast<double>(allocations) / mb : 0.0);
+        }
+    }
+}// namespace noterm
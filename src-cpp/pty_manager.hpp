@@ -0,0 +1,450 @@
+#ifndef NOTERM_PTY_MANAGER_HPP
+#define NOTERM_PTY_MANAGER_HPP
+
+#ifdef _WIN32
+#include "win32.hpp"
+#elif defined(__unix__) || defined(__APPLE__)
+#include "posix.hpp"
+#else
+#error "Unsupported platform"
+#endif
+
+#include "metrics.hpp"
+#include "output_scheduler.hpp"
+#include "recording.hpp"
+#include "ring_buffer.hpp"
+#include "screen.hpp"
+#include "screen_encoder.hpp"
+#include "scrollback_store.hpp"
+#include "session_registry.hpp"
+#include "trigger.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace noterm {
+    struct SessionStats {
+        int id;
+        // staged in the ring, not yet sent
+        size_t buffered;
+        // sent to the frontend, not yet acknowledged as written
+        size_t unacked;
+        // the reactor stopped reading the pty because the ring is full
+        bool reading_paused;
+        // read from the pty
+        uint64_t bytes_out;
+        // written to the pty
+        uint64_t bytes_in;
+        // record payload handed to the output sink, raw output or screen diffs
+        uint64_t bytes_sent;
+        uint64_t records_sent;
+        // highest ring fill and unacknowledged byte count seen
+        uint64_t buffered_peak;
+        uint64_t unacked_peak;
+        // bytes per reactor wakeup
+        HistogramSnapshot read_sizes;
+        // nanoseconds spent waiting for a contended screen lock
+        HistogramSnapshot screen_lock_wait;
+        // microseconds from handing a record to the sink until the frontend acknowledged all of it
+        HistogramSnapshot ack_latency;
+        // from the create request until the first output was handed to the sink, 0 before that
+        uint64_t first_output_us;
+        // handed over from the prewarm pool
+        bool prewarmed;
+        ScrollbackStats scrollback;
+    };
+
+    struct SearchResult {
+        int id;
+        // numbered like scrollback lines; the visible screen continues after the history
+        uint64_t line;
+        // in terminal cells
+        int column;
+        int length;
+        std::string text;
+    };
+
+    // what a reconnecting frontend needs to rebuild a tab
+    struct SessionInfo {
+        int id;
+        std::string command;
+        std::string title;
+        int cols;
+        int rows;
+    };
+
+    enum class RenderMode {
+        // every output byte is forwarded to the frontend's terminal
+        Stream,
+        // only the difference between the native screen and what the frontend last rendered is sent,
+        // one update per acknowledgement; output that scrolled past unseen costs nothing
+        Screen,
+    };
+
+    // Owns every PTY session. Per-session operations (input, resize, acknowledgements, flushes) look
+    // the session up in a sharded registry and then only touch that session's own state, so traffic
+    // on one tab never waits for another. m_mutex only serialises configuration and start/stop.
+    class PTYManager {
+    public:
+        using OutputSink = std::function<void(const char* frame, size_t size)>;
+        using CreateCallback = std::function<void(int id)>;
+        using TriggerCallback = std::function<void(const std::vector<TriggerMatch>& matches)>;
+
+        static PTYManager& instance() {
+            static PTYManager mgr;
+            return mgr;
+        }
+
+        // capacity of each session's output ring; applies to sessions created afterwards
+        void set_output_capacity(size_t bytes) {
+            m_output_capacity.store(bytes, std::memory_order_relaxed);
+        }
+
+        // Output flow control: a session with `high` unacknowledged bytes gets no further frames until
+        // acknowledgements bring it down to `low`. Its ring then fills up, the reactor stops reading
+        // and the child blocks in the kernel instead of growing our heap.
+        void set_flow_control(size_t high, size_t low) {
+            m_high_watermark.store(high, std::memory_order_relaxed);
+            m_low_watermark.store(low < high ? low : high, std::memory_order_relaxed);
+        }
+
+        // how the reactor sizes and batches its reads from every pty
+        void set_read_policy(const ReadPolicy& policy) {
+            m_reactor.set_read_policy(policy);
+        }
+
+        void set_frame_interval(std::chrono::microseconds interval) {
+            m_scheduler.set_frame_interval(interval);
+        }
+
+        // render mode of sessions created afterwards
+        void set_default_render_mode(RenderMode mode) {
+            m_default_render_mode.store(mode, std::memory_order_relaxed);
+        }
+
+        // e.g. screen mode for hidden tabs; switching back to stream repaints the tab in one frame
+        void set_render_mode(int id, RenderMode mode);
+
+        // transport for multiplexed output frames; called on the scheduler thread only
+        void set_output_sink(OutputSink sink) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sink = std::move(sink);
+        }
+
+        // Patterns watched for in every session's output as the screen parses it, null for none.
+        // Output already parsed is not scanned again for a new set.
+        void set_triggers(std::shared_ptr<const PatternSet> triggers) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_triggers = std::move(triggers);
+        }
+
+        // called on the scheduler thread with the matches of a flush once its frame is sent, at most
+        // TRIGGER_MATCHES_PER_FLUSH per session
+        void set_trigger_callback(TriggerCallback callback) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_trigger_callback = std::move(callback);
+        }
+
+        // Keeps count idle sessions of command running, already attached to the reactor, so creating
+        // one only has to resize it and hand it over. Refilled in the background; 0 closes the idle ones.
+        void set_prewarm(const std::string& command, size_t count);
+
+        int create(const std::string& command, int cols, int rows);
+        // create() on the spawner thread, which calls done with the new id; for UI callbacks that
+        // must not wait for a process to start
+        void create_async(const std::string& command, int cols, int rows, CreateCallback done);
+
+        // A session that plays an asciicast recording instead of running a process. Its output takes
+        // the same path through staging, flow control and the sink as a pty's; input is ignored and
+        // recorded resizes are not replayed. See CastPlayer for speed and idle_limit. Returns 0 if
+        // the recording cannot be read.
+        int replay(const std::string& path, int cols, int rows, double speed, std::chrono::milliseconds idle_limit);
+
+        // Records the output of every session created afterwards to an asciicast v2 file in
+        // directory, LZ4-compressed if compress; an empty directory stops recording new sessions.
+        void set_recording(const std::string& directory, bool compress) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_record_directory = directory;
+            m_record_compress = compress;
+        }
+
+        // Takes effect on the scheduler thread with the session's next flush; sizes set in between
+        // collapse into the last one. Bytes staged before it are parsed at the old size, and for a
+        // short while afterwards the session sends screen diffs instead of raw output, so the redraw
+        // burst the resize provokes costs one repaint rather than streaming stale-geometry output.
+        void set_size(int id, int cols, int rows);
+
+        // Records in the input frame format whose payload is [cols u32 LE][rows u32 LE], one per tab;
+        // all of them are applied in one flush.
+        void set_sizes_frame(const char* frame, size_t size);
+
+        // Input arrives in the same record format as output: [id][len][bytes]... . Consecutive
+        // records for one session are handed to its console as a single vectored write.
+        void write_input_frame(const char* frame, size_t size);
+
+        // ask for a flush of this session's staged output even if the reactor has not signalled it
+        void request_output(int id) {
+            m_scheduler.mark_dirty(id);
+        }
+
+        // the frontend has written `bytes` of this session's output into its terminal
+        void acknowledge(int id, size_t bytes);
+
+        std::vector<SessionStats> stats();
+
+        // UTF-8 text of what the session's terminal shows, rows joined with '\n'; empty for unknown ids
+        std::string screen_text(int id);
+
+        // lines that scrolled off the session's primary screen, numbered from 0; empty for unknown ids
+        ScrollbackPage scrollback(int id, uint64_t first, size_t count);
+
+        // Matches across the history and screen of every session, sorted by session and line. Most
+        // recent output is searched first, so with more than limit matches the oldest are left out.
+        // Empty for an invalid pattern.
+        std::vector<SearchResult> search(const std::string& pattern, bool regex, bool ignore_case, size_t limit);
+
+        void close_all();
+
+        // Close and remove a single PTY by id. The console is shut down on the spawner thread, the
+        // id is gone as soon as this returns.
+        void close(int id);
+
+        // iterate IDs
+        std::vector<int> ids();
+
+        // Keeps every session running without a frontend: all of them switch to screen mode, so
+        // output keeps being drained into the screen and history instead of stalling on acknowledgements.
+        void detach();
+        std::vector<SessionInfo> describe();
+        // A frontend took over the session: the next frame is a snapshot, the recent history (for a
+        // fresh terminal) followed by a full repaint of the screen, instead of a replay of everything missed.
+        void reattach(int id, bool with_history);
+        // sends the whole screen of the session once, for a frontend that starts showing it mid-stream;
+        // every frontend gets it, the stream resumes afterwards
+        void repaint(int id);
+
+    private:
+        struct SentRecord {
+            // sent_total once the record is sent
+            uint64_t end;
+            std::chrono::steady_clock::time_point time;
+            // async event id in the trace
+            uint64_t trace_id;
+        };
+        static constexpr size_t SENT_RECORD_SLOTS = 64;
+
+        struct Session {
+            // null for a replayed session
+            std::unique_ptr<detail::PseudoConsole> console;
+            // written by the reactor thread, drained by flush() on the scheduler thread
+            std::unique_ptr<ByteRing> ring;
+            // writes the ring in place of the reactor for a replayed session; stopped before the ring goes
+            std::unique_ptr<CastPlayer> player;
+            // fed along with the screen, scheduler thread only
+            std::unique_ptr<Recorder> recorder;
+            TriggerScanner triggers;
+
+            // headless model of the terminal, fed from the ring on the scheduler thread
+            std::mutex screen_mutex;
+            std::unique_ptr<Screen> screen;
+            // leading bytes of the ring's readable region that the screen has already seen
+            size_t parsed_ahead = 0;
+
+            std::atomic<RenderMode> render_mode{RenderMode::Stream};
+            // the mode flush() last acted on, and the state it needs; scheduler thread only
+            RenderMode active_render_mode = RenderMode::Stream;
+            bool resync_pending = false;
+            ScreenEncoder encoder;
+            PendingScrollback scrollback{SCROLLBACK_APPEND_LIMIT};
+            // every line that scrolled off, whatever the render mode
+            ScrollbackStore history;
+            std::string diff_frame;
+            // stream records that needed invalid UTF-8 replaced, header room in front; scheduler thread only
+            std::string stream_copy;
+            // bytes of an unfinished escape sequence the last stream record stopped short of, see stream_cut()
+            size_t stream_held = 0;
+            // size requested by set_size() and not applied yet, cols << 32 | rows, 0 for none
+            std::atomic<uint64_t> pending_size{0};
+            // screen mode until then, whatever render_mode says; scheduler thread only
+            std::chrono::steady_clock::time_point resize_settle_until;
+
+            // 0 while waiting in the prewarm pool
+            std::atomic<int> id{0};
+            std::chrono::steady_clock::time_point requested_at;
+            std::atomic<uint64_t> first_output_us{0};
+            bool prewarmed = false;
+
+            std::atomic_bool reattach_pending{false};
+            std::atomic_bool repaint_pending{false};
+            std::atomic_bool reattach_history{false};
+            // the next screen update starts with the recent history; scheduler thread only
+            bool restore_history = false;
+            std::string command;
+
+            std::atomic<uint64_t> bytes_out{0};
+            std::atomic<uint64_t> unacked{0};
+            // flush() held output back at the high watermark; the next acknowledgement reschedules it
+            std::atomic_bool throttled{false};
+            uint64_t allocations_at_open = 0;
+
+            // always-on counters, reported through stats()
+            std::atomic<uint64_t> bytes_in{0};
+            // steady_clock ticks when input was last written, see is_foreground()
+            std::atomic<int64_t> last_input{0};
+            // parse allowance a background flush left unused, see flush(); scheduler thread only
+            size_t deficit = 0;
+            std::atomic<uint64_t> bytes_sent{0};
+            std::atomic<uint64_t> records_sent{0};
+            std::atomic<uint64_t> buffered_peak{0};
+            std::atomic<uint64_t> unacked_peak{0};
+            Histogram read_sizes;
+            Histogram screen_lock_wait;
+            Histogram ack_latency;
+
+            // Records sent and not fully acknowledged yet, oldest first, for ack_latency and the trace.
+            // Acknowledgements are byte counts, a record is done once they cover its last byte. When
+            // more records are in flight than there are slots, the extra ones go unmeasured.
+            std::mutex ack_mutex;
+            SentRecord sent[SENT_RECORD_SLOTS];
+            size_t sent_first = 0;
+            size_t sent_count = 0;
+            uint64_t sent_total = 0;
+            uint64_t acked_total = 0;
+        };
+
+        // scrolled-off lines kept for the next screen diff, xterm.js' default scrollback
+        static constexpr size_t SCROLLBACK_APPEND_LIMIT = 1000;
+        // bytes parsed per screen-mode session and flush
+        static constexpr size_t SCREEN_PARSE_BUDGET = 256 * 1024;
+        // how far back stream_cut() looks for the start of an unfinished escape sequence
+        static constexpr size_t STREAM_TAIL_SCAN = 256;
+        // how long after a resize output is sent as screen diffs; shells redraw well within it
+        static constexpr std::chrono::milliseconds RESIZE_SETTLE{100};
+        // how long after input a session's output is flushed as foreground
+        static constexpr std::chrono::milliseconds FOREGROUND_HOLD{1000};
+        // parse allowance a background session gains per round, times its weight: 1 for a hidden
+        // session, as much as SCREEN_PARSE_BUDGET lets it parse per flush, BACKGROUND_SHOWN_WEIGHT for
+        // one the frontend shows, a full default ring
+        static constexpr size_t BACKGROUND_QUANTUM = 256 * 1024;
+        static constexpr size_t BACKGROUND_SHOWN_WEIGHT = 4;
+        // bytes one background slice parses before foreground output gets its turn
+        static constexpr size_t BACKGROUND_SLICE = 256 * 1024;
+        // trigger matches reported per session and flush; a pattern in a flood of output is not
+        // worth more notifications than that
+        static constexpr size_t TRIGGER_MATCHES_PER_FLUSH = 16;
+
+        // a payload with room for its record header in front of it: a readable ring span, its
+        // sanitized copy, or an encoded screen diff
+        struct PendingRecord {
+            Session* session;
+            char* frame;
+            size_t length;
+            // ring bytes the record stands for, consumed once it is sent
+            size_t consumed;
+        };
+
+        struct SpawnJob {
+            std::string command;
+            int cols;
+            int rows;
+            CreateCallback done;
+            std::chrono::steady_clock::time_point requested_at;
+        };
+
+        struct PrewarmPool {
+            std::string command;
+            size_t count;
+            std::vector<std::shared_ptr<Session>> idle;
+        };
+
+        PTYManager() = default;
+        ~PTYManager() = default;
+
+        // starts the reactor, scheduler and spawner threads if they are not running
+        void start();
+        // ring, screen and history of a new session, without anything writing to it yet
+        std::shared_ptr<Session> make_session(const std::string& command, int cols, int rows);
+        // a running console whose output goes to its ring, not registered under an id yet
+        std::shared_ptr<Session> spawn(const std::string& command, int cols, int rows);
+        // reactor or player thread: bytes were committed to the session's ring
+        void on_output(Session& session, size_t bytes);
+        // an idle pooled session for command, or nullptr
+        std::shared_ptr<Session> take_prewarmed(const std::string& command);
+        // registers the session under a fresh id at the requested size
+        int adopt(const std::shared_ptr<Session>& session, int cols, int rows, std::chrono::steady_clock::time_point requested_at);
+        int create(const std::string& command, int cols, int rows, std::chrono::steady_clock::time_point requested_at);
+        void run_spawner();
+
+        // scheduler thread: flushes ids from the front, all of them for foreground, and returns how many
+        size_t flush(const std::vector<int>& ids, bool foreground);
+        // the session was written to within FOREGROUND_HOLD
+        static bool is_foreground(const Session& session);
+        // scheduler thread: feed up to limit bytes committed since the last flush into the session's
+        // screen, its recorder and the trigger scanner
+        void update_screen(Session& session, const std::pair<ByteRing::Span, ByteRing::Span>& spans, size_t limit);
+        // scheduler thread: where a stream record of the first `take` staged bytes should end
+        size_t stream_cut(Session& session, const std::pair<ByteRing::Span, ByteRing::Span>& spans, size_t take, bool whole);
+        static void close_session(int id, Session& session);
+        // the scheduler made room in the session's ring
+        static void resume_output(Session& session);
+        // scheduler thread, screen locked: the most recent history, written so that it ends up in a
+        // fresh terminal's scrollback
+        static void append_history(Session& session, std::string& out);
+
+        ShardedRegistry<Session> m_sessions;
+        std::atomic<int> m_last_id{0};
+
+        std::mutex m_mutex;
+        OutputSink m_sink;
+        std::shared_ptr<const PatternSet> m_triggers;
+        TriggerCallback m_trigger_callback;
+        std::string m_record_directory;
+        bool m_record_compress = false;
+        detail::Reactor m_reactor;
+        OutputScheduler m_scheduler;
+        bool m_running = false;
+
+        // Spawner thread: asynchronous creates first, then deferred closes, then pool refills. Process
+        // startup and shutdown both block for a while and never run on a UI callback.
+        std::mutex m_spawn_mutex;
+        std::condition_variable m_spawn_cv;
+        std::deque<SpawnJob> m_spawn_jobs;
+        std::vector<std::shared_ptr<Session>> m_retired;
+        std::vector<PrewarmPool> m_pools;
+        bool m_spawner_running = false;
+        std::thread m_spawner;
+        // size the last session was created or resized to, a good guess for the next one
+        std::atomic<int> m_last_cols{80};
+        std::atomic<int> m_last_rows{24};
+
+        // flush() scratch state, reused across frames; only touched on the scheduler thread
+        std::vector<std::pair<int, std::shared_ptr<Session>>> m_flush_sessions;
+        std::vector<PendingRecord> m_records;
+        std::vector<char> m_frame;
+        // the raw bytes of a stream record that has to be sanitized
+        std::string m_stream_raw;
+        // the trigger set for the current flush and the matches it found
+        std::shared_ptr<const PatternSet> m_flush_triggers;
+        std::vector<TriggerMatch> m_matches;
+        uint64_t m_trace_id = 0;
+        // the session a background slice stopped in the middle of, 0 for none; the next slice
+        // goes on with it without adding to its allowance
+        int m_resume_id = 0;
+
+        std::atomic<size_t> m_output_capacity{1024 * 1024};
+        std::atomic<size_t> m_high_watermark{512 * 1024};
+        std::atomic<size_t> m_low_watermark{128 * 1024};
+        std::atomic<RenderMode> m_default_render_mode{RenderMode::Stream};
+    };
+}// namespace noterm
+
+#endif
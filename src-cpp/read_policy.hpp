@@ -0,0 +1,47 @@
+#ifndef NOTERM_READ_POLICY_HPP
+#define NOTERM_READ_POLICY_HPP
+
+#include <chrono>
+#include <cstddef>
+
+namespace noterm {
+    // How much the reactor reads from a pty per wakeup. Each pty starts at min_read; the amount
+    // doubles while wakeups drain all of it, up to max_read, and halves again while they come back
+    // with less than min_read, which is what an interactive session looks like.
+    struct ReadPolicy {
+        size_t min_read = 4 * 1024;
+        size_t max_read = 256 * 1024;
+        // A pty that delivered at least min_read in one wakeup is polled again only after this long,
+        // so a busy stream of small writes is taken in fewer, larger reads; 0 polls it right away.
+        // Interactive sessions never wait.
+        std::chrono::microseconds batch_delay{300};
+    };
+
+    namespace detail {
+        // reactor thread: one pty's current read size under a ReadPolicy
+        class AdaptiveReadSize {
+        public:
+            size_t next(const ReadPolicy& policy) {
+                if (m_size < policy.min_read) m_size = policy.min_read;
+                if (m_size > policy.max_read) m_size = policy.max_read;
+                return m_size;
+            }
+
+            // after a wakeup that read `got` of the `asked` bytes; true when the pty counts as busy
+            bool update(const ReadPolicy& policy, size_t asked, size_t got) {
+                if (got >= asked) {
+                    m_size = asked * 2 < policy.max_read ? asked * 2 : policy.max_read;
+                    return true;
+                }
+                if (got >= policy.min_read) return true;
+                m_size = asked / 2 > policy.min_read ? asked / 2 : policy.min_read;
+                return false;
+            }
+
+        private:
+            size_t m_size = 0;
+        };
+    }// namespace detail
+}// namespace noterm
+
+#endif
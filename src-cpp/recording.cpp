@@ -0,0 +1,538 @@
+#include "recording.hpp"
+
+#include "frame.hpp"
+#include "log.hpp"
+#include "lz4_block.hpp"
+#include "utf8.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+namespace noterm {
+    namespace detail {
+        struct CastFile {
+            FILE* file = nullptr;
+            bool compress = false;
+            std::string path;
+            // a write failed; logged once, later blocks are discarded
+            bool failed = false;
+
+            ~CastFile() {
+                if (file) std::fclose(file);
+            }
+        };
+    }// namespace detail
+
+    namespace {
+        // a recorder hands its buffer over once it holds this much, or at its first event this long
+        // after the last hand-off
+        constexpr size_t HAND_OFF_SIZE = 64 * 1024;
+        constexpr std::chrono::seconds HAND_OFF_INTERVAL{1};
+        // blocks waiting for the writer across all recordings; more are dropped
+        constexpr size_t WRITE_QUEUE_LIMIT = 32 * 1024 * 1024;
+        // a compressed block claiming more than this is treated as corrupt
+        constexpr size_t MAX_BLOCK_SIZE = 64 * 1024 * 1024;
+        constexpr size_t READ_CHUNK = 64 * 1024;
+        constexpr std::chrono::milliseconds RESUME_POLL{10};
+
+        class CastWriter {
+        public:
+            CastWriter() : m_thread([this]() { run(); }) {}
+
+            ~CastWriter() {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_running = false;
+                }
+                m_cv.notify_all();
+                m_thread.join();
+            }
+
+            // False if the queue is full; the file is closed after the block if last. The last block
+            // is always queued: it is the tail of the recording, and at most one per recording.
+            bool push(const std::shared_ptr<detail::CastFile>& file, std::string text, bool last) {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (!last && m_queued_bytes + text.size() > WRITE_QUEUE_LIMIT) return false;
+                    m_queued_bytes += text.size();
+                    m_queue.push_back({file, std::move(text), last});
+                    ++m_queued;
+                }
+                m_cv.notify_all();
+                return true;
+            }
+
+            void flush() {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                uint64_t target = m_queued;
+                m_cv.wait(lock, [&]() { return m_written >= target || !m_running; });
+            }
+
+        private:
+            struct Job {
+                std::shared_ptr<detail::CastFile> file;
+                std::string text;
+                bool last;
+            };
+
+            void run() {
+                std::vector<Job> batch;
+                std::string packed;
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while (true) {
+                    m_cv.wait(lock, [this]() { return !m_running || !m_queue.empty(); });
+                    if (m_queue.empty() && !m_running) break;
+
+                    batch.swap(m_queue);
+                    lock.unlock();
+                    size_t bytes = 0;
+                    for (Job& job: batch) {
+                        bytes += job.text.size();
+                        write(*job.file, job.text, packed);
+                        if (job.last && job.file->file) {
+                            std::fclose(job.file->file);
+                            job.file->file = nullptr;
+                        }
+                    }
+                    lock.lock();
+                    m_queued_bytes -= bytes;
+                    m_written += batch.size();
+                    batch.clear();
+                    m_cv.notify_all();
+                }
+            }
+
+            static void write(detail::CastFile& file, const std::string& text, std::string& packed) {
+                if (text.empty() || !file.file || file.failed) return;
+                bool ok;
+                if (file.compress) {
+                    packed.assign(FRAME_HEADER_SIZE, '\0');
+                    size_t size = lz4::compress(text.data(), text.size(), packed);
+                    write_u32_le(packed.data(), static_cast<uint32_t>(text.size()));
+                    write_u32_le(packed.data() + 4, static_cast<uint32_t>(size));
+                    ok = std::fwrite(packed.data(), 1, packed.size(), file.file) == packed.size();
+                } else {
+                    ok = std::fwrite(text.data(), 1, text.size(), file.file) == text.size();
+                }
+                if (!ok || std::fflush(file.file) != 0) {
+                    file.failed = true;
+                    NOTERM_LOG_ERROR("Failed to write recording %s: %s", file.path.c_str(), std::strerror(errno));
+                }
+            }
+
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::vector<Job> m_queue;
+            size_t m_queued_bytes = 0;
+            uint64_t m_queued = 0;
+            uint64_t m_written = 0;
+            bool m_running = true;
+            // last: started once the queue above exists
+            std::thread m_thread;
+        };
+
+        CastWriter& writer() {
+            static CastWriter w;
+            return w;
+        }
+
+        // appends valid UTF-8 as the contents of a JSON string
+        void append_escaped(std::string& out, const char* data, size_t size) {
+            static const char hex[] = "0123456789abcdef";
+            size_t run = 0;
+            for (size_t i = 0; i < size; ++i) {
+                unsigned char c = static_cast<unsigned char>(data[i]);
+                if (c >= 0x20 && c != '"' && c != '\\') continue;
+                out.append(data + run, i - run);
+                run = i + 1;
+                switch (c) {
+                    case '"': out += "\\\""; break;
+                    case '\\': out += "\\\\"; break;
+                    case '\n': out += "\\n"; break;
+                    case '\r': out += "\\r"; break;
+                    case '\t': out += "\\t"; break;
+                    case '\b': out += "\\b"; break;
+                    default:
+                        out += "\\u00";
+                        out.push_back(hex[c >> 4]);
+                        out.push_back(hex[c & 15]);
+                        break;
+                }
+            }
+            out.append(data + run, size - run);
+        }
+
+        void append_utf8(std::string& out, uint32_t cp) {
+            if (cp < 0x80) {
+                out.push_back(static_cast<char>(cp));
+            } else if (cp < 0x800) {
+                out.push_back(static_cast<char>(0xc0 | cp >> 6));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            } else if (cp < 0x10000) {
+                out.push_back(static_cast<char>(0xe0 | cp >> 12));
+                out.push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            } else {
+                out.push_back(static_cast<char>(0xf0 | cp >> 18));
+                out.push_back(static_cast<char>(0x80 | (cp >> 12 & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            }
+        }
+
+        const char* skip_space(const char* p, const char* end) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+            return p;
+        }
+
+        bool parse_hex4(const char* p, const char* end, uint32_t& value) {
+            if (end - p < 4) return false;
+            value = 0;
+            for (int i = 0; i < 4; ++i) {
+                char c = p[i];
+                value <<= 4;
+                if (c >= '0' && c <= '9') value |= static_cast<uint32_t>(c - '0');
+                else if (c >= 'a' && c <= 'f') value |= static_cast<uint32_t>(c - 'a' + 10);
+                else if (c >= 'A' && c <= 'F') value |= static_cast<uint32_t>(c - 'A' + 10);
+                else return false;
+            }
+            return true;
+        }
+
+        // a JSON string starting at p; p ends up after its closing quote
+        bool parse_string(const char*& p, const char* end, std::string& out) {
+            out.clear();
+            if (p >= end || *p != '"') return false;
+            ++p;
+            while (p < end) {
+                const char* run = p;
+                while (p < end && *p != '"' && *p != '\\') ++p;
+                out.append(run, static_cast<size_t>(p - run));
+                if (p >= end) return false;
+                if (*p++ == '"') return true;
+                if (p >= end) return false;
+                switch (char c = *p++) {
+                    case 'n': out.push_back('\n'); break;
+                    case 'r': out.push_back('\r'); break;
+                    case 't': out.push_back('\t'); break;
+                    case 'b': out.push_back('\b'); break;
+                    case 'f': out.push_back('\f'); break;
+                    case 'u': {
+                        uint32_t cp;
+                        if (!parse_hex4(p, end, cp)) return false;
+                        p += 4;
+                        uint32_t low;
+                        if (cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+                            parse_hex4(p + 2, end, low) && low >= 0xdc00 && low < 0xe000) {
+                            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                            p += 6;
+                        } else if (cp >= 0xd800 && cp < 0xe000) {
+                            cp = 0xfffd;
+                        }
+                        append_utf8(out, cp);
+                        break;
+                    }
+                    default: out.push_back(c); break;
+                }
+            }
+            return false;
+        }
+
+        // value of a top-level integer field of the header, or fallback
+        long json_int(const std::string& object, const char* key, long fallback) {
+            std::string quoted = std::string("\"") + key + "\"";
+            size_t at = object.find(quoted);
+            if (at == std::string::npos) return fallback;
+            const char* p = skip_space(object.data() + at + quoted.size(), object.data() + object.size());
+            if (*p != ':') return fallback;
+            char* parsed;
+            long value = std::strtol(p + 1, &parsed, 10);
+            return parsed == p + 1 ? fallback : value;
+        }
+    }// namespace
+
+    Recorder::~Recorder() {
+        if (!m_file) return;
+        if (!m_carry.empty()) {
+            // the program stopped in the middle of a code point; it is replaced like any invalid byte
+            begin_event('o');
+            m_scratch.clear();
+            utf8::sanitize(m_carry.data(), m_carry.size(), m_scratch);
+            append_escaped(m_buffer, m_scratch.data(), m_scratch.size());
+            m_buffer += "\"]\n";
+        }
+        hand_off(true);
+    }
+
+    bool Recorder::open(const std::string& path, int cols, int rows, const std::string& command, bool compress) {
+        auto file = std::make_shared<detail::CastFile>();
+        file->file = std::fopen(path.c_str(), "wb");
+        if (!file->file) {
+            NOTERM_LOG_ERROR("Failed to create recording %s: %s", path.c_str(), std::strerror(errno));
+            return false;
+        }
+        file->compress = compress;
+        file->path = path;
+        // the magic goes out before any block; nothing else writes to the file yet
+        if (compress) std::fwrite(CAST_LZ4_MAGIC, 1, sizeof(CAST_LZ4_MAGIC), file->file);
+
+        m_file = std::move(file);
+        m_start = std::chrono::steady_clock::now();
+        m_handed_at = m_start;
+        char header[160];
+        std::snprintf(header, sizeof(header), "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %lld, \"env\": {\"TERM\": \"xterm-256color\"}",
+                      cols, rows, static_cast<long long>(std::time(nullptr)));
+        m_buffer = header;
+        if (!command.empty()) {
+            m_buffer += ", \"command\": \"";
+            utf8::sanitize(command.data(), command.size(), m_scratch);
+            append_escaped(m_buffer, m_scratch.data(), m_scratch.size());
+            m_buffer += "\"";
+        }
+        m_buffer += "}\n";
+        return true;
+    }
+
+    void Recorder::output(const char* data, size_t size) {
+        if (!m_file || size == 0) return;
+        if (!m_carry.empty()) {
+            m_carry.append(data, size);
+            m_carry.swap(m_scratch);
+            m_carry.clear();
+            data = m_scratch.data();
+            size = m_scratch.size();
+        }
+        size_t tail = utf8::incomplete_tail(data, size);
+        size_t body = size - tail;
+        if (body > 0) {
+            begin_event('o');
+            if (utf8::valid_prefix(data, body) == body) {
+                append_escaped(m_buffer, data, body);
+            } else {
+                std::string sanitized;
+                utf8::sanitize(data, body, sanitized);
+                append_escaped(m_buffer, sanitized.data(), sanitized.size());
+            }
+            end_event();
+        }
+        // may point into m_scratch, which is free again once the event is out
+        if (tail > 0) m_carry.assign(data + body, tail);
+    }
+
+    void Recorder::resize(int cols, int rows) {
+        if (!m_file) return;
+        begin_event('r');
+        m_buffer += std::to_string(cols) + "x" + std::to_string(rows);
+        end_event();
+    }
+
+    void Recorder::flush_all() {
+        writer().flush();
+    }
+
+    double Recorder::elapsed() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+    void Recorder::begin_event(char type) {
+        char prefix[48];
+        std::snprintf(prefix, sizeof(prefix), "[%.6f, \"%c\", \"", elapsed(), type);
+        m_buffer += prefix;
+    }
+
+    void Recorder::end_event() {
+        m_buffer += "\"]\n";
+        hand_off(false);
+    }
+
+    void Recorder::hand_off(bool last) {
+        if (!last) {
+            bool due = m_buffer.size() >= HAND_OFF_SIZE || std::chrono::steady_clock::now() - m_handed_at >= HAND_OFF_INTERVAL;
+            if (!due) return;
+        }
+        m_handed_at = std::chrono::steady_clock::now();
+        size_t size = m_buffer.size();
+        if (!writer().push(m_file, std::move(m_buffer), last)) {
+            if (m_dropped == 0) NOTERM_LOG_WARN("Recording %s falls behind, dropping output", m_file->path.c_str());
+            m_dropped += size;
+        }
+        if (last && m_dropped > 0) {
+            NOTERM_LOG_WARN("Recording %s is missing %llu bytes of output the writer could not keep up with", m_file->path.c_str(),
+                            static_cast<unsigned long long>(m_dropped));
+        }
+        m_buffer = std::string();
+        m_buffer.reserve(HAND_OFF_SIZE);
+        if (last) m_file.reset();
+    }
+
+    CastReader::~CastReader() {
+        if (m_file) std::fclose(m_file);
+    }
+
+    bool CastReader::open(const std::string& path) {
+        m_file = std::fopen(path.c_str(), "rb");
+        if (!m_file) {
+            NOTERM_LOG_ERROR("Failed to open recording %s: %s", path.c_str(), std::strerror(errno));
+            return false;
+        }
+        char magic[sizeof(CAST_LZ4_MAGIC)];
+        m_compressed = std::fread(magic, 1, sizeof(magic), m_file) == sizeof(magic) &&
+                       std::memcmp(magic, CAST_LZ4_MAGIC, sizeof(magic)) == 0;
+        if (!m_compressed) std::rewind(m_file);
+
+        std::string header;
+        if (!read_line(header) || header.empty() || header[0] != '{' || json_int(header, "version", 0) != 2) {
+            NOTERM_LOG_ERROR("%s is not an asciicast v2 recording", path.c_str());
+            std::fclose(m_file);
+            m_file = nullptr;
+            return false;
+        }
+        m_cols = static_cast<int>(json_int(header, "width", 80));
+        m_rows = static_cast<int>(json_int(header, "height", 24));
+        return true;
+    }
+
+    bool CastReader::next(CastEvent& event) {
+        while (read_line(m_line)) {
+            const char* p = m_line.data();
+            const char* end = p + m_line.size();
+            p = skip_space(p, end);
+            if (p >= end || *p != '[') continue;
+            char* parsed;
+            event.time = std::strtod(p + 1, &parsed);
+            if (parsed == p + 1) continue;
+            p = skip_space(parsed, end);
+            if (p >= end || *p != ',') continue;
+            p = skip_space(p + 1, end);
+            if (!parse_string(p, end, event.data) || event.data.empty()) continue;
+            event.type = event.data[0];
+            p = skip_space(p, end);
+            if (p >= end || *p != ',') continue;
+            p = skip_space(p + 1, end);
+            if (!parse_string(p, end, event.data)) continue;
+            return true;
+        }
+        return false;
+    }
+
+    bool CastReader::read_line(std::string& line) {
+        if (!m_file) return false;
+        size_t scanned = m_pos;
+        while (true) {
+            size_t newline = m_text.find('\n', scanned);
+            if (newline != std::string::npos) {
+                line.assign(m_text, m_pos, newline - m_pos);
+                m_pos = newline + 1;
+                return true;
+            }
+            m_text.erase(0, m_pos);
+            m_pos = 0;
+            scanned = m_text.size();
+            if (!refill()) break;
+        }
+        // the last line may lack its newline
+        if (m_text.empty()) return false;
+        line.swap(m_text);
+        m_text.clear();
+        return true;
+    }
+
+    bool CastReader::refill() {
+        if (!m_compressed) {
+            size_t at = m_text.size();
+            m_text.resize(at + READ_CHUNK);
+            size_t n = std::fread(m_text.data() + at, 1, READ_CHUNK, m_file);
+            m_text.resize(at + n);
+            return n > 0;
+        }
+
+        char header[FRAME_HEADER_SIZE];
+        if (std::fread(header, 1, sizeof(header), m_file) != sizeof(header)) return false;
+        size_t raw = read_u32_le(header);
+        size_t packed = read_u32_le(header + 4);
+        if (raw > MAX_BLOCK_SIZE || packed > MAX_BLOCK_SIZE) return false;
+        m_packed.resize(packed);
+        if (std::fread(m_packed.data(), 1, packed, m_file) != packed) return false;
+        size_t at = m_text.size();
+        m_text.resize(at + raw);
+        if (!lz4::decompress(m_packed.data(), packed, m_text.data() + at, raw)) {
+            m_text.resize(at);
+            NOTERM_LOG_ERROR("Corrupt block in compressed recording");
+            return false;
+        }
+        return true;
+    }
+
+    void CastPlayer::start(ByteRing* ring, double speed, std::chrono::milliseconds idle_limit, OutputHandler handler) {
+        m_ring = ring;
+        m_handler = std::move(handler);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = true;
+        }
+        m_thread = std::thread([this, speed, idle_limit]() { run(speed, idle_limit); });
+    }
+
+    void CastPlayer::stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+        }
+        m_cv.notify_all();
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    void CastPlayer::resume_output() {
+        if (!m_paused.load()) return;
+        // taken so the notification cannot fall between the player's check and its wait
+        { std::lock_guard<std::mutex> lock(m_mutex); }
+        m_cv.notify_all();
+    }
+
+    void CastPlayer::run(double speed, std::chrono::milliseconds idle_limit) {
+        auto start = std::chrono::steady_clock::now();
+        double limit = idle_limit.count() > 0 ? static_cast<double>(idle_limit.count()) / 1000.0 : 0;
+        double recorded = 0;
+        double at = 0;
+        CastEvent event;
+        while (m_reader.next(event)) {
+            if (event.type != 'o') continue;
+            double gap = event.time > recorded ? event.time - recorded : 0;
+            recorded = event.time;
+            at += limit > 0 && gap > limit ? limit : gap;
+            if (speed > 0) {
+                auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(at / speed));
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_cv.wait_until(lock, due, [this]() { return !m_running; })) return;
+            }
+            if (!write(event.data.data(), event.data.size())) return;
+        }
+        m_finished = true;
+        NOTERM_LOG_DEBUG("Replay finished");
+    }
+
+    bool CastPlayer::write(const char* data, size_t size) {
+        while (size > 0) {
+            ByteRing::Span span = m_ring->write_span();
+            if (span.second == 0) {
+                m_paused = true;
+                std::unique_lock<std::mutex> lock(m_mutex);
+                // the timeout covers a resume_output() that saw the flag before it was set
+                m_cv.wait_for(lock, RESUME_POLL, [this]() { return !m_running || m_ring->write_span().second > 0; });
+                m_paused = false;
+                if (!m_running) return false;
+                continue;
+            }
+            size_t n = size < span.second ? size : span.second;
+            std::memcpy(span.first, data, n);
+            m_ring->commit(n);
+            if (m_handler) m_handler(n);
+            data += n;
+            size -= n;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_running;
+    }
+}// namespace noterm
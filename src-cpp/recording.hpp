@@ -0,0 +1,155 @@
+#ifndef NOTERM_RECORDING_HPP
+#define NOTERM_RECORDING_HPP
+
+#include "ring_buffer.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace noterm {
+    namespace detail {
+        struct CastFile;
+    }
+
+    // Writes a session's output as an asciicast v2 recording, the format asciinema records and plays.
+    // Events are formatted on the calling thread into a buffer that is handed, a block at a time, to
+    // a background writer shared by every recording; the caller never waits for the disk. If the
+    // writer falls too far behind, whole blocks are dropped and counted instead.
+    //
+    // A compressed recording starts with CAST_LZ4_MAGIC and holds the same text as a series of
+    // [raw size u32 LE][packed size u32 LE][LZ4 block] records, one per block handed over.
+    class Recorder {
+    public:
+        Recorder() = default;
+        Recorder(const Recorder&) = delete;
+        Recorder& operator=(const Recorder&) = delete;
+        // hands over what is left and closes the file
+        ~Recorder();
+
+        // creates path and writes the header; false, logged, if the file cannot be created
+        bool open(const std::string& path, int cols, int rows, const std::string& command, bool compress);
+
+        // raw pty output; an incomplete code point at the end waits for the next call
+        void output(const char* data, size_t size);
+        void resize(int cols, int rows);
+
+        // bytes of events lost because the writer fell behind
+        uint64_t dropped() const { return m_dropped; }
+
+        // blocks until every block handed over so far is written
+        static void flush_all();
+
+    private:
+        double elapsed() const;
+        void begin_event(char type);
+        void end_event();
+        // hands the buffer to the writer, if it is due or last
+        void hand_off(bool last);
+
+        std::shared_ptr<detail::CastFile> m_file;
+        std::chrono::steady_clock::time_point m_start;
+        std::chrono::steady_clock::time_point m_handed_at;
+        std::string m_buffer;
+        // trailing bytes of a code point the last output() ended in the middle of
+        std::string m_carry;
+        std::string m_scratch;
+        uint64_t m_dropped = 0;
+    };
+
+    struct CastEvent {
+        // seconds since the start of the recording
+        double time = 0;
+        // 'o' output, 'i' input, 'r' resize ("COLSxROWS"), 'm' marker
+        char type = 0;
+        std::string data;
+    };
+
+    // Reads an asciicast v2 recording, plain or compressed by Recorder, one event at a time.
+    class CastReader {
+    public:
+        CastReader() = default;
+        CastReader(const CastReader&) = delete;
+        CastReader& operator=(const CastReader&) = delete;
+        ~CastReader();
+
+        // reads the header; false, logged, for a missing file or one that is not asciicast v2
+        bool open(const std::string& path);
+        int cols() const { return m_cols; }
+        int rows() const { return m_rows; }
+
+        // false at the end of the recording; malformed lines are skipped
+        bool next(CastEvent& event);
+
+    private:
+        // appends the next line to line without its newline; false at the end of the file
+        bool read_line(std::string& line);
+        // decodes more of the file into m_text; false at its end
+        bool refill();
+
+        FILE* m_file = nullptr;
+        bool m_compressed = false;
+        std::string m_text;
+        size_t m_pos = 0;
+        std::string m_packed;
+        std::string m_line;
+        int m_cols = 80;
+        int m_rows = 24;
+    };
+
+    // Plays a recording's output into a ring on its own thread, standing in for the pty of a
+    // session: the bytes go through the same staging, flow control and transport as live output.
+    class CastPlayer {
+    public:
+        // bytes committed to the ring, as the reactor reports a read
+        using OutputHandler = std::function<void(size_t bytes)>;
+
+        CastPlayer() = default;
+        CastPlayer(const CastPlayer&) = delete;
+        CastPlayer& operator=(const CastPlayer&) = delete;
+        ~CastPlayer() { stop(); }
+
+        bool open(const std::string& path) { return m_reader.open(path); }
+        int cols() const { return m_reader.cols(); }
+        int rows() const { return m_reader.rows(); }
+
+        // Speed 1 keeps the recorded timing, 2 plays twice as fast and 0 as fast as the consumer
+        // drains the ring. Pauses between events are capped at idle_limit (scaled by speed).
+        void start(ByteRing* ring, double speed, std::chrono::milliseconds idle_limit, OutputHandler handler);
+        // stops the thread; nothing is written to the ring afterwards
+        void stop();
+
+        // the consumer freed space in the ring
+        void resume_output();
+        // true while playback waits for space in the ring
+        bool output_paused() const { return m_paused.load(); }
+        bool finished() const { return m_finished.load(); }
+
+    private:
+        void run(double speed, std::chrono::milliseconds idle_limit);
+        // false if stopped before all of it was written
+        bool write(const char* data, size_t size);
+
+        CastReader m_reader;
+        ByteRing* m_ring = nullptr;
+        OutputHandler m_handler;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool m_running = false;
+        std::atomic_bool m_paused{false};
+        std::atomic_bool m_finished{false};
+        std::thread m_thread;
+    };
+
+    // first bytes of a compressed recording
+    constexpr char CAST_LZ4_MAGIC[8] = {'N', 'T', 'C', 'A', 'S', 'T', 'Z', '1'};
+}// namespace noterm
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef NOTERM_RING_BUFFER_HPP
+#define NOTERM_RING_BUFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace noterm {
+    // Single-producer/single-consumer byte ring.
+    //
+    // The producer reads straight into write_span() and publishes with commit(); the consumer takes
+    // read_span() and releases with consume(). The header_reserve bytes in front of every readable
+    // span belong to the consumer, so it can write a frame header there and hand header + payload to
+    // the transport as one contiguous buffer without copying the payload.
+    class ByteRing {
+    public:
+        using Span = std::pair<char*, size_t>;
+
+        ByteRing(size_t capacity, size_t header_reserve)
+            : m_capacity(round_up_pow2(capacity)),
+              m_mask(m_capacity - 1),
+              m_header_reserve(header_reserve),
+              m_storage(new char[header_reserve + m_capacity]) {}
+
+        ByteRing(const ByteRing&) = delete;
+        ByteRing& operator=(const ByteRing&) = delete;
+
+        size_t capacity() const { return m_capacity; }
+        size_t header_reserve() const { return m_header_reserve; }
+
+        // bytes committed but not yet consumed
+        size_t size() const {
+            return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+        }
+
+        // producer: contiguous free region, empty when the consumer is behind
+        Span write_span() {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            size_t tail = m_tail.load(std::memory_order_acquire);
+            // keep header_reserve bytes behind the consumer free, they may hold its frame header
+            size_t limit = m_capacity - m_header_reserve;
+            size_t used = head - tail;
+            if (used >= limit) return {nullptr, 0};
+            size_t offset = head & m_mask;
+            size_t contiguous = m_capacity - offset;
+            size_t free_bytes = limit - used;
+            return {data_at(offset), free_bytes < contiguous ? free_bytes : contiguous};
+        }
+
+        void commit(size_t n) {
+            m_head.store(m_head.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        }
+
+        // consumer: contiguous readable region; [span.first - header_reserve, span.first) is writable
+        Span read_span() {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            size_t head = m_head.load(std::memory_order_acquire);
+            if (head == tail) return {nullptr, 0};
+            size_t offset = tail & m_mask;
+            size_t contiguous = m_capacity - offset;
+            size_t used = head - tail;
+            return {data_at(offset), used < contiguous ? used : contiguous};
+        }
+
+        // consumer: every readable byte as up to two spans (the tail of the buffer, then the wrapped
+        // head); the header reserve in front of each is writable, the second one being the prefix
+        std::pair<Span, Span> read_spans() {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            size_t head = m_head.load(std::memory_order_acquire);
+            size_t used = head - tail;
+            size_t offset = tail & m_mask;
+            size_t contiguous = m_capacity - offset;
+            if (used <= contiguous) return {{used ? data_at(offset) : nullptr, used}, {nullptr, 0}};
+            return {{data_at(offset), contiguous}, {data_at(0), used - contiguous}};
+        }
+
+        void consume(size_t n) {
+            m_tail.store(m_tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        }
+
+    private:
+        static size_t round_up_pow2(size_t n) {
+            size_t v = 4096;
+            while (v < n) v <<= 1;
+            return v;
+        }
+
+        char* data_at(size_t offset) { return m_storage.get() + m_header_reserve + offset; }
+
+        const size_t m_capacity;
+        const size_t m_mask;
+        const size_t m_header_reserve;
+        std::unique_ptr<char[]> m_storage;
+
+        // monotonically increasing positions, masked on access
+        alignas(64) std::atomic<size_t> m_head{0};
+        alignas(64) std::atomic<size_t> m_tail{0};
+    };
+}// namespace noterm
+
+#endif
@@ -0,0 +1,778 @@
+#include "screen.hpp"
+
+#include <algorithm>
+
+namespace noterm {
+    namespace {
+        struct Range {
+            char32_t first;
+            char32_t last;
+        };
+
+        constexpr Range ZERO_WIDTH[] = {
+                {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A}, {0x064B, 0x065F},
+                {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF},
+                {0x200B, 0x200F}, {0x2028, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0xFE00, 0xFE0F},
+                {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0xE0100, 0xE01EF},
+        };
+
+        constexpr Range WIDE[] = {
+                {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0},
+                {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F},
+                {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5},
+                {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+                {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728},
+                {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+                {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+                {0x2E80, 0x303E}, {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+                {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F},
+                {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4}, {0x17000, 0x18CFF}, {0x1B000, 0x1B2FF},
+                {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F251},
+                {0x1F300, 0x1F64F}, {0x1F680, 0x1F6FF}, {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F9FF}, {0x1FA70, 0x1FAFF},
+                {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+        };
+
+        template<size_t N>
+        bool in_table(const Range (&table)[N], char32_t cp) {
+            if (cp < table[0].first || cp > table[N - 1].last) return false;
+            const Range* it = std::upper_bound(table, table + N, cp, [](char32_t c, const Range& r) { return c < r.first; });
+            return it != table && cp <= (it - 1)->last;
+        }
+
+        // DEC special graphics (line drawing) for 0x5F..0x7E
+        constexpr char32_t DEC_GRAPHICS[] = {
+                U' ', U'◆', U'▒', U'␉', U'␌', U'␍', U'␊', U'°', U'±', U'␤', U'␋', U'┘', U'┐', U'┌', U'└', U'┼',
+                U'⎺', U'⎻', U'─', U'⎼', U'⎽', U'├', U'┤', U'┴', U'┬', U'│', U'≤', U'≥', U'π', U'≠', U'£', U'·',
+        };
+
+        std::vector<bool> default_tab_stops(int cols) {
+            std::vector<bool> stops(cols, false);
+            for (int x = 8; x < cols; x += 8) stops[x] = true;
+            return stops;
+        }
+
+        // copies the overlapping part of a rotated grid into an unrotated one, dropping `shift` rows from the top
+        std::vector<Cell> resize_grid(const std::vector<Cell>& old, int base, int old_cols, int old_rows, int cols, int rows, int shift) {
+            std::vector<Cell> grid(static_cast<size_t>(cols) * rows);
+            int copy_rows = std::min(old_rows - shift, rows);
+            int copy_cols = std::min(old_cols, cols);
+            for (int y = 0; y < copy_rows; ++y) {
+                const Cell* src = old.data() + static_cast<size_t>((y + shift + base) % old_rows) * old_cols;
+                Cell* dst = grid.data() + static_cast<size_t>(y) * cols;
+                std::copy(src, src + copy_cols, dst);
+                // a wide character cut in half by the new right edge
+                if (dst[copy_cols - 1].attrs & ATTR_WIDE) dst[copy_cols - 1] = Cell{};
+            }
+            return grid;
+        }
+    }// namespace
+
+    void append_utf8(std::string& out, char32_t cp) {
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    int codepoint_width(char32_t cp) {
+        if (cp < 0x300) return 1;
+        if (in_table(ZERO_WIDTH, cp)) return 0;
+        if (in_table(WIDE, cp)) return 2;
+        return 1;
+    }
+
+    Screen::Screen(int cols, int rows)
+        : m_cols(std::max(cols, 1)),
+          m_rows(std::max(rows, 1)),
+          m_cells(static_cast<size_t>(m_cols) * m_rows),
+          m_other_cells(m_cells.size()),
+          m_row_generations(m_rows, m_generation),
+          m_scroll_bottom(m_rows - 1),
+          m_tab_stops(default_tab_stops(m_cols)) {}
+
+    void Screen::resize(int cols, int rows) {
+        cols = std::max(cols, 1);
+        rows = std::max(rows, 1);
+        if (cols == m_cols && rows == m_rows) return;
+
+        // keep the cursor row on screen: when shrinking past it, rows scroll off the top
+        int shift = std::max(0, m_cursor.y - (rows - 1));
+        if (!m_alternate && m_scroll_callback) {
+            for (int y = 0; y < shift; ++y) m_scroll_callback(static_cast<const Screen*>(this)->row(y), m_cols);
+        }
+        m_cells = resize_grid(m_cells, m_row_base, m_cols, m_rows, cols, rows, shift);
+        m_other_cells = resize_grid(m_other_cells, m_other_row_base, m_cols, m_rows, cols, rows, 0);
+        m_row_base = 0;
+        m_other_row_base = 0;
+        m_cols = cols;
+        m_rows = rows;
+        ++m_generation;
+        m_row_generations.assign(m_rows, m_generation);
+
+        m_cursor.y -= shift;
+        for (Cursor* c: {&m_cursor, &m_saved_cursor, &m_other_saved_cursor}) {
+            c->x = std::min(c->x, m_cols - 1);
+            c->y = std::min(c->y, m_rows - 1);
+            c->pending_wrap = false;
+        }
+        m_scroll_top = 0;
+        m_scroll_bottom = m_rows - 1;
+        m_tab_stops = default_tab_stops(m_cols);
+    }
+
+    std::string Screen::row_text(int y) const {
+        std::string out;
+        const Cell* r = row(y);
+        size_t trimmed = 0;
+        for (int x = 0; x < m_cols; ++x) {
+            if (r[x].attrs & ATTR_WIDE_SPACER) continue;
+            append_utf8(out, r[x].ch);
+            if (r[x].ch != U' ') trimmed = out.size();
+        }
+        out.resize(trimmed);
+        return out;
+    }
+
+    std::string Screen::text() const {
+        std::string out;
+        for (int y = 0; y < m_rows; ++y) {
+            if (y) out.push_back('\n');
+            out += row_text(y);
+        }
+        return out;
+    }
+
+    Cell Screen::blank() const {
+        // erased cells take the current background (back colour erase)
+        Cell c;
+        c.bg = m_cursor.pen.bg;
+        return c;
+    }
+
+    void Screen::print_ascii(const char* data, size_t size) {
+        m_last_char = static_cast<unsigned char>(data[size - 1]);
+        if (m_insert_mode || m_charsets[m_active_charset]) {
+            for (size_t i = 0; i < size; ++i) {
+                char32_t ch = static_cast<unsigned char>(data[i]);
+                if (m_charsets[m_active_charset] && ch >= 0x5F && ch <= 0x7E) ch = DEC_GRAPHICS[ch - 0x5F];
+                put(ch, 1);
+            }
+            return;
+        }
+
+        size_t i = 0;
+        while (i < size) {
+            wrap_if_pending();
+            Cell* r = row(m_cursor.y);
+            int x = m_cursor.x;
+            size_t room = static_cast<size_t>(m_cols - x);
+            size_t n = std::min(room, size - i);
+
+            if (r[x].attrs & ATTR_WIDE_SPACER && x > 0) r[x - 1] = blank();
+            if (x + n < static_cast<size_t>(m_cols) && r[x + n].attrs & ATTR_WIDE_SPACER) r[x + n] = blank();
+            Cell pen = m_cursor.pen;
+            for (size_t k = 0; k < n; ++k) {
+                pen.ch = static_cast<unsigned char>(data[i + k]);
+                r[x + k] = pen;
+            }
+            i += n;
+
+            if (x + static_cast<int>(n) >= m_cols) {
+                m_cursor.x = m_cols - 1;
+                if (m_autowrap) {
+                    m_cursor.pending_wrap = true;
+                } else if (i < size) {
+                    // without autowrap the rest piles up in the last column; only the final byte survives
+                    pen.ch = static_cast<unsigned char>(data[size - 1]);
+                    r[m_cols - 1] = pen;
+                    i = size;
+                }
+            } else {
+                m_cursor.x = x + static_cast<int>(n);
+            }
+        }
+    }
+
+    void Screen::print(char32_t codepoint) {
+        int width = codepoint_width(codepoint);
+        // combining marks are not stored; the base character stands in for the cluster
+        if (width == 0) return;
+        m_last_char = codepoint;
+        put(codepoint, width);
+    }
+
+    void Screen::put(char32_t ch, int width) {
+        if (width > m_cols) width = 1;
+        wrap_if_pending();
+        if (width == 2 && m_cursor.x == m_cols - 1) {
+            // does not fit: blank the last column and wrap early, as xterm does
+            if (!m_autowrap) return;
+            row(m_cursor.y)[m_cursor.x] = blank();
+            carriage_return();
+            linefeed();
+        }
+        if (m_insert_mode) insert_chars(width);
+
+        Cell* r = row(m_cursor.y);
+        int x = m_cursor.x;
+        if (r[x].attrs & ATTR_WIDE_SPACER && x > 0) r[x - 1] = blank();
+        int end = x + width;
+        if (end < m_cols && r[end].attrs & ATTR_WIDE_SPACER) r[end] = blank();
+
+        Cell cell = m_cursor.pen;
+        cell.ch = ch;
+        if (width == 2) {
+            cell.attrs |= ATTR_WIDE;
+            r[x] = cell;
+            cell.ch = U' ';
+            cell.attrs = static_cast<uint16_t>((cell.attrs & ~ATTR_WIDE) | ATTR_WIDE_SPACER);
+            r[x + 1] = cell;
+        } else {
+            r[x] = cell;
+        }
+
+        if (end >= m_cols) {
+            m_cursor.x = m_cols - 1;
+            m_cursor.pending_wrap = m_autowrap;
+        } else {
+            m_cursor.x = end;
+        }
+    }
+
+    void Screen::wrap_if_pending() {
+        if (!m_cursor.pending_wrap) return;
+        carriage_return();
+        linefeed();
+    }
+
+    void Screen::linefeed() {
+        m_cursor.pending_wrap = false;
+        if (m_cursor.y == m_scroll_bottom) {
+            scroll_up(m_scroll_top, m_scroll_bottom, 1);
+        } else if (m_cursor.y < m_rows - 1) {
+            ++m_cursor.y;
+        }
+    }
+
+    void Screen::reverse_index() {
+        m_cursor.pending_wrap = false;
+        if (m_cursor.y == m_scroll_top) {
+            scroll_down(m_scroll_top, m_scroll_bottom, 1);
+        } else if (m_cursor.y > 0) {
+            --m_cursor.y;
+        }
+    }
+
+    void Screen::move_to(int x, int y) {
+        int top = m_cursor.origin_mode ? m_scroll_top : 0;
+        int bottom = m_cursor.origin_mode ? m_scroll_bottom : m_rows - 1;
+        m_cursor.x = std::clamp(x, 0, m_cols - 1);
+        m_cursor.y = std::clamp(y, top, bottom);
+        m_cursor.pending_wrap = false;
+    }
+
+    void Screen::scroll_up(int top, int bottom, int n) {
+        n = std::min(n, bottom - top + 1);
+        if (n <= 0) return;
+        if (top == 0 && !m_alternate && m_scroll_callback) {
+            for (int y = 0; y < n; ++y) m_scroll_callback(static_cast<const Screen*>(this)->row(y), m_cols);
+        }
+        if (top == 0 && bottom == m_rows - 1) {
+            m_row_base = (m_row_base + n) % m_rows;
+            touch_all_rows();
+        } else {
+            for (int y = top; y + n <= bottom; ++y) std::copy(row(y + n), row(y + n) + m_cols, row(y));
+        }
+        for (int y = bottom + 1 - n; y <= bottom; ++y) std::fill(row(y), row(y) + m_cols, blank());
+    }
+
+    void Screen::scroll_down(int top, int bottom, int n) {
+        n = std::min(n, bottom - top + 1);
+        if (n <= 0) return;
+        if (top == 0 && bottom == m_rows - 1) {
+            m_row_base = (m_row_base + m_rows - n) % m_rows;
+            touch_all_rows();
+        } else {
+            for (int y = bottom; y - n >= top; --y) std::copy(row(y - n), row(y - n) + m_cols, row(y));
+        }
+        for (int y = top; y < top + n; ++y) std::fill(row(y), row(y) + m_cols, blank());
+    }
+
+    void Screen::erase_cells(int y, int from, int to) {
+        if (from >= to) return;
+        Cell* r = row(y);
+        // never leave half of a wide character behind
+        if (from > 0 && r[from].attrs & ATTR_WIDE_SPACER) r[from - 1] = blank();
+        if (to < m_cols && r[to].attrs & ATTR_WIDE_SPACER) r[to] = blank();
+        std::fill(r + from, r + to, blank());
+    }
+
+    void Screen::erase_display(int mode) {
+        switch (mode) {
+            case 0:
+                erase_cells(m_cursor.y, m_cursor.x, m_cols);
+                for (int y = m_cursor.y + 1; y < m_rows; ++y) erase_cells(y, 0, m_cols);
+                break;
+            case 1:
+                for (int y = 0; y < m_cursor.y; ++y) erase_cells(y, 0, m_cols);
+                erase_cells(m_cursor.y, 0, m_cursor.x + 1);
+                break;
+            case 2:
+            case 3:
+                for (int y = 0; y < m_rows; ++y) erase_cells(y, 0, m_cols);
+                break;
+            default:
+                break;
+        }
+        m_cursor.pending_wrap = false;
+    }
+
+    void Screen::erase_line(int mode) {
+        switch (mode) {
+            case 0:
+                erase_cells(m_cursor.y, m_cursor.x, m_cols);
+                break;
+            case 1:
+                erase_cells(m_cursor.y, 0, m_cursor.x + 1);
+                break;
+            case 2:
+                erase_cells(m_cursor.y, 0, m_cols);
+                break;
+            default:
+                break;
+        }
+        m_cursor.pending_wrap = false;
+    }
+
+    void Screen::insert_chars(int n) {
+        Cell* r = row(m_cursor.y);
+        int x = m_cursor.x;
+        n = std::min(n, m_cols - x);
+        if (r[x].attrs & ATTR_WIDE_SPACER && x > 0) {
+            r[x - 1] = blank();
+            r[x] = blank();
+        }
+        std::copy_backward(r + x, r + m_cols - n, r + m_cols);
+        std::fill(r + x, r + x + n, blank());
+        if (r[m_cols - 1].attrs & ATTR_WIDE) r[m_cols - 1] = blank();
+        m_cursor.pending_wrap = false;
+    }
+
+    void Screen::delete_chars(int n) {
+        Cell* r = row(m_cursor.y);
+        int x = m_cursor.x;
+        n = std::min(n, m_cols - x);
+        if (r[x].attrs & ATTR_WIDE_SPACER && x > 0) r[x - 1] = blank();
+        if (x + n < m_cols && r[x + n].attrs & ATTR_WIDE_SPACER) r[x + n] = blank();
+        std::copy(r + x + n, r + m_cols, r + x);
+        std::fill(r + m_cols - n, r + m_cols, blank());
+        if (r[x].attrs & ATTR_WIDE_SPACER) r[x] = blank();
+        m_cursor.pending_wrap = false;
+    }
+
+    void Screen::execute(uint8_t control) {
+        switch (control) {
+            case 0x08:// BS
+                if (m_cursor.x > 0) --m_cursor.x;
+                m_cursor.pending_wrap = false;
+                break;
+            case 0x09: {// HT
+                int x = m_cursor.x + 1;
+                while (x < m_cols - 1 && !m_tab_stops[x]) ++x;
+                m_cursor.x = std::min(x, m_cols - 1);
+                m_cursor.pending_wrap = false;
+                break;
+            }
+            case 0x0A:// LF, VT, FF
+            case 0x0B:
+            case 0x0C:
+                linefeed();
+                break;
+            case 0x0D:
+                carriage_return();
+                break;
+            case 0x0E:// SO: G1 into GL
+                m_active_charset = 1;
+                break;
+            case 0x0F:// SI: G0 into GL
+                m_active_charset = 0;
+                break;
+            default:
+                break;
+        }
+    }
+
+    void Screen::esc_dispatch(const vt::Sequence& seq) {
+        char intermediate = seq.intermediate();
+        if (intermediate == '(' || intermediate == ')') {
+            m_charsets[intermediate == ')'] = seq.final == '0';
+            return;
+        }
+        if (intermediate == '#') {
+            if (seq.final == '8') {
+                // DECALN: fill the screen with 'E'
+                Cell e;
+                e.ch = U'E';
+                std::fill(m_cells.begin(), m_cells.end(), e);
+                touch_all_rows();
+                move_to(0, 0);
+            }
+            return;
+        }
+        if (intermediate) return;
+
+        switch (seq.final) {
+            case '7':// DECSC
+                m_saved_cursor = m_cursor;
+                break;
+            case '8':// DECRC
+                m_cursor = m_saved_cursor;
+                break;
+            case 'D':// IND
+                linefeed();
+                break;
+            case 'E':// NEL
+                carriage_return();
+                linefeed();
+                break;
+            case 'M':// RI
+                reverse_index();
+                break;
+            case 'H':// HTS
+                m_tab_stops[m_cursor.x] = true;
+                break;
+            case 'c':// RIS
+                reset();
+                break;
+            case '=':// DECKPAM
+                m_application_keypad = true;
+                break;
+            case '>':// DECKPNM
+                m_application_keypad = false;
+                break;
+            default:
+                break;
+        }
+    }
+
+    void Screen::csi_dispatch(const vt::Sequence& seq) {
+        if (seq.prefix == '?') {
+            if (seq.final == 'h' || seq.final == 'l') set_mode(seq, seq.final == 'h');
+            return;
+        }
+        if (seq.prefix) return;
+
+        char intermediate = seq.intermediate();
+        if (intermediate == '!' && seq.final == 'p') {
+            // DECSTR soft reset: modes and pen, not the screen contents
+            m_cursor.pen = Cell{};
+            m_cursor.origin_mode = false;
+            m_autowrap = true;
+            m_insert_mode = false;
+            m_cursor_visible = true;
+            m_scroll_top = 0;
+            m_scroll_bottom = m_rows - 1;
+            m_saved_cursor = Cursor{};
+            return;
+        }
+        if (intermediate) return;
+
+        int n = seq.param(0, 1);
+        int top = m_cursor.y >= m_scroll_top ? m_scroll_top : 0;
+        int bottom = m_cursor.y <= m_scroll_bottom ? m_scroll_bottom : m_rows - 1;
+        int origin = m_cursor.origin_mode ? m_scroll_top : 0;
+
+        switch (seq.final) {
+            case '@':// ICH
+                insert_chars(n);
+                break;
+            case 'A':// CUU
+                m_cursor.y = std::max(m_cursor.y - n, top);
+                m_cursor.pending_wrap = false;
+                break;
+            case 'B':// CUD
+            case 'e':// VPR
+                m_cursor.y = std::min(m_cursor.y + n, bottom);
+                m_cursor.pending_wrap = false;
+                break;
+            case 'C':// CUF
+            case 'a':// HPR
+                m_cursor.x = std::min(m_cursor.x + n, m_cols - 1);
+                m_cursor.pending_wrap = false;
+                break;
+            case 'D':// CUB
+                m_cursor.x = std::max(m_cursor.x - n, 0);
+                m_cursor.pending_wrap = false;
+                break;
+            case 'E':// CNL
+                m_cursor.y = std::min(m_cursor.y + n, bottom);
+                carriage_return();
+                break;
+            case 'F':// CPL
+                m_cursor.y = std::max(m_cursor.y - n, top);
+                carriage_return();
+                break;
+            case 'G':// CHA
+            case '`':// HPA
+                move_to(n - 1, m_cursor.y);
+                break;
+            case 'H':// CUP
+            case 'f':// HVP
+                move_to(seq.param(1, 1) - 1, origin + n - 1);
+                break;
+            case 'I':// CHT
+                for (int i = 0; i < n; ++i) execute(0x09);
+                break;
+            case 'J':// ED
+                erase_display(seq.raw_param(0));
+                break;
+            case 'K':// EL
+                erase_line(seq.raw_param(0));
+                break;
+            case 'L':// IL
+                if (m_cursor.y >= m_scroll_top && m_cursor.y <= m_scroll_bottom) {
+                    scroll_down(m_cursor.y, m_scroll_bottom, n);
+                    carriage_return();
+                }
+                break;
+            case 'M':// DL
+                if (m_cursor.y >= m_scroll_top && m_cursor.y <= m_scroll_bottom) {
+                    scroll_up(m_cursor.y, m_scroll_bottom, n);
+                    carriage_return();
+                }
+                break;
+            case 'P':// DCH
+                delete_chars(n);
+                break;
+            case 'S':// SU
+                scroll_up(m_scroll_top, m_scroll_bottom, n);
+                break;
+            case 'T':// SD
+                scroll_down(m_scroll_top, m_scroll_bottom, n);
+                break;
+            case 'X':// ECH
+                erase_cells(m_cursor.y, m_cursor.x, std::min(m_cursor.x + n, m_cols));
+                m_cursor.pending_wrap = false;
+                break;
+            case 'Z':// CBT
+                for (int i = 0; i < n && m_cursor.x > 0; ++i) {
+                    do {
+                        --m_cursor.x;
+                    } while (m_cursor.x > 0 && !m_tab_stops[m_cursor.x]);
+                }
+                m_cursor.pending_wrap = false;
+                break;
+            case 'b':// REP
+                for (int i = 0; i < n && m_last_char; ++i) print(m_last_char);
+                break;
+            case 'd':// VPA
+                move_to(m_cursor.x, origin + n - 1);
+                break;
+            case 'g':// TBC
+                if (seq.raw_param(0) == 0) m_tab_stops[m_cursor.x] = false;
+                else if (seq.raw_param(0) == 3) std::fill(m_tab_stops.begin(), m_tab_stops.end(), false);
+                break;
+            case 'h':
+            case 'l':
+                set_mode(seq, seq.final == 'h');
+                break;
+            case 'm':
+                select_graphic_rendition(seq);
+                break;
+            case 'r': {// DECSTBM
+                int new_top = seq.param(0, 1) - 1;
+                int new_bottom = std::min(seq.param(1, m_rows), m_rows) - 1;
+                if (new_top < new_bottom) {
+                    m_scroll_top = new_top;
+                    m_scroll_bottom = new_bottom;
+                    move_to(0, m_cursor.origin_mode ? m_scroll_top : 0);
+                }
+                break;
+            }
+            case 's':// SCOSC
+                m_saved_cursor = m_cursor;
+                break;
+            case 'u':// SCORC
+                m_cursor = m_saved_cursor;
+                break;
+            default:
+                break;
+        }
+    }
+
+    void Screen::osc_dispatch(std::string_view data) {
+        size_t semicolon = data.find(';');
+        if (semicolon == std::string_view::npos) return;
+        std::string_view command = data.substr(0, semicolon);
+        // OSC 0 sets icon name and title, OSC 2 the title
+        if (command == "0" || command == "2") m_title.assign(data.substr(semicolon + 1));
+    }
+
+    void Screen::set_mode(const vt::Sequence& seq, bool enable) {
+        for (int i = 0; i < seq.param_count; ++i) {
+            int mode = seq.raw_param(i);
+            if (seq.prefix != '?') {
+                if (mode == 4) m_insert_mode = enable;// IRM
+                continue;
+            }
+            switch (mode) {
+                case 6:// DECOM
+                    m_cursor.origin_mode = enable;
+                    move_to(0, enable ? m_scroll_top : 0);
+                    break;
+                case 7:// DECAWM
+                    m_autowrap = enable;
+                    if (!enable) m_cursor.pending_wrap = false;
+                    break;
+                case 25:// DECTCEM
+                    m_cursor_visible = enable;
+                    break;
+                case 47:
+                case 1047:
+                    switch_screen(enable, false);
+                    break;
+                case 1049:
+                    switch_screen(enable, true);
+                    break;
+                default:
+                    for (int m = 0; m < TRACKED_MODE_COUNT; ++m) {
+                        if (TRACKED_MODES[m] != mode) continue;
+                        if (enable) m_tracked_modes |= 1u << m;
+                        else m_tracked_modes &= ~(1u << m);
+                    }
+                    break;
+            }
+        }
+    }
+
+    void Screen::select_graphic_rendition(const vt::Sequence& seq) {
+        Cell& pen = m_cursor.pen;
+        if (seq.param_count == 0) {
+            pen = Cell{};
+            return;
+        }
+
+        // 38/48: ";5;n", ";2;r;g;b" or the colon forms ":5:n", ":2:r:g:b" and ":2:cs:r:g:b"
+        auto extended_color = [&](int& i) -> uint32_t {
+            bool colon = seq.is_subparam(i + 1);
+            int mode = seq.raw_param(i + 1);
+            int base = i + 2;
+            int last = i + 1;
+            if (colon) {
+                while (seq.is_subparam(last + 1)) ++last;
+                // a colour space id precedes r:g:b when all four are present
+                if (mode == 2 && last - (i + 1) >= 4) ++base;
+            } else {
+                last = mode == 5 ? i + 2 : mode == 2 ? i + 4 : i + 1;
+            }
+            i = std::min(last, seq.param_count - 1);
+            if (mode == 5) return COLOR_INDEXED | (seq.raw_param(base) & 0xFF);
+            if (mode == 2) {
+                return COLOR_RGB | ((seq.raw_param(base) & 0xFF) << 16) | ((seq.raw_param(base + 1) & 0xFF) << 8) |
+                       (seq.raw_param(base + 2) & 0xFF);
+            }
+            return COLOR_DEFAULT;
+        };
+
+        for (int i = 0; i < seq.param_count; ++i) {
+            int p = seq.raw_param(i);
+            if (p == 38) {
+                pen.fg = extended_color(i);
+                continue;
+            }
+            if (p == 48) {
+                pen.bg = extended_color(i);
+                continue;
+            }
+
+            if (p == 0) pen = Cell{};
+            else if (p == 1) pen.attrs |= ATTR_BOLD;
+            else if (p == 2) pen.attrs |= ATTR_DIM;
+            else if (p == 3) pen.attrs |= ATTR_ITALIC;
+            else if (p == 4) {
+                // 4:0 turns underline off; other styles (double, curly, ...) are plain underline here
+                if (seq.is_subparam(i + 1) && seq.raw_param(i + 1) == 0) pen.attrs &= ~ATTR_UNDERLINE;
+                else pen.attrs |= ATTR_UNDERLINE;
+            } else if (p == 5 || p == 6) pen.attrs |= ATTR_BLINK;
+            else if (p == 7) pen.attrs |= ATTR_INVERSE;
+            else if (p == 8) pen.attrs |= ATTR_HIDDEN;
+            else if (p == 9) pen.attrs |= ATTR_STRIKE;
+            else if (p == 21) pen.attrs |= ATTR_UNDERLINE;
+            else if (p == 22) pen.attrs &= ~(ATTR_BOLD | ATTR_DIM);
+            else if (p == 23) pen.attrs &= ~ATTR_ITALIC;
+            else if (p == 24) pen.attrs &= ~ATTR_UNDERLINE;
+            else if (p == 25) pen.attrs &= ~ATTR_BLINK;
+            else if (p == 27) pen.attrs &= ~ATTR_INVERSE;
+            else if (p == 28) pen.attrs &= ~ATTR_HIDDEN;
+            else if (p == 29) pen.attrs &= ~ATTR_STRIKE;
+            else if (p >= 30 && p <= 37) pen.fg = COLOR_INDEXED | (p - 30);
+            else if (p == 39) pen.fg = COLOR_DEFAULT;
+            else if (p >= 40 && p <= 47) pen.bg = COLOR_INDEXED | (p - 40);
+            else if (p == 49) pen.bg = COLOR_DEFAULT;
+            else if (p >= 90 && p <= 97) pen.fg = COLOR_INDEXED | (p - 90 + 8);
+            else if (p >= 100 && p <= 107) pen.bg = COLOR_INDEXED | (p - 100 + 8);
+
+            while (seq.is_subparam(i + 1)) ++i;
+        }
+    }
+
+    void Screen::switch_screen(bool alternate, bool save_cursor) {
+        if (alternate == m_alternate) return;
+        if (alternate && save_cursor) m_saved_cursor = m_cursor;
+
+        m_cells.swap(m_other_cells);
+        std::swap(m_row_base, m_other_row_base);
+        std::swap(m_saved_cursor, m_other_saved_cursor);
+        m_alternate = alternate;
+
+        if (alternate) {
+            std::fill(m_cells.begin(), m_cells.end(), blank());
+        } else if (save_cursor) {
+            m_cursor = m_saved_cursor;
+        }
+        m_cursor.pending_wrap = false;
+        touch_all_rows();
+    }
+
+    void Screen::touch_all_rows() {
+        std::fill(m_row_generations.begin(), m_row_generations.end(), m_generation);
+    }
+
+    void Screen::reset() {
+        if (m_alternate) {
+            m_cells.swap(m_other_cells);
+            m_alternate = false;
+        }
+        m_row_base = 0;
+        m_other_row_base = 0;
+        std::fill(m_cells.begin(), m_cells.end(), Cell{});
+        std::fill(m_other_cells.begin(), m_other_cells.end(), Cell{});
+        m_cursor = Cursor{};
+        m_saved_cursor = Cursor{};
+        m_other_saved_cursor = Cursor{};
+        m_scroll_top = 0;
+        m_scroll_bottom = m_rows - 1;
+        m_tab_stops = default_tab_stops(m_cols);
+        m_autowrap = true;
+        m_insert_mode = false;
+        m_cursor_visible = true;
+        m_application_keypad = false;
+        m_tracked_modes = 0;
+        m_charsets[0] = m_charsets[1] = false;
+        m_active_charset = 0;
+        m_last_char = 0;
+        m_title.clear();
+        touch_all_rows();
+    }
+}// namespace noterm
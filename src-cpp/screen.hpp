@@ -0,0 +1,182 @@
+#ifndef NOTERM_SCREEN_HPP
+#define NOTERM_SCREEN_HPP
+
+#include "vt.hpp"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace noterm {
+    // Colours are packed into a u32: 0 is the default colour, COLOR_INDEXED | n a palette entry and
+    // COLOR_RGB | 0xRRGGBB a true colour.
+    constexpr uint32_t COLOR_DEFAULT = 0;
+    constexpr uint32_t COLOR_INDEXED = 0x01000000;
+    constexpr uint32_t COLOR_RGB = 0x02000000;
+
+    enum CellAttr : uint16_t {
+        ATTR_BOLD = 1 << 0,
+        ATTR_DIM = 1 << 1,
+        ATTR_ITALIC = 1 << 2,
+        ATTR_UNDERLINE = 1 << 3,
+        ATTR_BLINK = 1 << 4,
+        ATTR_INVERSE = 1 << 5,
+        ATTR_HIDDEN = 1 << 6,
+        ATTR_STRIKE = 1 << 7,
+        // first half of a double-width character
+        ATTR_WIDE = 1 << 8,
+        // second half of a double-width character, holds no character of its own
+        ATTR_WIDE_SPACER = 1 << 9,
+    };
+
+    struct Cell {
+        char32_t ch = U' ';
+        uint32_t fg = COLOR_DEFAULT;
+        uint32_t bg = COLOR_DEFAULT;
+        uint16_t attrs = 0;
+    };
+
+    // columns occupied by a code point: 0 for combining marks, 2 for East Asian wide and emoji
+    int codepoint_width(char32_t cp);
+
+    void append_utf8(std::string& out, char32_t cp);
+
+    // DEC private modes the screen does not act on but remembers, so a repaint can restore them on
+    // the frontend: cursor keys, mouse reporting and encodings, focus events, bracketed paste
+    constexpr int TRACKED_MODES[] = {1, 9, 1000, 1002, 1003, 1004, 1005, 1006, 1015, 2004};
+    constexpr int TRACKED_MODE_COUNT = sizeof(TRACKED_MODES) / sizeof(TRACKED_MODES[0]);
+
+    // Headless cell-grid model of what the terminal shows, fed by vt::Parser. Covers what shells and
+    // full-screen programs rely on: cursor movement, erase/insert/delete, scroll regions, SGR, the
+    // alternate screen and autowrap. Not thread-safe; the owner serialises feed and reads.
+    class Screen : public vt::Handler {
+    public:
+        // receives each row about to scroll off the top of the primary screen
+        using ScrollCallback = std::function<void(const Cell* row, int cols)>;
+
+        Screen(int cols, int rows);
+
+        void feed(const char* data, size_t size) {
+            ++m_generation;
+            m_parser.feed(data, size);
+        }
+        void resize(int cols, int rows);
+
+        void set_scroll_callback(ScrollCallback callback) { m_scroll_callback = std::move(callback); }
+
+        // Bumped by every feed and resize. A row whose generation is newer than the generation a
+        // consumer last saw has changed since, which is all a diffing renderer needs.
+        uint64_t generation() const { return m_generation; }
+        uint64_t row_generation(int y) const { return m_row_generations[y]; }
+
+        int cols() const { return m_cols; }
+        int rows() const { return m_rows; }
+        int cursor_x() const { return m_cursor.x; }
+        int cursor_y() const { return m_cursor.y; }
+        bool cursor_pending_wrap() const { return m_cursor.pending_wrap; }
+        bool cursor_visible() const { return m_cursor_visible; }
+        const Cell& pen() const { return m_cursor.pen; }
+        int scroll_top() const { return m_scroll_top; }
+        int scroll_bottom() const { return m_scroll_bottom; }
+        bool autowrap() const { return m_autowrap; }
+        bool insert_mode() const { return m_insert_mode; }
+        // G0 (0) or G1 (1) is designated as DEC special graphics
+        bool dec_graphics(int g) const { return m_charsets[g]; }
+        int active_charset() const { return m_active_charset; }
+        bool alternate_screen() const { return m_alternate; }
+        bool application_keypad() const { return m_application_keypad; }
+        // bit i: TRACKED_MODES[i] is set
+        uint32_t tracked_modes() const { return m_tracked_modes; }
+        bool bracketed_paste() const { return m_tracked_modes & (1u << (TRACKED_MODE_COUNT - 1)); }
+        const std::string& title() const { return m_title; }
+
+        const Cell& cell(int x, int y) const { return row(y)[x]; }
+        // UTF-8 text of one row, trailing blanks trimmed
+        std::string row_text(int y) const;
+        // every row, joined with '\n'
+        std::string text() const;
+
+        // vt::Handler
+        void print_ascii(const char* data, size_t size) override;
+        void print(char32_t codepoint) override;
+        void execute(uint8_t control) override;
+        void esc_dispatch(const vt::Sequence& seq) override;
+        void csi_dispatch(const vt::Sequence& seq) override;
+        void osc_dispatch(std::string_view data) override;
+
+    private:
+        struct Cursor {
+            int x = 0;
+            int y = 0;
+            // the last column was written; the next printable wraps first (xterm's deferred wrap)
+            bool pending_wrap = false;
+            // colours and attributes applied to newly written and erased cells
+            Cell pen;
+            bool origin_mode = false;
+        };
+
+        // rows are stored rotated by m_row_base, so a full-screen scroll only moves the base;
+        // mutable access stamps the row with the current generation
+        Cell* row(int y) {
+            m_row_generations[y] = m_generation;
+            return m_cells.data() + static_cast<size_t>((y + m_row_base) % m_rows) * m_cols;
+        }
+        const Cell* row(int y) const { return m_cells.data() + static_cast<size_t>((y + m_row_base) % m_rows) * m_cols; }
+        Cell blank() const;
+
+        void put(char32_t ch, int width);
+        void wrap_if_pending();
+        void linefeed();
+        void reverse_index();
+        void carriage_return() { m_cursor.x = 0; m_cursor.pending_wrap = false; }
+        void move_to(int x, int y);
+        void scroll_up(int top, int bottom, int n);
+        void scroll_down(int top, int bottom, int n);
+        void erase_cells(int y, int from, int to);
+        void erase_display(int mode);
+        void erase_line(int mode);
+        void insert_chars(int n);
+        void delete_chars(int n);
+        void set_mode(const vt::Sequence& seq, bool enable);
+        void select_graphic_rendition(const vt::Sequence& seq);
+        void switch_screen(bool alternate, bool save_cursor);
+        void reset();
+        void touch_all_rows();
+
+        vt::Parser m_parser{*this};
+
+        int m_cols;
+        int m_rows;
+        std::vector<Cell> m_cells;
+        // the grid of the screen not currently shown (primary while the alternate one is active)
+        std::vector<Cell> m_other_cells;
+        int m_row_base = 0;
+        int m_other_row_base = 0;
+        // indexed by visible row, not storage row
+        std::vector<uint64_t> m_row_generations;
+        uint64_t m_generation = 1;
+        ScrollCallback m_scroll_callback;
+        bool m_alternate = false;
+
+        Cursor m_cursor;
+        Cursor m_saved_cursor;
+        Cursor m_other_saved_cursor;
+        int m_scroll_top = 0;
+        int m_scroll_bottom = 0;
+        std::vector<bool> m_tab_stops;
+
+        bool m_autowrap = true;
+        bool m_insert_mode = false;
+        bool m_cursor_visible = true;
+        bool m_application_keypad = false;
+        uint32_t m_tracked_modes = 0;
+        // G0/G1 designated as DEC special graphics, and which one is invoked into GL
+        bool m_charsets[2] = {false, false};
+        int m_active_charset = 0;
+        // last printed character, for REP
+        char32_t m_last_char = 0;
+        std::string m_title;
+    };
+}// namespace noterm
+
+#endif
@@ -0,0 +1,226 @@
+#include "screen_encoder.hpp"
+
+namespace noterm {
+    namespace {
+        void append_number(std::string& out, unsigned v) {
+            char digits[10];
+            int n = 0;
+            do {
+                digits[n++] = static_cast<char>('0' + v % 10);
+                v /= 10;
+            } while (v);
+            while (n) out.push_back(digits[--n]);
+        }
+
+        void move_cursor(std::string& out, int x, int y) {
+            out += "\x1b[";
+            append_number(out, static_cast<unsigned>(y + 1));
+            out.push_back(';');
+            append_number(out, static_cast<unsigned>(x + 1));
+            out.push_back('H');
+        }
+
+        void append_color(std::string& out, uint32_t color, bool background) {
+            uint32_t value = color & 0xFFFFFF;
+            if ((color & COLOR_INDEXED) && value < 8) {
+                out.push_back(';');
+                append_number(out, (background ? 40 : 30) + value);
+            } else if ((color & COLOR_INDEXED) && value < 16) {
+                out.push_back(';');
+                append_number(out, (background ? 100 : 90) + value - 8);
+            } else if (color & COLOR_INDEXED) {
+                out += background ? ";48;5;" : ";38;5;";
+                append_number(out, value);
+            } else if (color & COLOR_RGB) {
+                out += background ? ";48;2;" : ";38;2;";
+                append_number(out, (value >> 16) & 0xFF);
+                out.push_back(';');
+                append_number(out, (value >> 8) & 0xFF);
+                out.push_back(';');
+                append_number(out, value & 0xFF);
+            }
+        }
+
+        bool is_default_blank(const Cell& cell) {
+            // the second half of a wide character is not blank: erasing it would erase the character
+            return cell.ch == U' ' && cell.fg == COLOR_DEFAULT && cell.bg == COLOR_DEFAULT && cell.attrs == 0;
+        }
+
+        constexpr uint16_t PEN_ATTRS = static_cast<uint16_t>(~(ATTR_WIDE | ATTR_WIDE_SPACER));
+
+        struct SgrFlag {
+            uint16_t attr;
+            const char* code;
+        };
+        constexpr SgrFlag SGR_FLAGS[] = {
+                {ATTR_BOLD, ";1"}, {ATTR_DIM, ";2"}, {ATTR_ITALIC, ";3"}, {ATTR_UNDERLINE, ";4"},
+                {ATTR_BLINK, ";5"}, {ATTR_INVERSE, ";7"}, {ATTR_HIDDEN, ";8"}, {ATTR_STRIKE, ";9"},
+        };
+
+        bool same_pen(const Cell& a, const Cell& b) {
+            return (a.attrs & PEN_ATTRS) == (b.attrs & PEN_ATTRS) && a.fg == b.fg && a.bg == b.bg;
+        }
+
+        // absolute SGR for the colours and attributes of cell
+        void append_sgr(std::string& out, const Cell& cell) {
+            out += "\x1b[0";
+            for (const SgrFlag& flag: SGR_FLAGS) {
+                if (cell.attrs & flag.attr) out += flag.code;
+            }
+            append_color(out, cell.fg, false);
+            append_color(out, cell.bg, true);
+            out.push_back('m');
+        }
+    }// namespace
+
+    void encode_line(const Cell* cells, int count, std::string& out) {
+        while (count > 0 && is_default_blank(cells[count - 1])) --count;
+        Cell pen;
+        for (int x = 0; x < count; ++x) {
+            const Cell& cell = cells[x];
+            if (cell.attrs & ATTR_WIDE_SPACER) continue;
+            if (!same_pen(cell, pen)) {
+                append_sgr(out, cell);
+                pen = cell;
+            }
+            append_utf8(out, cell.ch);
+        }
+        if (!same_pen(pen, Cell{})) out += "\x1b[0m";
+    }
+
+    void PendingScrollback::push(const Cell* row, int cols) {
+        if (m_lines.empty()) return;
+        if (m_count == m_lines.size()) {
+            m_first = (m_first + 1) % m_lines.size();
+            --m_count;
+        }
+        std::vector<Cell>& line = m_lines[(m_first + m_count) % m_lines.size()];
+        int end = cols;
+        while (end > 0 && is_default_blank(row[end - 1])) --end;
+        line.assign(row, row + end);
+        ++m_count;
+    }
+
+    void ScreenEncoder::set_pen(const Cell& cell, std::string& out) {
+        if (same_pen(cell, m_pen)) return;
+        append_sgr(out, cell);
+        m_pen.attrs = cell.attrs & PEN_ATTRS;
+        m_pen.fg = cell.fg;
+        m_pen.bg = cell.bg;
+    }
+
+    void ScreenEncoder::encode_row(const Cell* cells, int count, int cols, std::string& out) {
+        int end = count;
+        while (end > 0 && is_default_blank(cells[end - 1])) --end;
+        for (int x = 0; x < end; ++x) {
+            const Cell& cell = cells[x];
+            if (cell.attrs & ATTR_WIDE_SPACER) continue;
+            set_pen(cell, out);
+            append_utf8(out, cell.ch);
+        }
+        // the rest of the row is default blanks; writing up to the last column would leave nothing to erase
+        if (end < cols) {
+            set_pen(Cell{}, out);
+            out += "\x1b[K";
+        }
+    }
+
+    void ScreenEncoder::encode(const Screen& screen, PendingScrollback& scrollback, std::string& out) {
+        int rows = screen.rows();
+        int cols = screen.cols();
+        bool full = !m_valid;
+
+        // hide the cursor while painting; plain ASCII charsets, replace mode, absolute addressing
+        out += "\x1b[?25l\x1b[0m\x1b(B\x1b)B\x0f\x1b[4l\x1b[?6l";
+        m_pen = Cell{};
+
+        // Lines are pushed into the remote history through a two-row scroll region at the top:
+        // each is painted on row 1, then a linefeed on row 2 scrolls it into the scrollback.
+        bool top_rows_clobbered = false;
+        if (!scrollback.empty() && rows >= 2) {
+            if (m_alternate) {
+                out += "\x1b[?1049l";
+                m_alternate = false;
+                full = true;
+            }
+            out += "\x1b[1;2r";
+            for (size_t i = 0; i < scrollback.size(); ++i) {
+                const std::vector<Cell>& line = scrollback.line(i);
+                out += "\x1b[1;1H";
+                encode_row(line.data(), static_cast<int>(line.size()), cols, out);
+                out += "\x1b[2;1H\n";
+            }
+            top_rows_clobbered = true;
+        }
+        scrollback.clear();
+        out += "\x1b[r";
+
+        if (screen.alternate_screen() != m_alternate) {
+            out += screen.alternate_screen() ? "\x1b[?1049h" : "\x1b[?1049l";
+            m_alternate = screen.alternate_screen();
+            full = true;
+        }
+
+        for (int y = 0; y < rows; ++y) {
+            if (!full && screen.row_generation(y) <= m_generation && !(top_rows_clobbered && y < 2)) continue;
+            move_cursor(out, 0, y);
+            encode_row(&screen.cell(0, y), cols, cols, out);
+        }
+
+        if (full || screen.title() != m_title) {
+            m_title = screen.title();
+            out += "\x1b]2;";
+            out += m_title;
+            out.push_back('\x07');
+        }
+
+        uint32_t modes = screen.tracked_modes();
+        for (int m = 0; m < TRACKED_MODE_COUNT; ++m) {
+            uint32_t bit = 1u << m;
+            if (!full && (modes & bit) == (m_tracked_modes & bit)) continue;
+            out += "\x1b[?";
+            append_number(out, static_cast<unsigned>(TRACKED_MODES[m]));
+            out.push_back(modes & bit ? 'h' : 'l');
+        }
+        m_tracked_modes = modes;
+
+        if (full || screen.application_keypad() != m_application_keypad) {
+            m_application_keypad = screen.application_keypad();
+            out += m_application_keypad ? "\x1b=" : "\x1b>";
+        }
+        if (full || screen.autowrap() != m_autowrap) {
+            m_autowrap = screen.autowrap();
+            out += m_autowrap ? "\x1b[?7h" : "\x1b[?7l";
+        }
+
+        if (screen.scroll_top() != 0 || screen.scroll_bottom() != rows - 1) {
+            out += "\x1b[";
+            append_number(out, static_cast<unsigned>(screen.scroll_top() + 1));
+            out.push_back(';');
+            append_number(out, static_cast<unsigned>(screen.scroll_bottom() + 1));
+            out.push_back('r');
+        }
+
+        int x = screen.cursor_x();
+        int y = screen.cursor_y();
+        if (screen.cursor_pending_wrap() && screen.autowrap()) {
+            // re-print the last cell so the remote cursor also waits to wrap on the next character
+            if (x > 0 && screen.cell(x, y).attrs & ATTR_WIDE_SPACER) --x;
+            move_cursor(out, x, y);
+            set_pen(screen.cell(x, y), out);
+            append_utf8(out, screen.cell(x, y).ch);
+        } else {
+            move_cursor(out, x, y);
+        }
+        set_pen(screen.pen(), out);
+
+        if (screen.insert_mode()) out += "\x1b[4h";
+        if (screen.dec_graphics(0)) out += "\x1b(0";
+        if (screen.dec_graphics(1)) out += "\x1b)0";
+        if (screen.active_charset() == 1) out.push_back('\x0e');
+        if (screen.cursor_visible()) out += "\x1b[?25h";
+
+        m_generation = screen.generation();
+        m_valid = true;
+    }
+}// namespace noterm
@@ -0,0 +1,68 @@
+#ifndef NOTERM_SCREEN_ENCODER_HPP
+#define NOTERM_SCREEN_ENCODER_HPP
+
+#include "screen.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace noterm {
+    // SGR-styled UTF-8 of one line, starting and ending at the default pen, trailing blanks trimmed
+    void encode_line(const Cell* cells, int count, std::string& out);
+
+    // Rows that scrolled off the top of a screen and have not been sent yet. Bounded: beyond
+    // `limit` lines the oldest are dropped, the frontend's own scrollback would drop them anyway.
+    // Line slots are reused, so steady-state appends do not allocate.
+    class PendingScrollback {
+    public:
+        explicit PendingScrollback(size_t limit) : m_lines(limit) {}
+
+        void push(const Cell* row, int cols);
+        void clear() { m_count = 0; }
+
+        size_t size() const { return m_count; }
+        bool empty() const { return m_count == 0; }
+        // i-th oldest pending line, trailing blanks trimmed
+        const std::vector<Cell>& line(size_t i) const { return m_lines[(m_first + i) % m_lines.size()]; }
+
+    private:
+        std::vector<std::vector<Cell>> m_lines;
+        size_t m_first = 0;
+        size_t m_count = 0;
+    };
+
+    // Turns a Screen into the VT sequence that brings a terminal emulator showing an earlier state
+    // up to date: pending scrollback lines first, pushed into its history, then every row whose
+    // generation is newer than the last encoded one, then modes, pen and cursor. The encoder keeps
+    // track of what the remote terminal was last told; invalidate() forces a full repaint.
+    class ScreenEncoder {
+    public:
+        void invalidate() { m_valid = false; }
+
+        // something to send: a row changed, lines scrolled off, or the remote state is unknown
+        bool pending(const Screen& screen, const PendingScrollback& scrollback) const {
+            return !m_valid || screen.generation() != m_generation || !scrollback.empty();
+        }
+
+        // appends the update to out and clears scrollback
+        void encode(const Screen& screen, PendingScrollback& scrollback, std::string& out);
+
+    private:
+        void encode_row(const Cell* cells, int count, int cols, std::string& out);
+        void set_pen(const Cell& cell, std::string& out);
+
+        bool m_valid = false;
+        uint64_t m_generation = 0;
+        bool m_alternate = false;
+        bool m_autowrap = true;
+        bool m_application_keypad = false;
+        uint32_t m_tracked_modes = 0;
+        std::string m_title;
+
+        // pen of the remote terminal while encoding; valid only inside encode()
+        Cell m_pen;
+    };
+}// namespace noterm
+
+#endif
@@ -0,0 +1,242 @@
+#include "scrollback_store.hpp"
+
+#include "lz4_block.hpp"
+#include "screen_encoder.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace noterm {
+    std::atomic<size_t> ScrollbackStore::s_memory_used{0};
+    std::atomic<size_t> ScrollbackStore::s_memory_budget{64 * 1024 * 1024};
+    std::atomic<size_t> ScrollbackStore::s_spill_capacity{0};
+
+    void ScrollbackStore::set_limits(size_t memory_budget, size_t spill_capacity) {
+        s_memory_budget.store(memory_budget, std::memory_order_relaxed);
+        s_spill_capacity.store(spill_capacity, std::memory_order_relaxed);
+    }
+
+    ScrollbackStore::~ScrollbackStore() {
+        s_memory_used.fetch_sub(m_memory_bytes, std::memory_order_relaxed);
+    }
+
+    void ScrollbackStore::append(const Cell* row, int cols) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // sized once for a whole block and the line that overflows it, so scrolling never grows it;
+        // seal() clears it keeping the capacity
+        if (m_open.capacity() < BLOCK_SIZE) m_open.reserve(BLOCK_SIZE + BLOCK_SIZE / 4);
+        size_t before = m_open.size();
+        encode_line(row, cols, m_open);
+        m_open.push_back('\n');
+        m_raw_bytes += m_open.size() - before;
+        ++m_open_lines;
+        ++m_end_line;
+        if (m_open.size() >= BLOCK_SIZE) seal();
+    }
+
+    void ScrollbackStore::seal() {
+        m_compress_scratch.clear();
+        lz4::compress(m_open.data(), m_open.size(), m_compress_scratch);
+
+        // the slot of a block dropped earlier: its filter is reset, its buffer already freed
+        Block& block = m_blocks.push_back();
+        block.trigrams = TrigramFilter();
+        block.spilled = false;
+        block.spill_offset = 0;
+        const char* p = m_open.data();
+        const char* end = p + m_open.size();
+        while (p < end) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            strip_escapes(std::string_view(p, eol - p), m_plain_scratch);
+            block.trigrams.add(m_plain_scratch);
+            p = eol + 1;
+        }
+        block.first_line = m_end_line - m_open_lines;
+        block.line_count = m_open_lines;
+        block.raw_size = static_cast<uint32_t>(m_open.size());
+        block.compressed_size = static_cast<uint32_t>(m_compress_scratch.size());
+        // A recycled buffer if it fits, else a fresh one with an eighth of slack, so the next
+        // block, usually about as large, fits once this one is dropped. Not the scratch string:
+        // its capacity would double what the block holds.
+        if (m_spare_data.capacity() >= m_compress_scratch.size()) block.data.swap(m_spare_data);
+        else block.data.reserve(m_compress_scratch.size() + m_compress_scratch.size() / 8);
+        block.data.assign(m_compress_scratch);
+
+        m_memory_bytes += m_compress_scratch.size();
+        s_memory_used.fetch_add(m_compress_scratch.size(), std::memory_order_relaxed);
+        m_open.clear();
+        m_open_lines = 0;
+
+        enforce_budget();
+    }
+
+    void ScrollbackStore::enforce_budget() {
+        while (m_spilled_blocks < m_blocks.size() &&
+               s_memory_used.load(std::memory_order_relaxed) > s_memory_budget.load(std::memory_order_relaxed)) {
+            size_t capacity = s_spill_capacity.load(std::memory_order_relaxed);
+            if (capacity == 0 || m_spill_failed || m_blocks[m_spilled_blocks].compressed_size > capacity) {
+                // history must stay contiguous: dropping the oldest in-memory block drops everything spilled too
+                while (m_spilled_blocks > 0) drop_front();
+                drop_front();
+                continue;
+            }
+            if (!m_spill.is_open() && !m_spill.open(capacity)) {
+                m_spill_failed = true;
+                continue;
+            }
+            spill_oldest();
+        }
+    }
+
+    void ScrollbackStore::spill_oldest() {
+        Block& block = m_blocks[m_spilled_blocks];
+        size_t size = block.compressed_size;
+        size_t offset = m_spill_head + size <= m_spill.size() ? m_spill_head : 0;
+
+        // Blocks live in the ring in spill order, so the ones in the way are the oldest; drop up to
+        // and including the newest of them. After a wrap that includes the skipped tail as well.
+        size_t overlap = 0;
+        for (size_t i = 0; i < m_spilled_blocks; ++i) {
+            const Block& other = m_blocks[i];
+            if (other.spill_offset < offset + size && offset < other.spill_offset + other.compressed_size) overlap = i + 1;
+        }
+        while (overlap-- > 0) drop_front();
+
+        // drop_front() moved the queue's front and m_spilled_blocks along; the block is still the
+        // oldest in memory, looked up again by its new index
+        Block& target = m_blocks[m_spilled_blocks];
+        std::memcpy(m_spill.data() + offset, target.data.data(), size);
+        recycle(target.data);
+        target.spilled = true;
+        target.spill_offset = offset;
+        m_spill_head = offset + size;
+        ++m_spilled_blocks;
+
+        m_memory_bytes -= size;
+        m_spilled_bytes += size;
+        s_memory_used.fetch_sub(size, std::memory_order_relaxed);
+    }
+
+    void ScrollbackStore::drop_front() {
+        Block& block = m_blocks.front();
+        if (block.spilled) {
+            m_spilled_bytes -= block.compressed_size;
+            --m_spilled_blocks;
+        } else {
+            m_memory_bytes -= block.compressed_size;
+            s_memory_used.fetch_sub(block.compressed_size, std::memory_order_relaxed);
+        }
+        m_raw_bytes -= block.raw_size;
+        m_first_line = block.first_line + block.line_count;
+        recycle(block.data);
+        m_blocks.pop_front();
+    }
+
+    void ScrollbackStore::recycle(std::string& data) {
+        if (data.capacity() > m_spare_data.capacity()) m_spare_data.swap(data);
+        std::string().swap(data);
+    }
+
+    ScrollbackPage ScrollbackStore::read(uint64_t first, size_t count) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ScrollbackPage page;
+        page.first = std::max(first, m_first_line);
+        page.end = m_end_line;
+        if (page.first >= m_end_line) {
+            page.first = m_end_line;
+            return page;
+        }
+        count = static_cast<size_t>(std::min<uint64_t>(count, m_end_line - page.first));
+        page.lines.reserve(count);
+
+        // first block that ends after page.first
+        size_t index = 0;
+        for (size_t end = m_blocks.size(); index < end;) {
+            size_t mid = index + (end - index) / 2;
+            if (page.first < m_blocks[mid].first_line + m_blocks[mid].line_count) end = mid;
+            else index = mid + 1;
+        }
+        uint64_t line = page.first;
+        for (; index < m_blocks.size() && page.lines.size() < count; ++index) {
+            const Block& block = m_blocks[index];
+            read_block(block, static_cast<size_t>(line - block.first_line), count - page.lines.size(), page.lines);
+            line = block.first_line + block.line_count;
+        }
+
+        // the open block is plain text
+        size_t skip = static_cast<size_t>(line - (m_end_line - m_open_lines));
+        const char* p = m_open.data();
+        const char* end = p + m_open.size();
+        while (p < end && page.lines.size() < count) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (skip > 0) {
+                --skip;
+            } else {
+                page.lines.emplace_back(p, eol - p);
+            }
+            p = eol + 1;
+        }
+        return page;
+    }
+
+    void ScrollbackStore::read_block(const Block& block, size_t skip, size_t count, std::vector<std::string>& out) const {
+        const char* src = block.spilled ? m_spill.data() + block.spill_offset : block.data.data();
+        m_decompress_scratch.resize(block.raw_size);
+        if (!lz4::decompress(src, block.compressed_size, m_decompress_scratch.data(), block.raw_size)) {
+            // keep the numbering intact rather than shifting every later line
+            for (size_t i = skip; i < block.line_count && count > 0; ++i, --count) out.emplace_back();
+            return;
+        }
+        const char* p = m_decompress_scratch.data();
+        const char* end = p + block.raw_size;
+        while (p < end && count > 0) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (skip > 0) {
+                --skip;
+            } else {
+                out.emplace_back(p, eol - p);
+                --count;
+            }
+            p = eol + 1;
+        }
+    }
+
+    void ScrollbackStore::search(Searcher& searcher, size_t limit, std::vector<ScrollbackHit>& out) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        search_lines(m_open.data(), m_open.size(), m_end_line - m_open_lines, searcher, limit, out);
+
+        const TrigramFilter* filter = searcher.filter();
+        for (size_t i = m_blocks.size(); i > 0 && out.size() < limit; --i) {
+            const Block& block = m_blocks[i - 1];
+            if (filter && !block.trigrams.covers(*filter)) continue;
+            const char* src = block.spilled ? m_spill.data() + block.spill_offset : block.data.data();
+            m_decompress_scratch.resize(block.raw_size);
+            if (!lz4::decompress(src, block.compressed_size, m_decompress_scratch.data(), block.raw_size)) continue;
+            search_lines(m_decompress_scratch.data(), block.raw_size, block.first_line, searcher, limit, out);
+        }
+    }
+
+    void ScrollbackStore::search_lines(const char* data, size_t size, uint64_t first_line, Searcher& searcher, size_t limit,
+                                       std::vector<ScrollbackHit>& out) const {
+        const char* p = data;
+        const char* end = data + size;
+        for (uint64_t line = first_line; p < end && out.size() < limit; ++line) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            strip_escapes(std::string_view(p, eol - p), m_plain_scratch);
+            p = eol + 1;
+
+            m_match_scratch.clear();
+            searcher.find(m_plain_scratch, m_match_scratch);
+            for (const LineMatch& match: m_match_scratch) {
+                if (out.size() >= limit) break;
+                int column = cell_columns(m_plain_scratch, 0, match.offset);
+                int length = cell_columns(m_plain_scratch, match.offset, match.offset + match.length);
+                out.push_back({line, column, length, m_plain_scratch});
+            }
+        }
+    }
+
+    ScrollbackStats ScrollbackStore::stats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return {m_end_line - m_first_line, m_raw_bytes, m_memory_bytes + m_spilled_bytes + m_open.size(), m_spilled_bytes};
+    }
+}// namespace noterm
@@ -0,0 +1,139 @@
+#ifndef NOTERM_SCROLLBACK_STORE_HPP
+#define NOTERM_SCROLLBACK_STORE_HPP
+
+#include "mapped_file.hpp"
+#include "screen.hpp"
+#include "search.hpp"
+#include "slot_queue.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace noterm {
+    struct ScrollbackStats {
+        uint64_t lines;
+        // uncompressed size of the kept lines
+        size_t raw_bytes;
+        // what they take: sealed blocks compressed, the open block as is
+        size_t stored_bytes;
+        // part of stored_bytes living in the spill file
+        size_t spilled_bytes;
+    };
+
+    struct ScrollbackPage {
+        // absolute number of lines[0]
+        uint64_t first;
+        // one past the newest stored line
+        uint64_t end;
+        // SGR-styled UTF-8, one entry per line
+        std::vector<std::string> lines;
+    };
+
+    struct ScrollbackHit {
+        uint64_t line;
+        // in terminal cells
+        int column;
+        int length;
+        // the line without styling
+        std::string text;
+    };
+
+    // History of one session: lines that scrolled off the primary screen, appended to an open block
+    // and LZ4-compressed once it is full. Lines are numbered from 0 for the life of the session.
+    //
+    // All stores share one memory budget. When sealing a block pushes the total over it, the store
+    // that sealed moves its own oldest in-memory blocks to its spill file, a memory-mapped ring, or
+    // drops them if spilling is off. The ring overwrites its oldest blocks, so history stays
+    // contiguous and only ever loses its oldest end.
+    //
+    // Appended on the scheduler thread, read from the UI thread.
+    class ScrollbackStore {
+    public:
+        // memory_budget: sealed in-memory bytes across all stores; spill_capacity: spill file size per
+        // store, 0 to drop instead of spilling
+        static void set_limits(size_t memory_budget, size_t spill_capacity);
+
+        ScrollbackStore() = default;
+        ~ScrollbackStore();
+        ScrollbackStore(const ScrollbackStore&) = delete;
+        ScrollbackStore& operator=(const ScrollbackStore&) = delete;
+
+        void append(const Cell* row, int cols);
+
+        // up to count lines from line first on, clamped to what is kept
+        ScrollbackPage read(uint64_t first, size_t count) const;
+        ScrollbackStats stats() const;
+        // number the next appended line will get
+        uint64_t end() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_end_line;
+        }
+
+        // Appends matches, newest blocks first, stopping once out holds limit hits. Blocks whose
+        // trigram filter rules the needle out are not decompressed; the open block is always scanned.
+        void search(Searcher& searcher, size_t limit, std::vector<ScrollbackHit>& out) const;
+
+    private:
+        struct Block {
+            uint64_t first_line;
+            uint32_t line_count;
+            uint32_t raw_size;
+            uint32_t compressed_size;
+            // compressed lines, each terminated by '\n'; empty once spilled
+            std::string data;
+            bool spilled = false;
+            size_t spill_offset = 0;
+            // of the unstyled text; kept in memory when the block is spilled
+            TrigramFilter trigrams;
+        };
+
+        void seal();
+        void enforce_budget();
+        void spill_oldest();
+        void drop_front();
+        // frees a block's compressed bytes, keeping the largest buffer for the next seal
+        void recycle(std::string& data);
+        // appends the lines of block from line skip on to out, at most count
+        void read_block(const Block& block, size_t skip, size_t count, std::vector<std::string>& out) const;
+        // searches '\n'-terminated lines numbered from first_line
+        void search_lines(const char* data, size_t size, uint64_t first_line, Searcher& searcher, size_t limit,
+                          std::vector<ScrollbackHit>& out) const;
+
+        // raw bytes at which the open block is sealed
+        static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+        static std::atomic<size_t> s_memory_used;
+        static std::atomic<size_t> s_memory_budget;
+        static std::atomic<size_t> s_spill_capacity;
+
+        mutable std::mutex m_mutex;
+        // oldest first; spilled blocks always come before in-memory ones
+        SlotQueue<Block> m_blocks;
+        size_t m_spilled_blocks = 0;
+
+        std::string m_open;
+        uint32_t m_open_lines = 0;
+        uint64_t m_first_line = 0;
+        uint64_t m_end_line = 0;
+
+        size_t m_raw_bytes = 0;
+        size_t m_memory_bytes = 0;
+        size_t m_spilled_bytes = 0;
+
+        MappedFile m_spill;
+        bool m_spill_failed = false;
+        size_t m_spill_head = 0;
+
+        std::string m_compress_scratch;
+        // a dropped or spilled block's buffer; once history is at its budget, every seal frees one
+        std::string m_spare_data;
+        mutable std::string m_decompress_scratch;
+        mutable std::string m_plain_scratch;
+        mutable std::vector<LineMatch> m_match_scratch;
+    };
+}// namespace noterm
+
+#endif
@@ -0,0 +1,218 @@
+#include "search.hpp"
+
+#include "screen.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace noterm {
+    namespace {
+        inline unsigned char fold(unsigned char c) { return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c; }
+
+        inline uint32_t trigram_bit(unsigned char a, unsigned char b, unsigned char c) {
+            uint32_t v = (static_cast<uint32_t>(fold(a)) << 16) | (static_cast<uint32_t>(fold(b)) << 8) | fold(c);
+            return (v * 2654435761u) >> (32 - 13);
+        }
+
+        bool is_quantifier(char c) { return c == '*' || c == '?' || c == '{'; }
+
+        // Longest run of literal characters outside groups and classes. Empty when the pattern has a
+        // top-level alternation, since then no literal is required.
+        std::string required_literal(const std::string& pattern) {
+            std::string best;
+            std::string run;
+            int depth = 0;
+            auto end_run = [&] {
+                if (run.size() > best.size()) best = run;
+                run.clear();
+            };
+            for (size_t i = 0; i < pattern.size(); ++i) {
+                char c = pattern[i];
+                char next = i + 1 < pattern.size() ? pattern[i + 1] : 0;
+                if (c == '\\' && next) {
+                    ++i;
+                    // \d, \w, \b and friends are classes or assertions, not characters
+                    bool literal = !std::isalnum(static_cast<unsigned char>(next));
+                    if (!literal) {
+                        // \xHH, \uHHHH, \cX, \k<name> and backreferences carry an argument, which is
+                        // not part of the text either
+                        size_t skip = 0;
+                        if (next == 'x') skip = 2;
+                        else if (next == 'u') skip = 4;
+                        else if (next == 'c') skip = 1;
+                        else if (next == 'k' && i + 1 < pattern.size() && pattern[i + 1] == '<') skip = pattern.find('>', i) - i;
+                        else if (next >= '1' && next <= '9') skip = std::strspn(pattern.c_str() + i + 1, "0123456789");
+                        i = std::min(i + skip, pattern.size() - 1);
+                    }
+                    char after = i + 1 < pattern.size() ? pattern[i + 1] : 0;
+                    if (!literal || depth > 0 || is_quantifier(after)) {
+                        end_run();
+                        continue;
+                    }
+                    run.push_back(next);
+                    if (after == '+') end_run();
+                    continue;
+                }
+                if (c == '[') {
+                    // skip the class
+                    for (++i; i < pattern.size() && pattern[i] != ']'; ++i) {
+                        if (pattern[i] == '\\') ++i;
+                    }
+                    end_run();
+                    continue;
+                }
+                if (c == '(') {
+                    ++depth;
+                    end_run();
+                    continue;
+                }
+                if (c == ')') {
+                    --depth;
+                    end_run();
+                    continue;
+                }
+                if (c == '|' && depth == 0) return {};
+                if (c == '{') {
+                    // skip the counts of a bounded repeat
+                    size_t close = pattern.find('}', i);
+                    if (close != std::string::npos) i = close;
+                    end_run();
+                    continue;
+                }
+                if (depth > 0 || c == '.' || c == '^' || c == '$' || c == '|' || c == '+' || is_quantifier(c)) {
+                    end_run();
+                    continue;
+                }
+                // an optional character is not required, and ends the run before it
+                if (is_quantifier(next)) {
+                    end_run();
+                    continue;
+                }
+                run.push_back(c);
+                if (next == '+') end_run();
+            }
+            end_run();
+            return best;
+        }
+
+        // case-sensitive substring search; memchr on the first byte is the vectorised part
+        size_t find_literal(const char* text, size_t size, const std::string& needle, size_t from) {
+            size_t n = needle.size();
+            const char first = needle[0];
+            while (from + n <= size) {
+                const void* hit = std::memchr(text + from, first, size - from - n + 1);
+                if (!hit) return std::string::npos;
+                size_t at = static_cast<const char*>(hit) - text;
+                if (std::memcmp(text + at + 1, needle.data() + 1, n - 1) == 0) return at;
+                from = at + 1;
+            }
+            return std::string::npos;
+        }
+    }// namespace
+
+    void strip_escapes(std::string_view styled, std::string& plain) {
+        plain.clear();
+        size_t i = 0;
+        while (i < styled.size()) {
+            const void* esc = std::memchr(styled.data() + i, 0x1B, styled.size() - i);
+            size_t end = esc ? static_cast<const char*>(esc) - styled.data() : styled.size();
+            plain.append(styled.data() + i, end - i);
+            if (end == styled.size()) break;
+            // CSI: parameters and intermediates up to the final byte
+            i = end + 1;
+            if (i < styled.size() && styled[i] == '[') {
+                ++i;
+                while (i < styled.size() && !(styled[i] >= 0x40 && styled[i] <= 0x7E)) ++i;
+            }
+            ++i;
+        }
+    }
+
+    void TrigramFilter::add(std::string_view text) {
+        for (size_t i = 0; i + 3 <= text.size(); ++i) {
+            uint32_t bit = trigram_bit(text[i], text[i + 1], text[i + 2]);
+            words[bit >> 6] |= uint64_t{1} << (bit & 63);
+        }
+    }
+
+    bool TrigramFilter::empty() const {
+        for (uint64_t w: words) {
+            if (w) return false;
+        }
+        return true;
+    }
+
+    bool TrigramFilter::covers(const TrigramFilter& other) const {
+        for (int i = 0; i < BITS / 64; ++i) {
+            if ((words[i] & other.words[i]) != other.words[i]) return false;
+        }
+        return true;
+    }
+
+    Searcher::Searcher(const std::string& pattern, bool regex, bool ignore_case)
+        : m_regex(regex), m_ignore_case(ignore_case) {
+        if (pattern.empty()) return;
+        if (regex) {
+            try {
+                auto flags = std::regex::ECMAScript | std::regex::optimize;
+                if (ignore_case) flags |= std::regex::icase;
+                m_pattern = std::regex(pattern, flags);
+            } catch (const std::regex_error&) {
+                return;
+            }
+            m_needle = required_literal(pattern);
+        } else {
+            m_needle = pattern;
+        }
+        if (ignore_case) {
+            for (char& c: m_needle) c = static_cast<char>(fold(c));
+        }
+        m_filter.add(m_needle);
+        m_has_filter = !m_filter.empty();
+        m_valid = true;
+    }
+
+    void Searcher::find(std::string_view plain, std::vector<LineMatch>& out) {
+        const char* text = plain.data();
+        if (m_ignore_case) {
+            m_folded.assign(plain);
+            for (char& c: m_folded) c = static_cast<char>(fold(c));
+            text = m_folded.data();
+        }
+
+        if (m_regex) {
+            if (!m_needle.empty() && find_literal(text, plain.size(), m_needle, 0) == std::string::npos) return;
+            for (std::cregex_iterator it(plain.data(), plain.data() + plain.size(), m_pattern), end; it != end; ++it) {
+                // an empty match says nothing useful about where to look
+                if (it->length() == 0) continue;
+                out.push_back({static_cast<size_t>(it->position()), static_cast<size_t>(it->length())});
+            }
+            return;
+        }
+
+        size_t at = 0;
+        while ((at = find_literal(text, plain.size(), m_needle, at)) != std::string::npos) {
+            out.push_back({at, m_needle.size()});
+            at += m_needle.size();
+        }
+    }
+
+    int cell_columns(std::string_view line, size_t from, size_t to) {
+        int columns = 0;
+        size_t i = from;
+        while (i < to) {
+            unsigned char c = static_cast<unsigned char>(line[i]);
+            int length = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+            if (length == 1) {
+                ++columns;
+                ++i;
+                continue;
+            }
+            char32_t cp = c & (0x7F >> length);
+            for (int k = 1; k < length && i + k < line.size(); ++k) cp = (cp << 6) | (line[i + k] & 0x3F);
+            columns += codepoint_width(cp);
+            i += length;
+        }
+        return columns;
+    }
+}// namespace noterm
@@ -0,0 +1,65 @@
+#ifndef NOTERM_SEARCH_HPP
+#define NOTERM_SEARCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace noterm {
+    // text of an SGR-styled line without its escape sequences
+    void strip_escapes(std::string_view styled, std::string& plain);
+
+    // Bloom-style set of the case-folded byte trigrams of a text. A sealed scrollback block keeps one,
+    // so a search only decompresses the blocks that can contain every trigram of the needle.
+    struct TrigramFilter {
+        static constexpr int BITS = 8192;
+
+        uint64_t words[BITS / 64] = {};
+
+        void add(std::string_view text);
+        bool empty() const;
+        // every trigram of other may be in this set
+        bool covers(const TrigramFilter& other) const;
+    };
+
+    // a match in a line: byte range in the plain text
+    struct LineMatch {
+        size_t offset;
+        size_t length;
+    };
+
+    // A compiled query: a literal substring, or an ECMAScript regex. Case folding is ASCII only.
+    // A regex is prefiltered by the longest literal every match must contain, when there is one:
+    // blocks and lines without it never reach std::regex.
+    class Searcher {
+    public:
+        Searcher(const std::string& pattern, bool regex, bool ignore_case);
+
+        // false for an empty pattern or a regex that does not compile
+        bool valid() const { return m_valid; }
+        // trigrams every matching block has; null when blocks cannot be filtered (short needles)
+        const TrigramFilter* filter() const { return m_has_filter ? &m_filter : nullptr; }
+
+        // appends the non-overlapping matches in plain
+        void find(std::string_view plain, std::vector<LineMatch>& out);
+
+    private:
+        bool m_valid = false;
+        bool m_regex = false;
+        bool m_ignore_case = false;
+        // the literal, or the regex's required literal (possibly empty); folded when ignoring case
+        std::string m_needle;
+        std::regex m_pattern;
+        TrigramFilter m_filter;
+        bool m_has_filter = false;
+        std::string m_folded;
+    };
+
+    // terminal columns taken by the UTF-8 text in [from, to) of line, wide characters counting two
+    int cell_columns(std::string_view line, size_t from, size_t to);
+}// namespace noterm
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef NOTERM_SESSION_REGISTRY_HPP
+#define NOTERM_SESSION_REGISTRY_HPP
+
+#include <cstddef>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace noterm {
+    // Id -> shared_ptr<T> table split into independently locked shards.
+    //
+    // Lookups take a shared lock on one shard and return a reference-counted handle, so the caller
+    // works on the object without holding any registry lock. Ids are handed out sequentially, so
+    // consecutive sessions land in different shards and operations on different sessions never
+    // touch the same lock or cache line.
+    template<typename T, size_t Shards = 64>
+    class ShardedRegistry {
+        static_assert((Shards & (Shards - 1)) == 0, "shard count must be a power of two");
+
+    public:
+        using Handle = std::shared_ptr<T>;
+
+        void insert(int id, Handle value) {
+            Shard& shard = shard_of(id);
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            shard.map[id] = std::move(value);
+        }
+
+        Handle find(int id) const {
+            const Shard& shard = shard_of(id);
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto it = shard.map.find(id);
+            return it == shard.map.end() ? nullptr : it->second;
+        }
+
+        // removes the entry and hands the last registry reference to the caller
+        Handle erase(int id) {
+            Shard& shard = shard_of(id);
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            auto it = shard.map.find(id);
+            if (it == shard.map.end()) return nullptr;
+            Handle value = std::move(it->second);
+            shard.map.erase(it);
+            return value;
+        }
+
+        // appends every entry; shards are visited one at a time, so this is not an atomic snapshot
+        void collect(std::vector<std::pair<int, Handle>>& out) const {
+            for (const Shard& shard: m_shards) {
+                std::shared_lock<std::shared_mutex> lock(shard.mutex);
+                for (auto& kv: shard.map) out.emplace_back(kv.first, kv.second);
+            }
+        }
+
+        // empties the registry, moving every entry into out
+        void take_all(std::vector<std::pair<int, Handle>>& out) {
+            for (Shard& shard: m_shards) {
+                std::unique_lock<std::shared_mutex> lock(shard.mutex);
+                for (auto& kv: shard.map) out.emplace_back(kv.first, std::move(kv.second));
+                shard.map.clear();
+            }
+        }
+
+    private:
+        struct alignas(64) Shard {
+            mutable std::shared_mutex mutex;
+            std::unordered_map<int, Handle> map;
+        };
+
+        Shard& shard_of(int id) { return m_shards[static_cast<size_t>(id) & (Shards - 1)]; }
+        const Shard& shard_of(int id) const { return m_shards[static_cast<size_t>(id) & (Shards - 1)]; }
+
+        Shard m_shards[Shards];
+    };
+}// namespace noterm
+
+#endif
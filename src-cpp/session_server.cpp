@@ -0,0 +1,449 @@
+#include "session_server.hpp"
+
+#include "frame.hpp"
+#include "log.hpp"
+#include "pty_manager.hpp"
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace noterm {
+    namespace {
+#ifdef MSG_NOSIGNAL
+        constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+        constexpr int SEND_FLAGS = 0;
+#endif
+        // a message longer than this is not one of ours, and the client is dropped
+        constexpr size_t MAX_MESSAGE = 16 * 1024 * 1024;
+
+        bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+
+        void set_nonblocking(int fd) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+
+        // length of the complete messages at the start of data, or SIZE_MAX if one is too long
+        size_t complete_messages(const std::string& data) {
+            size_t off = 0;
+            while (off + FRAME_HEADER_SIZE <= data.size()) {
+                size_t length = read_u32_le(data.data() + off + 4);
+                if (length > MAX_MESSAGE) return SIZE_MAX;
+                if (FRAME_HEADER_SIZE + length > data.size() - off) break;
+                off += FRAME_HEADER_SIZE + length;
+            }
+            return off;
+        }
+
+        void append_u32(std::string& out, uint32_t value) {
+            char bytes[4];
+            write_u32_le(bytes, value);
+            out.append(bytes, 4);
+        }
+    }// namespace
+
+    SessionServer::SessionServer()
+        : m_fanout([](int id, size_t bytes) { PTYManager::instance().acknowledge(id, bytes); },
+                   [](int id) { PTYManager::instance().repaint(id); }) {}
+
+    bool SessionServer::start(const std::string& path) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_running) return true;
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            NOTERM_LOG_ERROR("Socket path %s is empty or too long", path.c_str());
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        // only a socket is ever replaced; anything else at the path is the user's
+        struct stat existing {};
+        bool exists = ::lstat(path.c_str(), &existing) == 0;
+        if (exists && !S_ISSOCK(existing.st_mode)) {
+            NOTERM_LOG_ERROR("%s exists and is not a socket", path.c_str());
+            return false;
+        }
+
+        int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            NOTERM_LOG_ERROR("Failed to create the session socket: %s", std::strerror(errno));
+            return false;
+        }
+        // a socket file left by a server that died is replaced, a live server's is not
+        if (exists && ::connect(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+            NOTERM_LOG_ERROR("Another server already listens on %s", path.c_str());
+            ::close(listener);
+            return false;
+        }
+        ::close(listener);
+        if (exists) ::unlink(path.c_str());
+
+        listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        bool bound = listener >= 0 && ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        // only the user running the server may attach to its shells
+        bool ok = bound && ::chmod(path.c_str(), S_IRUSR | S_IWUSR) == 0 && ::listen(listener, 64) == 0 && ::pipe(m_wake_pipe) == 0;
+        if (!ok) {
+            NOTERM_LOG_ERROR("Failed to listen on %s: %s", path.c_str(), std::strerror(errno));
+            if (listener >= 0) ::close(listener);
+            // a failed bind created nothing, and the path may be someone else's by now
+            if (bound) ::unlink(path.c_str());
+            return false;
+        }
+        set_nonblocking(listener);
+        set_nonblocking(m_wake_pipe[0]);
+        set_nonblocking(m_wake_pipe[1]);
+        m_listener = listener;
+        m_path = path;
+        m_running = true;
+
+        PTYManager::instance().set_output_sink([this](const char* frame, size_t size) { m_fanout.publish(frame, size); });
+        PTYManager::instance().set_trigger_callback([this](const std::vector<TriggerMatch>& matches) { triggered(matches); });
+        m_thread = std::thread([this]() { run(); });
+        NOTERM_LOG_INFO("Sessions served on %s", path.c_str());
+        return true;
+    }
+
+    void SessionServer::stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_running) return;
+            m_running = false;
+        }
+        wake();
+        m_thread.join();
+        PTYManager::instance().set_output_sink(nullptr);
+        PTYManager::instance().set_trigger_callback(nullptr);
+
+        std::vector<uint64_t> clients;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& [key, client]: m_clients) {
+                ::close(client.socket);
+                clients.push_back(key);
+            }
+            m_clients.clear();
+            ::close(m_listener);
+            ::close(m_wake_pipe[0]);
+            ::close(m_wake_pipe[1]);
+            m_listener = -1;
+            m_wake_pipe[0] = m_wake_pipe[1] = -1;
+            ::unlink(m_path.c_str());
+        }
+        for (uint64_t key: clients) m_fanout.unsubscribe(key);
+    }
+
+    size_t SessionServer::client_count() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_clients.size();
+    }
+
+    void SessionServer::run() {
+        std::vector<pollfd> fds;
+        std::vector<uint64_t> owners;
+        // gathered under the lock, handled after it: handling calls into the fanout, which delivers under its own lock
+        std::vector<uint64_t> accepted;
+        // entries past received_count are kept for their buffers
+        std::vector<std::pair<uint64_t, std::string>> received;
+        size_t received_count = 0;
+        std::vector<uint64_t> failed;
+        char buffer[64 * 1024];
+        while (true) {
+            fds.clear();
+            owners.clear();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_running) break;
+                fds.push_back({m_listener, POLLIN, 0});
+                fds.push_back({m_wake_pipe[0], POLLIN, 0});
+                for (auto& [key, client]: m_clients) {
+                    short events = POLLIN;
+                    if (!client.out.empty()) events |= POLLOUT;
+                    fds.push_back({client.socket, events, 0});
+                    owners.push_back(key);
+                }
+            }
+
+            if (::poll(fds.data(), static_cast<nfds_t>(fds.size()), -1) < 0) continue;
+
+            accepted.clear();
+            received_count = 0;
+            failed.clear();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (fds[1].revents & POLLIN) {
+                    while (::read(m_wake_pipe[0], buffer, sizeof(buffer)) > 0) {}
+                }
+
+                for (size_t i = 2; i < fds.size(); ++i) {
+                    short revents = fds[i].revents;
+                    if (!revents) continue;
+                    uint64_t key = owners[i - 2];
+                    auto it = m_clients.find(key);
+                    if (it == m_clients.end()) continue;
+                    Client& client = it->second;
+
+                    bool broken = (revents & (POLLERR | POLLNVAL)) != 0;
+                    // a hangup is seen as the end of what is left to read
+                    if (!broken && (revents & (POLLIN | POLLHUP))) {
+                        long n = static_cast<long>(::recv(client.socket, buffer, sizeof(buffer), 0));
+                        if (n > 0) {
+                            client.in.append(buffer, static_cast<size_t>(n));
+                            size_t complete = complete_messages(client.in);
+                            if (complete == SIZE_MAX) {
+                                NOTERM_LOG_WARN("Client %llu sent a malformed message", static_cast<unsigned long long>(key));
+                                broken = true;
+                            } else if (complete > 0) {
+                                if (received_count == received.size()) received.emplace_back();
+                                auto& [from, data] = received[received_count++];
+                                from = key;
+                                data.assign(client.in, 0, complete);
+                                client.in.erase(0, complete);
+                            }
+                        } else if (n == 0 || !would_block()) {
+                            broken = true;
+                        }
+                    }
+                    if (!broken && (revents & POLLOUT)) broken = !flush(client);
+                    if (broken) failed.push_back(key);
+                }
+
+                if (fds[0].revents & POLLIN) {
+                    while (true) {
+                        int socket = ::accept(m_listener, nullptr, nullptr);
+                        if (socket < 0) break;
+                        set_nonblocking(socket);
+#ifdef SO_NOSIGPIPE
+                        int on = 1;
+                        ::setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+                        uint64_t key = m_next_client++;
+                        m_clients[key].socket = socket;
+                        accepted.push_back(key);
+                    }
+                }
+            }
+
+            for (uint64_t key: accepted) {
+                NOTERM_LOG_INFO("Client %llu attached", static_cast<unsigned long long>(key));
+                m_fanout.subscribe(key, [this, key](const char* frame, size_t size) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    send_locked(key, ServeMessage::Output, frame, size);
+                });
+            }
+            for (size_t i = 0; i < received_count; ++i) dispatch(received[i].first, received[i].second);
+            for (uint64_t key: failed) disconnect(key);
+        }
+    }
+
+    void SessionServer::wake() {
+        char byte = 0;
+        if (::write(m_wake_pipe[1], &byte, 1) < 0) {
+            // the pipe is full: the server thread is woken already
+        }
+    }
+
+    void SessionServer::send_locked(uint64_t key, ServeMessage kind, const char* payload, size_t size) {
+        auto it = m_clients.find(key);
+        if (it == m_clients.end()) return;
+        Client& client = it->second;
+        char header[FRAME_HEADER_SIZE];
+        write_frame_header(header, static_cast<int>(kind), size);
+        if (!client.out.empty()) {
+            client.out.append(header, sizeof(header));
+            client.out.append(payload, size);
+            return;
+        }
+
+        // nothing queued: straight to the socket, header and payload in one call
+        iovec parts[2] = {{header, sizeof(header)}, {const_cast<char*>(payload), size}};
+        msghdr message{};
+        message.msg_iov = parts;
+        message.msg_iovlen = 2;
+        long n = static_cast<long>(::sendmsg(client.socket, &message, SEND_FLAGS));
+        // a failed connection is noticed by poll
+        size_t written = n > 0 ? static_cast<size_t>(n) : 0;
+        if (written == sizeof(header) + size) return;
+        if (written < sizeof(header)) {
+            client.out.append(header + written, sizeof(header) - written);
+            client.out.append(payload, size);
+        } else {
+            client.out.append(payload + (written - sizeof(header)), size - (written - sizeof(header)));
+        }
+        // the server thread waits for the socket to drain
+        wake();
+    }
+
+    void SessionServer::send(uint64_t key, ServeMessage kind, const std::string& payload) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        send_locked(key, kind, payload.data(), payload.size());
+    }
+
+    void SessionServer::triggered(const std::vector<TriggerMatch>& matches) {
+        m_matches.resize(matches.size() * 16);
+        char* out = m_matches.data();
+        for (const TriggerMatch& match: matches) {
+            write_u32_le(out, static_cast<uint32_t>(match.id));
+            write_u32_le(out + 4, match.pattern);
+            write_u32_le(out + 8, static_cast<uint32_t>(match.end));
+            write_u32_le(out + 12, static_cast<uint32_t>(match.end >> 32));
+            out += 16;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& [key, client]: m_clients) send_locked(key, ServeMessage::Triggered, m_matches.data(), m_matches.size());
+    }
+
+    bool SessionServer::flush(Client& client) {
+        size_t written = 0;
+        while (written < client.out.size()) {
+            long n = static_cast<long>(::send(client.socket, client.out.data() + written, client.out.size() - written, SEND_FLAGS));
+            if (n < 0 && would_block()) break;
+            if (n <= 0) return false;
+            written += static_cast<size_t>(n);
+        }
+        client.out.erase(0, written);
+        return true;
+    }
+
+    void SessionServer::dispatch(uint64_t key, const std::string& data) {
+        for (size_t off = 0; off + FRAME_HEADER_SIZE <= data.size();) {
+            auto kind = static_cast<ServeMessage>(read_u32_le(data.data() + off));
+            size_t length = read_u32_le(data.data() + off + 4);
+            handle(key, kind, data.data() + off + FRAME_HEADER_SIZE, length);
+            off += FRAME_HEADER_SIZE + length;
+        }
+    }
+
+    void SessionServer::handle(uint64_t key, ServeMessage kind, const char* payload, size_t size) {
+        PTYManager& manager = PTYManager::instance();
+        switch (kind) {
+            case ServeMessage::Create: {
+                if (size < 12) return;
+                uint32_t token = read_u32_le(payload);
+                int cols = static_cast<int>(read_u32_le(payload + 4));
+                int rows = static_cast<int>(read_u32_le(payload + 8));
+                // empty: the user's login shell
+                std::string command(payload + 12, size - 12);
+                manager.create_async(command, cols, rows, [this, key, token](int id) {
+                    // claimed first: the prompt may already be waiting for its viewer
+                    m_fanout.claim(key, id);
+                    std::string reply;
+                    append_u32(reply, token);
+                    append_u32(reply, static_cast<uint32_t>(id));
+                    send(key, ServeMessage::Created, reply);
+                });
+                break;
+            }
+            case ServeMessage::Input: {
+                // only into sessions the client attached; the frame goes through as it is unless
+                // something has to be cut out of it
+                size_t off = 0;
+                while (off + FRAME_HEADER_SIZE <= size) {
+                    size_t record = FRAME_HEADER_SIZE + read_u32_le(payload + off + 4);
+                    if (record > size - off || !m_fanout.shows(key, static_cast<int>(read_u32_le(payload + off)))) break;
+                    off += record;
+                }
+                if (off == size) {
+                    if (size > 0) manager.write_input_frame(payload, size);
+                    break;
+                }
+                std::string kept(payload, off);
+                while (off + FRAME_HEADER_SIZE <= size) {
+                    size_t record = FRAME_HEADER_SIZE + read_u32_le(payload + off + 4);
+                    if (record > size - off) break;
+                    if (m_fanout.shows(key, static_cast<int>(read_u32_le(payload + off)))) kept.append(payload + off, record);
+                    off += record;
+                }
+                if (!kept.empty()) manager.write_input_frame(kept.data(), kept.size());
+                break;
+            }
+            case ServeMessage::Resize: {
+                std::string owned;
+                for (size_t off = 0; off + FRAME_HEADER_SIZE <= size;) {
+                    size_t record = FRAME_HEADER_SIZE + read_u32_le(payload + off + 4);
+                    if (record > size - off) break;
+                    if (m_fanout.owns(key, static_cast<int>(read_u32_le(payload + off)))) owned.append(payload + off, record);
+                    off += record;
+                }
+                if (!owned.empty()) manager.set_sizes_frame(owned.data(), owned.size());
+                break;
+            }
+            case ServeMessage::Ack:
+                for (size_t off = 0; off + 8 <= size; off += 8) {
+                    size_t bytes = read_u32_le(payload + off + 4);
+                    if (bytes > 0) m_fanout.acknowledge(key, static_cast<int>(read_u32_le(payload + off)), bytes);
+                }
+                break;
+            case ServeMessage::Close: {
+                if (size < 4) return;
+                int id = static_cast<int>(read_u32_le(payload));
+                if (!m_fanout.owns(key, id) && !m_fanout.release(key, id)) return;
+                manager.close(id);
+                m_fanout.forget(id);
+                break;
+            }
+            case ServeMessage::Attach: {
+                if (size < 16) return;
+                int id = static_cast<int>(read_u32_le(payload));
+                int cols = static_cast<int>(read_u32_le(payload + 4));
+                int rows = static_cast<int>(read_u32_le(payload + 8));
+                bool history = read_u32_le(payload + 12) != 0;
+                if (!m_fanout.claim(key, id)) {
+                    manager.repaint(id);
+                    return;
+                }
+                // resized first, so the snapshot is encoded at the new terminal's size
+                if (cols > 0 && rows > 0) manager.set_size(id, cols, rows);
+                manager.reattach(id, history);
+                break;
+            }
+            case ServeMessage::List: {
+                std::string reply;
+                for (auto& info: manager.describe()) {
+                    append_u32(reply, static_cast<uint32_t>(info.id));
+                    append_u32(reply, static_cast<uint32_t>(info.cols));
+                    append_u32(reply, static_cast<uint32_t>(info.rows));
+                    append_u32(reply, static_cast<uint32_t>(info.command.size()));
+                    reply += info.command;
+                    append_u32(reply, static_cast<uint32_t>(info.title.size()));
+                    reply += info.title;
+                }
+                send(key, ServeMessage::Sessions, reply);
+                break;
+            }
+            case ServeMessage::RenderMode: {
+                if (size < 8 || m_render_modes_fixed) return;
+                int id = static_cast<int>(read_u32_le(payload));
+                bool shown = m_fanout.set_visible(key, id, read_u32_le(payload + 4) == 0);
+                manager.set_render_mode(id, shown ? RenderMode::Stream : RenderMode::Screen);
+                break;
+            }
+            default:
+                NOTERM_LOG_DEBUG("Client %llu sent unknown message %u", static_cast<unsigned long long>(key), static_cast<unsigned>(kind));
+                break;
+        }
+    }
+
+    void SessionServer::disconnect(uint64_t key) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_clients.find(key);
+            if (it == m_clients.end()) return;
+            ::close(it->second.socket);
+            m_clients.erase(it);
+        }
+        // what only this client showed keeps running, in screen mode, until someone attaches
+        for (int id: m_fanout.unsubscribe(key)) PTYManager::instance().set_render_mode(id, RenderMode::Screen);
+        NOTERM_LOG_INFO("Client %llu detached", static_cast<unsigned long long>(key));
+    }
+}// namespace noterm
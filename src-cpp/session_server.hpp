@@ -0,0 +1,113 @@
+#ifndef NOTERM_SESSION_SERVER_HPP
+#define NOTERM_SESSION_SERVER_HPP
+
+#include "output_fanout.hpp"
+#include "trigger.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace noterm {
+    // Messages on a SessionServer socket, in the record layout: [kind u32 LE][len u32 LE][payload].
+    // Integers in payloads are u32 LE as well.
+    enum class ServeMessage : uint32_t {
+        // client to server
+        // [token][cols][rows][command]: starts a session, answered by Created with the same token
+        Create = 1,
+        // an input frame as PTYManager::write_input_frame() takes it
+        Input = 2,
+        // a sizes frame as PTYManager::set_sizes_frame() takes it; only sessions the client owns
+        Resize = 3,
+        // [id][bytes]...: output the client has written
+        Ack = 4,
+        // [id]: closes the session, or only stops showing it for a client that does not own it
+        Close = 5,
+        // [id][cols][rows][history]: shows a running session; a snapshot (with the recent history
+        // if asked for) or, if another client shows it, a repaint arrives as output
+        Attach = 6,
+        // answered by Sessions
+        List = 7,
+        // [id][hidden]: stream output while any client shows the session, screen diffs otherwise
+        RenderMode = 8,
+
+        // server to client
+        // an output frame of [id][len][payload] records
+        Output = 0x81,
+        // [token][id]
+        Created = 0x82,
+        // [id][cols][rows][command length][command][title length][title]... for every running session
+        Sessions = 0x83,
+        // [id][pattern][end low][end high]... for trigger matches, see PTYManager::set_triggers(); to every client
+        Triggered = 0x84,
+    };
+
+    // Serves PTYManager's sessions to local clients over a Unix domain socket, so shells outlive
+    // any one frontend and tools can drive hundreds of sessions without a webview. Each client is
+    // an OutputFanout subscriber with its own flow control window; the first to show a session
+    // owns it. A session nobody shows any more keeps running in screen mode until it is closed.
+    //
+    // One thread accepts clients and reads their messages. Output is written to the client's
+    // non-blocking socket on the scheduler thread; what does not fit is queued for the server
+    // thread, within the client's window.
+    class SessionServer {
+    public:
+        SessionServer();
+        SessionServer(const SessionServer&) = delete;
+        SessionServer& operator=(const SessionServer&) = delete;
+        ~SessionServer() { stop(); }
+
+        // listens on path and becomes PTYManager's output sink; false, logged, if it cannot. A
+        // stale socket file is replaced, one another server still listens on is not.
+        bool start(const std::string& path);
+        // disconnects every client; the sessions keep running
+        void stop();
+
+        // RenderMode messages are ignored, e.g. for a render mode forced on the command line
+        void fix_render_modes() { m_render_modes_fixed = true; }
+
+        size_t client_count();
+
+    private:
+        struct Client {
+            int socket = -1;
+            // bytes received, up to the end of the last complete message
+            std::string in;
+            // bytes not written to the socket yet
+            std::string out;
+        };
+
+        void run();
+        void wake();
+        // queues or writes one message, under m_mutex
+        void send_locked(uint64_t client, ServeMessage kind, const char* payload, size_t size);
+        void send(uint64_t client, ServeMessage kind, const std::string& payload);
+        // writes the queue as far as the socket takes it; false if the connection failed
+        static bool flush(Client& client);
+        // runs the complete messages of data, without m_mutex
+        void dispatch(uint64_t client, const std::string& data);
+        void handle(uint64_t client, ServeMessage kind, const char* payload, size_t size);
+        void disconnect(uint64_t client);
+        // scheduler thread
+        void triggered(const std::vector<TriggerMatch>& matches);
+
+        OutputFanout m_fanout;
+
+        std::mutex m_mutex;
+        std::unordered_map<uint64_t, Client> m_clients;
+        uint64_t m_next_client = 1;
+        std::string m_path;
+        int m_listener = -1;
+        int m_wake_pipe[2] = {-1, -1};
+        bool m_running = false;
+        bool m_render_modes_fixed = false;
+        std::thread m_thread;
+        // Triggered payload, scheduler thread only
+        std::string m_matches;
+    };
+}// namespace noterm
+
+#endif
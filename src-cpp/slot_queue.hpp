@@ -0,0 +1,59 @@
+#ifndef NOTERM_SLOT_QUEUE_HPP
+#define NOTERM_SLOT_QUEUE_HPP
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace noterm {
+    // FIFO over a power-of-two ring of slots that grows but never shrinks. Unlike std::deque it
+    // does not allocate and free nodes as it moves along, and a popped slot keeps its object:
+    // push_back() hands it out again as it was, so e.g. a string's capacity is reused. In steady
+    // state neither pushing nor popping allocates. Callers that must not keep what a popped
+    // element holds release it before popping.
+    template<typename T>
+    class SlotQueue {
+    public:
+        bool empty() const { return m_size == 0; }
+        size_t size() const { return m_size; }
+
+        T& front() { return m_slots[m_head]; }
+        const T& front() const { return m_slots[m_head]; }
+        T& back() { return (*this)[m_size - 1]; }
+        // i-th element from the front
+        T& operator[](size_t i) { return m_slots[(m_head + i) & (m_slots.size() - 1)]; }
+        const T& operator[](size_t i) const { return m_slots[(m_head + i) & (m_slots.size() - 1)]; }
+
+        // appends the slot after the back and returns it, holding whatever was last popped from it
+        T& push_back() {
+            if (m_size == m_slots.size()) grow();
+            ++m_size;
+            return back();
+        }
+
+        void pop_front() {
+            m_head = (m_head + 1) & (m_slots.size() - 1);
+            --m_size;
+        }
+
+        void clear() {
+            m_head = 0;
+            m_size = 0;
+        }
+
+    private:
+        void grow() {
+            std::vector<T> slots(m_slots.empty() ? 8 : m_slots.size() * 2);
+            // only called when full: every old slot holds an element
+            for (size_t i = 0; i < m_size; ++i) slots[i] = std::move((*this)[i]);
+            m_slots.swap(slots);
+            m_head = 0;
+        }
+
+        std::vector<T> m_slots;
+        size_t m_head = 0;
+        size_t m_size = 0;
+    };
+}// namespace noterm
+
+#endif
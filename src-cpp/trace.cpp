@@ -0,0 +1,140 @@
+#include "trace.hpp"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace noterm::trace {
+    namespace detail {
+        std::atomic_bool g_enabled{false};
+    }
+
+    namespace {
+        struct Event {
+            const char* name;
+            // Chrome trace phase: 'X' complete, 'b'/'e' async begin/end
+            char phase;
+            int tid;
+            int session;
+            uint64_t ts;
+            uint64_t dur;
+            uint64_t id;
+            uint64_t bytes;
+        };
+
+        struct Recorder {
+            std::mutex mutex;
+            std::vector<Event> events;
+            size_t capacity = 0;
+            uint64_t dropped = 0;
+            std::vector<std::pair<int, const char*>> threads;
+            int next_tid = 1;
+        };
+
+        Recorder& recorder() {
+            static Recorder r;
+            return r;
+        }
+
+        thread_local int t_tid = 0;
+        thread_local const char* t_name = nullptr;
+
+        void record(const Event& event) {
+            Recorder& r = recorder();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            if (r.events.size() >= r.capacity) {
+                ++r.dropped;
+                return;
+            }
+            r.events.push_back(event);
+        }
+
+        // numbered on first use, so the export only lists threads that recorded something
+        int thread_id() {
+            if (t_tid == 0) {
+                Recorder& r = recorder();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                t_tid = r.next_tid++;
+                r.threads.emplace_back(t_tid, t_name);
+            }
+            return t_tid;
+        }
+    }// namespace
+
+    void start(size_t capacity) {
+        Recorder& r = recorder();
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.events.clear();
+            r.events.reserve(capacity);
+            r.capacity = capacity;
+            r.dropped = 0;
+        }
+        detail::g_enabled.store(true);
+    }
+
+    void stop() {
+        detail::g_enabled.store(false);
+    }
+
+    uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                             std::chrono::steady_clock::now().time_since_epoch())
+                                             .count());
+    }
+
+    void set_thread_name(const char* name) {
+        t_name = name;
+        if (t_tid == 0) return;
+        Recorder& r = recorder();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (auto& thread: r.threads) {
+            if (thread.first == t_tid) thread.second = name;
+        }
+    }
+
+    void complete(const char* name, uint64_t start, int session, uint64_t bytes) {
+        uint64_t end = now();
+        record({name, 'X', thread_id(), session, start, end - start, 0, bytes});
+    }
+
+    void async_begin(const char* name, uint64_t id, int session, uint64_t bytes) {
+        if (!enabled()) return;
+        record({name, 'b', thread_id(), session, now(), 0, id, bytes});
+    }
+
+    void async_end(const char* name, uint64_t id, int session, uint64_t bytes) {
+        if (!enabled()) return;
+        record({name, 'e', thread_id(), session, now(), 0, id, bytes});
+    }
+
+    std::string export_json() {
+        Recorder& r = recorder();
+        std::lock_guard<std::mutex> lock(r.mutex);
+
+        std::string json = "{\"traceEvents\":[";
+        json.reserve(json.size() + r.events.size() * 128);
+        bool first = true;
+        char entry[256];
+        for (auto& [tid, name]: r.threads) {
+            snprintf(entry, sizeof(entry),
+                     "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                     first ? "" : ",", tid, name ? name : "thread");
+            json += entry;
+            first = false;
+        }
+        for (const Event& e: r.events) {
+            int n = snprintf(entry, sizeof(entry), "%s{\"name\":\"%s\",\"cat\":\"noterm\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%" PRIu64,
+                             first ? "" : ",", e.name, e.phase, e.tid, e.ts);
+            if (e.phase == 'X') n += snprintf(entry + n, sizeof(entry) - n, ",\"dur\":%" PRIu64, e.dur);
+            else n += snprintf(entry + n, sizeof(entry) - n, ",\"id\":%" PRIu64, e.id);
+            snprintf(entry + n, sizeof(entry) - n, ",\"args\":{\"session\":%d,\"bytes\":%" PRIu64 "}}", e.session, e.bytes);
+            json += entry;
+            first = false;
+        }
+        json += "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":" + std::to_string(r.dropped) + "}}";
+        return json;
+    }
+}// namespace noterm::trace
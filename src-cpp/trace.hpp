@@ -0,0 +1,58 @@
+#ifndef NOTERM_TRACE_HPP
+#define NOTERM_TRACE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Optional span tracing of the output path, exported in the Chrome trace event format (load it in
+// chrome://tracing or ui.perfetto.dev). Off by default; while off every hook is a single relaxed load.
+// Event names are string literals, they are stored by pointer.
+namespace noterm::trace {
+    namespace detail {
+        extern std::atomic_bool g_enabled;
+    }
+
+    inline bool enabled() { return detail::g_enabled.load(std::memory_order_relaxed); }
+
+    // clears earlier events and records up to capacity more
+    void start(size_t capacity = 1 << 20);
+    void stop();
+
+    // microseconds on the steady clock, the timestamps of every event
+    uint64_t now();
+
+    // shown for the calling thread's events; a literal, set once when the thread starts
+    void set_thread_name(const char* name);
+
+    // a finished span on the calling thread
+    void complete(const char* name, uint64_t start, int session, uint64_t bytes);
+    // a span that starts and ends on different threads, matched by id, e.g. a frame from send to ack
+    void async_begin(const char* name, uint64_t id, int session, uint64_t bytes);
+    void async_end(const char* name, uint64_t id, int session, uint64_t bytes);
+
+    // {"traceEvents":[...]} of everything recorded since start()
+    std::string export_json();
+
+    // records a complete event for its scope; session and bytes may be filled in before it ends
+    class Span {
+    public:
+        explicit Span(const char* name, int session = -1)
+            : session(session), m_name(name), m_start(enabled() ? now() : 0) {}
+        ~Span() {
+            if (m_start && enabled()) complete(m_name, m_start, session, bytes);
+        }
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        int session;
+        uint64_t bytes = 0;
+
+    private:
+        const char* m_name;
+        uint64_t m_start;
+    };
+}// namespace noterm::trace
+
+#endif
@@ -0,0 +1,153 @@
+#include "trigger.hpp"
+
+#include "log.hpp"
+#include <atomic>
+#include <cstring>
+
+namespace noterm {
+    namespace {
+        unsigned char fold(unsigned char c, bool ignore_case) {
+            return ignore_case && c >= 'A' && c <= 'Z' ? static_cast<unsigned char>(c - 'A' + 'a') : c;
+        }
+
+        std::atomic<uint64_t> last_generation{0};
+    }// namespace
+
+    PatternSet::PatternSet(const std::vector<std::string>& patterns, bool ignore_case)
+        : m_patterns(patterns), m_generation(++last_generation) {
+        // one column per byte value some pattern uses, case pairs share theirs; column 0 is the rest
+        for (const std::string& pattern: m_patterns) {
+            for (unsigned char c: pattern) {
+                unsigned char folded = fold(c, ignore_case);
+                if (m_column[folded] == 0) m_column[folded] = static_cast<uint16_t>(m_columns++);
+            }
+        }
+        if (ignore_case) {
+            for (int c = 'A'; c <= 'Z'; ++c) m_column[c] = m_column[c - 'A' + 'a'];
+        }
+
+        // the trie, with NONE for a missing edge
+        m_next.assign(m_columns, NONE);
+        std::vector<std::vector<uint32_t>> own(1);
+        for (uint32_t i = 0; i < m_patterns.size(); ++i) {
+            if (m_patterns[i].empty()) continue;
+            // row offsets and the MATCH flag share 32 bits
+            if ((own.size() + m_patterns[i].size()) * m_columns >= MATCH) {
+                NOTERM_LOG_WARN("Trigger patterns from %u on do not fit the automaton and are ignored", i);
+                break;
+            }
+            uint32_t state = 0;
+            for (unsigned char c: m_patterns[i]) {
+                uint32_t& edge = m_next[state * m_columns + m_column[c]];
+                if (edge == NONE) {
+                    edge = static_cast<uint32_t>(own.size());
+                    own.emplace_back();
+                    m_next.resize(m_next.size() + m_columns, NONE);
+                }
+                state = m_next[state * m_columns + m_column[c]];
+            }
+            own[state].push_back(i);
+        }
+        uint32_t states = static_cast<uint32_t>(own.size());
+
+        // breadth first, so a state's failure link is complete before the state is: a missing edge
+        // becomes the failure link's edge, turning the trie into a DFA
+        std::vector<uint32_t> failure(states, 0);
+        m_dictionary.assign(states, NONE);
+        std::vector<uint32_t> queue;
+        queue.reserve(states);
+        for (uint32_t c = 0; c < m_columns; ++c) {
+            uint32_t& edge = m_next[c];
+            if (edge == NONE) edge = 0;
+            else queue.push_back(edge);
+        }
+        for (size_t head = 0; head < queue.size(); ++head) {
+            uint32_t state = queue[head];
+            uint32_t fail = failure[state];
+            m_dictionary[state] = own[fail].empty() ? m_dictionary[fail] : fail;
+            for (uint32_t c = 0; c < m_columns; ++c) {
+                uint32_t& edge = m_next[state * m_columns + c];
+                uint32_t fallback = m_next[fail * m_columns + c];
+                if (edge == NONE) {
+                    edge = fallback;
+                } else {
+                    failure[edge] = fallback;
+                    queue.push_back(edge);
+                }
+            }
+        }
+
+        m_output_begin.resize(states + 1);
+        for (uint32_t state = 0; state < states; ++state) {
+            m_output_begin[state] = static_cast<uint32_t>(m_outputs.size());
+            m_outputs.insert(m_outputs.end(), own[state].begin(), own[state].end());
+        }
+        m_output_begin[states] = static_cast<uint32_t>(m_outputs.size());
+
+        // edges become row offsets, saving the scan loop a multiplication, and are flagged where
+        // they lead into a state where something ends, so the loop tests one bit
+        for (uint32_t& edge: m_next) {
+            bool match = !own[edge].empty() || m_dictionary[edge] != NONE;
+            edge = edge * m_columns | (match ? MATCH : 0);
+        }
+    }
+
+    void TriggerScanner::scan(const PatternSet& set, int id, const char* data, size_t size, std::vector<TriggerMatch>& out, size_t max) {
+        if (m_generation != set.generation()) {
+            m_generation = set.generation();
+            m_state = 0;
+        }
+        const auto* bytes = reinterpret_cast<const unsigned char*>(data);
+        uint32_t state = m_state;
+        size_t i = 0;
+        while (i < size) {
+            if (m_filter == Filter::Text) {
+                // text runs up to the next escape sequence, found with memchr rather than per byte
+                const void* escape = std::memchr(bytes + i, 0x1b, size - i);
+                size_t end = escape ? static_cast<size_t>(static_cast<const unsigned char*>(escape) - bytes) : size;
+                for (; i < end; ++i) {
+                    state = set.next(state, bytes[i]);
+                    if (!(state & PatternSet::MATCH)) continue;
+                    state &= ~PatternSet::MATCH;
+                    uint64_t at = m_offset + i + 1;
+                    set.for_each_match(state, [&](uint32_t pattern) {
+                        if (out.size() < max) out.push_back({id, pattern, at});
+                    });
+                }
+                if (escape) {
+                    m_filter = Filter::Escape;
+                    ++i;
+                }
+                continue;
+            }
+
+            unsigned char byte = bytes[i++];
+            switch (m_filter) {
+                case Filter::Escape:
+                    if (byte == '[') m_filter = Filter::Csi;
+                    else if (byte == ']' || byte == 'P' || byte == 'X' || byte == '^' || byte == '_') m_filter = Filter::String;
+                    // intermediates and another ESC keep the sequence open, anything else ends it
+                    else if (byte != 0x1b && (byte < 0x20 || byte > 0x2f)) m_filter = Filter::Text;
+                    break;
+                case Filter::Csi:
+                    if (byte == 0x1b) m_filter = Filter::Escape;
+                    else if (byte >= 0x40 && byte <= 0x7e) m_filter = Filter::Text;
+                    break;
+                case Filter::String:
+                    if (byte == 0x07) m_filter = Filter::Text;
+                    else if (byte == 0x1b) m_filter = Filter::StringEscape;
+                    break;
+                case Filter::StringEscape:
+                    // ST ends the string; any other ESC starts a sequence of its own
+                    m_filter = Filter::Escape;
+                    if (byte == '\\') m_filter = Filter::Text;
+                    else --i;
+                    break;
+                case Filter::Text:
+                    break;
+            }
+        }
+        m_state = state;
+        m_offset += size;
+    }
+}// namespace noterm
@@ -0,0 +1,90 @@
+#ifndef NOTERM_TRIGGER_HPP
+#define NOTERM_TRIGGER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace noterm {
+    // a pattern seen in a session's output
+    struct TriggerMatch {
+        int id;
+        // index into the pattern list the set was built from
+        uint32_t pattern;
+        // bytes of the session's raw output up to the end of the match
+        uint64_t end;
+    };
+
+    // Aho-Corasick automaton over a list of literal patterns, compiled to a DFA: one table lookup
+    // per byte scanned, however many patterns there are. Bytes no pattern uses share a column of
+    // the table, so thousands of patterns stay within a few MB. Case folding is ASCII only.
+    class PatternSet {
+    public:
+        // empty patterns never match but keep their index
+        PatternSet(const std::vector<std::string>& patterns, bool ignore_case);
+
+        size_t size() const { return m_patterns.size(); }
+        // tells sets apart, even one allocated where a freed one was
+        uint64_t generation() const { return m_generation; }
+        const std::string& pattern(size_t i) const { return m_patterns[i]; }
+
+        // The state after byte; MATCH is set when a pattern ends there, see for_each_match(). A
+        // state is the offset of its row in the table, 0 is the start.
+        uint32_t next(uint32_t state, unsigned char byte) const { return m_next[state + m_column[byte]]; }
+
+        // calls f(pattern index) for every pattern ending in state (without MATCH)
+        template<typename F>
+        void for_each_match(uint32_t state, F&& f) const {
+            for (state /= m_columns; state != NONE; state = m_dictionary[state]) {
+                for (uint32_t i = m_output_begin[state]; i < m_output_begin[state + 1]; ++i) f(m_outputs[i]);
+            }
+        }
+
+        static constexpr uint32_t MATCH = 0x80000000u;
+
+    private:
+        static constexpr uint32_t NONE = 0xffffffffu;
+
+        std::vector<std::string> m_patterns;
+        uint64_t m_generation;
+        uint16_t m_column[256] = {};
+        uint32_t m_columns = 1;
+        // states x columns, holding row offsets
+        std::vector<uint32_t> m_next;
+        // Indexed by state number, a row offset divided by m_columns. The patterns ending exactly in
+        // state s are m_outputs[m_output_begin[s] .. m_output_begin[s + 1]).
+        std::vector<uint32_t> m_output_begin;
+        std::vector<uint32_t> m_outputs;
+        // the nearest state down the failure chain that has outputs of its own, or NONE
+        std::vector<uint32_t> m_dictionary;
+    };
+
+    // Runs a PatternSet over one session's output, a chunk at a time, straight from where the
+    // chunk lies. Escape sequences are skipped, also when they are split across chunks, so text
+    // matches whatever colours it is printed in; everything else, line breaks included, is seen
+    // as it is written.
+    class TriggerScanner {
+    public:
+        // Appends the matches ending in data to out while it holds fewer than max, the rest are
+        // dropped. A different set than the last call's starts from scratch.
+        void scan(const PatternSet& set, int id, const char* data, size_t size, std::vector<TriggerMatch>& out, size_t max);
+
+    private:
+        enum class Filter : uint8_t {
+            Text,
+            Escape,
+            Csi,
+            // OSC, DCS, SOS, PM and APC, up to BEL or ST
+            String,
+            StringEscape,
+        };
+
+        uint64_t m_generation = 0;
+        uint32_t m_state = 0;
+        Filter m_filter = Filter::Text;
+        uint64_t m_offset = 0;
+    };
+}// namespace noterm
+
+#endif
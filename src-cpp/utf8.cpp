@@ -0,0 +1,246 @@
+#include "utf8.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#define NOTERM_UTF8_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define NOTERM_UTF8_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NOTERM_TARGET_SSSE3
+#else
+#define NOTERM_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+
+namespace noterm::utf8 {
+    namespace {
+        // Length of the well-formed code point at p, or 0 with bad set to the length of the maximal
+        // ill-formed subsequence starting there; a sequence cut off by avail counts as ill-formed.
+        inline size_t decode_length(const unsigned char* p, size_t avail, size_t& bad) {
+            unsigned char c = p[0];
+            if (c < 0x80) return 1;
+            size_t n;
+            unsigned char lo = 0x80;
+            unsigned char hi = 0xBF;
+            if (c >= 0xC2 && c <= 0xDF) {
+                n = 2;
+            } else if (c >= 0xE0 && c <= 0xEF) {
+                n = 3;
+                // overlong forms and UTF-16 surrogates
+                if (c == 0xE0) lo = 0xA0;
+                else if (c == 0xED) hi = 0x9F;
+            } else if (c >= 0xF0 && c <= 0xF4) {
+                n = 4;
+                // overlong forms and code points above U+10FFFF
+                if (c == 0xF0) lo = 0x90;
+                else if (c == 0xF4) hi = 0x8F;
+            } else {
+                bad = 1;
+                return 0;
+            }
+            for (size_t k = 1; k < n; ++k) {
+                if (k >= avail || p[k] < lo || p[k] > hi) {
+                    bad = k;
+                    return 0;
+                }
+                lo = 0x80;
+                hi = 0xBF;
+            }
+            return n;
+        }
+
+        // leading run of ASCII bytes
+        size_t ascii_run(const char* data, size_t size) {
+            size_t i = 0;
+#if defined(NOTERM_UTF8_SSE2)
+            for (; i + 16 <= size; i += 16) {
+                int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+                if (mask) break;
+            }
+#elif defined(NOTERM_UTF8_NEON)
+            for (; i + 16 <= size; i += 16) {
+                uint8x16_t high = vcgeq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(data + i)), vdupq_n_u8(0x80));
+                if (vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(high), 4)), 0)) break;
+            }
+#else
+            for (; i + 8 <= size; i += 8) {
+                uint64_t word;
+                std::memcpy(&word, data + i, 8);
+                if (word & 0x8080808080808080ull) break;
+            }
+#endif
+            while (i < size && static_cast<unsigned char>(data[i]) < 0x80) ++i;
+            return i;
+        }
+
+#if defined(NOTERM_UTF8_SSE2)
+        bool has_ssse3() {
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, 1);
+            return (info[2] & (1 << 9)) != 0;
+#else
+            return __builtin_cpu_supports("ssse3");
+#endif
+        }
+
+        const bool s_ssse3 = has_ssse3();
+
+        // Error classes of a byte pair (prev1, input), one bit each; a pair is ill-formed when all three
+        // lookups below agree on a bit. From "Validating UTF-8 In Less Than One Instruction Per Byte"
+        // (Keiser, Lemire 2021).
+        constexpr uint8_t TOO_SHORT = 1 << 0;
+        constexpr uint8_t TOO_LONG = 1 << 1;
+        constexpr uint8_t OVERLONG_3 = 1 << 2;
+        constexpr uint8_t TOO_LARGE = 1 << 3;
+        constexpr uint8_t SURROGATE = 1 << 4;
+        constexpr uint8_t OVERLONG_2 = 1 << 5;
+        constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+        constexpr uint8_t OVERLONG_4 = 1 << 6;
+        constexpr uint8_t TWO_CONTS = 1 << 7;
+        constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+        // indexed by the high nibble of the first byte
+        alignas(16) constexpr uint8_t BYTE_1_HIGH[16] = {
+                TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+                TOO_SHORT | OVERLONG_2,
+                TOO_SHORT,
+                TOO_SHORT | OVERLONG_3 | SURROGATE,
+                TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4};
+        // indexed by the low nibble of the first byte
+        alignas(16) constexpr uint8_t BYTE_1_LOW[16] = {
+                CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+                CARRY | OVERLONG_2,
+                CARRY,
+                CARRY,
+                CARRY | TOO_LARGE,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000};
+        // indexed by the high nibble of the second byte
+        alignas(16) constexpr uint8_t BYTE_2_HIGH[16] = {
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT};
+        // a block ending in a lead byte whose sequence needs more bytes than the block has left
+        alignas(16) constexpr uint8_t INCOMPLETE_MAX[16] = {
+                0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1};
+
+        NOTERM_TARGET_SSSE3 inline __m128i high_nibbles(__m128i v) {
+            return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+        }
+
+        NOTERM_TARGET_SSSE3 inline __m128i lookup(const uint8_t* table, __m128i index) {
+            return _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(table)), index);
+        }
+
+        // Number of leading bytes, a multiple of 16 backed off to a code point boundary, that are
+        // well-formed UTF-8; the scalar decoder continues from there.
+        NOTERM_TARGET_SSSE3 size_t valid_blocks_ssse3(const char* data, size_t size) {
+            const __m128i low_nibble = _mm_set1_epi8(0x0F);
+            __m128i prev = _mm_setzero_si128();
+            __m128i prev_incomplete = _mm_setzero_si128();
+            size_t i = 0;
+            for (; i + 16 <= size; i += 16) {
+                __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                __m128i error;
+                if (_mm_movemask_epi8(input) == 0) {
+                    // ASCII: only an unfinished sequence from the previous block can be wrong
+                    error = prev_incomplete;
+                } else {
+                    __m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+                    __m128i special = _mm_and_si128(
+                            _mm_and_si128(lookup(BYTE_1_HIGH, high_nibbles(prev1)), lookup(BYTE_1_LOW, _mm_and_si128(prev1, low_nibble))),
+                            lookup(BYTE_2_HIGH, high_nibbles(input)));
+                    // bytes two or three after a 3- or 4-byte lead must be continuations, and only those
+                    __m128i prev2 = _mm_alignr_epi8(input, prev, 14);
+                    __m128i prev3 = _mm_alignr_epi8(input, prev, 13);
+                    __m128i must_continue = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+                                                         _mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xF0 - 0x80))));
+                    error = _mm_xor_si128(_mm_and_si128(must_continue, _mm_set1_epi8(static_cast<char>(0x80))), special);
+                }
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF) break;
+                prev_incomplete = _mm_subs_epu8(input, _mm_load_si128(reinterpret_cast<const __m128i*>(INCOMPLETE_MAX)));
+                prev = input;
+            }
+            // everything before the error, or the end, is well-formed except maybe an unfinished last code point
+            return i - incomplete_tail(data, i);
+        }
+#endif
+    }// namespace
+
+    size_t valid_prefix_scalar(const char* data, size_t size) {
+        const auto* p = reinterpret_cast<const unsigned char*>(data);
+        size_t i = 0;
+        size_t bad;
+        while (i < size) {
+            size_t n = decode_length(p + i, size - i, bad);
+            if (n == 0) break;
+            i += n;
+        }
+        return i;
+    }
+
+    size_t valid_prefix(const char* data, size_t size) {
+        const auto* p = reinterpret_cast<const unsigned char*>(data);
+        size_t i = 0;
+#if defined(NOTERM_UTF8_SSE2)
+        if (s_ssse3) i = valid_blocks_ssse3(data, size);
+#endif
+        size_t bad;
+        while (i < size) {
+            i += ascii_run(data + i, size - i);
+            if (i == size) break;
+            size_t n = decode_length(p + i, size - i, bad);
+            if (n == 0) break;
+            i += n;
+        }
+        return i;
+    }
+
+    size_t incomplete_tail(const char* data, size_t size) {
+        const auto* p = reinterpret_cast<const unsigned char*>(data);
+        for (size_t k = 1; k <= 3 && k <= size; ++k) {
+            unsigned char c = p[size - k];
+            if ((c & 0xC0) == 0x80) continue;
+            if (c < 0xC0) return 0;
+            size_t needed = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+            return needed > k ? k : 0;
+        }
+        return 0;
+    }
+
+    void sanitize(const char* data, size_t size, std::string& out) {
+        const auto* p = reinterpret_cast<const unsigned char*>(data);
+        size_t i = 0;
+        while (i < size) {
+            size_t run = valid_prefix(data + i, size - i);
+            out.append(data + i, run);
+            i += run;
+            if (i == size) break;
+            size_t bad = 1;
+            decode_length(p + i, size - i, bad);
+            out += "\xEF\xBF\xBD";
+            i += bad;
+        }
+    }
+}// namespace noterm::utf8
@@ -0,0 +1,26 @@
+#ifndef NOTERM_UTF8_HPP
+#define NOTERM_UTF8_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace noterm::utf8 {
+    // Length of the longest prefix of data that is well-formed UTF-8 made of complete code points:
+    // it stops at the first invalid byte, or at a sequence cut off by the end of data. Pure ASCII is
+    // skipped 16 bytes at a time; multibyte text is validated with SSSE3 (Keiser and Lemire's
+    // lookup algorithm) where the CPU has it.
+    size_t valid_prefix(const char* data, size_t size);
+
+    // one code point at a time; the reference valid_prefix() is tested and benchmarked against
+    size_t valid_prefix_scalar(const char* data, size_t size);
+
+    // Trailing bytes of data that start a code point not completed within data, 0 to 3. Only looks
+    // at the byte lengths, a tail that could never be completed is invalid and not counted.
+    size_t incomplete_tail(const char* data, size_t size);
+
+    // Appends data to out with every maximal ill-formed subsequence replaced by U+FFFD, as the
+    // WHATWG decoder (and so xterm.js) would show it. An incomplete_tail() is replaced as well.
+    void sanitize(const char* data, size_t size, std::string& out);
+}// namespace noterm::utf8
+
+#endif
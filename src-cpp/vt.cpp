@@ -0,0 +1,332 @@
+#include "vt.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NOTERM_VT_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define NOTERM_VT_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace noterm::vt {
+    namespace {
+        constexpr char32_t REPLACEMENT_CHARACTER = 0xFFFD;
+        constexpr size_t MAX_OSC_LENGTH = 4096;
+
+        inline unsigned count_trailing_zeros(uint64_t v) {
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanForward64(&index, v);
+            return static_cast<unsigned>(index);
+#else
+            return static_cast<unsigned>(__builtin_ctzll(v));
+#endif
+        }
+
+        inline bool is_printable(unsigned char c) { return c >= 0x20 && c < 0x7F; }
+    }// namespace
+
+    size_t scan_printable(const char* data, size_t size) {
+        size_t i = 0;
+#if defined(NOTERM_VT_SSE2)
+        // signed compare: bytes >= 0x80 are negative, so "< 0x20" also catches every non-ASCII byte
+        const __m128i space = _mm_set1_epi8(0x20);
+        const __m128i del = _mm_set1_epi8(0x7F);
+        for (; i + 16 <= size; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i stop = _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del));
+            int mask = _mm_movemask_epi8(stop);
+            if (mask) return i + count_trailing_zeros(static_cast<uint64_t>(mask));
+        }
+#elif defined(NOTERM_VT_NEON)
+        const uint8x16_t space = vdupq_n_u8(0x20);
+        const uint8x16_t del = vdupq_n_u8(0x7F);
+        for (; i + 16 <= size; i += 16) {
+            uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i));
+            uint8x16_t stop = vorrq_u8(vcltq_u8(v, space), vcgeq_u8(v, del));
+            // narrow to one nibble per byte to get a 64-bit movemask
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(stop), 4)), 0);
+            if (mask) return i + (count_trailing_zeros(mask) >> 2);
+        }
+#endif
+        for (; i < size; ++i) {
+            if (!is_printable(static_cast<unsigned char>(data[i]))) break;
+        }
+        return i;
+    }
+
+    size_t unterminated_escape(const char* data, size_t size) {
+        const auto* p = reinterpret_cast<const unsigned char*>(data);
+        size_t start = size;
+        while (start > 0 && p[start - 1] != 0x1B) --start;
+        if (start == 0) return 0;
+        size_t esc = start - 1;
+        if (start == size) return size - esc;
+
+        size_t i = start;
+        switch (p[i]) {
+            case '[':
+                // parameters and intermediates up to the final byte; anything else ends it malformed
+                for (++i; i < size; ++i) {
+                    if (p[i] < 0x20 || p[i] > 0x3F) return 0;
+                }
+                return size - esc;
+            case ']':
+            case 'P':
+            case 'X':
+            case '^':
+            case '_':
+                // ESC \ would be a later ESC, so BEL is the only terminator left to find
+                for (++i; i < size; ++i) {
+                    if (p[i] == 0x07) return 0;
+                }
+                return size - esc;
+            default:
+                while (i < size && p[i] >= 0x20 && p[i] <= 0x2F) ++i;
+                return i == size ? size - esc : 0;
+        }
+    }
+
+    void Parser::feed(const char* data, size_t size) {
+        size_t i = 0;
+        while (i < size) {
+            if (m_state == State::Ground && m_utf8_remaining == 0) {
+                size_t run = scan_printable(data + i, size - i);
+                if (run > 0) {
+                    m_handler.print_ascii(data + i, run);
+                    i += run;
+                    if (i == size) break;
+                }
+            }
+            step(static_cast<uint8_t>(data[i++]));
+        }
+    }
+
+    void Parser::reset() {
+        m_state = State::Ground;
+        m_utf8_remaining = 0;
+        m_osc.clear();
+        clear_sequence();
+    }
+
+    void Parser::step(uint8_t byte) {
+        if (byte == 0x1B) {
+            if (m_state == State::OscString) {
+                m_state = State::OscEscape;
+                return;
+            }
+            if (m_state == State::StringIgnore) {
+                m_state = State::StringEscape;
+                return;
+            }
+            if (m_utf8_remaining) {
+                m_utf8_remaining = 0;
+                m_handler.print(REPLACEMENT_CHARACTER);
+            }
+            clear_sequence();
+            m_state = State::Escape;
+            return;
+        }
+        if (byte == 0x18 || byte == 0x1A) {
+            // CAN / SUB abort any sequence in progress
+            if (m_utf8_remaining) {
+                m_utf8_remaining = 0;
+                m_handler.print(REPLACEMENT_CHARACTER);
+            }
+            m_state = State::Ground;
+            return;
+        }
+
+        switch (m_state) {
+            case State::Ground:
+                ground(byte);
+                break;
+            case State::Escape:
+            case State::EscapeIntermediate:
+                escape(byte);
+                break;
+            case State::CsiEntry:
+            case State::CsiParam:
+            case State::CsiIntermediate:
+            case State::CsiIgnore:
+                csi(byte);
+                break;
+            case State::OscString:
+                if (byte == 0x07) {
+                    m_handler.osc_dispatch(m_osc);
+                    m_state = State::Ground;
+                } else if (byte >= 0x20 && m_osc.size() < MAX_OSC_LENGTH) {
+                    m_osc.push_back(static_cast<char>(byte));
+                }
+                break;
+            case State::OscEscape:
+                // ESC \ is the string terminator; any other byte ends the string and starts a new sequence
+                m_handler.osc_dispatch(m_osc);
+                clear_sequence();
+                m_state = State::Escape;
+                if (byte == '\\') {
+                    m_state = State::Ground;
+                } else {
+                    escape(byte);
+                }
+                break;
+            case State::StringIgnore:
+                break;
+            case State::StringEscape:
+                clear_sequence();
+                m_state = State::Escape;
+                if (byte == '\\') {
+                    m_state = State::Ground;
+                } else {
+                    escape(byte);
+                }
+                break;
+        }
+    }
+
+    void Parser::ground(uint8_t byte) {
+        if (m_utf8_remaining) {
+            if ((byte & 0xC0) == 0x80) {
+                m_codepoint = (m_codepoint << 6) | (byte & 0x3F);
+                if (--m_utf8_remaining == 0) {
+                    bool valid = m_codepoint >= m_utf8_min && m_codepoint <= 0x10FFFF &&
+                                 !(m_codepoint >= 0xD800 && m_codepoint <= 0xDFFF);
+                    m_handler.print(valid ? m_codepoint : REPLACEMENT_CHARACTER);
+                }
+                return;
+            }
+            // truncated sequence: replace it and reprocess this byte
+            m_utf8_remaining = 0;
+            m_handler.print(REPLACEMENT_CHARACTER);
+        }
+
+        if (byte < 0x20) {
+            m_handler.execute(byte);
+        } else if (byte < 0x7F) {
+            char c = static_cast<char>(byte);
+            m_handler.print_ascii(&c, 1);
+        } else if (byte == 0x7F) {
+            // DEL is ignored
+        } else if (byte >= 0xC2 && byte <= 0xDF) {
+            m_codepoint = byte & 0x1F;
+            m_utf8_remaining = 1;
+            m_utf8_min = 0x80;
+        } else if (byte >= 0xE0 && byte <= 0xEF) {
+            m_codepoint = byte & 0x0F;
+            m_utf8_remaining = 2;
+            m_utf8_min = 0x800;
+        } else if (byte >= 0xF0 && byte <= 0xF4) {
+            m_codepoint = byte & 0x07;
+            m_utf8_remaining = 3;
+            m_utf8_min = 0x10000;
+        } else {
+            m_handler.print(REPLACEMENT_CHARACTER);
+        }
+    }
+
+    void Parser::escape(uint8_t byte) {
+        if (byte < 0x20) {
+            m_handler.execute(byte);
+            return;
+        }
+        if (byte <= 0x2F) {
+            collect_intermediate(byte);
+            m_state = State::EscapeIntermediate;
+            return;
+        }
+        if (m_state == State::Escape) {
+            switch (byte) {
+                case '[':
+                    m_state = State::CsiEntry;
+                    return;
+                case ']':
+                    m_osc.clear();
+                    m_state = State::OscString;
+                    return;
+                case 'P':
+                case 'X':
+                case '^':
+                case '_':
+                    m_state = State::StringIgnore;
+                    return;
+                default:
+                    break;
+            }
+        }
+        if (byte <= 0x7E) {
+            m_seq.final = static_cast<char>(byte);
+            m_handler.esc_dispatch(m_seq);
+            m_state = State::Ground;
+        }
+    }
+
+    void Parser::csi(uint8_t byte) {
+        if (byte < 0x20) {
+            m_handler.execute(byte);
+            return;
+        }
+        if (m_state == State::CsiIgnore) {
+            if (byte >= 0x40 && byte <= 0x7E) m_state = State::Ground;
+            return;
+        }
+
+        if (byte >= '0' && byte <= '9') {
+            if (m_state == State::CsiIntermediate) {
+                m_state = State::CsiIgnore;
+                return;
+            }
+            if (m_seq.param_count == 0) {
+                m_seq.params[0] = 0;
+                m_seq.param_count = 1;
+            }
+            uint16_t& param = m_seq.params[m_seq.param_count - 1];
+            uint32_t value = param * 10u + (byte - '0');
+            param = static_cast<uint16_t>(value > 0xFFFF ? 0xFFFF : value);
+            m_state = State::CsiParam;
+        } else if (byte == ';' || byte == ':') {
+            if (m_state == State::CsiIntermediate) {
+                m_state = State::CsiIgnore;
+                return;
+            }
+            if (m_seq.param_count == 0) {
+                m_seq.params[0] = 0;
+                m_seq.param_count = 1;
+            }
+            if (m_seq.param_count < Sequence::MAX_PARAMS) {
+                if (byte == ':') m_seq.subparams |= 1u << m_seq.param_count;
+                m_seq.params[m_seq.param_count++] = 0;
+            }
+            m_state = State::CsiParam;
+        } else if (byte >= 0x3C && byte <= 0x3F) {
+            if (m_state == State::CsiEntry) {
+                m_seq.prefix = static_cast<char>(byte);
+                m_state = State::CsiParam;
+            } else {
+                m_state = State::CsiIgnore;
+            }
+        } else if (byte <= 0x2F) {
+            collect_intermediate(byte);
+            m_state = State::CsiIntermediate;
+        } else if (byte <= 0x7E) {
+            m_seq.final = static_cast<char>(byte);
+            m_handler.csi_dispatch(m_seq);
+            m_state = State::Ground;
+        }
+    }
+
+    void Parser::clear_sequence() {
+        m_seq.param_count = 0;
+        m_seq.subparams = 0;
+        m_seq.prefix = 0;
+        m_seq.intermediate_count = 0;
+        m_seq.final = 0;
+    }
+
+    void Parser::collect_intermediate(uint8_t byte) {
+        if (m_seq.intermediate_count < 2) m_seq.intermediates[m_seq.intermediate_count++] = static_cast<char>(byte);
+    }
+}// namespace noterm::vt
@@ -0,0 +1,103 @@
+#ifndef NOTERM_VT_HPP
+#define NOTERM_VT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace noterm::vt {
+    // a parsed ESC or CSI sequence
+    struct Sequence {
+        static constexpr int MAX_PARAMS = 32;
+
+        uint16_t params[MAX_PARAMS];
+        // bit i: params[i] was introduced by ':' (a sub-parameter of the previous one)
+        uint32_t subparams = 0;
+        int param_count = 0;
+        // '?', '>', '=' or '<' right after CSI, 0 otherwise
+        char prefix = 0;
+        char intermediates[2] = {};
+        int intermediate_count = 0;
+        char final = 0;
+
+        // a missing or zero parameter takes the default, as in most CSI sequences
+        int param(int i, int fallback) const {
+            return i < param_count && params[i] != 0 ? params[i] : fallback;
+        }
+        int raw_param(int i) const { return i < param_count ? params[i] : 0; }
+        bool is_subparam(int i) const { return i < param_count && (subparams >> i) & 1; }
+        char intermediate() const { return intermediate_count ? intermediates[0] : 0; }
+    };
+
+    // receives the actions of the parser, in stream order
+    class Handler {
+    public:
+        virtual ~Handler() = default;
+
+        // a run of printable ASCII (0x20..0x7E)
+        virtual void print_ascii(const char* data, size_t size) = 0;
+        // any other printable code point; malformed UTF-8 arrives as U+FFFD
+        virtual void print(char32_t codepoint) = 0;
+        // C0 control
+        virtual void execute(uint8_t control) = 0;
+        virtual void esc_dispatch(const Sequence& seq) = 0;
+        virtual void csi_dispatch(const Sequence& seq) = 0;
+        // body of an OSC string, without the introducer and terminator
+        virtual void osc_dispatch(std::string_view data) = 0;
+    };
+
+    // Length of the leading run of printable ASCII in data. Vectorised with SSE2 or NEON where
+    // available; this is the parser's fast path, output is almost always long printable runs.
+    size_t scan_printable(const char* data, size_t size);
+
+    // Length of the escape sequence at the end of data if it is not complete yet, 0 otherwise, so
+    // output can be cut in front of it. Only the last ESC in data is looked at: a string (OSC, DCS,
+    // ...) is complete at BEL, a CSI at its final byte, anything else at its first non-intermediate.
+    size_t unterminated_escape(const char* data, size_t size);
+
+    // Incremental VT500-style parser (after Paul Williams' state diagram). Bytes can be fed in
+    // arbitrary chunks; sequences and UTF-8 split across feeds are reassembled.
+    class Parser {
+    public:
+        explicit Parser(Handler& handler) : m_handler(handler) {}
+
+        void feed(const char* data, size_t size);
+        void reset();
+
+    private:
+        enum class State : uint8_t {
+            Ground,
+            Escape,
+            EscapeIntermediate,
+            CsiEntry,
+            CsiParam,
+            CsiIntermediate,
+            CsiIgnore,
+            OscString,
+            OscEscape,
+            // DCS, SOS, PM and APC bodies are skipped up to the string terminator
+            StringIgnore,
+            StringEscape,
+        };
+
+        void step(uint8_t byte);
+        void ground(uint8_t byte);
+        void escape(uint8_t byte);
+        void csi(uint8_t byte);
+        void clear_sequence();
+        void collect_intermediate(uint8_t byte);
+
+        Handler& m_handler;
+        State m_state = State::Ground;
+        Sequence m_seq;
+
+        char32_t m_codepoint = 0;
+        int m_utf8_remaining = 0;
+        char32_t m_utf8_min = 0;
+
+        std::string m_osc;
+    };
+}// namespace noterm::vt
+
+#endif
@@ -1,6 +1,10 @@
 #include "win32.hpp"
 
-#include <iostream>
+#include <cstdio>
+
+#include "input_chunking.hpp"
+#include "log.hpp"
+#include "trace.hpp"
 
 namespace noterm ::detail {
     PseudoConsoleFunctions PseudoConsoleFunctions::g_pfns;
@@ -26,32 +30,66 @@ namespace noterm ::detail {
         PseudoConsoleFunctions::g_pfns = functions;
     }
 
+    namespace {
+        // size of the pipe buffers and upper bound of a single write; reads follow the ReadPolicy
+        constexpr DWORD READ_CHUNK_SIZE = 64 * 1024;
+
+        // anonymous pipes cannot do overlapped I/O, so each direction is a uniquely named pipe whose
+        // server end (ours) is associated with the completion port and whose client end goes to ConPTY
+        bool create_overlapped_pipe(HANDLE* server, HANDLE* client, bool server_reads) {
+            static std::atomic<unsigned long> serial{0};
+            char name[128];
+            snprintf(name, sizeof(name), "\\\\.\\pipe\\noterm-%lu-%lu", GetCurrentProcessId(), serial.fetch_add(1));
+
+            DWORD open_mode = (server_reads ? PIPE_ACCESS_INBOUND : PIPE_ACCESS_OUTBOUND) | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE;
+            *server = CreateNamedPipeA(
+                    name,
+                    open_mode,
+                    PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                    1,
+                    READ_CHUNK_SIZE,
+                    READ_CHUNK_SIZE,
+                    0,
+                    nullptr);
+            if (*server == INVALID_HANDLE_VALUE) {
+                *server = nullptr;
+                return false;
+            }
+
+            *client = CreateFileA(name, server_reads ? GENERIC_WRITE : GENERIC_READ, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (*client == INVALID_HANDLE_VALUE) {
+                CloseHandle(*server);
+                *server = nullptr;
+                *client = nullptr;
+                return false;
+            }
+            return true;
+        }
+    }// namespace
+
     void PseudoConsole::init(std::string_view proc_name, int cols, int rows) {
-        if (m_running) {
+        if (m_hPC) {
             // close existing pseudo console
             close();
         }
 
-        m_input_queue = InputQueue(1024);
-        m_output_queue = OutputQueue(1024);
-
-        SECURITY_ATTRIBUTES sa = {
-                sizeof(SECURITY_ATTRIBUTES),
-                nullptr,
-                TRUE,
-        };
-        CreatePipe(&m_hInRead, &m_hInWrite, &sa, 0);
-        CreatePipe(&m_hOutRead, &m_hOutWrite, &sa, 0);
+        HANDLE hInRead = nullptr;
+        HANDLE hOutWrite = nullptr;
+        if (!create_overlapped_pipe(&m_hInWrite, &hInRead, false) || !create_overlapped_pipe(&m_hOutRead, &hOutWrite, true)) {
+            NOTERM_LOG_ERROR("Failed to create pseudo console pipes.");
+            close();
+            return;
+        }
 
         create_pseudo_console(
                 {static_cast<SHORT>(cols), static_cast<SHORT>(rows)},
-                m_hInRead,
-                m_hOutWrite,
+                hInRead,
+                hOutWrite,
                 0,
                 &m_hPC);
 
-        CloseHandle(m_hInRead);
-        CloseHandle(m_hOutWrite);
+        CloseHandle(hInRead);
+        CloseHandle(hOutWrite);
 
         STARTUPINFOEXA si = {};
         si.StartupInfo.cb = sizeof(STARTUPINFOEXA);
@@ -68,10 +106,11 @@ namespace noterm ::detail {
                 nullptr,
                 nullptr);
 
+        std::string command_line(proc_name);
         PROCESS_INFORMATION pi = {};
         CreateProcessA(
                 nullptr,
-                (char*) proc_name.data(),
+                command_line.data(),
                 nullptr,
                 nullptr,
                 FALSE,
@@ -81,21 +120,34 @@ namespace noterm ::detail {
                 reinterpret_cast<LPSTARTUPINFOA>(&si),
                 &pi);
 
-        m_running = true;
+        DeleteProcThreadAttributeList(si.lpAttributeList);
+        HeapFree(GetProcessHeap(), 0, si.lpAttributeList);
 
-        m_hInputThread = CreateThread(nullptr, 0, input_thread_proc, this, 0, nullptr);
-        m_hOutputThread = CreateThread(nullptr, 0, output_thread_proc, this, 0, nullptr);
+        if (pi.hThread) CloseHandle(pi.hThread);
+        m_hProcess = pi.hProcess;
 
-        std::cout << "PseudoConsole initialized with process: " << proc_name << std::endl;
+        NOTERM_LOG_INFO("PseudoConsole initialized with process: %s", command_line.c_str());
     }
 
     void PseudoConsole::close() {
-        m_running = false;
+        Reactor* reactor = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_input_mutex);
+            reactor = m_reactor;
+        }
 
+        // ConPTY may block until its output is drained, so keep the reactor reading until it is
+        // gone, also when nobody consumes the ring anymore
         if (m_hPC) {
+            if (reactor) reactor->drain(this);
             close_pseudo_console(m_hPC);
             m_hPC = nullptr;
         }
+
+        if (reactor) {
+            reactor->detach(this);
+        }
+
         if (m_hInWrite) {
             CloseHandle(m_hInWrite);
             m_hInWrite = nullptr;
@@ -104,62 +156,274 @@ namespace noterm ::detail {
             CloseHandle(m_hOutRead);
             m_hOutRead = nullptr;
         }
-        if (m_hInputThread) {
-            WaitForSingleObject(m_hInputThread, INFINITE);
-            CloseHandle(m_hInputThread);
-            m_hInputThread = nullptr;
+        if (m_hProcess) {
+            CloseHandle(m_hProcess);
+            m_hProcess = nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(m_input_mutex);
+        m_pending_input.clear();
+    }
+
+    void PseudoConsole::write_input(const std::string_view* parts, size_t count) {
+        Reactor* reactor = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_input_mutex);
+            for (size_t i = 0; i < count; ++i) m_pending_input.append(parts[i]);
+            reactor = m_reactor;
         }
-        if (m_hOutputThread) {
-            WaitForSingleObject(m_hOutputThread, INFINITE);
-            CloseHandle(m_hOutputThread);
-            m_hOutputThread = nullptr;
+        if (reactor) {
+            reactor->submit_write(this);
         }
     }
 
-    DWORD PseudoConsole::input_thread_proc(LPVOID lpParam) {
-        PseudoConsole* self = reinterpret_cast<PseudoConsole*>(lpParam);
-        while (true) {
-            if (!self->m_running) {
-                break;
-            }
+    void PseudoConsole::resume_output() {
+        Reactor* reactor = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_input_mutex);
+            reactor = m_reactor;
+        }
+        if (reactor) {
+            reactor->resume_read(this);
+        }
+    }
 
-            std::string input;
-            if (!self->m_input_queue.wait_dequeue_timed(input, std::chrono::milliseconds(10))) {
-                continue;
+    bool Reactor::start() {
+        if (m_running) return true;
+
+        m_iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+        if (!m_iocp) {
+            NOTERM_LOG_ERROR("Failed to create I/O completion port.");
+            return false;
+        }
+
+        m_running = true;
+        m_thread = std::thread([this]() { run(); });
+        return true;
+    }
+
+    void Reactor::stop() {
+        if (m_running.exchange(false)) {
+            // completion key 0 without an OVERLAPPED wakes the loop up to observe m_running
+            PostQueuedCompletionStatus(m_iocp, 0, 0, nullptr);
+        }
+        {
+            // a detach waiting for its read gives up, nothing will dequeue it any more
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_read_done.notify_all();
+        }
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& kv: m_states) {
+                if (PseudoConsole* pc = kv.second->console) {
+                    std::lock_guard<std::mutex> input_lock(pc->m_input_mutex);
+                    pc->m_reactor = nullptr;
+                }
+            }
+            // nothing dequeues the completions anymore; any state with I/O in flight is intentionally leaked
+            for (auto& kv: m_states) {
+                if (kv.second->read_pending || kv.second->write_pending) kv.second.release();
             }
+            m_states.clear();
+        }
+
+        if (m_iocp) {
+            CloseHandle(m_iocp);
+            m_iocp = nullptr;
+        }
+    }
+
+    void Reactor::attach(PseudoConsole* pc) {
+        if (!pc->m_hOutRead || !pc->m_hInWrite || !pc->m_output_ring) return;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ULONG_PTR token = m_next_token++;
+
+        auto state = std::make_unique<IoState>();
+        state->console = pc;
+        state->read_handle = pc->m_hOutRead;
+        state->write_handle = pc->m_hInWrite;
+        state->write_op.is_write = true;
+
+        CreateIoCompletionPort(pc->m_hOutRead, m_iocp, token, 0);
+        CreateIoCompletionPort(pc->m_hInWrite, m_iocp, token, 0);
+
+        {
+            std::lock_guard<std::mutex> input_lock(pc->m_input_mutex);
+            pc->m_reactor = this;
+            pc->m_token = token;
+        }
+
+        IoState& ref = *state;
+        m_states[token] = std::move(state);
+        post_read(ref);
+        // input may have been queued before the console was attached
+        post_write(ref);
+    }
+
+    void Reactor::detach(PseudoConsole* pc) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ULONG_PTR token = pc->m_token;
+        auto it = m_states.find(token);
+        if (it != m_states.end()) {
+            IoState& state = *it->second;
+            state.console = nullptr;
+            // the state is freed by the loop once the aborted operations have been dequeued
+            if (state.read_pending) CancelIoEx(state.read_handle, &state.read_op.overlapped);
+            if (state.write_pending) CancelIoEx(state.write_handle, &state.write_op.overlapped);
+            if (!state.read_pending && !state.write_pending) m_states.erase(it);
+        }
+        // CancelIoEx only requests the abort: the kernel may still be filling the console's ring,
+        // which its owner frees once we return, so wait until the loop has dequeued the read. The
+        // write buffer belongs to the state and may stay in flight.
+        m_read_done.wait(lock, [&]() {
+            auto found = m_states.find(token);
+            return !m_running || found == m_states.end() || !found->second->read_pending;
+        });
+        lock.unlock();
+
+        std::lock_guard<std::mutex> input_lock(pc->m_input_mutex);
+        pc->m_reactor = nullptr;
+        pc->m_token = 0;
+    }
+
+    void Reactor::submit_write(PseudoConsole* pc) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_states.find(pc->m_token);
+        if (it != m_states.end()) post_write(*it->second);
+    }
+
+    void Reactor::resume_read(PseudoConsole* pc) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_states.find(pc->m_token);
+        if (it != m_states.end()) post_read(*it->second);
+    }
 
-            DWORD bytes_written;
-            BOOL result = WriteFile(self->m_hInWrite, input.data(), static_cast<DWORD>(input.size()), &bytes_written, nullptr);
-            if (!result || bytes_written == 0) {
-                break;
+    void Reactor::drain(PseudoConsole* pc) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_states.find(pc->m_token);
+        if (it == m_states.end()) return;
+        it->second->draining = true;
+        post_read(*it->second);
+    }
+
+    void Reactor::post_read(IoState& state) {
+        if (state.read_pending || state.read_closed || !state.console) return;
+
+        if (state.draining) {
+            if (!state.scratch) state.scratch.reset(new char[READ_CHUNK_SIZE]);
+            state.read_into_ring = false;
+            state.read_op.overlapped = {};
+            BOOL result = ReadFile(state.read_handle, state.scratch.get(), READ_CHUNK_SIZE, nullptr, &state.read_op.overlapped);
+            if (result || GetLastError() == ERROR_IO_PENDING) {
+                state.read_pending = true;
+            } else {
+                state.read_closed = true;
             }
+            return;
+        }
+
+        // read straight into the ring; while it is full no read is outstanding and ConPTY blocks
+        auto span = state.console->m_output_ring->write_span();
+        state.console->m_output_paused = span.second == 0;
+        if (span.second == 0) return;
+
+        size_t asked = state.read_size.next(m_policy);
+        DWORD size = static_cast<DWORD>(span.second < asked ? span.second : asked);
+        state.read_asked = size;
+        state.read_into_ring = true;
+        state.read_op.overlapped = {};
+        BOOL result = ReadFile(state.read_handle, span.first, size, nullptr, &state.read_op.overlapped);
+        // a synchronous success still queues a completion packet
+        if (result || GetLastError() == ERROR_IO_PENDING) {
+            state.read_pending = true;
+        } else {
+            state.read_closed = true;
         }
-        return 0;
     }
 
-    DWORD PseudoConsole::output_thread_proc(LPVOID lpParam) {
-        PseudoConsole* self = reinterpret_cast<PseudoConsole*>(lpParam);
-        char chunk[4096];
-        DWORD bytes_read;
+    void Reactor::post_write(IoState& state) {
+        if (state.write_pending || !state.console) return;
 
+        if (state.write_buffer.empty()) {
+            // take everything queued so far as one write instead of one WriteFile per input event
+            std::lock_guard<std::mutex> input_lock(state.console->m_input_mutex);
+            state.write_buffer.swap(state.console->m_pending_input);
+        }
+        if (state.write_buffer.empty()) return;
+
+        // one pipe buffer per write, cut so ConPTY never sees half of an escape or UTF-8 sequence
+        size_t size = input_chunk_boundary(state.write_buffer.data(), state.write_buffer.size(), READ_CHUNK_SIZE);
+        state.write_op.overlapped = {};
+        BOOL result = WriteFile(state.write_handle, state.write_buffer.data(), static_cast<DWORD>(size), nullptr, &state.write_op.overlapped);
+        if (result || GetLastError() == ERROR_IO_PENDING) {
+            state.write_pending = true;
+        } else {
+            state.write_buffer.clear();
+        }
+    }
+
+    void Reactor::run() {
+        trace::set_thread_name("reactor");
         while (true) {
-            if (!self->m_running) {
-                break;
-            }
+            DWORD bytes = 0;
+            ULONG_PTR key = 0;
+            LPOVERLAPPED overlapped = nullptr;
+            BOOL ok = GetQueuedCompletionStatus(m_iocp, &bytes, &key, &overlapped, INFINITE);
 
-            BOOL result = ReadFile(self->m_hOutRead, chunk, sizeof(chunk), &bytes_read, nullptr);
-            if (!result) {
-                std::cerr << "ReadFile failed in output thread." << std::endl;
-                break;
+            if (!overlapped) {
+                if (!ok && GetLastError() != WAIT_TIMEOUT) {
+                    NOTERM_LOG_ERROR("GetQueuedCompletionStatus failed in reactor.");
+                    break;
+                }
+                if (!m_running) break;
+                continue;
             }
-            if (bytes_read == 0) {
+
+            IoOperation* op = CONTAINING_RECORD(overlapped, IoOperation, overlapped);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_states.find(key);
+            if (it == m_states.end()) {
                 continue;
             }
+            IoState& state = *it->second;
+
+            if (op->is_write) {
+                state.write_pending = false;
+                if (ok) {
+                    state.write_buffer.erase(0, bytes);
+                    post_write(state);
+                } else {
+                    state.write_buffer.clear();
+                }
+            } else {
+                state.read_pending = false;
+                if (ok && state.console) {
+                    if (state.read_into_ring) {
+                        if (bytes > 0) {
+                            trace::Span traced("pty.read");
+                            traced.bytes = bytes;
+                            state.console->m_output_ring->commit(bytes);
+                            if (state.console->m_output_handler) state.console->m_output_handler(bytes);
+                        }
+                        state.read_size.update(m_policy, state.read_asked, bytes);
+                    }
+                    post_read(state);
+                } else if (!ok && GetLastError() != ERROR_OPERATION_ABORTED) {
+                    // ERROR_BROKEN_PIPE: the pseudo console is gone, stop reading
+                    state.read_closed = true;
+                }
+                if (!state.console) m_read_done.notify_all();
+            }
 
-            std::cout << "Read " << bytes_read << " bytes from pseudo console." << std::endl;
-            std::string output(chunk, bytes_read);
-            self->m_output_queue.enqueue(output);
+            if (!state.console && !state.read_pending && !state.write_pending) {
+                m_states.erase(it);
+            }
         }
-        return 0;
     }
-}// namespace noterm::detail
\ No newline at end of file
+}// namespace noterm::detail
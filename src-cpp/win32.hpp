@@ -2,9 +2,15 @@
 #define _WIN32_WINNT 0x0A00     // _WIN32_WINNT_WIN10
 #define NTDDI_VERSION 0x0A000006//NTDDI_WIN10_RS5
 
-#include <optional>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
 
 
 /* clang-format off */
@@ -12,9 +18,8 @@
 #include <wincon.h>
 /* clang-format on */
 
-#include <blockingconcurrentqueue.h>
-#include <concurrentqueue.h>
-
+#include "read_policy.hpp"
+#include "ring_buffer.hpp"
 
 namespace noterm {
     namespace detail {
@@ -44,10 +49,16 @@ namespace noterm {
             return PseudoConsoleFunctions::g_pfns.ResizePseudoConsole(hPC, size);
         }
 
+        class Reactor;
+
         struct PseudoConsole {
         public:
-            using OutputQueue = moodycamel::BlockingConcurrentQueue<std::string>;
-            using InputQueue = moodycamel::BlockingConcurrentQueue<std::string>;
+            // invoked on the reactor thread after new bytes were committed to the output ring
+            using OutputHandler = std::function<void(size_t bytes)>;
+
+            PseudoConsole() = default;
+            PseudoConsole(const PseudoConsole&) = delete;
+            PseudoConsole& operator=(const PseudoConsole&) = delete;
 
             void init(std::string_view proc_name, int cols, int rows);
 
@@ -57,41 +68,124 @@ namespace noterm {
                 resize_pseudo_console(m_hPC, {static_cast<SHORT>(cols), static_cast<SHORT>(rows)});
             }
 
-            void write_input(const std::string& input) {
-                m_input_queue.enqueue(input);
+            // queues the parts and hands them to the reactor as overlapped writes
+            void write_input(const std::string_view* parts, size_t count);
+
+            void write_input(std::string_view input) {
+                write_input(&input, 1);
             }
 
-            std::optional<std::string> read_output() {
-                std::string output;
-                if (m_output_queue.wait_dequeue_timed(output, std::chrono::milliseconds(10))) {
-                    return output;
-                }
-                return std::nullopt;
+            // the reactor reads straight into this ring; must be set before attaching
+            void set_output_ring(ByteRing* ring) {
+                m_output_ring = ring;
             }
 
-            std::optional<std::string> read_output_nonblocking() {
-                std::string output;
-                if (m_output_queue.try_dequeue(output)) {
-                    return output;
-                }
-                return std::nullopt;
+            void set_output_handler(OutputHandler handler) {
+                m_output_handler = std::move(handler);
+            }
+
+            // consumer side: the ring has room again, resume reading if it was full
+            void resume_output();
+
+            // true while no read is outstanding because the ring is full
+            bool output_paused() const {
+                return m_output_paused.load(std::memory_order_relaxed);
             }
 
         private:
-            InputQueue m_input_queue;
-            OutputQueue m_output_queue;
+            friend class Reactor;
 
             HPCON m_hPC = nullptr;
-            HANDLE m_hInRead, m_hInWrite;
-            HANDLE m_hOutRead, m_hOutWrite;
+            // server ends of the two named pipes, opened for overlapped I/O
+            HANDLE m_hInWrite = nullptr;
+            HANDLE m_hOutRead = nullptr;
+            HANDLE m_hProcess = nullptr;
 
-            HANDLE m_hInputThread = nullptr;
-            HANDLE m_hOutputThread = nullptr;
+            Reactor* m_reactor = nullptr;
+            ULONG_PTR m_token = 0;
 
-            bool m_running = false;
+            ByteRing* m_output_ring = nullptr;
+            OutputHandler m_output_handler;
+            std::atomic_bool m_output_paused{false};
 
-            static DWORD WINAPI input_thread_proc(LPVOID lpParam);
-            static DWORD WINAPI output_thread_proc(LPVOID lpParam);
+            std::mutex m_input_mutex;
+            std::string m_pending_input;
+        };
+
+        // single I/O completion port multiplexing the pipes of every attached PseudoConsole
+        class Reactor {
+        public:
+            Reactor() = default;
+            ~Reactor() { stop(); }
+            Reactor(const Reactor&) = delete;
+            Reactor& operator=(const Reactor&) = delete;
+
+            bool start();
+            void stop();
+
+            void attach(PseudoConsole* pc);
+            // Once detach returns the reactor thread no longer touches pc, and no read is outstanding
+            // into its output ring: cancelling is asynchronous, so it waits for the aborted read.
+            void detach(PseudoConsole* pc);
+
+            // the batch delay is not applied here: ConPTY already coalesces output into frames
+            void set_read_policy(const ReadPolicy& policy) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_policy = policy;
+            }
+
+        private:
+            friend struct PseudoConsole;
+
+            struct IoOperation {
+                OVERLAPPED overlapped = {};
+                bool is_write = false;
+            };
+
+            // overlapped state of one console; it outlives the console until its cancelled operations complete
+            struct IoState {
+                PseudoConsole* console = nullptr;
+                HANDLE read_handle = nullptr;
+                HANDLE write_handle = nullptr;
+
+                IoOperation read_op;
+                IoOperation write_op;
+                bool read_pending = false;
+                bool write_pending = false;
+                // the pipe is broken; no further reads are posted
+                bool read_closed = false;
+                // the console is closing: output goes to scratch and is dropped, whether or not the ring has room
+                bool draining = false;
+                // the outstanding read targets the ring rather than scratch
+                bool read_into_ring = false;
+                std::unique_ptr<char[]> scratch;
+                AdaptiveReadSize read_size;
+                // size of the outstanding read
+                DWORD read_asked = 0;
+
+                std::string write_buffer;
+            };
+
+            void submit_write(PseudoConsole* pc);
+            void resume_read(PseudoConsole* pc);
+            // ClosePseudoConsole waits for the output to be read, so this discards it until the pipe breaks
+            void drain(PseudoConsole* pc);
+            // caller holds m_mutex
+            void post_read(IoState& state);
+            void post_write(IoState& state);
+            void run();
+
+            HANDLE m_iocp = nullptr;
+            std::atomic_bool m_running{false};
+            std::thread m_thread;
+
+            // held while dispatching so detach can synchronise with the loop
+            std::mutex m_mutex;
+            // signalled when a detached console's read completes
+            std::condition_variable m_read_done;
+            std::unordered_map<ULONG_PTR, std::unique_ptr<IoState>> m_states;
+            ULONG_PTR m_next_token = 1;
+            ReadPolicy m_policy;
         };
     }// namespace detail
 
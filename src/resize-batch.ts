@@ -0,0 +1,31 @@
+import { invoke } from './webui-ext';
+
+export { queueResize };
+
+// Size changes of every tab fitted in the same animation frame go to the native side as one call, a
+// binary frame of [id u32 LE][8 u32 LE][cols u32 LE][rows u32 LE] records. A tab resized twice
+// before the flush only sends its last size.
+const pending = new Map<number, [number, number]>();
+
+function flushResizes() {
+    const frame = new Uint8Array(pending.size * 16);
+    const view = new DataView(frame.buffer);
+    let offset = 0;
+    for (const [id, [cols, rows]] of pending) {
+        view.setUint32(offset, id, true);
+        view.setUint32(offset + 4, 8, true);
+        view.setUint32(offset + 8, cols, true);
+        view.setUint32(offset + 12, rows, true);
+        offset += 16;
+    }
+    pending.clear();
+    invoke('webui_resize_terminals', frame).catch((err) => {
+        console.error('Failed to resize terminals:', err);
+    });
+}
+
+function queueResize(id: number, cols: number, rows: number) {
+    // a task, not a microtask: it runs after every terminal's animation frame callback
+    if (pending.size === 0) setTimeout(flushResizes, 0);
+    pending.set(id, [cols, rows]);
+}